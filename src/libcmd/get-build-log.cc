@@ -4,7 +4,8 @@
 
 namespace nix {
 
-std::string fetchBuildLog(ref<Store> store, const StorePath & path, std::string_view what)
+static std::string fetchBuildLogWith(
+    ref<Store> store, std::string_view what, fun<std::optional<std::string>(LogStore & logStore)> getLog)
 {
     auto subs = getDefaultSubstituters();
 
@@ -18,7 +19,7 @@ std::string fetchBuildLog(ref<Store> store, const StorePath & path, std::string_
         }
         auto & logSub = *logSubP;
 
-        auto log = logSub.getBuildLog(path);
+        auto log = getLog(logSub);
         if (!log)
             continue;
         printInfo("got build log for '%s' from '%s'", what, logSub.config.getHumanReadableURI());
@@ -28,4 +29,21 @@ std::string fetchBuildLog(ref<Store> store, const StorePath & path, std::string_
     throw Error("build log of '%s' is not available", what);
 }
 
+std::string fetchBuildLog(ref<Store> store, const StorePath & path, std::string_view what)
+{
+    return fetchBuildLogWith(store, what, [&](LogStore & logStore) { return logStore.getBuildLog(path); });
+}
+
+std::string
+fetchBuildLogRange(ref<Store> store, const StorePath & path, std::string_view what, int64_t offset, uint64_t length)
+{
+    return fetchBuildLogWith(
+        store, what, [&](LogStore & logStore) { return logStore.getBuildLogRange(path, offset, length); });
+}
+
+std::string fetchBuildLogTail(ref<Store> store, const StorePath & path, std::string_view what, size_t nrLines)
+{
+    return fetchBuildLogWith(store, what, [&](LogStore & logStore) { return logStore.getBuildLogTail(path, nrLines); });
+}
+
 } // namespace nix
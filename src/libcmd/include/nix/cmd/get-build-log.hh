@@ -20,4 +20,18 @@ namespace nix {
  */
 std::string fetchBuildLog(ref<Store> store, const StorePath & path, std::string_view what);
 
+/**
+ * Like `fetchBuildLog()`, but only fetch at most `length` bytes of the
+ * log starting at byte `offset`. A negative `offset` counts from the
+ * end of the log.
+ */
+std::string
+fetchBuildLogRange(ref<Store> store, const StorePath & path, std::string_view what, int64_t offset, uint64_t length);
+
+/**
+ * Like `fetchBuildLog()`, but only fetch the last `nrLines` lines of
+ * the log.
+ */
+std::string fetchBuildLogTail(ref<Store> store, const StorePath & path, std::string_view what, size_t nrLines);
+
 } // namespace nix
@@ -0,0 +1,53 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+
+namespace nix {
+
+/**
+ * Function calls dominated by variable lookups, attribute selections,
+ * conditionals and Boolean operators, similar to the predicates used
+ * throughout Nixpkgs.
+ */
+static const std::string callHeavyExpr = R"(
+  let
+    fib = n: if n < 2 then n else fib (n - 1) + fib (n - 2);
+    isAvailable = pkg: pkg.meta.available && !(pkg ? broken) && (pkg.system == "x86_64-linux" || pkg.meta.platforms.any);
+    pkgs = builtins.genList (i: {
+      system = if builtins.bitAnd i 1 == 0 then "x86_64-linux" else "aarch64-linux";
+      meta = { available = i != 7; platforms.any = builtins.bitAnd i 2 == 0; };
+    }) 5000;
+  in fib 20 + builtins.length (builtins.filter isAvailable pkgs)
+)";
+
+/**
+ * Evaluate `callHeavyExpr` with the AST interpreter (arg 0) or the
+ * bytecode interpreter (arg 1).
+ */
+static void BM_EvalCallHeavy(benchmark::State & state)
+{
+    auto store = openStore("dummy://");
+    fetchers::Settings fetchSettings{};
+    bool readOnlyMode = true;
+    EvalSettings evalSettings{readOnlyMode};
+    evalSettings.nixPath = {};
+    evalSettings.evalBytecode = state.range(0);
+
+    auto stPtr = std::make_shared<EvalState>(LookupPath{}, store, fetchSettings, evalSettings, nullptr);
+    auto & st = *stPtr;
+    Expr * expr = st.parseExprFromString(callHeavyExpr, st.rootPath(CanonPath::root));
+
+    for (auto _ : state) {
+        Value v;
+        st.eval(expr, v);
+        st.forceValue(v, noPos);
+        benchmark::DoNotOptimize(v);
+    }
+}
+
+BENCHMARK(BM_EvalCallHeavy)->Arg(false)->Arg(true)->Unit(benchmark::kMillisecond);
+
+} // namespace nix
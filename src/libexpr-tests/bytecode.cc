@@ -0,0 +1,108 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "nix/expr/bytecode.hh"
+#include "nix/expr/tests/libexpr.hh"
+#include "nix/util/tests/gmock-matchers.hh"
+
+namespace nix {
+
+using namespace testing;
+
+class BytecodeTest : public LibExprTest
+{
+public:
+    BytecodeTest()
+        : LibExprTest(openStore("dummy://"), [](bool & readOnlyMode) {
+            EvalSettings settings{readOnlyMode};
+            settings.nixPath = {};
+            settings.evalBytecode = true;
+            return settings;
+        })
+    {
+    }
+
+    /**
+     * Return the traces of the error thrown by evaluating `input`.
+     */
+    std::vector<std::string> traces(std::string input)
+    {
+        try {
+            eval(input);
+        } catch (Error & e) {
+            std::vector<std::string> res;
+            for (auto & trace : e.info().traces)
+                res.push_back(trace.hint.str());
+            return res;
+        }
+        ADD_FAILURE() << "expected an error";
+        return {};
+    }
+};
+
+TEST_F(BytecodeTest, conditionals)
+{
+    auto runs = bytecode::nrProgramRuns.load();
+    ASSERT_THAT(eval("let f = x: if x then 1 else 2; in f true + f false * 10"), IsIntEq(21));
+    ASSERT_GT(bytecode::nrProgramRuns.load(), runs);
+}
+
+TEST_F(BytecodeTest, booleanOperators)
+{
+    ASSERT_THAT(eval("let f = a: b: a && b; in f true false"), IsFalse());
+    ASSERT_THAT(eval("let f = a: b: a || b; in f false true"), IsTrue());
+    ASSERT_THAT(eval("let f = a: b: a || b; in f false false"), IsFalse());
+    ASSERT_THAT(eval("let f = a: b: a -> b; in f false (throw \"lazy\")"), IsTrue());
+    ASSERT_THAT(eval("let f = a: b: a -> b; in f true false"), IsFalse());
+    ASSERT_THAT(eval("let f = a: !a; in f false"), IsTrue());
+    /* The right operand is not evaluated if the left one decides the
+       result. */
+    ASSERT_THAT(eval("let f = a: a || throw \"lazy\"; in f true"), IsTrue());
+    ASSERT_THAT(eval("let f = a: a && throw \"lazy\"; in f false"), IsFalse());
+}
+
+TEST_F(BytecodeTest, equality)
+{
+    ASSERT_THAT(eval("let f = a: b: a == b; in f { x = [ 1 ]; } { x = [ 1 ]; }"), IsTrue());
+    ASSERT_THAT(eval("let f = a: b: a != b; in f 1 2"), IsTrue());
+    ASSERT_THAT(eval("let f = a: a == \"foo\"; in f \"bar\""), IsFalse());
+}
+
+TEST_F(BytecodeTest, selectAndHasAttr)
+{
+    ASSERT_THAT(eval("let f = s: s.a.b; in f { a.b = 42; }"), IsIntEq(42));
+    ASSERT_THAT(eval("let f = s: s.a.c or 3; in f { a.b = 42; }"), IsIntEq(3));
+    ASSERT_THAT(eval("let f = s: s ? a.b; in f { a.b = 42; }"), IsTrue());
+    ASSERT_THAT(eval("let f = s: if s ? x then s.x else s.y; in f { y = 2; }"), IsIntEq(2));
+}
+
+TEST_F(BytecodeTest, recursiveCalls)
+{
+    ASSERT_THAT(eval("let fib = n: if n < 2 then n else fib (n - 1) + fib (n - 2); in fib 15"), IsIntEq(610));
+    ASSERT_THAT(eval("let f = g: x: g (g x); in f (x: x * 3) 2"), IsIntEq(18));
+}
+
+TEST_F(BytecodeTest, withFallsBack)
+{
+    ASSERT_THAT(eval("let f = s: with s; if a then b else c; in f { a = false; b = 1; c = 2; }"), IsIntEq(2));
+}
+
+TEST_F(BytecodeTest, errorTraces)
+{
+    ASSERT_THAT(
+        traces("let f = x: if x then 1 else 2; in f 1"), Contains(HasSubstr("while evaluating a branch condition")));
+    ASSERT_THAT(
+        traces("let f = a: b: a && b; in f true 1"),
+        Contains(HasSubstr("in the right operand of the AND (&&) operator")));
+    ASSERT_THAT(
+        traces("let f = a: b: a || b; in f 1 true"),
+        Contains(HasSubstr("in the left operand of the OR (||) operator")));
+    ASSERT_THAT(traces("let f = a: !a; in f null"), Contains(HasSubstr("in the argument of the not operator")));
+
+    /* Both conditions of nested conditionals add a trace. */
+    auto t = traces("let f = x: if (if x then true else false) then 1 else 2; in f 1");
+    ASSERT_EQ(
+        std::ranges::count_if(t, [](auto & s) { return s.ends_with("while evaluating a branch condition"); }), 2);
+}
+
+} // namespace nix
@@ -0,0 +1,70 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/expr/json-to-value.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+#include "nix/util/fmt.hh"
+
+namespace nix {
+
+/**
+ * A JSON document resembling an npm `package-lock.json`.
+ */
+static std::string makeLockFile(size_t nrPackages)
+{
+    std::string res = R"({"name": "example", "lockfileVersion": 3, "requires": true, "packages": {)";
+    for (size_t i = 0; i < nrPackages; ++i) {
+        if (i)
+            res += ',';
+        res += fmt(
+            R"("node_modules/package-%1%": {"version": "1.%1%.0", )"
+            R"("resolved": "https://registry.npmjs.org/package-%1%/-/package-%1%-1.%1%.0.tgz", )"
+            R"("integrity": "sha512-YWJjZGVmZ2hpamtsbW5vcHFyc3R1dnd4eXoxMjM0NTY3ODkwYWJjZGVm", )"
+            R"("dev": %2%, "license": "MIT", "engines": {"node": ">=14"}, )"
+            R"("dependencies": {"package-%3%": "^1.0.0", "package-%4%": "~2.1.0"}, )"
+            R"("funding": [{"type": "github", "url": "https://github.com/sponsors/x\u00e9"}]})",
+            i,
+            i % 3 == 0 ? "true" : "false",
+            (i * 7) % nrPackages,
+            (i * 13) % nrPackages);
+    }
+    res += "}}";
+    return res;
+}
+
+/**
+ * Parse a lock file with nlohmann's SAX parser (arg 0) or with the
+ * two-stage parser (arg 1).
+ */
+static void BM_ParseJSON(benchmark::State & state)
+{
+    const bool fast = state.range(0);
+
+    auto store = openStore("dummy://");
+    fetchers::Settings fetchSettings{};
+    bool readOnlyMode = true;
+    EvalSettings evalSettings{readOnlyMode};
+    evalSettings.nixPath = {};
+
+    auto stPtr = std::make_shared<EvalState>(LookupPath{}, store, fetchSettings, evalSettings, nullptr);
+    auto & st = *stPtr;
+
+    auto json = makeLockFile(20'000);
+
+    for (auto _ : state) {
+        Value v;
+        if (fast)
+            parseJSON(st, json, v);
+        else
+            parseJSONWithSax(st, json, v);
+        benchmark::DoNotOptimize(v);
+    }
+
+    state.SetBytesProcessed(state.iterations() * json.size());
+}
+
+BENCHMARK(BM_ParseJSON)->Arg(false)->Arg(true)->Unit(benchmark::kMillisecond);
+
+} // namespace nix
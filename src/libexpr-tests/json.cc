@@ -1,7 +1,10 @@
 #include "nix/expr/tests/libexpr.hh"
 #include "nix/expr/value-to-json.hh"
+#include "nix/expr/json-to-value.hh"
 #include "nix/expr/static-string-data.hh"
 
+#include <nlohmann/json.hpp>
+
 namespace nix {
 // Testing the conversion to JSON
 
@@ -67,6 +70,41 @@ TEST_F(JSONValueTest, StringQuotes)
     ASSERT_EQ(getJSONValue(v), "\"test\\\"\"");
 }
 
+TEST_F(JSONValueTest, StringEscapes)
+{
+    Value v;
+    v.mkStringNoCopy("\\ \b\f\n\r\t \x01\x1f\x7f \xc3\xa9 \xf0\x9f\x98\x80"_sds);
+    ASSERT_EQ(getJSONValue(v), "\"\\\\ \\b\\f\\n\\r\\t \\u0001\\u001f\x7f \xc3\xa9 \xf0\x9f\x98\x80\"");
+}
+
+TEST_F(JSONValueTest, StringInvalidUTF8)
+{
+    Value v;
+    v.mkStringNoCopy("ab\xff"_sds);
+    ASSERT_THROW(getJSONValue(v), JSONSerializationError);
+    v.mkStringNoCopy("\xed\xa0\x80"_sds);
+    ASSERT_THROW(getJSONValue(v), JSONSerializationError);
+    v.mkStringNoCopy("\xe2\x82"_sds);
+    ASSERT_THROW(getJSONValue(v), JSONSerializationError);
+}
+
+TEST_F(JSONValueTest, MatchesDOM)
+{
+    auto v = eval(R"({
+      a = [ 1 2.5 1.0 1e100 "x" null true { } [ ] ];
+      b = { "c\nd" = { e = [ { } ]; }; };
+      c = -9223372036854775807;
+    })");
+
+    for (unsigned int indent : {0, 2}) {
+        NixStringContext context;
+        StringSink out;
+        printValueAsJSON(state, true, v, noPos, out, context, true, indent);
+        auto dom = printValueAsJSON(state, true, v, noPos, context);
+        ASSERT_EQ(out.s, indent ? dom.dump(indent) : dom.dump());
+    }
+}
+
 // The dummy store doesn't support writing files. Fails with this exception message:
 // C++ exception with description "error: operation 'addToStoreFromDump' is
 // not supported by store 'dummy'" thrown in the test body.
@@ -76,4 +114,95 @@ TEST_F(JSONValueTest, DISABLED_Path)
     v.mkPath(state.rootPath(CanonPath("/test")), state.mem);
     ASSERT_EQ(getJSONValue(v), "\"/nix/store/g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-x\"");
 }
+
+// Testing the conversion from JSON
+
+class FromJSONTest : public LibExprTest
+{
+protected:
+    /**
+     * Check that `parseJSON()` and the SAX parser agree on `s`.
+     */
+    void checkSameAsSax(std::string_view s)
+    {
+        Value v1, v2;
+        parseJSON(state, s, v1);
+        parseJSONWithSax(state, s, v2);
+        state.forceValueDeep(v1);
+        ASSERT_TRUE(state.eqValues(v1, v2, noPos, "")) << s;
+    }
+};
+
+TEST_F(FromJSONTest, matchesSax)
+{
+    for (auto s : {
+             "null",
+             " true ",
+             "false",
+             "0",
+             "-0",
+             "123",
+             "-9223372036854775808",
+             "18446744073709551616",
+             "1.5",
+             "-2.5e-3",
+             "1E10",
+             R"("")",
+             R"("simple")",
+             R"("esc\"apes\\ \/ \b\f\n\r\t")",
+             R"("é€😀")",
+             "\"raw \xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\"",
+             "[]",
+             "{}",
+             "[1, [2, [3, []]], {}]",
+             R"({"b": 1, "a": [true, null], "c": {"d": "e"}})",
+             R"({"a": 1, "a": 2, "b": 3, "a": 4})",
+             R"({ "x" : { "y" : [ { } , [ ] ] } })",
+         })
+        checkSameAsSax(s);
+}
+
+TEST_F(FromJSONTest, longStrings)
+{
+    std::string s(1000, 'x');
+    s[500] = '"';
+    checkSameAsSax(fmt("[\"%s\", \"%s\"]", std::string(200, 'a'), replaceStrings(s, "\"", "\\\"")));
+}
+
+TEST_F(FromJSONTest, invalid)
+{
+    for (auto s : {
+             "",
+             "  ",
+             "nul",
+             "truex",
+             "01",
+             "1.",
+             "-",
+             "[1,]",
+             "[1 2]",
+             R"({"a" 1})",
+             R"({"a": 1,})",
+             R"({1: 2})",
+             R"("unterminated)",
+             "\"bad \xff utf-8\"",
+             "\"control \x01 char\"",
+             R"("\ud800")",
+             R"("\x")",
+             "[1] 2",
+             "\"a\"b",
+         }) {
+        Value v;
+        ASSERT_THROW(parseJSON(state, s, v), JSONParseError) << s;
+    }
+}
+
+TEST_F(FromJSONTest, semanticErrors)
+{
+    Value v;
+    ASSERT_THROW(parseJSON(state, "18446744073709551615", v), Error);
+    ASSERT_THROW(parseJSON(state, R"({"a\u0000b": 1})", v), Error);
+    ASSERT_THROW(parseJSON(state, R"(["a\u0000b"])", v), Error);
+}
+
 } /* namespace nix */
@@ -97,6 +97,23 @@ TEST_F(TrivialExpressionTest, hasAttrOpTrue)
     ASSERT_THAT(v, IsTrue());
 }
 
+TEST_F(TrivialExpressionTest, selectFromChangingLayouts)
+{
+    // The same selection site sees attribute sets of different layouts,
+    // so its inline cache must be validated.
+    auto v = eval(R"(
+      builtins.foldl' (acc: s: acc + s.b + (s.c or 0)) 0 [
+        { a = 1; b = 2; }
+        { b = 3; }
+        { b = 4; c = 5; }
+        ({ a = 0; } // { b = 6; })
+        ({ b = 7; } // { a = 1; })
+        ({ b = 100; } // { b = 8; })
+      ]
+    )");
+    ASSERT_THAT(v, IsIntEq(35));
+}
+
 TEST_F(TrivialExpressionTest, withFound)
 {
     auto v = eval("with { a = 23; }; a");
@@ -0,0 +1,75 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/expr/value-to-json.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+
+#include <nlohmann/json.hpp>
+
+namespace nix {
+
+/**
+ * An attribute set resembling a dump of package metadata.
+ */
+static const std::string packageMetadataExpr = R"(
+  builtins.listToAttrs (builtins.genList (i: {
+    name = "package-${toString i}";
+    value = {
+      pname = "package-${toString i}";
+      version = "1.${toString i}.0";
+      meta = {
+        description = "A package with a moderately long description, number ${toString i}";
+        homepage = "https://example.org/package-${toString i}";
+        license = { spdxId = "MIT"; free = true; };
+        platforms = [ "x86_64-linux" "aarch64-linux" "x86_64-darwin" "aarch64-darwin" ];
+        priority = i;
+      };
+    };
+  }) 20000)
+)";
+
+/**
+ * Serialise `packageMetadataExpr` to JSON via a `nlohmann::json` DOM
+ * (arg 0) or with the streaming writer (arg 1).
+ */
+static void BM_PrintValueAsJSON(benchmark::State & state)
+{
+    const bool streaming = state.range(0);
+
+    auto store = openStore("dummy://");
+    fetchers::Settings fetchSettings{};
+    bool readOnlyMode = true;
+    EvalSettings evalSettings{readOnlyMode};
+    evalSettings.nixPath = {};
+
+    auto stPtr = std::make_shared<EvalState>(LookupPath{}, store, fetchSettings, evalSettings, nullptr);
+    auto & st = *stPtr;
+    Expr * expr = st.parseExprFromString(packageMetadataExpr, st.rootPath(CanonPath::root));
+
+    Value v;
+    st.eval(expr, v);
+    st.forceValueDeep(v);
+
+    size_t bytes = 0;
+
+    for (auto _ : state) {
+        NixStringContext context;
+        std::string s;
+        if (streaming) {
+            StringSink out;
+            printValueAsJSON(st, true, v, noPos, out, context, false);
+            s = std::move(out.s);
+        } else
+            s = printValueAsJSON(st, true, v, noPos, context, false).dump();
+        bytes += s.size();
+        benchmark::DoNotOptimize(s);
+    }
+
+    state.SetBytesProcessed(bytes);
+}
+
+BENCHMARK(BM_PrintValueAsJSON)->Arg(false)->Arg(true)->Unit(benchmark::kMillisecond);
+
+} // namespace nix
@@ -0,0 +1,386 @@
+#include "nix/expr/bytecode.hh"
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-inline.hh"
+#include "nix/expr/gc-small-vector.hh"
+#include "nix/expr/print.hh"
+
+#include <memory>
+#include <vector>
+
+namespace nix::bytecode {
+
+Counter nrProgramsCompiled;
+Counter nrProgramRuns;
+
+/**
+ * Programs that need more registers than this are not compiled, to
+ * bound the stack usage of each call.
+ */
+constexpr size_t maxRegs = 64;
+
+/**
+ * Marks lambdas that are not worth compiling.
+ */
+static const Program notCompiled;
+
+namespace {
+
+struct Compiler
+{
+    std::vector<Instr> code;
+    std::vector<TraceRange> traces;
+    size_t nextReg = 1, nRegs = 1;
+
+    uint32_t here() const
+    {
+        return code.size();
+    }
+
+    Instr & emit(OpCode op, Reg dst, Expr * expr = nullptr)
+    {
+        auto & i = code.emplace_back();
+        i.op = op;
+        i.dst = dst;
+        i.expr = expr;
+        return i;
+    }
+
+    Reg allocReg()
+    {
+        nRegs = std::max(nRegs, nextReg + 1);
+        return nextReg++;
+    }
+
+    void freeReg()
+    {
+        nextReg--;
+    }
+
+    /**
+     * Compile `e` into `dst`, failing like `EvalState::evalBool()` if
+     * the result isn't a Boolean.
+     */
+    void compileBool(Expr * e, Reg dst, PosIdx pos, std::string_view errorCtx)
+    {
+        auto begin = here();
+        compile(e, dst);
+        auto & test = emit(OpCode::TestBool, dst, e);
+        test.src = dst;
+        test.pos = pos;
+        traces.push_back({.begin = begin, .end = here(), .pos = pos, .errorCtx = errorCtx});
+    }
+
+    void compileJump(OpCode op, Reg src, auto && compileRest)
+    {
+        auto jump = here();
+        emit(op, 0).src = src;
+        compileRest();
+        code[jump].n = here();
+    }
+
+    void compile(Expr * e, Reg dst)
+    {
+        if (auto e2 = dynamic_cast<ExprInt *>(e))
+            emit(OpCode::Const, dst, e).value = &e2->v;
+
+        else if (auto e2 = dynamic_cast<ExprFloat *>(e))
+            emit(OpCode::Const, dst, e).value = &e2->v;
+
+        else if (auto e2 = dynamic_cast<ExprString *>(e))
+            emit(OpCode::Const, dst, e).value = &e2->v;
+
+        else if (auto e2 = dynamic_cast<ExprPath *>(e))
+            emit(OpCode::Const, dst, e).value = &e2->v;
+
+        else if (auto e2 = dynamic_cast<ExprVar *>(e); e2 && !e2->fromWith) {
+            auto & i = emit(OpCode::Var, dst, e);
+            i.n = e2->level;
+            i.displ = e2->displ;
+            i.pos = e2->pos;
+        }
+
+        else if (auto e2 = dynamic_cast<ExprSelect *>(e)) {
+            compile(e2->e, dst);
+            emit(OpCode::Select, dst, e).src = dst;
+        }
+
+        else if (auto e2 = dynamic_cast<ExprOpHasAttr *>(e)) {
+            compile(e2->e, dst);
+            emit(OpCode::HasAttr, dst, e).src = dst;
+        }
+
+        else if (auto e2 = dynamic_cast<ExprCall *>(e)) {
+            /* The function must not be overwritten by the result
+               while it is being called. */
+            auto fun = allocReg();
+            compile(e2->fun, fun);
+            auto & i = emit(OpCode::Call, dst, e);
+            i.src = fun;
+            i.pos = e2->pos;
+            freeReg();
+        }
+
+        else if (auto e2 = dynamic_cast<ExprIf *>(e)) {
+            compileBool(e2->cond, dst, e2->pos, "while evaluating a branch condition");
+            auto jumpToElse = here();
+            emit(OpCode::JumpIfFalse, 0).src = dst;
+            compile(e2->then, dst);
+            compileJump(OpCode::Jump, 0, [&]() {
+                code[jumpToElse].n = here();
+                compile(e2->else_, dst);
+            });
+        }
+
+        else if (auto e2 = dynamic_cast<ExprOpNot *>(e)) {
+            compileBool(e2->e, dst, e2->getPos(), "in the argument of the not operator");
+            emit(OpCode::Not, dst).src = dst;
+        }
+
+        else if (auto e2 = dynamic_cast<ExprOpAnd *>(e)) {
+            compileBool(e2->e1, dst, e2->pos, "in the left operand of the AND (&&) operator");
+            compileJump(OpCode::JumpIfFalse, dst, [&]() {
+                compileBool(e2->e2, dst, e2->pos, "in the right operand of the AND (&&) operator");
+            });
+        }
+
+        else if (auto e2 = dynamic_cast<ExprOpOr *>(e)) {
+            compileBool(e2->e1, dst, e2->pos, "in the left operand of the OR (||) operator");
+            compileJump(OpCode::JumpIfTrue, dst, [&]() {
+                compileBool(e2->e2, dst, e2->pos, "in the right operand of the OR (||) operator");
+            });
+        }
+
+        else if (auto e2 = dynamic_cast<ExprOpImpl *>(e)) {
+            compileBool(e2->e1, dst, e2->pos, "in the left operand of the IMPL (->) operator");
+            emit(OpCode::Not, dst).src = dst;
+            compileJump(OpCode::JumpIfTrue, dst, [&]() {
+                compileBool(e2->e2, dst, e2->pos, "in the right operand of the IMPL (->) operator");
+            });
+        }
+
+        else if (auto e2 = dynamic_cast<ExprOpEq *>(e))
+            compileEq(OpCode::Eq, e2->e1, e2->e2, dst, e2->pos, "while testing two values for equality");
+
+        else if (auto e2 = dynamic_cast<ExprOpNEq *>(e))
+            compileEq(OpCode::NEq, e2->e1, e2->e2, dst, e2->pos, "while testing two values for inequality");
+
+        else
+            emit(OpCode::Eval, dst, e);
+    }
+
+    void compileEq(OpCode op, Expr * e1, Expr * e2, Reg dst, PosIdx pos, std::string_view errorCtx)
+    {
+        compile(e1, dst);
+        auto rhs = allocReg();
+        compile(e2, rhs);
+        auto & i = emit(op, dst);
+        i.src = dst;
+        i.src2 = rhs;
+        i.pos = pos;
+        i.errorCtx = errorCtx;
+        freeReg();
+    }
+};
+
+} // namespace
+
+/**
+ * The interpreter. Every instruction stores the address of its handler,
+ * so that there is no central dispatch loop: each handler jumps
+ * directly to the handler of the next instruction.
+ *
+ * Called with `labelsOut` set, this returns the handler addresses instead
+ * of running anything, for linking programs.
+ */
+static void interpret(
+    EvalState * state_, const Program * program, Env * env_, Value * result, const void * const ** labelsOut)
+{
+    /* Must be in the order of `OpCode`. */
+    static const void * const labels[] = {
+        &&op_Eval,
+        &&op_Const,
+        &&op_Var,
+        &&op_Select,
+        &&op_HasAttr,
+        &&op_Call,
+        &&op_TestBool,
+        &&op_Not,
+        &&op_Eq,
+        &&op_NEq,
+        &&op_Jump,
+        &&op_JumpIfFalse,
+        &&op_JumpIfTrue,
+        &&op_Return,
+    };
+    static_assert(std::size(labels) == (size_t) OpCode::Return + 1);
+
+    if (labelsOut) {
+        *labelsOut = labels;
+        return;
+    }
+
+    auto & state = *state_;
+    auto & env = *env_;
+
+    /* The registers live on the stack, where the garbage collector
+       finds them. */
+    auto regs = static_cast<Value *>(__builtin_alloca(program->nRegs * sizeof(Value)));
+    std::uninitialized_default_construct_n(regs, program->nRegs);
+
+    const Instr * ip = program->code.data();
+
+#define DISPATCH() goto * ip->handler
+#define NEXT()      \
+    do {            \
+        ++ip;       \
+        DISPATCH(); \
+    } while (0)
+
+    try {
+        DISPATCH();
+
+    op_Eval:
+        ip->expr->eval(state, env, regs[ip->dst]);
+        NEXT();
+
+    op_Const:
+        regs[ip->dst] = *ip->value;
+        NEXT();
+
+    op_Var: {
+        auto * env2 = &env;
+        for (auto l = ip->n; l; --l)
+            env2 = env2->up;
+        auto * v = env2->values[ip->displ];
+        state.forceValue(*v, ip->pos);
+        regs[ip->dst] = *v;
+        NEXT();
+    }
+
+    op_Select:
+        static_cast<ExprSelect *>(ip->expr)->evalFrom(state, env, regs[ip->src], regs[ip->dst]);
+        NEXT();
+
+    op_HasAttr:
+        static_cast<ExprOpHasAttr *>(ip->expr)->evalFrom(state, env, regs[ip->src], regs[ip->dst]);
+        NEXT();
+
+    op_Call: {
+        auto & args = *static_cast<ExprCall *>(ip->expr)->args;
+        SmallValueVector<4> vArgs(args.size());
+        for (size_t i = 0; i < args.size(); ++i)
+            vArgs[i] = args[i]->maybeThunk(state, env);
+        state.callFunction(regs[ip->src], vArgs, regs[ip->dst], ip->pos);
+        NEXT();
+    }
+
+    op_TestBool: {
+        auto & v = regs[ip->src];
+        if (v.type() != nBool)
+            state
+                .error<TypeError>(
+                    "expected a Boolean but found %1%: %2%", showType(v), ValuePrinter(state, v, errorPrintOptions))
+                .atPos(ip->pos)
+                .withFrame(env, *ip->expr)
+                .debugThrow();
+        NEXT();
+    }
+
+    op_Not:
+        regs[ip->dst].mkBool(!regs[ip->src].boolean());
+        NEXT();
+
+    op_Eq:
+        regs[ip->dst].mkBool(state.eqValues(regs[ip->src], regs[ip->src2], ip->pos, ip->errorCtx));
+        NEXT();
+
+    op_NEq:
+        regs[ip->dst].mkBool(!state.eqValues(regs[ip->src], regs[ip->src2], ip->pos, ip->errorCtx));
+        NEXT();
+
+    op_Jump:
+        ip = program->code.data() + ip->n;
+        DISPATCH();
+
+    op_JumpIfFalse:
+        if (!regs[ip->src].boolean()) {
+            ip = program->code.data() + ip->n;
+            DISPATCH();
+        }
+        NEXT();
+
+    op_JumpIfTrue:
+        if (regs[ip->src].boolean()) {
+            ip = program->code.data() + ip->n;
+            DISPATCH();
+        }
+        NEXT();
+
+    op_Return:
+        *result = regs[ip->src];
+        return;
+
+    } catch (Error & e) {
+        uint32_t offset = ip - program->code.data();
+        for (auto & range : program->traces)
+            if (offset >= range.begin && offset < range.end)
+                e.addTrace(state.positions[range.pos], range.errorCtx);
+        throw;
+    }
+
+#undef NEXT
+#undef DISPATCH
+}
+
+const Program & compile(Expr & e, std::pmr::polymorphic_allocator<char> & alloc)
+{
+    Compiler compiler;
+    compiler.compile(&e, 0);
+    compiler.emit(OpCode::Return, 0).src = 0;
+
+    const void * const * labels;
+    interpret(nullptr, nullptr, nullptr, nullptr, &labels);
+    for (auto & i : compiler.code)
+        i.handler = labels[(size_t) i.op];
+
+    auto code = alloc.allocate_object<Instr>(compiler.code.size());
+    std::ranges::uninitialized_copy(compiler.code, std::span(code, compiler.code.size()));
+
+    auto traces = alloc.allocate_object<TraceRange>(compiler.traces.size());
+    std::ranges::uninitialized_copy(compiler.traces, std::span(traces, compiler.traces.size()));
+
+    return *alloc.new_object<Program>(Program{
+        .code = {code, compiler.code.size()},
+        .traces = {traces, compiler.traces.size()},
+        .nRegs = compiler.nRegs,
+    });
+}
+
+const Program * getProgram(EvalState & state, ExprLambda & lambda)
+{
+    auto program = lambda.program.load(std::memory_order_acquire);
+
+    if (!program) {
+        const Program * compiled = &compile(*lambda.body, state.mem.exprs.alloc);
+        /* A body that compiles to a single AST evaluation gains
+           nothing from the interpreter. */
+        if ((compiled->code.size() == 2 && compiled->code[0].op == OpCode::Eval) || compiled->nRegs > maxRegs)
+            compiled = &notCompiled;
+        else
+            nrProgramsCompiled++;
+        /* If another thread compiled it in the meantime, use its
+           program. */
+        if (lambda.program.compare_exchange_strong(program, compiled, std::memory_order_acq_rel))
+            program = compiled;
+    }
+
+    return program == &notCompiled ? nullptr : program;
+}
+
+void run(EvalState & state, const Program & program, Env & env, Value & v)
+{
+    nrProgramRuns++;
+    interpret(&state, &program, &env, &v, nullptr);
+}
+
+} // namespace nix::bytecode
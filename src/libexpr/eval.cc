@@ -1,4 +1,5 @@
 #include "nix/expr/eval.hh"
+#include "nix/expr/bytecode.hh"
 #include "nix/expr/eval-error.hh"
 #include "nix/expr/eval-settings.hh"
 #include "nix/expr/primops.hh"
@@ -1477,11 +1478,15 @@ static std::string showAttrSelectionPath(EvalState & state, Env & env, std::span
 void ExprSelect::eval(EvalState & state, Env & env, Value & v)
 {
     Value vTmp;
+    e->eval(state, env, vTmp);
+    evalFrom(state, env, vTmp, v);
+}
+
+void ExprSelect::evalFrom(EvalState & state, Env & env, Value & vTmp, Value & v)
+{
     PosIdx pos2;
     Value * vAttrs = &vTmp;
 
-    e->eval(state, env, vTmp);
-
     try {
         auto dts = state.debugRepl ? makeDebugTraceStacker(
                                          state,
@@ -1492,19 +1497,20 @@ void ExprSelect::eval(EvalState & state, Env & env, Value & v)
                                          showAttrSelectionPath(state, env, getAttrPath()))
                                    : nullptr;
 
-        for (auto & i : getAttrPath()) {
+        for (auto [i, hint] : std::views::zip(getAttrPath(), std::span(attrPathHints, nAttrPath))) {
             state.nrLookups++;
             const Attr * j;
+            bool hit;
             auto name = getName(i, state, env);
             if (def) {
                 state.forceValue(*vAttrs, pos);
-                if (vAttrs->type() != nAttrs || !(j = vAttrs->attrs()->get(name))) {
+                if (vAttrs->type() != nAttrs || !(j = vAttrs->attrs()->get(name, hint, hit))) {
                     def->eval(state, env, v);
                     return;
                 }
             } else {
                 state.forceAttrs(*vAttrs, pos, "while selecting an attribute");
-                if (!(j = vAttrs->attrs()->get(name))) {
+                if (!(j = vAttrs->attrs()->get(name, hint, hit))) {
                     StringSet allAttrNames;
                     for (auto & attr : *vAttrs->attrs())
                         allAttrNames.insert(std::string(state.symbols[attr.name]));
@@ -1516,6 +1522,8 @@ void ExprSelect::eval(EvalState & state, Env & env, Value & v)
                         .debugThrow();
                 }
             }
+            if (hit)
+                state.nrSelectCacheHits++;
             vAttrs = j->value;
             pos2 = j->pos;
             if (state.countCalls)
@@ -1557,9 +1565,13 @@ Symbol ExprSelect::evalExceptFinalSelect(EvalState & state, Env & env, Value & a
 void ExprOpHasAttr::eval(EvalState & state, Env & env, Value & v)
 {
     Value vTmp;
-    Value * vAttrs = &vTmp;
-
     e->eval(state, env, vTmp);
+    evalFrom(state, env, vTmp, v);
+}
+
+void ExprOpHasAttr::evalFrom(EvalState & state, Env & env, Value & vTmp, Value & v)
+{
+    Value * vAttrs = &vTmp;
 
     for (auto & i : attrPath) {
         state.forceValue(*vAttrs, getPos());
@@ -1704,7 +1716,14 @@ void EvalState::callFunction(Value & fun, std::span<Value *> args, Value & vRes,
                                : nullptr;
 
                 vCur.reset();
-                lambda.body->eval(*this, env2, vCur);
+                /* The debugger needs the AST interpreter's trace
+                   stackers, so the bytecode interpreter is only used
+                   without it. */
+                if (auto program =
+                        settings.evalBytecode && !debugRepl ? bytecode::getProgram(*this, lambda) : nullptr)
+                    bytecode::run(*this, *program, env2, vCur);
+                else
+                    lambda.body->eval(*this, env2, vCur);
             } catch (Error & e) {
                 if (loggerSettings.showTrace.get()) {
                     addErrorTrace(
@@ -3102,8 +3121,13 @@ void EvalState::printStatistics()
     topObj["waitingTime"] = microsecondsWaiting / (double) 1000000;
     topObj["nrAvoided"] = nrAvoided.load();
     topObj["nrLookups"] = nrLookups.load();
+    topObj["nrSelectCacheHits"] = nrSelectCacheHits.load();
     topObj["nrPrimOpCalls"] = nrPrimOpCalls.load();
     topObj["nrFunctionCalls"] = nrFunctionCalls.load();
+    topObj["bytecode"] = {
+        {"compiled", bytecode::nrProgramsCompiled.load()},
+        {"runs", bytecode::nrProgramRuns.load()},
+    };
 #if NIX_USE_BOEHMGC
     topObj["gc"] = {
         {"heapSize", heapSize},
@@ -3198,6 +3222,10 @@ Expr * EvalState::parseExprFromFile(const SourcePath & path)
 
 Expr * EvalState::parseExprFromFile(const SourcePath & path, const std::shared_ptr<StaticEnv> & staticEnv)
 {
+    std::optional<Activity> act;
+    if (loggerSettings.activityTracePath.get())
+        act.emplace(*logger, lvlVomit, actParseFile, fmt("parsing '%s'", path));
+
     auto buffer = path.resolveSymlinks().readFile();
     // readFile hopefully have left some extra space for terminators
     buffer.append("\0\0", 2);
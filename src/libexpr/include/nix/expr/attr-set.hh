@@ -8,6 +8,7 @@
 #include <boost/iterator/function_output_iterator.hpp>
 
 #include <algorithm>
+#include <atomic>
 #include <functional>
 #include <ranges>
 #include <optional>
@@ -372,6 +373,39 @@ public:
         return nullptr;
     }
 
+    /**
+     * Like `get()`, but first try the attribute at index `hint` of the
+     * top layer, and on success update `hint` to the index of the
+     * attribute in the top layer, if it's there. This makes repeated
+     * lookups of the same name in attribute sets with the same
+     * layout O(1).
+     *
+     * Any value of `hint` is safe, since the guess is verified. `hint`
+     * may be shared between threads.
+     *
+     * @param hit Set to whether `hint` was correct.
+     */
+    const Attr * get(Symbol name, std::atomic<size_type> & hint, bool & hit) const noexcept
+    {
+        auto guess = hint.load(std::memory_order_relaxed);
+        if (guess < numAttrs && attrs[guess].name == name) [[likely]] {
+            hit = true;
+            return &attrs[guess];
+        }
+
+        hit = false;
+
+        auto first = attrs;
+        auto last = first + numAttrs;
+        const Attr * i = std::lower_bound(first, last, Attr{name, nullptr});
+        if (i != last && i->name == name) {
+            hint.store(i - first, std::memory_order_relaxed);
+            return i;
+        }
+
+        return baseLayer ? baseLayer->get(name) : nullptr;
+    }
+
     /**
      * Check if the layer chain is full.
      */
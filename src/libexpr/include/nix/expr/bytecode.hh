@@ -0,0 +1,165 @@
+#pragma once
+///@file
+
+#include "nix/expr/counter.hh"
+#include "nix/expr/nixexpr.hh"
+
+#include <span>
+
+namespace nix {
+
+class EvalState;
+
+/**
+ * An optional, faster evaluator for lambda bodies.
+ *
+ * When `eval-bytecode` is enabled, the body of a lambda is compiled on
+ * its first call into a small register machine program, which a
+ * direct-threaded interpreter then runs instead of walking the AST.
+ * The compiler lowers the node types that dominate typical Nix code
+ * (variables, constants, attribute selection, calls, conditionals and
+ * Boolean operators) and emits an `Eval` instruction that falls back to
+ * the AST interpreter for everything else, so every expression can be
+ * compiled. The AST interpreter remains the reference: instructions
+ * reuse its helpers, and produce the same values and error traces.
+ */
+namespace bytecode {
+
+/**
+ * Index of a register in the frame of a running program. Register 0
+ * holds the result.
+ */
+typedef uint16_t Reg;
+
+enum class OpCode : uint8_t {
+    /** `dst = expr` using the AST interpreter. */
+    Eval,
+    /** `dst = *value` for literals. */
+    Const,
+    /** `dst = ` the forced variable at (`n`, `displ`), like `ExprVar`. */
+    Var,
+    /** `dst = src.attrPath`, like `ExprSelect` with `src` as `e`. */
+    Select,
+    /** `dst = src ? attrPath`, like `ExprOpHasAttr` with `src` as `e`. */
+    HasAttr,
+    /** `dst = src args`, like `ExprCall` with `src` as `fun`. */
+    Call,
+    /** Throw if `src` is not a Boolean, like `EvalState::evalBool()`. */
+    TestBool,
+    /** `dst = !src` for a Boolean `src`. */
+    Not,
+    /** `dst = src == src2`. */
+    Eq,
+    /** `dst = src != src2`. */
+    NEq,
+    /** Continue at instruction `n`. */
+    Jump,
+    /** Continue at instruction `n` if the Boolean `src` is false. */
+    JumpIfFalse,
+    /** Continue at instruction `n` if the Boolean `src` is true. */
+    JumpIfTrue,
+    /** Return `src`. */
+    Return,
+};
+
+struct Instr
+{
+    /**
+     * The address of the interpreter code for `op`, so that dispatching
+     * to the next instruction is a single indirect jump.
+     */
+    const void * handler = nullptr;
+
+    OpCode op;
+
+    Reg dst = 0, src = 0, src2 = 0;
+
+    /**
+     * The jump target, or the number of environments to go up for
+     * `Var`.
+     */
+    uint32_t n = 0;
+
+    /**
+     * The displacement for `Var`.
+     */
+    Displacement displ = 0;
+
+    PosIdx pos;
+
+    /**
+     * The expression this instruction was compiled from.
+     */
+    Expr * expr = nullptr;
+
+    const Value * value = nullptr;
+
+    /**
+     * Error context for `Eq` and `NEq`.
+     */
+    std::string_view errorCtx;
+};
+
+/**
+ * Errors thrown by instructions `begin` to `end` (exclusive) get a
+ * trace, mirroring a `try` block in the AST interpreter.
+ */
+struct TraceRange
+{
+    uint32_t begin, end;
+    PosIdx pos;
+    std::string_view errorCtx;
+};
+
+/**
+ * A compiled lambda body. Like the AST, it lives in the `Exprs` arena
+ * of the `EvalState`.
+ */
+struct Program
+{
+    std::span<const Instr> code;
+
+    /**
+     * Innermost ranges first, so that traces are added in the same
+     * order as in the AST interpreter.
+     */
+    std::span<const TraceRange> traces;
+
+    /**
+     * The number of registers used by the program.
+     */
+    size_t nRegs = 1;
+};
+
+/**
+ * Return the compiled body of `lambda`, compiling it if necessary. Return
+ * `nullptr` if compiling it isn't worthwhile, e.g. if its body is
+ * something that the AST interpreter would evaluate in one step anyway.
+ * This is thread-safe.
+ */
+const Program * getProgram(EvalState & state, ExprLambda & lambda);
+
+/**
+ * Compile `e` as the body of a lambda, allocating the program with
+ * `alloc`.
+ */
+const Program & compile(Expr & e, std::pmr::polymorphic_allocator<char> & alloc);
+
+/**
+ * Run `program` in `env`, storing the result in `v`.
+ */
+void run(EvalState & state, const Program & program, Env & env, Value & v);
+
+/**
+ * Number of lambdas compiled so far.
+ */
+extern Counter nrProgramsCompiled;
+
+/**
+ * Number of calls of compiled lambdas so far.
+ */
+extern Counter nrProgramRuns;
+
+} // namespace bytecode
+
+} // namespace nix
@@ -515,6 +515,18 @@ public:
 
           Note that enabling the debugger (`--debugger`) disables multi-threaded evaluation.
         )"};
+
+    Setting<bool> evalBytecode{
+        this,
+        false,
+        "eval-bytecode",
+        R"(
+          If set to true, the body of a function is compiled on its first call into a bytecode program, which is used to evaluate subsequent calls instead of walking the syntax tree.
+          This speeds up functions that consist mostly of variable lookups, attribute selections, function calls, conditionals and Boolean operators.
+          Results and error messages are the same either way.
+
+          This setting has no effect when the debugger (`--debugger`) is enabled.
+        )"};
 };
 
 /**
@@ -1083,6 +1083,11 @@ private:
     std::string mkSingleDerivedPathStringRaw(const SingleDerivedPath & p);
 
     Counter nrLookups;
+    /**
+     * Number of attribute selections resolved by the inline cache of
+     * the `ExprSelect`, out of `nrLookups`.
+     */
+    Counter nrSelectCacheHits;
     Counter nrAvoided;
     Counter nrOpUpdates;
     Counter nrOpUpdateValuesCopied;
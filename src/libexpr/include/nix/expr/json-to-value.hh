@@ -12,6 +12,15 @@ struct Value;
 
 MakeError(JSONParseError, Error);
 
+/**
+ * Parse the JSON document `s` into `v`.
+ */
 void parseJSON(EvalState & state, const std::string_view & s, Value & v);
 
+/**
+ * Like `parseJSON()`, but always using nlohmann's SAX parser, which
+ * `parseJSON()` falls back to for reporting errors.
+ */
+void parseJSONWithSax(EvalState & state, std::string_view s, Value & v);
+
 } // namespace nix
@@ -1,6 +1,7 @@
 #pragma once
 ///@file
 
+#include <atomic>
 #include <map>
 #include <span>
 #include <memory>
@@ -27,6 +28,10 @@ struct ExprWith;
 struct StaticEnv;
 struct Value;
 
+namespace bytecode {
+struct Program;
+}
+
 /**
  * A documentation comment, in the sense of [RFC
  * 145](https://github.com/NixOS/rfcs/blob/master/rfcs/0145-doc-strings.md)
@@ -275,6 +280,15 @@ struct ExprSelect : Expr
     Expr *e, *def;
     AttrName * attrPathStart;
 
+    /**
+     * Inline caches for the elements of the attribute path: the index
+     * at which the attribute was last found in the attribute set it was
+     * selected from. Attribute sets that are selected from repeatedly
+     * at the same site usually have the same layout (or are the same
+     * set), so this usually avoids the binary search in `Bindings`.
+     */
+    std::atomic<uint32_t> * attrPathHints;
+
     ExprSelect(
         std::pmr::polymorphic_allocator<char> & alloc,
         const PosIdx & pos,
@@ -286,8 +300,10 @@ struct ExprSelect : Expr
         , e(e)
         , def(def)
         , attrPathStart(alloc.allocate_object<AttrName>(nAttrPath))
+        , attrPathHints(alloc.allocate_object<std::atomic<uint32_t>>(nAttrPath))
     {
         std::ranges::copy(attrPath, attrPathStart);
+        std::uninitialized_value_construct_n(attrPathHints, nAttrPath);
     };
 
     ExprSelect(std::pmr::polymorphic_allocator<char> & alloc, const PosIdx & pos, Expr * e, Symbol name)
@@ -296,6 +312,7 @@ struct ExprSelect : Expr
         , e(e)
         , def(0)
         , attrPathStart((alloc.allocate_object<AttrName>()))
+        , attrPathHints(alloc.new_object<std::atomic<uint32_t>>(0u))
     {
         *attrPathStart = AttrName(name);
     };
@@ -321,6 +338,12 @@ struct ExprSelect : Expr
      */
     Symbol evalExceptFinalSelect(EvalState & state, Env & env, Value & attrs);
 
+    /**
+     * Select the attribute path from `vTmp`, the result of evaluating
+     * `e`. `vTmp` and `v` may be the same value.
+     */
+    void evalFrom(EvalState & state, Env & env, Value & vTmp, Value & v);
+
     COMMON_METHODS
 };
 
@@ -341,6 +364,12 @@ struct ExprOpHasAttr : Expr
         return e->getPos();
     }
 
+    /**
+     * Check the attribute path in `vTmp`, the result of evaluating
+     * `e`. `vTmp` and `v` may be the same value.
+     */
+    void evalFrom(EvalState & state, Env & env, Value & vTmp, Value & v);
+
     COMMON_METHODS
 };
 
@@ -525,6 +554,12 @@ public:
     Expr * body;
     DocComment docComment;
 
+    /**
+     * The compiled body, if `eval-bytecode` is enabled and the lambda
+     * has been called. See `bytecode::getProgram()`.
+     */
+    std::atomic<const bytecode::Program *> program = nullptr;
+
     ExprLambda(
         const PosTable & positions,
         std::pmr::polymorphic_allocator<char> & alloc,
@@ -10,6 +10,8 @@
 
 namespace nix {
 
+struct Sink;
+
 nlohmann::json printValueAsJSON(
     EvalState & state, bool strict, Value & v, const PosIdx pos, NixStringContext & context, bool copyToStore = true);
 
@@ -22,6 +24,26 @@ void printValueAsJSON(
     NixStringContext & context,
     bool copyToStore = true);
 
+/**
+ * Write the JSON representation of `v` to `sink` while forcing it,
+ * without building a `nlohmann::json` DOM first. The output is the
+ * same as that of `nlohmann::json::dump()` on the result of the DOM
+ * variant of this function. On error, `sink` may have received part of
+ * the output.
+ *
+ * @param indent If non-zero, pretty-print the output with this many
+ * spaces per level of indentation.
+ */
+void printValueAsJSON(
+    EvalState & state,
+    bool strict,
+    Value & v,
+    const PosIdx pos,
+    Sink & sink,
+    NixStringContext & context,
+    bool copyToStore = true,
+    unsigned int indent = 0);
+
 MakeError(JSONSerializationError, Error);
 
 } // namespace nix
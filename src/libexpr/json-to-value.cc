@@ -1,7 +1,11 @@
 #include "nix/expr/json-to-value.hh"
 #include "nix/expr/value.hh"
 #include "nix/expr/eval.hh"
+#include "nix/expr/attr-set.hh"
 
+#include <bit>
+#include <charconv>
+#include <cstring>
 #include <limits>
 #include <nlohmann/json.hpp>
 
@@ -202,16 +206,643 @@ public:
     }
 };
 
+/**
+ * Helpers for classifying 8 bytes at a time in a `uint64_t` ("SIMD
+ * within a register"), which works the same on every platform.
+ */
+namespace swar {
+
+constexpr uint64_t ones = 0x0101010101010101ULL;
+constexpr uint64_t highBits = 0x8080808080808080ULL;
+
+inline uint64_t load(const char * p)
+{
+    uint64_t w;
+    std::memcpy(&w, p, sizeof(w));
+    if constexpr (std::endian::native == std::endian::big)
+        w = std::byteswap(w);
+    return w;
+}
+
+/**
+ * The high bit of every byte of `w` that is equal to `c`.
+ */
+inline uint64_t equal(uint64_t w, unsigned char c)
+{
+    uint64_t x = w ^ (ones * c);
+    /* Unlike the usual `(x - ones) & ~x` trick, this doesn't propagate
+       borrows, so it's exact for every byte. */
+    return ~(((x & ~highBits) + ~highBits) | x | ~highBits);
+}
+
+/**
+ * Whether any byte of `w` is less than `n`, for `n <= 128`.
+ */
+inline bool anyLess(uint64_t w, unsigned char n)
+{
+    return (w - ones * n) & ~w & highBits;
+}
+
+inline bool anyEqual(uint64_t w, unsigned char c)
+{
+    return anyLess(w ^ (ones * c), 1);
+}
+
+/**
+ * Gather the high bits of the bytes of `w` into an 8-bit mask.
+ */
+inline uint64_t movemask(uint64_t w)
+{
+    return ((w >> 7) * 0x0102040810204080ULL) >> 56;
+}
+
+} // namespace swar
+
+/**
+ * A two-stage JSON parser in the style of simdjson that builds Nix
+ * values directly.
+ *
+ * Stage 1 classifies the input 64 bytes at a time using bitmasks,
+ * finding the string regions (taking escapes into account) and
+ * recording the offsets of all structural characters and the starts of
+ * all scalars. Stage 2 walks these offsets with an explicit stack,
+ * collecting the elements of every list and attribute set in a scratch
+ * buffer so that each can be allocated with its exact size once it's
+ * complete.
+ *
+ * Errors that nlohmann reports as semantic errors during parsing (null
+ * bytes, out-of-range integers) are thrown with the same messages. For
+ * anything it doesn't accept, the parser gives up and `parseJSON()`
+ * falls back to the SAX parser, which then produces nlohmann's error
+ * message.
+ */
+class JSONParser
+{
+    EvalState & state;
+    std::string_view input;
+
+    /**
+     * Offsets of the structural characters and scalar starts.
+     */
+    std::vector<uint32_t> structurals;
+
+    /**
+     * The unescaped contents of the last string that had escapes.
+     */
+    std::string buf;
+
+    /**
+     * Elements of the lists and attribute sets being parsed. These must
+     * be visible to the garbage collector.
+     */
+    std::vector<Attr, traceable_allocator<Attr>> scratch;
+
+    struct Frame
+    {
+        bool isObject;
+        /**
+         * Offset in `scratch` of the first element.
+         */
+        size_t start;
+        /**
+         * Where to put the list or attribute set when it's complete.
+         */
+        Value * target;
+    };
+
+    std::vector<Frame> stack;
+
+    static bool isDelimiter(char c)
+    {
+        switch (c) {
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\r':
+        case ',':
+        case ':':
+        case '[':
+        case ']':
+        case '{':
+        case '}':
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /**
+     * Return a mask of the characters in the current block that are
+     * escaped by a backslash, given the mask of backslashes.
+     * `prevEscaped` carries over whether the first character of the
+     * next block is escaped.
+     */
+    static uint64_t findEscaped(uint64_t backslash, uint64_t & prevEscaped)
+    {
+        constexpr uint64_t evenBits = 0x5555555555555555ULL;
+        backslash &= ~prevEscaped;
+        uint64_t followsEscape = backslash << 1 | prevEscaped;
+        uint64_t oddSequenceStarts = backslash & ~evenBits & ~followsEscape;
+        uint64_t sequencesStartingOnEvenBits;
+        prevEscaped = __builtin_add_overflow(oddSequenceStarts, backslash, &sequencesStartingOnEvenBits);
+        uint64_t invertMask = sequencesStartingOnEvenBits << 1;
+        return (evenBits ^ invertMask) & followsEscape;
+    }
+
+    static uint64_t prefixXor(uint64_t x)
+    {
+        x ^= x << 1;
+        x ^= x << 2;
+        x ^= x << 4;
+        x ^= x << 8;
+        x ^= x << 16;
+        x ^= x << 32;
+        return x;
+    }
+
+    /**
+     * Stage 1: find the structural characters. Return false if the
+     * input has an unterminated string.
+     */
+    bool index()
+    {
+        structurals.reserve(input.size() / 8);
+
+        uint64_t prevEscaped = 0, prevInString = 0, prevScalar = 0;
+
+        for (size_t base = 0; base < input.size(); base += 64) {
+            /* Pad the last block with spaces. */
+            char block[64];
+            auto n = std::min<size_t>(64, input.size() - base);
+            std::memcpy(block, input.data() + base, n);
+            std::memset(block + n, ' ', 64 - n);
+
+            uint64_t backslash = 0, quote = 0, ws = 0, op = 0;
+            for (size_t i = 0; i < 8; ++i) {
+                auto w = swar::load(block + i * 8);
+                auto shift = i * 8;
+                backslash |= swar::movemask(swar::equal(w, '\\')) << shift;
+                quote |= swar::movemask(swar::equal(w, '"')) << shift;
+                ws |= swar::movemask(
+                          swar::equal(w, ' ') | swar::equal(w, '\t') | swar::equal(w, '\n') | swar::equal(w, '\r'))
+                      << shift;
+                op |= swar::movemask(
+                          swar::equal(w, '{') | swar::equal(w, '}') | swar::equal(w, '[') | swar::equal(w, ']')
+                          | swar::equal(w, ':') | swar::equal(w, ','))
+                      << shift;
+            }
+
+            quote &= ~findEscaped(backslash, prevEscaped);
+
+            /* Everything from an opening quote up to (but excluding)
+               the closing quote. */
+            uint64_t inString = prefixXor(quote) ^ prevInString;
+            prevInString = inString >> 63 ? ~0ULL : 0;
+
+            uint64_t scalar = ~(op | ws | quote);
+            uint64_t scalarStart = scalar & ~(scalar << 1 | prevScalar);
+            prevScalar = scalar >> 63;
+
+            uint64_t bits = ((op | scalarStart) & ~inString) | (quote & inString);
+
+            while (bits) {
+                structurals.push_back(base + std::countr_zero(bits));
+                bits &= bits - 1;
+            }
+        }
+
+        return !prevInString;
+    }
+
+    /**
+     * Parse the string whose opening quote is at `p`, returning its
+     * unescaped contents. Return `std::nullopt` if the string is
+     * invalid.
+     */
+    std::optional<std::string_view> parseString(size_t p)
+    {
+        const char * s = input.data();
+        size_t n = input.size();
+
+        size_t start = ++p;
+        size_t copied = start;
+        bool escaped = false;
+
+        while (true) {
+            /* Skip over blocks that are plain ASCII without quotes or
+               escapes. */
+            while (p + 8 <= n) {
+                auto w = swar::load(s + p);
+                if ((w & swar::highBits) || swar::anyLess(w, 0x20) || swar::anyEqual(w, '"')
+                    || swar::anyEqual(w, '\\'))
+                    break;
+                p += 8;
+            }
+
+            if (p >= n)
+                return std::nullopt;
+
+            unsigned char c = s[p];
+
+            if (c == '"')
+                break;
+
+            else if (c == '\\') {
+                if (!escaped) {
+                    buf.clear();
+                    escaped = true;
+                }
+                buf.append(s + copied, p - copied);
+                if (++p >= n)
+                    return std::nullopt;
+                switch (s[p]) {
+                case '"':
+                    buf += '"';
+                    break;
+                case '\\':
+                    buf += '\\';
+                    break;
+                case '/':
+                    buf += '/';
+                    break;
+                case 'b':
+                    buf += '\b';
+                    break;
+                case 'f':
+                    buf += '\f';
+                    break;
+                case 'n':
+                    buf += '\n';
+                    break;
+                case 'r':
+                    buf += '\r';
+                    break;
+                case 't':
+                    buf += '\t';
+                    break;
+                case 'u': {
+                    auto cp = parseHex4(p + 1);
+                    if (!cp)
+                        return std::nullopt;
+                    p += 4;
+                    char32_t codepoint = *cp;
+                    if (codepoint >= 0xd800 && codepoint <= 0xdbff) {
+                        if (p + 2 >= n || s[p + 1] != '\\' || s[p + 2] != 'u')
+                            return std::nullopt;
+                        auto low = parseHex4(p + 3);
+                        if (!low || *low < 0xdc00 || *low > 0xdfff)
+                            return std::nullopt;
+                        p += 6;
+                        codepoint = 0x10000 + ((codepoint - 0xd800) << 10) + (*low - 0xdc00);
+                    } else if (codepoint >= 0xdc00 && codepoint <= 0xdfff)
+                        return std::nullopt;
+                    appendUTF8(codepoint);
+                    break;
+                }
+                default:
+                    return std::nullopt;
+                }
+                copied = ++p;
+            }
+
+            else if (c < 0x20)
+                return std::nullopt;
+
+            else if (c < 0x80)
+                ++p;
+
+            else {
+                auto len = validUTF8Length(p);
+                if (!len)
+                    return std::nullopt;
+                p += len;
+            }
+        }
+
+        if (escaped) {
+            buf.append(s + copied, p - copied);
+            return std::string_view(buf);
+        }
+
+        return input.substr(start, p - start);
+    }
+
+    std::optional<char32_t> parseHex4(size_t p)
+    {
+        if (p + 4 > input.size())
+            return std::nullopt;
+        char32_t res = 0;
+        for (size_t i = 0; i < 4; ++i) {
+            char c = input[p + i];
+            res <<= 4;
+            if (c >= '0' && c <= '9')
+                res |= c - '0';
+            else if (c >= 'a' && c <= 'f')
+                res |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')
+                res |= c - 'A' + 10;
+            else
+                return std::nullopt;
+        }
+        return res;
+    }
+
+    void appendUTF8(char32_t cp)
+    {
+        if (cp < 0x80)
+            buf += (char) cp;
+        else if (cp < 0x800) {
+            buf += (char) (0xc0 | (cp >> 6));
+            buf += (char) (0x80 | (cp & 0x3f));
+        } else if (cp < 0x10000) {
+            buf += (char) (0xe0 | (cp >> 12));
+            buf += (char) (0x80 | ((cp >> 6) & 0x3f));
+            buf += (char) (0x80 | (cp & 0x3f));
+        } else {
+            buf += (char) (0xf0 | (cp >> 18));
+            buf += (char) (0x80 | ((cp >> 12) & 0x3f));
+            buf += (char) (0x80 | ((cp >> 6) & 0x3f));
+            buf += (char) (0x80 | (cp & 0x3f));
+        }
+    }
+
+    /**
+     * Return the length of the UTF-8 sequence starting at `p`, or 0 if
+     * it isn't valid.
+     */
+    size_t validUTF8Length(size_t p)
+    {
+        unsigned char c = input[p];
+        size_t len;
+        unsigned char lo = 0x80, hi = 0xbf;
+        if (c >= 0xc2 && c <= 0xdf)
+            len = 2;
+        else if (c == 0xe0)
+            len = 3, lo = 0xa0;
+        else if (c == 0xed)
+            len = 3, hi = 0x9f;
+        else if (c >= 0xe1 && c <= 0xef)
+            len = 3;
+        else if (c == 0xf0)
+            len = 4, lo = 0x90;
+        else if (c >= 0xf1 && c <= 0xf3)
+            len = 4;
+        else if (c == 0xf4)
+            len = 4, hi = 0x8f;
+        else
+            return 0;
+        if (p + len > input.size())
+            return 0;
+        for (size_t k = 1; k < len; ++k) {
+            unsigned char c2 = input[p + k];
+            if (c2 < (k == 1 ? lo : 0x80) || c2 > (k == 1 ? hi : 0xbf))
+                return 0;
+        }
+        return len;
+    }
+
+    bool parseLiteral(size_t p, std::string_view literal)
+    {
+        return input.substr(p, literal.size()) == literal
+               && (p + literal.size() == input.size() || isDelimiter(input[p + literal.size()]));
+    }
+
+    bool parseNumber(size_t p, Value & v)
+    {
+        auto begin = input.data() + p, end = input.data() + input.size(), q = begin;
+
+        auto digits = [&]() {
+            auto start = q;
+            while (q < end && *q >= '0' && *q <= '9')
+                ++q;
+            return q != start;
+        };
+
+        bool negative = q < end && *q == '-';
+        if (negative)
+            ++q;
+        if (q < end && *q == '0')
+            ++q;
+        else if (!digits())
+            return false;
+
+        bool isFloat = false;
+        if (q < end && *q == '.') {
+            ++q;
+            if (!digits())
+                return false;
+            isFloat = true;
+        }
+        if (q < end && (*q == 'e' || *q == 'E')) {
+            ++q;
+            if (q < end && (*q == '+' || *q == '-'))
+                ++q;
+            if (!digits())
+                return false;
+            isFloat = true;
+        }
+
+        if (q < end && !isDelimiter(*q))
+            return false;
+
+        if (!isFloat) {
+            NixInt::Inner i;
+            if (std::from_chars(begin, q, i).ec == std::errc()) {
+                v.mkInt(i);
+                return true;
+            }
+            uint64_t u;
+            if (!negative && std::from_chars(begin, q, u).ec == std::errc())
+                throw Error("unsigned json number %1% outside of Nix integer range", u);
+            /* Like nlohmann, treat integers that don't fit in 64 bits
+               as floats. */
+        }
+
+        NixFloat f;
+        /* Leave floats that overflow or underflow to nlohmann. */
+        if (std::from_chars(begin, q, f).ec != std::errc())
+            return false;
+        v.mkFloat(f);
+        return true;
+    }
+
+    /**
+     * Sort the attributes collected in `attrs` by symbol, keeping only
+     * the last occurrence of duplicate names like nlohmann does.
+     */
+    static size_t sortAttrs(std::span<Attr> attrs)
+    {
+        std::ranges::stable_sort(attrs, [](const Attr & a, const Attr & b) { return a.name < b.name; });
+        size_t n = 0;
+        for (size_t i = 0; i < attrs.size(); ++i) {
+            if (i + 1 < attrs.size() && attrs[i + 1].name == attrs[i].name)
+                continue;
+            attrs[n++] = attrs[i];
+        }
+        return n;
+    }
+
+public:
+
+    JSONParser(EvalState & state, std::string_view input)
+        : state(state)
+        , input(input)
+    {
+    }
+
+    /**
+     * Parse the input into `result`. Return false if the input isn't
+     * valid JSON or uses something this parser doesn't handle.
+     */
+    bool parse(Value & result)
+    {
+        if (input.size() > std::numeric_limits<uint32_t>::max() || !index())
+            return false;
+
+        size_t i = 0;
+        const size_t n = structurals.size();
+        Value * target = &result;
+
+        auto peek = [&]() { return i < n ? input[structurals[i]] : 0; };
+
+        auto newElement = [&](Symbol name) {
+            scratch.emplace_back(name, state.allocValue());
+            target = scratch.back().value;
+        };
+
+    value:
+        if (i == n)
+            return false;
+        {
+            auto p = structurals[i++];
+            switch (input[p]) {
+            case '{':
+                stack.push_back({.isObject = true, .start = scratch.size(), .target = target});
+                if (peek() == '}') {
+                    ++i;
+                    goto endObject;
+                }
+                goto key;
+            case '[':
+                stack.push_back({.isObject = false, .start = scratch.size(), .target = target});
+                if (peek() == ']') {
+                    ++i;
+                    goto endArray;
+                }
+                newElement({});
+                goto value;
+            case '"': {
+                auto str = parseString(p);
+                if (!str)
+                    return false;
+                forceNoNullByte(*str);
+                target->mkString(*str, state.mem);
+                break;
+            }
+            case 't':
+                if (!parseLiteral(p, "true"))
+                    return false;
+                target->mkBool(true);
+                break;
+            case 'f':
+                if (!parseLiteral(p, "false"))
+                    return false;
+                target->mkBool(false);
+                break;
+            case 'n':
+                if (!parseLiteral(p, "null"))
+                    return false;
+                target->mkNull();
+                break;
+            default:
+                if (!parseNumber(p, *target))
+                    return false;
+            }
+        }
+
+    afterValue:
+        if (stack.empty())
+            return i == n;
+        if (i == n)
+            return false;
+        switch (input[structurals[i++]]) {
+        case ',':
+            if (stack.back().isObject)
+                goto key;
+            newElement({});
+            goto value;
+        case '}':
+            if (!stack.back().isObject)
+                return false;
+            goto endObject;
+        case ']':
+            if (stack.back().isObject)
+                return false;
+            goto endArray;
+        default:
+            return false;
+        }
+
+    key:
+        if (peek() != '"')
+            return false;
+        {
+            auto str = parseString(structurals[i++]);
+            if (!str)
+                return false;
+            forceNoNullByte(*str);
+            auto name = state.symbols.create(*str);
+            if (peek() != ':')
+                return false;
+            ++i;
+            newElement(name);
+        }
+        goto value;
+
+    endObject: {
+        auto frame = stack.back();
+        stack.pop_back();
+        auto attrs = std::span(scratch).subspan(frame.start);
+        auto size = sortAttrs(attrs);
+        auto bindings = state.buildBindings(size);
+        for (auto & attr : attrs.subspan(0, size))
+            bindings.insert(attr);
+        frame.target->mkAttrs(bindings.alreadySorted());
+        scratch.resize(frame.start);
+        goto afterValue;
+    }
+
+    endArray: {
+        auto frame = stack.back();
+        stack.pop_back();
+        auto elems = std::span(scratch).subspan(frame.start);
+        auto list = state.buildList(elems.size());
+        for (const auto & [k, v] : enumerate(list))
+            v = elems[k].value;
+        frame.target->mkList(list);
+        scratch.resize(frame.start);
+        goto afterValue;
+    }
+    }
+};
+
 } // namespace
 
-void parseJSON(EvalState & state, const std::string_view & s_, Value & v)
+void parseJSONWithSax(EvalState & state, std::string_view s, Value & v)
 {
     JSONSax parser(state, v);
-    bool res = json::sax_parse(s_, &parser);
+    bool res = json::sax_parse(s, &parser);
     if (!res)
         throw JSONParseError("Invalid JSON Value");
 }
 
+void parseJSON(EvalState & state, const std::string_view & s_, Value & v)
+{
+    JSONParser parser(state, s_);
+    if (!parser.parse(v))
+        parseJSONWithSax(state, s_, v);
+}
+
 void JSONParseError::anchor() {}
 
 } // namespace nix
@@ -1,5 +1,6 @@
 #include "nix/store/derivations.hh"
 #include "nix/store/downstream-placeholder.hh"
+#include "nix/store/drv-hash-cache.hh"
 #include "nix/expr/eval-inline.hh"
 #include "nix/expr/eval.hh"
 #include "nix/expr/eval-settings.hh"
@@ -1433,6 +1434,10 @@ static void prim_derivationStrictGeneric(EvalState & state, const PosIdx pos, Va
         throw;
     }
 
+    std::optional<Activity> act;
+    if (loggerSettings.activityTracePath.get())
+        act.emplace(*logger, lvlVomit, actDerivationStrict, fmt("instantiating '%s'", drvName));
+
     try {
         derivationStrictInternal(state, drvName, attrs, v, state.evalContext.provenance, acceptMeta);
     } catch (Error & e) {
@@ -1916,9 +1921,12 @@ static void derivationStrictInternal(
 
     /* Optimisation, but required in read-only mode! because in that
        case we don't actually write store derivations, so we can't
-       read them later. */
+       read them later. Also record the hash on disk so that later
+       processes don't have to read this derivation to hash it. */
     {
         auto h = hashDerivationModulo(*state.store, drv, false);
+        if (auto diskCache = DrvHashCache::get())
+            diskCache->upsert(*state.store, drvPath, h);
         drvHashes.insert_or_assign(drvPath, std::move(h));
     }
 
@@ -2723,10 +2731,10 @@ static RegisterPrimOp primop_toXML({
    represented (e.g., functions). */
 static void prim_toJSON(EvalState & state, const PosIdx pos, Value ** args, Value & v)
 {
-    std::ostringstream out;
+    StringSink out;
     NixStringContext context;
     printValueAsJSON(state, true, *args[0], pos, out, context);
-    v.mkString(out.view(), context, state.mem);
+    v.mkString(out.s, context, state.mem);
 }
 
 static RegisterPrimOp primop_toJSON({
@@ -1,5 +1,7 @@
 #include "nix/expr/primops.hh"
 #include "nix/expr/eval-inline.hh"
+#include "nix/store/wasm-module-cache.hh"
+#include "nix/util/sync.hh"
 
 #include <wasmtime.hh>
 #include <boost/unordered/concurrent_flat_map.hpp>
@@ -29,6 +31,11 @@ static Engine & getEngine()
     return engine;
 }
 
+/**
+ * Identifies the configuration of `getEngine()` in the compiled module cache.
+ */
+static constexpr std::string_view engineKey = "builtins.wasm;pooling;cow;wasmtime-" WASMTIME_VERSION;
+
 static std::span<uint8_t> string2span(std::string_view s)
 {
     return std::span<uint8_t>((uint8_t *) s.data(), s.size());
@@ -78,19 +85,52 @@ TrapResult<InstancePre> instantiate_pre(Linker & linker, const Module & m)
     return InstancePre(instance_pre);
 }
 
+/**
+ * Compile a module, or load it from the compiled module cache if
+ * it was compiled by a previous process.
+ */
+static Module compileModule(Engine & engine, std::span<uint8_t> bytes)
+{
+    if (auto compiled = lookupCompiledWasmModule(engineKey, bytes)) {
+        auto module = Module::deserialize(engine, string2span(*compiled));
+        if (module)
+            return module.ok();
+        debug("cannot use cached compiled Wasm module: %s", module.err().message());
+    }
+
+    auto module = unwrap(Module::compile(engine, bytes));
+    if (auto compiled = module.serialize())
+        storeCompiledWasmModule(engineKey, bytes, compiled.ok());
+    return module;
+}
+
 static void regFuns(Linker & linker, bool useWasi);
 
+struct NixWasmInstance;
+
 struct NixWasmInstancePre
 {
     Engine & engine = getEngine();
     std::string name;
     bool useWasi = false;
+
+    /**
+     * Whether an instance may be reused for subsequent calls, which
+     * the module declares by exporting `nix_wasm_reusable_v1`.
+     */
+    bool reusable = false;
+
     InstancePre instancePre;
 
+    /**
+     * Idle instances of a reusable module that have already been
+     * initialised.
+     */
+    Sync<std::vector<std::unique_ptr<NixWasmInstance>>> pool;
+
     InstancePre compile(std::span<uint8_t> bytes)
     {
-        // Compile the module
-        auto module = unwrap(Module::compile(engine, bytes));
+        auto module = compileModule(engine, bytes);
 
         // Auto-detect WASI by checking for wasi_snapshot_preview1 imports.
         for (const auto & ref : module.imports())
@@ -99,6 +139,12 @@ struct NixWasmInstancePre
                 break;
             }
 
+        for (const auto & ref : module.exports())
+            if (const_cast<std::decay_t<decltype(ref)> &>(ref).name() == "nix_wasm_reusable_v1") {
+                reusable = true;
+                break;
+            }
+
         // Create linker with appropriate WASI support
         Linker linker(engine);
         if (useWasi)
@@ -136,6 +182,11 @@ struct NixWasmInstance
     ValueVector values;
     std::exception_ptr ex;
 
+    /**
+     * Whether `nix_wasm_init_v1` has been called.
+     */
+    bool initialized = false;
+
     std::optional<std::string> functionName;
 
     ValueId resultId = 0;
@@ -555,7 +606,12 @@ struct LazyMakeRef
     }
 };
 
-static NixWasmInstance instantiateWasm(EvalState & state, const SourcePath & wasmPath)
+/**
+ * Maximum number of idle instances kept per module.
+ */
+static constexpr size_t maxPooledInstances = 16;
+
+static std::unique_ptr<NixWasmInstance> instantiateWasm(EvalState & state, const SourcePath & wasmPath)
 {
     // FIXME: make this a weak Boehm GC pointer so that it can be freed during GC.
     // FIXME: move to EvalState?
@@ -567,7 +623,33 @@ static NixWasmInstance instantiateWasm(EvalState & state, const SourcePath & was
     instancesPre.try_emplace_and_cvisit(
         wasmPath, wasmPath, [&](auto & i) { instancePre = i.second.p; }, [&](auto & i) { instancePre = i.second.p; });
 
-    return NixWasmInstance{state, ref(instancePre)};
+    if (instancePre->reusable) {
+        auto pool(instancePre->pool.lock());
+        for (auto i = pool->begin(); i != pool->end(); ++i)
+            if (&(*i)->state == &state) {
+                auto instance = std::move(*i);
+                pool->erase(i);
+                return instance;
+            }
+    }
+
+    return std::make_unique<NixWasmInstance>(state, ref(instancePre));
+}
+
+/**
+ * Return an instance of a reusable module to its pool after a
+ * successful call.
+ */
+static void releaseInstance(std::unique_ptr<NixWasmInstance> instance)
+{
+    // Keep value ID 0 reserved.
+    instance->values.resize(1);
+    instance->resultId = 0;
+    instance->functionName.reset();
+
+    auto pool(instance->pre->pool.lock());
+    if (pool->size() < maxPooledInstances)
+        pool->push_back(std::move(instance));
 }
 
 /**
@@ -623,15 +705,15 @@ static void prim_wasm(EvalState & state, const PosIdx pos, Value ** args, Value
 
     try {
         auto instance = pathAttr ? instantiateWasm(state, state.realisePath(pos, *pathAttr->value))
-                                 : NixWasmInstance{
+                                 : std::make_unique<NixWasmInstance>(
                                        state,
                                        make_ref<NixWasmInstancePre>(state.forceStringNoCtx(
-                                           *watAttr->value, pos, "while evaluating the 'wat' attribute"))};
+                                           *watAttr->value, pos, "while evaluating the 'wat' attribute")));
 
         // Extract 'function' attribute (optional for wasi, required for non-wasi)
         std::string functionName;
         auto functionAttr = args[0]->attrs()->get(state.symbols.create("function"));
-        if (instance.pre->useWasi) {
+        if (instance->pre->useWasi) {
             functionName = "_start";
             if (functionAttr)
                 throw Error("'function' attribute is not allowed for WASI modules");
@@ -645,10 +727,10 @@ static void prim_wasm(EvalState & state, const PosIdx pos, Value ** args, Value
 
         debug("calling wasm module");
 
-        auto argId = instance.addValue(argValue);
+        auto argId = instance->addValue(argValue);
 
-        if (instance.pre->useWasi) {
-            WasiLogger logger{instance};
+        if (instance->pre->useWasi) {
+            WasiLogger logger{*instance};
 
             auto loggerTrampoline = [](void * data, const unsigned char * buf, size_t len) -> ptrdiff_t {
                 auto logger = static_cast<WasiLogger *>(data);
@@ -660,34 +742,42 @@ static void prim_wasm(EvalState & state, const PosIdx pos, Value ** args, Value
             wasi_config_set_stdout_custom(wasiConfig.capi(), loggerTrampoline, &logger, nullptr);
             wasi_config_set_stderr_custom(wasiConfig.capi(), loggerTrampoline, &logger, nullptr);
             wasiConfig.argv({"wasi", std::to_string(argId)});
-            unwrap(instance.wasmStore.context().set_wasi(std::move(wasiConfig)));
+            unwrap(instance->wasmStore.context().set_wasi(std::move(wasiConfig)));
 
-            auto res = instance.getExport<Func>(functionName).call(instance.wasmCtx, {});
-            if (!instance.resultId) {
+            auto res = instance->getExport<Func>(functionName).call(instance->wasmCtx, {});
+            if (!instance->resultId) {
                 unwrap(std::move(res));
                 throw Error(
                     "Wasm function '%s' from '%s' finished without returning a value",
                     functionName,
-                    instance.pre->name);
+                    instance->pre->name);
             }
 
-            auto & vRes = instance.getValue(instance.resultId);
+            auto & vRes = instance->getValue(instance->resultId);
             state.forceValue(vRes, pos);
             v = vRes;
         } else {
             // FIXME: use the "start" function if present.
-            instance.runFunction("nix_wasm_init_v1", {});
+            if (!instance->initialized) {
+                instance->runFunction("nix_wasm_init_v1", {});
+                instance->initialized = true;
+            }
 
-            auto res = instance.runFunction(functionName, {(int32_t) argId});
+            auto res = instance->runFunction(functionName, {(int32_t) argId});
             if (res.size() != 1)
                 throw Error(
-                    "Wasm function '%s' from '%s' did not return exactly one value", functionName, instance.pre->name);
+                    "Wasm function '%s' from '%s' did not return exactly one value", functionName, instance->pre->name);
             if (res[0].kind() != ValKind::I32)
                 throw Error(
-                    "Wasm function '%s' from '%s' did not return an i32 value", functionName, instance.pre->name);
-            auto & vRes = instance.getValue(res[0].i32());
+                    "Wasm function '%s' from '%s' did not return an i32 value", functionName, instance->pre->name);
+            auto & vRes = instance->getValue(res[0].i32());
             state.forceValue(vRes, pos);
             v = vRes;
+
+            /* Instances of inline modules aren't pooled, since their
+               `NixWasmInstancePre` isn't shared between calls. */
+            if (pathAttr && instance->pre->reusable)
+                releaseInstance(std::move(instance));
         }
     } catch (Error & e) {
         e.addTrace(state.positions[pos], "while executing a Wasm module");
@@ -712,6 +802,13 @@ static RegisterPrimOp primop_wasm(
 
       WASI mode is automatically enabled if the module imports from `wasi_snapshot_preview1`.
 
+      A non-WASI module loaded from `path` can export `nix_wasm_reusable_v1` to declare that its functions don't depend
+      on state left behind by previous calls. Nix then reuses its instances across calls, running `nix_wasm_init_v1`
+      only once per instance.
+
+      Compiled modules are cached in the user's cache directory, so subsequent Nix processes don't need to compile
+      them again.
+
       Example (non-WASI):
       ```nix
       builtins.wasm {
@@ -2,8 +2,11 @@
 #include "nix/expr/eval-inline.hh"
 #include "nix/store/store-api.hh"
 #include "nix/util/signals.hh"
+#include "nix/util/serialise.hh"
+#include "nix/util/util.hh"
 #include "nix/expr/parallel-eval.hh"
 
+#include <charconv>
 #include <cstdlib>
 #include <nlohmann/json.hpp>
 
@@ -146,20 +149,363 @@ json printValueAsJSON(
 
 void JSONSerializationError::anchor() {}
 
+namespace {
+
+/**
+ * Writes JSON to a `Sink`, producing exactly the same output as
+ * `nlohmann::json::dump()` would for the equivalent DOM.
+ */
+struct JSONWriter
+{
+    Sink & sink;
+
+    /**
+     * Number of spaces per indentation level, or 0 to write everything
+     * on a single line.
+     */
+    unsigned int indent;
+
+    unsigned int depth = 0;
+
+    /**
+     * Output is collected here and written to `sink` in large chunks,
+     * since `Sink::operator()` is a virtual call.
+     */
+    std::string buf;
+
+    static constexpr size_t bufSize = 64 * 1024;
+
+    JSONWriter(Sink & sink, unsigned int indent)
+        : sink(sink)
+        , indent(indent)
+    {
+        buf.reserve(bufSize);
+    }
+
+    void flush()
+    {
+        if (!buf.empty()) {
+            sink(buf);
+            buf.clear();
+        }
+    }
+
+    void maybeFlush()
+    {
+        if (buf.size() >= bufSize)
+            flush();
+    }
+
+    void newline()
+    {
+        if (indent) {
+            buf += '\n';
+            buf.append(depth * indent, ' ');
+        }
+    }
+
+    void beginContainer(char open)
+    {
+        buf += open;
+        ++depth;
+    }
+
+    /**
+     * Start the next element of an array or object.
+     */
+    void separator(bool first)
+    {
+        if (!first)
+            buf += ',';
+        newline();
+    }
+
+    void endContainer(char close, bool empty)
+    {
+        --depth;
+        if (!empty)
+            newline();
+        buf += close;
+        maybeFlush();
+    }
+
+    void key(std::string_view name)
+    {
+        string(name);
+        buf += indent ? ": " : ":";
+    }
+
+    void null()
+    {
+        buf += "null";
+    }
+
+    void boolean(bool b)
+    {
+        buf += b ? "true" : "false";
+    }
+
+    void integer(NixInt::Inner n)
+    {
+        char tmp[24];
+        auto [end, ec] = std::to_chars(tmp, tmp + sizeof(tmp), n);
+        assert(ec == std::errc());
+        buf.append(tmp, end);
+    }
+
+    void fpoint(NixFloat f)
+    {
+        /* Leave the (shortest round-trip) formatting of floats to
+           nlohmann. */
+        buf += json(f).dump();
+    }
+
+    /**
+     * Write a JSON value, e.g. one produced by an external value,
+     * indented to the current depth.
+     */
+    void value(const json & j)
+    {
+        auto s = j.dump(indent ? (int) indent : -1);
+        if (indent)
+            s = replaceStrings(s, "\n", "\n" + std::string(depth * indent, ' '));
+        buf += s;
+        maybeFlush();
+    }
+
+    [[noreturn]] static void invalidUTF8(std::string_view s, size_t i)
+    {
+        /* Use the same message as nlohmann. */
+        throw JSONSerializationError(
+            fmt("JSON serialization error: [json.exception.type_error.316] invalid UTF-8 byte at index %d: 0x%02X",
+                i,
+                (unsigned int) (unsigned char) s[i]));
+    }
+
+    /**
+     * Write a JSON string, escaping it like nlohmann does (without
+     * `ensure_ascii`). Throws if `s` is not valid UTF-8.
+     */
+    void string(std::string_view s)
+    {
+        buf += '"';
+
+        size_t i = 0;
+        while (i < s.size()) {
+            /* Copy runs of characters that don't need escaping at once. */
+            auto start = i;
+            while (i < s.size()) {
+                unsigned char c = s[i];
+                if (c < 0x20 || c == '"' || c == '\\' || c >= 0x80)
+                    break;
+                ++i;
+            }
+            buf.append(s.substr(start, i - start));
+            if (i == s.size())
+                break;
+
+            unsigned char c = s[i];
+
+            if (c < 0x80) {
+                switch (c) {
+                case '"':
+                    buf += "\\\"";
+                    break;
+                case '\\':
+                    buf += "\\\\";
+                    break;
+                case '\b':
+                    buf += "\\b";
+                    break;
+                case '\f':
+                    buf += "\\f";
+                    break;
+                case '\n':
+                    buf += "\\n";
+                    break;
+                case '\r':
+                    buf += "\\r";
+                    break;
+                case '\t':
+                    buf += "\\t";
+                    break;
+                default:
+                    buf += fmt("\\u%04x", (unsigned int) c);
+                }
+                ++i;
+                continue;
+            }
+
+            /* Validate a multi-byte sequence, reporting the first byte
+               that makes it invalid. */
+            size_t len;
+            unsigned char lo = 0x80, hi = 0xbf;
+            if (c >= 0xc2 && c <= 0xdf)
+                len = 2;
+            else if (c == 0xe0)
+                len = 3, lo = 0xa0;
+            else if (c == 0xed)
+                len = 3, hi = 0x9f;
+            else if (c >= 0xe1 && c <= 0xef)
+                len = 3;
+            else if (c == 0xf0)
+                len = 4, lo = 0x90;
+            else if (c >= 0xf1 && c <= 0xf3)
+                len = 4;
+            else if (c == 0xf4)
+                len = 4, hi = 0x8f;
+            else
+                invalidUTF8(s, i);
+
+            for (size_t k = 1; k < len; ++k) {
+                if (i + k == s.size())
+                    throw JSONSerializationError(
+                        fmt("JSON serialization error: [json.exception.type_error.316] incomplete UTF-8 string; "
+                            "last byte: 0x%02X",
+                            (unsigned int) (unsigned char) s.back()));
+                unsigned char c2 = s[i + k];
+                if (c2 < (k == 1 ? lo : 0x80) || c2 > (k == 1 ? hi : 0xbf))
+                    invalidUTF8(s, i + k);
+            }
+
+            buf.append(s.substr(i, len));
+            i += len;
+        }
+
+        buf += '"';
+    }
+};
+
+} // namespace
+
 void printValueAsJSON(
     EvalState & state,
     bool strict,
     Value & v,
     const PosIdx pos,
-    std::ostream & str,
+    Sink & sink,
     NixStringContext & context,
-    bool copyToStore)
+    bool copyToStore,
+    unsigned int indent)
 {
+    if (strict && state.executor->enabled && !Executor::amWorkerThread)
+        parallelForceDeep(state, v, pos);
+
+    JSONWriter out(sink, indent);
+
+    auto recurse = [&](this const auto & recurse, Value & v, PosIdx pos) -> void {
+        checkInterrupt();
+
+        auto _level = state.addCallDepth(pos);
+
+        if (strict)
+            state.forceValue(v, pos);
+
+        switch (v.type()) {
+
+        case nInt:
+            out.integer(v.integer().value);
+            break;
+
+        case nBool:
+            out.boolean(v.boolean());
+            break;
+
+        case nString:
+            copyContext(v, context);
+            out.string(v.string_view());
+            break;
+
+        case nPath:
+            if (copyToStore)
+                out.string(
+                    state.store->printStorePath(state.copyPathToStore(context, v.path(), v.determinePos(pos))));
+            else
+                out.string(v.path().path.abs());
+            break;
+
+        case nNull:
+            out.null();
+            break;
+
+        case nAttrs: {
+            auto maybeString = state.tryAttrsToString(pos, v, context, false, false);
+            if (maybeString) {
+                out.string(*maybeString);
+                break;
+            }
+            if (auto i = v.attrs()->get(state.s.outPath))
+                return recurse(*i->value, i->pos);
+            out.beginContainer('{');
+            bool first = true;
+            for (auto & a : v.attrs()->lexicographicOrder(state.symbols)) {
+                out.separator(first);
+                first = false;
+                out.key(state.symbols[a->name]);
+                try {
+                    recurse(*a->value, a->pos);
+                } catch (Error & e) {
+                    e.addTrace(
+                        state.positions[a->pos], HintFmt("while evaluating attribute '%1%'", state.symbols[a->name]));
+                    throw;
+                }
+            }
+            out.endContainer('}', first);
+            break;
+        }
+
+        case nList: {
+            out.beginContainer('[');
+            bool first = true;
+            for (const auto & [i, elem] : enumerate(v.listView())) {
+                out.separator(first);
+                first = false;
+                try {
+                    recurse(*elem, pos);
+                } catch (Error & e) {
+                    e.addTrace(state.positions[pos], HintFmt("while evaluating list element at index %1%", i));
+                    throw;
+                }
+            }
+            out.endContainer(']', first);
+            break;
+        }
+
+        case nExternal:
+            out.value(v.external()->printValueAsJSON(state, strict, context, copyToStore));
+            break;
+
+        case nFloat:
+            out.fpoint(v.fpoint());
+            break;
+
+        case nThunk:
+        case nFailed:
+        case nFunction:
+            state.error<TypeError>("cannot convert %1% to JSON", showType(v)).atPos(v.determinePos(pos)).debugThrow();
+        }
+    };
+
     try {
-        str << printValueAsJSON(state, strict, v, pos, context, copyToStore);
+        recurse(v, pos);
     } catch (nlohmann::json::exception & e) {
         throw JSONSerializationError("JSON serialization error: %s", e.what());
     }
+
+    out.flush();
+}
+
+void printValueAsJSON(
+    EvalState & state,
+    bool strict,
+    Value & v,
+    const PosIdx pos,
+    std::ostream & str,
+    NixStringContext & context,
+    bool copyToStore)
+{
+    LambdaSink sink([&](std::string_view data) { str << data; });
+    printValueAsJSON(state, strict, v, pos, sink, context, copyToStore);
 }
 
 json ExternalValueBase::printValueAsJSON(
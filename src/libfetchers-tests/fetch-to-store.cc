@@ -0,0 +1,70 @@
+#include "nix/fetchers/fetch-to-store.hh"
+#include "nix/util/file-system.hh"
+
+#include <gtest/gtest.h>
+
+namespace nix {
+
+class SourceTreeFingerprintTest : public ::testing::Test
+{
+    std::unique_ptr<AutoDelete> delTmpDir;
+
+protected:
+    std::filesystem::path tmpDir;
+    SourcePath root{getFSSourceAccessor()};
+
+    /**
+     * A time after which all test files have been created, so that
+     * they're not considered racily modified.
+     */
+    time_t notAfter = time(nullptr) + 3600;
+
+public:
+    void SetUp() override
+    {
+        tmpDir = createTempDir();
+        delTmpDir = std::make_unique<AutoDelete>(tmpDir, true);
+        root = SourcePath{makeFSSourceAccessor(tmpDir)};
+
+        createDirs(tmpDir / "dir");
+        writeFile(tmpDir / "foo", "hello");
+        writeFile(tmpDir / "dir" / "bar", "world");
+    }
+
+    void TearDown() override
+    {
+        delTmpDir.reset();
+    }
+};
+
+TEST_F(SourceTreeFingerprintTest, stable)
+{
+    auto fp = getSourceTreeFingerprint(root, notAfter);
+    ASSERT_TRUE(fp);
+    ASSERT_EQ(getSourceTreeFingerprint(root, notAfter), fp);
+}
+
+TEST_F(SourceTreeFingerprintTest, detectsChanges)
+{
+    auto fp = getSourceTreeFingerprint(root, notAfter);
+
+    writeFile(tmpDir / "dir" / "bar", "world!");
+    auto fp2 = getSourceTreeFingerprint(root, notAfter);
+    ASSERT_TRUE(fp2);
+    ASSERT_NE(fp2, fp);
+
+    writeFile(tmpDir / "dir" / "baz", "");
+    auto fp3 = getSourceTreeFingerprint(root, notAfter);
+    ASSERT_TRUE(fp3);
+    ASSERT_NE(fp3, fp2);
+
+    /* A subtree has its own fingerprint. */
+    ASSERT_NE(getSourceTreeFingerprint(root / "dir", notAfter), fp3);
+}
+
+TEST_F(SourceTreeFingerprintTest, racilyModified)
+{
+    ASSERT_EQ(getSourceTreeFingerprint(root, time(nullptr) - 3600), std::nullopt);
+}
+
+} // namespace nix
@@ -28,6 +28,53 @@ makeSourcePathToHashCacheKey(std::string_view fingerprint, ContentAddressMethod
         {{"fingerprint", std::string(fingerprint)}, {"method", std::string{method.render()}}, {"path", path.abs()}}};
 }
 
+std::optional<std::string> getSourceTreeFingerprint(const SourcePath & path, time_t notAfter)
+{
+    HashSink sink(HashAlgorithm::SHA256);
+
+    std::function<bool(const SourcePath &)> walk;
+    walk = [&](const SourcePath & path) {
+        auto physicalPath = path.getPhysicalPath();
+        if (!physicalPath)
+            return false;
+
+        /* Like git's "racily clean" index entries, a file modified in
+           the same second that we stat it could be modified again
+           without changing its metadata, so it makes the tree
+           uncacheable. */
+        auto st = nix::lstat(*physicalPath);
+        if (st.st_mtime >= notAfter || st.st_ctime >= notAfter)
+            return false;
+
+        auto s = path.path.abs();
+        sink(
+            fmt("%d:%s:%o:%d:%d:%d:%d:%d\n",
+                s.size(),
+                s,
+                st.st_mode,
+                st.st_dev,
+                st.st_ino,
+                st.st_size,
+                st.st_mtime,
+                st.st_ctime));
+
+        /* Enumerate entries through the accessor rather than the
+           filesystem, so that the fingerprint covers exactly the
+           entries that the accessor exposes. */
+        if (S_ISDIR(st.st_mode))
+            for (auto & [name, type] : path.readDirectory())
+                if (!walk(path / name))
+                    return false;
+
+        return true;
+    };
+
+    if (!walk(path))
+        return std::nullopt;
+
+    return "stat:" + sink.finish().hash.to_string(HashFormat::Nix32, false);
+}
+
 StorePath fetchToStore(
     const fetchers::Settings & settings,
     Store & store,
@@ -64,6 +111,15 @@ std::pair<StorePath, Hash> fetchToStore2(
     auto [subpath, fingerprint] = filter ? std::pair<CanonPath, std::optional<std::string>>{path.path, std::nullopt}
                                          : path.accessor->getFingerprint(path.path);
 
+    /* Trees on the local filesystem without a fingerprint (such as
+       `path:` inputs and `builtins.path` on a working directory) are
+       fingerprinted by the metadata of their files, so that unchanged
+       trees don't have to be hashed again. */
+    if (!fingerprint && !filter && path.getPhysicalPath()) {
+        fingerprint = getSourceTreeFingerprint(path, time(nullptr) - 1);
+        subpath = CanonPath::root;
+    }
+
     if (fingerprint) {
         cacheKey = makeSourcePathToHashCacheKey(*fingerprint, method, subpath);
         if (auto res = settings.getCache()->lookup(*cacheKey)) {
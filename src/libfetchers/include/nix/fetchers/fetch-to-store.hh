@@ -34,6 +34,16 @@ std::pair<StorePath, Hash> fetchToStore2(
     PathFilter * filter = nullptr,
     RepairFlag repair = NoRepair);
 
+/**
+ * Compute a fingerprint of the tree at `path` from the metadata
+ * (inode, size, mode, mtime and ctime) of its files, similar to how
+ * git's index detects modified files without reading them. Return
+ * `std::nullopt` if some file isn't on the local filesystem, or was
+ * modified at or after `notAfter` so that its metadata can't be
+ * trusted.
+ */
+std::optional<std::string> getSourceTreeFingerprint(const SourcePath & path, time_t notAfter);
+
 fetchers::Cache::Key
 makeSourcePathToHashCacheKey(std::string_view fingerprint, ContentAddressMethod method, const CanonPath & path);
 
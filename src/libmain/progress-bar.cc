@@ -1,12 +1,14 @@
 #include "nix/main/progress-bar.hh"
 #include "nix/util/terminal.hh"
 #include "nix/util/sync.hh"
+#include "nix/util/progress-coalescer.hh"
 #include "nix/util/signals.hh"
 #include "nix/store/path.hh"
 #include "nix/util/file-system.hh"
 #include "nix/store/names.hh"
 #include "nix/util/util.hh"
 
+#include <atomic>
 #include <map>
 #include <thread>
 #include <sstream>
@@ -99,6 +101,21 @@ private:
 
     Sync<State> state_;
 
+    /**
+     * Progress results (`resProgress` and `resSetExpected`) are very
+     * frequent when many paths are substituted or evaluated in
+     * parallel, so they're queued here without taking `state_`, and
+     * applied by `draw()`.
+     */
+    ProgressCoalescer progressQueue;
+
+    /**
+     * Whether `progressQueue` may contain results that haven't been
+     * applied yet. Used to wake up the update thread only once per
+     * redraw rather than for every result.
+     */
+    std::atomic<bool> progressQueued{false};
+
     std::thread updateThread;
 
     std::condition_variable quitCV, updateCV;
@@ -345,6 +362,9 @@ public:
     {
         auto state(state_.lock());
 
+        /* The final progress of the activity may still be queued. */
+        applyQueuedProgress(*state);
+
         auto i = state->its.find(act);
         if (i != state->its.end()) {
 
@@ -365,6 +385,14 @@ public:
 
     void result(ActivityId act, ResultType type, const std::vector<Field> & fields) noexcept override
     {
+        if ((type == resProgress || type == resSetExpected) && progressQueue.push(act, type, fields)) {
+            if (!progressQueued.load() && !progressQueued.exchange(true)) {
+                auto state(state_.lock());
+                update(*state);
+            }
+            return;
+        }
+
         auto state(state_.lock());
 
         if (type == resFileLinked) {
@@ -411,25 +439,20 @@ public:
         }
 
         else if (type == resProgress) {
-            auto i = state->its.find(act);
-            assert(i != state->its.end());
-            ActInfo & actInfo = *i->second;
-            actInfo.done = getI(fields, 0);
-            actInfo.expected = getI(fields, 1);
-            actInfo.running = getI(fields, 2);
-            actInfo.failed = getI(fields, 3);
+            /* The queue was full, so apply the result here, after the
+               ones that were queued before it. */
+            applyQueuedProgress(*state);
+            applyProgress(
+                *state,
+                {.act = act,
+                 .type = type,
+                 .values = {getI(fields, 0), getI(fields, 1), getI(fields, 2), getI(fields, 3)}});
             update(*state);
         }
 
         else if (type == resSetExpected) {
-            auto i = state->its.find(act);
-            assert(i != state->its.end());
-            ActInfo & actInfo = *i->second;
-            auto type = (ActivityType) getI(fields, 0);
-            auto & j = actInfo.expectedByType[type];
-            state->activitiesByType[type].expected -= j;
-            j = getI(fields, 1);
-            state->activitiesByType[type].expected += j;
+            applyQueuedProgress(*state);
+            applyProgress(*state, {.act = act, .type = type, .values = {getI(fields, 0), getI(fields, 1)}});
             update(*state);
         }
 
@@ -442,6 +465,45 @@ public:
         }
     }
 
+    void applyProgress(State & state, const ProgressCoalescer::Event & event)
+    {
+        /* A result may be applied after its activity has stopped if it
+           was pushed by another thread. */
+        auto i = state.its.find(event.act);
+        if (i == state.its.end())
+            return;
+        ActInfo & actInfo = *i->second;
+
+        if (event.type == resProgress) {
+            actInfo.done = event.values[0];
+            actInfo.expected = event.values[1];
+            actInfo.running = event.values[2];
+            actInfo.failed = event.values[3];
+        }
+
+        else if (event.type == resSetExpected) {
+            auto type = (ActivityType) event.values[0];
+            auto & j = actInfo.expectedByType[type];
+            state.activitiesByType[type].expected -= j;
+            j = event.values[1];
+            state.activitiesByType[type].expected += j;
+        }
+    }
+
+    void applyQueuedProgress(State & state) noexcept
+    {
+        /* Clear the flag first, so that a result pushed while we're
+           draining the queue sets it again. */
+        if (!progressQueued.exchange(false))
+            return;
+        try {
+            progressQueue.drain([&](const ProgressCoalescer::Event & event) { applyProgress(state, event); });
+        } catch (...) {
+            /* Can't log here since we are the logger. Losing a progress
+               update is harmless. */
+        }
+    }
+
     void update(State & state) noexcept
     {
         state.haveUpdate = true;
@@ -479,6 +541,8 @@ public:
     {
         auto nextWakeup = std::chrono::milliseconds::max();
 
+        applyQueuedProgress(state);
+
         state.haveUpdate = false;
         if (state.isPaused() || !state.active)
             return nextWakeup;
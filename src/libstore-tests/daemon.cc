@@ -0,0 +1,147 @@
+#include <gtest/gtest.h>
+
+#include "nix/store/daemon.hh"
+#include "nix/store/path-info.hh"
+#include "nix/store/store-open.hh"
+#include "nix/store/worker-protocol-connection.hh"
+#include "nix/store/worker-protocol-impl.hh"
+#include "nix/util/finally.hh"
+
+#ifndef _WIN32
+
+#  include <sys/socket.h>
+#  include <thread>
+
+namespace nix {
+
+namespace {
+
+/**
+ * Client end of a socket pair whose other end is served by
+ * `processConnection()` in a separate thread.
+ */
+struct SocketPairConnection : WorkerProto::BasicClientConnection
+{
+    AutoCloseFD fd;
+
+    void closeWrite() override
+    {
+        shutdown(fd.get(), SHUT_WR);
+    }
+};
+
+} // namespace
+
+/**
+ * Send many more requests on a multiplexed connection than the daemon
+ * lets be in flight, without waiting for replies, and check that each
+ * reply matches its request.
+ */
+TEST(Daemon, multiplexedInterleavedRequests)
+{
+    auto store = openStore("dummy://?read-only=false");
+
+    std::vector<StorePath> paths;
+    for (int i = 0; i < 10; ++i) {
+        StringSource dump{fmt("contents of path %d", i)};
+        paths.push_back(store->addToStoreFromDump(dump, fmt("daemon-test-%d", i), FileSerialisationMethod::Flat));
+    }
+    auto missingPath = StorePath::random("daemon-test-missing");
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+        throw SysError("creating socket pair");
+
+    SocketPairConnection conn;
+    conn.fd = AutoCloseFD{fds[0]};
+    conn.to = FdSink(conn.fd.get());
+    conn.from = FdSource(conn.fd.get());
+
+    /* processConnection() makes the connection's logger the global
+       one. */
+    auto prevLogger = logger;
+    Finally restoreLogger([&]() { logger = prevLogger; });
+
+    AutoCloseFD serverFd{fds[1]};
+    std::thread server([&]() {
+        daemon::processConnection(
+            store, FdSource(serverFd.get()), FdSink(serverFd.get()), NotTrusted, daemon::NotRecursive);
+    });
+    Finally joinServer([&]() {
+        conn.closeWrite();
+        server.join();
+    });
+
+    conn.protoVersion = WorkerProto::BasicClientConnection::handshake(conn.to, conn.from, WorkerProto::latest);
+    conn.maybeEnableStreamCompression();
+    conn.postHandshake(*store);
+    if (auto ex = conn.processStderrReturn())
+        std::rethrow_exception(ex);
+    ASSERT_TRUE(conn.protoVersion.features.contains(WorkerProto::featureMultiplexing));
+
+    conn.to << WorkerProto::Op::Multiplex;
+    if (auto ex = conn.processStderrReturn())
+        std::rethrow_exception(ex);
+
+    /* Every 7th request can't be multiplexed, every 5th is for a path
+       that doesn't exist, and the others are for the path at
+       `id % paths.size()`. */
+    const uint64_t nrRequests = 1000;
+
+    std::thread writer([&]() {
+        try {
+            for (uint64_t id = 1; id <= nrRequests; ++id) {
+                StringSink request;
+                if (id % 7 == 0)
+                    request << WorkerProto::Op::QueryValidPaths;
+                else {
+                    request << WorkerProto::Op::QueryPathInfo;
+                    WorkerProto::write(
+                        *store,
+                        WorkerProto::WriteConn{.to = request, .version = conn.protoVersion},
+                        id % 5 == 0 ? missingPath : paths[id % paths.size()]);
+                }
+                conn.to << id << request.s;
+                conn.to.flush();
+            }
+        } catch (Error & e) {
+            ADD_FAILURE() << e.what();
+        }
+    });
+    Finally joinWriter([&]() { writer.join(); });
+
+    std::map<uint64_t, std::string> replies;
+    std::set<uint64_t> finished;
+    while (finished.size() < nrRequests) {
+        auto id = readNum<uint64_t>(conn.from);
+        auto payload = readString(conn.from);
+        EXPECT_FALSE(finished.contains(id));
+        if (payload.empty())
+            finished.insert(id);
+        else
+            replies[id] += payload;
+    }
+
+    for (uint64_t id = 1; id <= nrRequests; ++id) {
+        StringSource from{replies[id]};
+        auto msg = readNum<uint64_t>(from);
+        if (id % 7 == 0) {
+            EXPECT_EQ(msg, (uint64_t) STDERR_ERROR);
+            continue;
+        }
+        ASSERT_EQ(msg, (uint64_t) STDERR_LAST);
+        auto valid = readInt(from);
+        if (id % 5 == 0) {
+            EXPECT_EQ(valid, 0u);
+            continue;
+        }
+        ASSERT_EQ(valid, 1u);
+        auto info = WorkerProto::Serialise<UnkeyedValidPathInfo>::read(
+            *store, WorkerProto::ReadConn{.from = from, .version = conn.protoVersion});
+        EXPECT_EQ(info.narHash, store->queryPathInfo(paths[id % paths.size()])->narHash);
+    }
+}
+
+} // namespace nix
+
+#endif
@@ -1,6 +1,11 @@
 #include <benchmark/benchmark.h>
 #include "nix/store/derivations.hh"
+#include "nix/store/drv-hash-cache.hh"
+#include "nix/store/dummy-store-impl.hh"
+#include "nix/store/globals.hh"
+#include "nix/store/sqlite.hh"
 #include "nix/store/store-api.hh"
+#include "nix/util/file-system.hh"
 #include "nix/util/tests/test-data.hh"
 #include "nix/store/store-open.hh"
 #include <fstream>
@@ -48,6 +53,113 @@ static void BM_UnparseRealDerivationFile(benchmark::State & state, const std::st
     state.SetBytesProcessed(state.iterations() * content.size());
 }
 
+/**
+ * A derivation with many inputs and environment variables, as is
+ * typical for derivations of large packages and of build environments.
+ */
+static Derivation makeLargeDerivation(Store & store)
+{
+    Derivation drv;
+    drv.name = "large";
+    drv.platform = "x86_64-linux";
+    drv.builder = "/nix/store/00000000000000000000000000000000-bash/bin/bash";
+    drv.args = {"-e", "/nix/store/00000000000000000000000000000000-builder.sh"};
+    StorePath outPath{"00000000000000000000000000000000-large"};
+    drv.outputs.insert_or_assign("out", DerivationOutput::InputAddressed{.path = outPath});
+    for (int i = 0; i < 500; ++i) {
+        drv.inputDrvs.map.insert_or_assign(
+            StorePath{fmt("%032d-input-%d.drv", i, i)}, DerivedPathMap<StringSet>::ChildNode{.value = {"out", "dev"}});
+        drv.inputSrcs.insert(StorePath{fmt("%032d-source-%d", i, i)});
+    }
+    for (int i = 0; i < 200; ++i)
+        drv.env.insert_or_assign(fmt("VAR_%d", i), fmt("value with \"quotes\" and\nnewlines %d", i));
+    drv.env.insert_or_assign("out", store.printStorePath(outPath));
+    return drv;
+}
+
+static void BM_ParseLargeDerivation(benchmark::State & state)
+{
+    auto store = openStore("dummy://");
+    ExperimentalFeatureSettings xpSettings;
+    auto content = makeLargeDerivation(*store).unparse(*store, /*maskOutputs=*/false);
+
+    for (auto _ : state) {
+        auto drv = parseDerivation(*store, std::string(content), "large", xpSettings);
+        benchmark::DoNotOptimize(drv);
+    }
+    state.SetBytesProcessed(state.iterations() * content.size());
+}
+
+static void BM_UnparseLargeDerivation(benchmark::State & state)
+{
+    auto store = openStore("dummy://");
+    auto drv = makeLargeDerivation(*store);
+    size_t size = 0;
+
+    for (auto _ : state) {
+        auto unparsed = drv.unparse(*store, /*maskOutputs=*/false);
+        size = unparsed.size();
+        benchmark::DoNotOptimize(unparsed);
+    }
+    state.SetBytesProcessed(state.iterations() * size);
+}
+
+BENCHMARK(BM_ParseLargeDerivation);
+BENCHMARK(BM_UnparseLargeDerivation);
+
+/**
+ * Hash a derivation with a closure of 2000 input derivations, as a new
+ * process does (i.e. with an empty `drvHashes`). Arg 0 reads and
+ * parses every input derivation; arg 1 gets their hashes from the
+ * persistent cache.
+ */
+static void BM_HashDerivationModuloClosure(benchmark::State & state)
+{
+    const bool useDiskCache = state.range(0);
+
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+
+    auto config = make_ref<DummyStoreConfig>(DummyStoreConfig::Params{});
+    config->readOnly = false;
+    auto store = config->openDummyStore();
+
+    DrvHashCache::set(
+        useDiskCache ? DrvHashCache::getTest({.useWAL = settings.useSQLiteWAL}, tmpDir / "drv-hashes.sqlite")
+                     : nullptr);
+
+    /* Each derivation depends on a few of the previous ones, so the
+       top-level derivation depends on all of them. */
+    std::vector<StorePath> drvPaths;
+    auto makeDrv = [&](std::string name) {
+        Derivation drv;
+        drv.name = std::move(name);
+        drv.platform = "x86_64-linux";
+        drv.builder = "/bin/sh";
+        drv.args = {"-c", "echo hello > $out"};
+        drv.env = {{"out", ""}, {"name", drv.name}};
+        drv.outputs.insert_or_assign("out", DerivationOutput::Deferred{});
+        for (size_t i = 1; i <= 4 && i <= drvPaths.size(); i *= 2)
+            drv.inputDrvs.map.insert_or_assign(
+                drvPaths[drvPaths.size() - i], DerivedPathMap<StringSet>::ChildNode{.value = {"out"}});
+        drv.fillInOutputPaths(*store);
+        return drv;
+    };
+    for (size_t i = 0; i < 2000; ++i)
+        drvPaths.push_back(store->writeDerivation(makeDrv(fmt("drv-%d", i))));
+    auto top = makeDrv("top");
+
+    for (auto _ : state) {
+        drvHashes.clear();
+        auto h = hashDerivationModulo(*store, top, false);
+        benchmark::DoNotOptimize(h);
+    }
+
+    DrvHashCache::set(nullptr);
+}
+
+BENCHMARK(BM_HashDerivationModuloClosure)->Arg(false)->Arg(true)->Unit(benchmark::kMillisecond);
+
 // Register benchmarks for actual test derivation files if they exist
 BENCHMARK_CAPTURE(BM_ParseRealDerivationFile, hello, (getUnitTestData() / "derivation/hello.drv").string());
 BENCHMARK_CAPTURE(BM_ParseRealDerivationFile, firefox, (getUnitTestData() / "derivation/firefox.drv").string());
@@ -0,0 +1,85 @@
+#include "nix/store/drv-hash-cache.hh"
+#include "nix/store/globals.hh"
+#include "nix/store/sqlite.hh"
+#include "nix/util/file-system.hh"
+
+#include <gtest/gtest.h>
+
+namespace nix {
+
+TEST(DrvHashCache, roundTrip)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    auto dbPath(tmpDir / "test-drv-hashes.sqlite");
+
+    std::string storeDir = "/nix/store";
+    StoreDirConfig store{storeDir};
+
+    StorePath regularPath{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-regular.drv"};
+    StorePath fixedPath{"g1w7hyyyy1w7hy3qg1w7hy3qg1w7hy3q-fixed.drv"};
+    StorePath deferredPath{"g1w7hy3qg1w7hy3qg1w7hyyyy1w7hy3q-deferred.drv"};
+
+    DrvHashModulo regular{hashString(HashAlgorithm::SHA256, "regular")};
+    DrvHashModulo fixed{DrvHashModulo::CaOutputHashes{
+        {"out", hashString(HashAlgorithm::SHA256, "out")},
+        {"dev", hashString(HashAlgorithm::SHA256, "dev")},
+    }};
+    DrvHashModulo deferred{DrvHashModulo::DeferredDrv{}};
+
+    {
+        auto cache = DrvHashCache::getTest({.useWAL = settings.useSQLiteWAL}, dbPath);
+
+        ASSERT_EQ(cache->lookup(store, regularPath), std::nullopt);
+
+        cache->upsert(store, regularPath, regular);
+        cache->upsert(store, fixedPath, fixed);
+        cache->upsert(store, deferredPath, deferred);
+
+        // Pending entries are visible before they're written.
+        ASSERT_EQ(cache->lookup(store, regularPath), regular);
+    }
+
+    // A new instance, like another process, sees the entries written
+    // by the previous one.
+    {
+        auto cache = DrvHashCache::getTest({.useWAL = settings.useSQLiteWAL}, dbPath);
+
+        ASSERT_EQ(cache->lookup(store, regularPath), regular);
+        ASSERT_EQ(cache->lookup(store, fixedPath), fixed);
+        ASSERT_EQ(cache->lookup(store, deferredPath), deferred);
+
+        // The key includes the store directory.
+        std::string otherStoreDir = "/other/store";
+        StoreDirConfig otherStore{otherStoreDir};
+        ASSERT_EQ(cache->lookup(otherStore, regularPath), std::nullopt);
+    }
+}
+
+TEST(DrvHashCache, flush)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    auto dbPath(tmpDir / "test-drv-hashes.sqlite");
+
+    std::string storeDir = "/nix/store";
+    StoreDirConfig store{storeDir};
+
+    StorePath drvPath{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-regular.drv"};
+    DrvHashModulo hash{hashString(HashAlgorithm::SHA256, "regular")};
+
+    auto cache = DrvHashCache::getTest({.useWAL = settings.useSQLiteWAL}, dbPath);
+    cache->upsert(store, drvPath, hash);
+
+    // Entries are written without destroying the cache, as needed
+    // before exec().
+    cache->flush();
+
+    auto other = DrvHashCache::getTest({.useWAL = settings.useSQLiteWAL}, dbPath);
+    ASSERT_EQ(other->lookup(store, drvPath), hash);
+
+    // Flushed entries are still visible to the original instance.
+    ASSERT_EQ(cache->lookup(store, drvPath), hash);
+}
+
+} // namespace nix
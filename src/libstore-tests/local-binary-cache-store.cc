@@ -1,6 +1,9 @@
 #include <gtest/gtest.h>
 
 #include "nix/store/local-binary-cache-store.hh"
+#include "nix/store/store-open.hh"
+#include "nix/util/archive.hh"
+#include "nix/util/file-system.hh"
 
 namespace nix {
 
@@ -22,4 +25,46 @@ TEST(LocalBinaryCacheStore, constructConfig)
     EXPECT_EQ(config.binaryCacheDir, "/foo/bar/baz");
 }
 
+TEST(LocalBinaryCacheStore, copyPathsThroughUploadPipeline)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+
+    auto srcStore = openStore("dummy://?read-only=false");
+
+    /* A chain of paths, each referencing the previous one. With an
+       upload concurrency of 1, on a machine with few cores, this
+       exercises the bound on pending compressed NARs, and the .narinfo
+       files have to be written in order. */
+    StorePathSet paths;
+    std::optional<StorePath> prev;
+    for (int i = 0; i < 8; ++i) {
+        StringSink nar;
+        dumpString(fmt("contents of path %d, referencing %s", i, prev ? prev->to_string() : "nothing"), nar);
+        StringSource source(nar.s);
+        StorePathSet references;
+        if (prev)
+            references.insert(*prev);
+        prev = srcStore->addToStoreFromDump(
+            source,
+            fmt("upload-pipeline-%d", i),
+            FileSerialisationMethod::NixArchive,
+            ContentAddressMethod::Raw::NixArchive,
+            HashAlgorithm::SHA256,
+            references);
+        paths.insert(*prev);
+    }
+
+    auto cacheUri = fmt("file://%s?compression=none&upload-concurrency=1", tmpDir.string());
+    copyPaths(*srcStore, *openStore(cacheUri), paths, NoRepair, NoCheckSigs);
+
+    /* Use a fresh store object so that nothing is served from its
+       in-memory path info cache. */
+    auto dstStore = openStore(cacheUri);
+    for (auto & path : paths) {
+        ASSERT_TRUE(dstStore->isValidPath(path));
+        EXPECT_EQ(dstStore->queryPathInfo(path)->references, srcStore->queryPathInfo(path)->references);
+    }
+}
+
 } // namespace nix
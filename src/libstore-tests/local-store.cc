@@ -1,6 +1,11 @@
 #include <gtest/gtest.h>
 
+#include "nix/store/globals.hh"
 #include "nix/store/local-store.hh"
+#include "nix/store/store-open.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/finally.hh"
+#include "nix/util/serialise.hh"
 
 // Needed for template specialisations. This is not good! When we
 // overhaul how store configs work, this should be fixed.
@@ -72,4 +77,100 @@ TEST(LocalStore, constructConfig_to_string)
     EXPECT_EQ(config.getReference().to_string(), "local");
 }
 
+#ifndef _WIN32
+
+class LocalStoreScrubTest : public ::testing::Test
+{
+protected:
+    std::filesystem::path tmpRoot = createTempDir();
+    AutoDelete delTmpRoot{tmpRoot};
+    std::shared_ptr<LocalStore> store;
+    std::filesystem::path cursorPath;
+
+    void SetUp() override
+    {
+        createDirs(tmpRoot / "nix/store");
+        store = std::dynamic_pointer_cast<LocalStore>(openStore(fmt("local?root=%s", tmpRoot.string())));
+        ASSERT_TRUE(store);
+        cursorPath = store->config->stateDir.get() / "scrub-cursor";
+    }
+
+    StorePath addPath(std::string_view name, std::string contents)
+    {
+        StringSource dump{contents};
+        return store->addToStoreFromDump(dump, name, FileSerialisationMethod::Flat);
+    }
+
+    void corrupt(const StorePath & path)
+    {
+        auto realPath = store->toRealPath(path);
+        std::filesystem::permissions(realPath, std::filesystem::perms::owner_write, std::filesystem::perm_options::add);
+        writeFile(realPath, "corrupted");
+    }
+};
+
+TEST_F(LocalStoreScrubTest, resumeAndWrapAround)
+{
+    std::vector<StorePath> paths{addPath("a", "a"), addPath("b", "b"), addPath("c", "c")};
+    std::sort(paths.begin(), paths.end());
+    corrupt(paths[1]);
+
+    StorePathSet all(paths.begin(), paths.end());
+    LocalStore::ScrubOptions options{.resume = true, .maxPaths = 1};
+
+    /* Each interrupted scrub records how far it got... */
+    ASSERT_FALSE(store->scrubStore(all, NoRepair, options));
+    ASSERT_EQ(readFile(cursorPath), paths[0].to_string());
+
+    /* ...and the next one continues after that. */
+    ASSERT_TRUE(store->scrubStore(all, NoRepair, options));
+    ASSERT_EQ(readFile(cursorPath), paths[1].to_string());
+
+    /* Once everything has been checked, the cursor is removed. */
+    ASSERT_FALSE(store->scrubStore(all, NoRepair, {.resume = true}));
+    ASSERT_FALSE(pathExists(cursorPath));
+
+    /* So the next scrub starts from the beginning again. */
+    ASSERT_FALSE(store->scrubStore(all, NoRepair, options));
+    ASSERT_EQ(readFile(cursorPath), paths[0].to_string());
+}
+
+TEST_F(LocalStoreScrubTest, fullPassIgnoresCursor)
+{
+    std::vector<StorePath> paths{addPath("a", "a"), addPath("b", "b")};
+    std::sort(paths.begin(), paths.end());
+    corrupt(paths[0]);
+
+    /* A cursor past the corrupted path doesn't stop a full scrub
+       from checking it, and isn't touched by it. */
+    createDirs(cursorPath.parent_path());
+    writeFile(cursorPath, paths[0].to_string());
+
+    ASSERT_TRUE(store->scrubStore({paths.begin(), paths.end()}, NoRepair, {}));
+    ASSERT_EQ(readFile(cursorPath), paths[0].to_string());
+
+    ASSERT_TRUE(store->verifyStore(true, NoRepair));
+    ASSERT_EQ(readFile(cursorPath), paths[0].to_string());
+}
+
+TEST_F(LocalStoreScrubTest, throttle)
+{
+    auto path = addPath("big", std::string(1024 * 1024, 'x'));
+
+    auto & scrubBandwidth = settings.getLocalSettings().scrubBandwidth;
+    auto oldBandwidth = scrubBandwidth.get();
+    Finally restoreBandwidth([&]() { scrubBandwidth = oldBandwidth; });
+    scrubBandwidth = 1024 * 1024;
+
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_FALSE(store->scrubStore({path}, NoRepair, {}));
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    /* Reading 1 MiB at 1 MiB/s takes about a second, minus the last
+       chunk, which isn't waited for. */
+    ASSERT_GE(elapsed, std::chrono::milliseconds(500));
+}
+
+#endif
+
 } // namespace nix
@@ -0,0 +1,71 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/util/archive.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/serialise.hh"
+#include "nix/util/source-accessor.hh"
+
+#include <thread>
+
+#include <sys/socket.h>
+
+namespace nix {
+
+/**
+ * Serialise a tree of large files, as the daemon does for
+ * `NarFromPath`, to a socket drained by another thread. Arg 0 copies
+ * the file contents through a buffer; arg 1 writes to the `FdSink`
+ * directly, which lets it use `sendfile()`.
+ *
+ * The CPU time of the benchmark thread divided by the bytes processed
+ * gives the CPU cost per GB of each path.
+ */
+static void BM_NarFromPath(benchmark::State & state)
+{
+    const bool zeroCopy = state.range(0);
+
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+
+    std::string contents(16 * 1024 * 1024, 'x');
+    for (size_t i = 0; i < contents.size(); i += 4096)
+        contents[i] = (char) i;
+    for (int i = 0; i < 8; ++i)
+        writeFile(tmpDir / fmt("file-%d", i), contents);
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+        throw SysError("creating socket pair");
+    AutoCloseFD writeEnd(fds[0]), readEnd(fds[1]);
+
+    std::thread drainer([&]() {
+        std::array<char, 256 * 1024> buf;
+        while (read(readEnd.get(), buf.data(), buf.size()) > 0)
+            ;
+    });
+
+    auto accessor = makeFSSourceAccessor(tmpDir);
+
+    size_t bytes = 0;
+
+    for (auto _ : state) {
+        FdSink to(writeEnd.get());
+        if (zeroCopy)
+            accessor->dumpPath(CanonPath::root, to);
+        else {
+            LambdaSink copying([&](std::string_view data) { to(data); });
+            accessor->dumpPath(CanonPath::root, copying);
+        }
+        to.flush();
+        bytes += to.written;
+    }
+
+    state.SetBytesProcessed(bytes);
+
+    shutdown(writeEnd.get(), SHUT_WR);
+    drainer.join();
+}
+
+BENCHMARK(BM_NarFromPath)->Arg(false)->Arg(true)->Unit(benchmark::kMillisecond);
+
+} // namespace nix
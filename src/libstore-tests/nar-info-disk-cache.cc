@@ -4,6 +4,7 @@
 #include <rapidcheck/gtest.h>
 #include "nix/store/globals.hh"
 #include "nix/store/sqlite.hh"
+#include "nix/store/store-api.hh"
 #include <sqlite3.h>
 
 namespace nix {
@@ -126,4 +127,81 @@ TEST(NarInfoDiskCacheImpl, create_and_read)
     }
 }
 
+TEST(NarInfoDiskCacheImpl, substituterStats)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    auto dbPath(tmpDir / "test-narinfo-disk-cache.sqlite");
+
+    // Latency samples are written in batches, so look at them through
+    // a new instance, like another process.
+    auto openCache = [&]() {
+        return NarInfoDiskCache::getTest(
+            settings.getNarInfoDiskCacheSettings(), {.useWAL = settings.useSQLiteWAL}, dbPath);
+    };
+
+    auto cache = openCache();
+
+    ASSERT_FALSE(cache->lookupSubstituterStats("http://foo"));
+
+    cache->createCache("http://foo", "/nix/storedir", {});
+
+    ASSERT_FALSE(cache->lookupSubstituterStats("http://foo"));
+
+    cache->recordNarInfoLatency("http://foo", 100);
+
+    // Not written yet.
+    ASSERT_FALSE(cache->lookupSubstituterStats("http://foo"));
+
+    cache = openCache();
+
+    {
+        auto stats = cache->lookupSubstituterStats("http://foo");
+        ASSERT_TRUE(stats);
+        ASSERT_EQ(stats->narInfoLatencyMs, 100);
+        ASSERT_FALSE(stats->downloadThroughput);
+    }
+
+    // Later samples are averaged with the earlier ones.
+    cache->recordNarInfoLatency("http://foo", 600);
+    cache->recordDownloadThroughput("http://foo", 1000000);
+
+    cache = openCache();
+
+    {
+        auto stats = cache->lookupSubstituterStats("http://foo");
+        ASSERT_TRUE(stats);
+        ASSERT_EQ(stats->narInfoLatencyMs, 200);
+        ASSERT_EQ(stats->downloadThroughput, 1000000);
+    }
+}
+
+TEST(NarInfoDiskCacheImpl, substituterStatsBatched)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    auto dbPath(tmpDir / "test-narinfo-disk-cache.sqlite");
+
+    {
+        auto cache = NarInfoDiskCache::getTest(
+            settings.getNarInfoDiskCacheSettings(), {.useWAL = settings.useSQLiteWAL}, dbPath);
+
+        cache->createCache("http://foo", "/nix/storedir", {});
+
+        // More samples than are written in one batch.
+        for (int i = 0; i < 100; ++i)
+            cache->recordNarInfoLatency("http://foo", 100);
+        cache->recordNarInfoLatency("http://foo", 600);
+    }
+
+    // The samples that were still pending are written when the cache
+    // is closed, so another instance sees all of them.
+    auto cache =
+        NarInfoDiskCache::getTest(settings.getNarInfoDiskCacheSettings(), {.useWAL = settings.useSQLiteWAL}, dbPath);
+
+    auto stats = cache->lookupSubstituterStats("http://foo");
+    ASSERT_TRUE(stats);
+    ASSERT_EQ(stats->narInfoLatencyMs, 200);
+}
+
 } // namespace nix
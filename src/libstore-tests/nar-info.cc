@@ -181,4 +181,30 @@ JSON_TEST_V3(impure, true)
 #undef JSON_READ_TEST_V3
 #undef JSON_WRITE_TEST_V3
 
+class NarInfoTextTest : public LibStoreTest
+{};
+
+TEST_F(NarInfoTextTest, deltaRoundtrips)
+{
+    auto info = makeNarInfo(*store, true);
+    info.delta = NarDelta{
+        .url = "delta/1w1fff338fvdw53sqgamddn1b2xgds473pv6y13gizdbqjv4i5p3.nar.zst",
+        .base = StorePath{"g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo-0.9"},
+        .baseNarHash = Hash::parseSRI("sha256-FePFYIlMuycIXPZbWi7LGEiMmZSX9FMbaQenWBzm1Sc="),
+        .fileSize = 1234,
+    };
+
+    NarInfo parsed(*store, info.to_string(*store), "test");
+    ASSERT_EQ(parsed.delta, info.delta);
+}
+
+TEST_F(NarInfoTextTest, incompleteDeltaIsIgnored)
+{
+    auto info = makeNarInfo(*store, true);
+    auto s = info.to_string(*store) + "DeltaURL: delta/foo.nar.zst\n";
+
+    NarInfo parsed(*store, s, "test");
+    ASSERT_EQ(parsed.delta, std::nullopt);
+}
+
 } // namespace nix
@@ -1,6 +1,8 @@
 #include "nix/store/references.hh"
 #include "nix/store/path-references.hh"
 #include "nix/util/memory-source-accessor.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/file-content-address.hh"
 
 #include <gtest/gtest.h>
 
@@ -319,4 +321,40 @@ TEST(references, scanForReferencesDeep)
     }
 }
 
+TEST(references, scanAndHashPath)
+{
+    StorePath path1{"dc04vv14dak1c1r48qa0m23vr9jy8sm0-foo"};
+    StorePath path2{"zc842j0rz61mjsp3h3wp5ly71ak6qgdn-bar"};
+
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    auto root = tmpDir / "out";
+
+    std::filesystem::create_directories(root / "subdir");
+    writeFile(root / "file1.txt", "This file references " + path1.hashPart() + " in its content");
+    writeFile(root / "subdir" / "script", "#! /bin/sh\n");
+    std::filesystem::permissions(
+        root / "subdir" / "script", std::filesystem::perms::owner_exec, std::filesystem::perm_options::add);
+    std::filesystem::create_symlink("file1.txt", root / "link1");
+
+    auto fileHash = [](const std::filesystem::path & path) {
+        return hashPath(makeFSSourceAccessor(path), FileSerialisationMethod::NixArchive, HashAlgorithm::SHA256).hash;
+    };
+
+    auto scan = scanAndHashPath(root, {path1, path2}, true);
+
+    EXPECT_EQ(scan.references, StorePathSet{path1});
+    auto narHash = hashPath(makeFSSourceAccessor(root), FileSerialisationMethod::NixArchive, HashAlgorithm::SHA256);
+    EXPECT_EQ(scan.narHash.hash, narHash.hash);
+    EXPECT_EQ(scan.narHash.numBytesDigested, narHash.numBytesDigested);
+
+    /* The file hashes must be the ones the store optimiser computes. */
+    EXPECT_EQ(scan.fileHashes.size(), 3);
+    EXPECT_EQ(scan.fileHashes.at(CanonPath("/file1.txt")), fileHash(root / "file1.txt"));
+    EXPECT_EQ(scan.fileHashes.at(CanonPath("/subdir/script")), fileHash(root / "subdir" / "script"));
+    EXPECT_EQ(scan.fileHashes.at(CanonPath("/link1")), fileHash(root / "link1"));
+
+    EXPECT_TRUE(scanAndHashPath(root, {path1, path2}, false).fileHashes.empty());
+}
+
 } // namespace nix
@@ -0,0 +1,90 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/util/archive.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/memory-source-accessor.hh"
+
+#ifdef __linux__
+#  include "nix/util/io-uring-restore-sink.hh"
+#endif
+
+namespace nix {
+
+/**
+ * A NAR resembling a Python site-packages tree: `nrDirs` directories of
+ * `filesPerDir` small files each.
+ */
+static std::string makeManySmallFilesNar(size_t nrDirs, size_t filesPerDir)
+{
+    using File = MemorySourceAccessor::File;
+
+    File::Directory root;
+    for (size_t d = 0; d < nrDirs; ++d) {
+        File::Directory dir;
+        for (size_t f = 0; f < filesPerDir; ++f) {
+            std::string contents;
+            while (contents.size() < 512 + (f * 97) % 4096)
+                contents += fmt("# module %d of package %d\n", f, d);
+            dir.entries.emplace(fmt("module-%d.py", f), File::Regular{.contents = std::move(contents)});
+        }
+        dir.entries.emplace("run", File::Regular{.executable = true, .contents = "#! /bin/sh\n"});
+        dir.entries.emplace("link", File::Symlink{.target = "module-0.py"});
+        root.entries.emplace(fmt("package-%d", d), std::move(dir));
+    }
+
+    auto accessor = make_ref<MemorySourceAccessor>();
+    accessor->root = std::move(root);
+
+    StringSink nar;
+    accessor->dumpPath(CanonPath::root, nar);
+    return std::move(nar.s);
+}
+
+/**
+ * Unpack a NAR of many small files with either `RestoreSink` (arg 0)
+ * or `IoUringRestoreSink` (arg 1).
+ */
+static void BM_RestoreManySmallFiles(benchmark::State & state)
+{
+    const bool useIoUring = state.range(0);
+
+    auto nar = makeManySmallFilesNar(200, 50);
+
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+
+    size_t n = 0;
+    for (auto _ : state) {
+        auto dst = tmpDir / std::to_string(n++);
+
+        StringSource source(nar);
+        if (useIoUring) {
+#ifdef __linux__
+            auto sink = linux::makeIoUringRestoreSink(dst, false);
+            if (!sink) {
+                state.SkipWithError("io_uring is not available");
+                break;
+            }
+            parseDump(*sink, source);
+            sink->finish();
+#else
+            state.SkipWithError("io_uring is only available on Linux");
+            break;
+#endif
+        } else {
+            RestoreSink sink{false};
+            sink.dstPath = dst;
+            parseDump(sink, source);
+        }
+
+        state.PauseTiming();
+        deletePath(dst);
+        state.ResumeTiming();
+    }
+
+    state.SetBytesProcessed(state.iterations() * nar.size());
+}
+
+BENCHMARK(BM_RestoreManySmallFiles)->Arg(false)->Arg(true)->Unit(benchmark::kMillisecond);
+
+} // namespace nix
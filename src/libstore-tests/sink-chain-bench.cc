@@ -0,0 +1,68 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/util/compression.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/hash.hh"
+#include "nix/util/serialise.hh"
+
+#include <fcntl.h>
+
+namespace nix {
+
+/**
+ * Read a file through the sinks that `BinaryCacheStore` uses to upload
+ * a NAR: the uncompressed data is hashed and compressed, and the
+ * compressed data is hashed and written to a file. Arg 0 hides the
+ * reference-counted chunks from the sinks, so each sink copies the
+ * data into its own buffer; arg 1 lets the sinks use them in place.
+ *
+ * `bytes_per_cycle` is the number of input bytes processed per CPU
+ * cycle of the benchmark thread.
+ */
+static void BM_SinkChain(benchmark::State & state)
+{
+    const bool chunks = state.range(0);
+
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+
+    std::string contents(64 * 1024 * 1024, 'x');
+    for (size_t i = 0; i < contents.size(); i += 97)
+        contents[i] = (char) (i / 97);
+    writeFile(tmpDir / "input", contents);
+
+    auto fd = openFileReadonly(tmpDir / "input");
+    AutoCloseFD devNull = toDescriptor(open("/dev/null", O_WRONLY));
+
+    size_t bytes = 0;
+
+    for (auto _ : state) {
+        HashSink narHashSink{HashAlgorithm::SHA256};
+        HashSink fileHashSink{HashAlgorithm::SHA256};
+        FdSink fileSink(devNull.get());
+        TeeSink teeSinkCompressed{fileSink, fileHashSink};
+        auto compressionSink = makeCompressionSink(CompressionAlgo::zstd, teeSinkCompressed, false, 1);
+        TeeSink teeSinkUncompressed{*compressionSink, narHashSink};
+
+        if (chunks)
+            copyFdRange(fd.get(), 0, contents.size(), teeSinkUncompressed);
+        else {
+            LambdaSink copying([&](std::string_view data) { teeSinkUncompressed(data); });
+            copyFdRange(fd.get(), 0, contents.size(), copying);
+        }
+
+        compressionSink->finish();
+        fileSink.flush();
+        benchmark::DoNotOptimize(narHashSink.finish());
+        benchmark::DoNotOptimize(fileHashSink.finish());
+        bytes += contents.size();
+    }
+
+    state.SetBytesProcessed(bytes);
+    state.counters["bytes_per_cycle"] =
+        benchmark::Counter(bytes / benchmark::CPUInfo::Get().cycles_per_second, benchmark::Counter::kIsRate);
+}
+
+BENCHMARK(BM_SinkChain)->Arg(false)->Arg(true)->Unit(benchmark::kMillisecond);
+
+} // namespace nix
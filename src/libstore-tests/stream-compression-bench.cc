@@ -0,0 +1,109 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/store/daemon.hh"
+#include "nix/store/dummy-store.hh"
+#include "nix/store/path-info.hh"
+#include "nix/store/store-open.hh"
+#include "nix/store/worker-protocol-connection.hh"
+#include "nix/util/archive.hh"
+
+#ifndef _WIN32
+
+#  include <sys/socket.h>
+#  include <thread>
+
+namespace nix {
+
+/**
+ * Client end of a socket pair, standing in for the SSH connection of an
+ * `ssh-ng://` store. The other end is served by `processConnection()`
+ * in a separate thread, like `nix-daemon --stdio` would.
+ */
+struct SocketPairConnection : WorkerProto::BasicClientConnection
+{
+    AutoCloseFD fd;
+
+    void closeWrite() override
+    {
+        shutdown(fd.get(), SHUT_WR);
+    }
+};
+
+/**
+ * Copy a closure of `nrPaths` compressible store objects from a daemon
+ * to another store, with or without zstd stream compression.
+ */
+static void BM_CopyClosureOverWorkerProtocol(benchmark::State & state)
+{
+    const bool compress = state.range(0);
+    const int nrPaths = 64;
+    const size_t pathSize = 1024 * 1024;
+
+    auto srcStore = openStore("dummy://?read-only=false");
+
+    StorePathSet paths;
+    for (int i = 0; i < nrPaths; ++i) {
+        std::string contents;
+        contents.reserve(pathSize);
+        while (contents.size() < pathSize)
+            contents += fmt("line %d of store object %d: some moderately compressible text\n", contents.size(), i);
+        StringSink nar;
+        dumpString(contents, nar);
+        StringSource source(nar.s);
+        paths.insert(srcStore->addToStoreFromDump(source, fmt("stream-compression-bench-%d", i)));
+    }
+
+    auto localVersion = WorkerProto::latest;
+    if (!compress)
+        localVersion.features.erase(std::string(WorkerProto::featureZstdStreamCompression));
+
+    size_t bytesOnWire = 0;
+
+    for (auto _ : state) {
+        auto dstStore = openStore("dummy://?read-only=false");
+
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+            throw SysError("creating socket pair");
+
+        AutoCloseFD serverFd{fds[1]};
+        std::thread server([&]() {
+            daemon::processConnection(
+                srcStore, FdSource(serverFd.get()), FdSink(serverFd.get()), Trusted, daemon::Recursive);
+        });
+
+        {
+            SocketPairConnection conn;
+            conn.fd = AutoCloseFD{fds[0]};
+            conn.to = FdSink(conn.fd.get());
+            conn.from = FdSource(conn.fd.get());
+
+            conn.protoVersion = WorkerProto::BasicClientConnection::handshake(conn.to, conn.from, localVersion);
+            conn.maybeEnableStreamCompression();
+            conn.postHandshake(*srcStore);
+            if (auto ex = conn.processStderrReturn())
+                std::rethrow_exception(ex);
+
+            bool daemonException = false;
+            for (auto & path : paths) {
+                auto info = conn.queryPathInfo(*srcStore, &daemonException, path);
+                conn.narFromPath(*srcStore, &daemonException, path, [&](Source & source) {
+                    dstStore->addToStore(ValidPathInfo{path, *info}, source, NoRepair, NoCheckSigs);
+                });
+            }
+
+            conn.closeWrite();
+            server.join();
+            bytesOnWire += conn.from.read;
+        }
+    }
+
+    state.SetBytesProcessed(state.iterations() * nrPaths * pathSize);
+    state.counters["wire_bytes_per_iter"] = benchmark::Counter(bytesOnWire / state.iterations());
+}
+
+BENCHMARK(BM_CopyClosureOverWorkerProtocol)->Arg(false)->Arg(true)->Unit(benchmark::kMillisecond);
+
+} // namespace nix
+
+#endif
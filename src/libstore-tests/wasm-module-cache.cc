@@ -0,0 +1,89 @@
+#include <gtest/gtest.h>
+
+#include "nix/store/wasm-module-cache.hh"
+#include "nix/util/environment-variables.hh"
+#include "nix/util/file-system.hh"
+
+namespace nix {
+
+static std::span<const uint8_t> string2span(std::string_view s)
+{
+    return std::span<const uint8_t>((const uint8_t *) s.data(), s.size());
+}
+
+class WasmModuleCacheTest : public ::testing::Test
+{
+protected:
+    std::filesystem::path cacheDir = createTempDir();
+    AutoDelete delCacheDir{cacheDir};
+
+    void SetUp() override
+    {
+        setEnv("NIX_CACHE_HOME", cacheDir.string().c_str());
+    }
+
+    void TearDown() override
+    {
+        unsetenv("NIX_CACHE_HOME");
+    }
+
+    /**
+     * The files in the cache.
+     */
+    std::vector<std::filesystem::path> entries()
+    {
+        std::vector<std::filesystem::path> res;
+        for (auto & entry : std::filesystem::recursive_directory_iterator(cacheDir))
+            if (entry.is_regular_file())
+                res.push_back(entry.path());
+        return res;
+    }
+};
+
+TEST_F(WasmModuleCacheTest, roundTrip)
+{
+    std::string wasm = "module", compiled = "compiled module";
+
+    ASSERT_EQ(lookupCompiledWasmModule("engine", string2span(wasm)), std::nullopt);
+
+    storeCompiledWasmModule("engine", string2span(wasm), string2span(compiled));
+
+    ASSERT_EQ(lookupCompiledWasmModule("engine", string2span(wasm)), compiled);
+
+    // Entries are specific to the engine and to the module.
+    ASSERT_EQ(lookupCompiledWasmModule("other engine", string2span(wasm)), std::nullopt);
+    ASSERT_EQ(lookupCompiledWasmModule("engine", string2span("other module")), std::nullopt);
+
+    // A new entry replaces the old one.
+    std::string recompiled = "recompiled module";
+    storeCompiledWasmModule("engine", string2span(wasm), string2span(recompiled));
+    ASSERT_EQ(lookupCompiledWasmModule("engine", string2span(wasm)), recompiled);
+    ASSERT_EQ(entries().size(), 1u);
+}
+
+TEST_F(WasmModuleCacheTest, corruptedEntry)
+{
+    std::string wasm = "module", compiled = "compiled module";
+
+    storeCompiledWasmModule("engine", string2span(wasm), string2span(compiled));
+
+    auto files = entries();
+    ASSERT_EQ(files.size(), 1u);
+
+    // Damage the compiled module.
+    auto contents = readFile(files[0]);
+    contents.back() ^= 1;
+    writeFile(files[0], contents);
+
+    // Corrupted entries are a miss and are removed.
+    ASSERT_EQ(lookupCompiledWasmModule("engine", string2span(wasm)), std::nullopt);
+    ASSERT_FALSE(pathExists(files[0]));
+
+    // So are truncated ones.
+    storeCompiledWasmModule("engine", string2span(wasm), string2span(compiled));
+    writeFile(files[0], "short");
+    ASSERT_EQ(lookupCompiledWasmModule("engine", string2span(wasm)), std::nullopt);
+    ASSERT_FALSE(pathExists(files[0]));
+}
+
+} // namespace nix
@@ -1,3 +1,4 @@
+#include <ranges>
 #include <thread>
 
 #include <nlohmann/json.hpp>
@@ -976,6 +977,87 @@ TEST_F(WorkerProtoTest, handshake_features)
         }));
 }
 
+TEST_F(WorkerProtoTest, multiplexed_out_of_order_replies)
+{
+    Pipe toClient, toServer;
+    toClient.create();
+    toServer.create();
+
+    struct TestConnection : WorkerProto::BasicClientConnection
+    {
+        AutoCloseFD & writeSide;
+
+        TestConnection(AutoCloseFD & writeSide)
+            : writeSide(writeSide)
+        {
+        }
+
+        void closeWrite() override
+        {
+            writeSide.close();
+        }
+    };
+
+    auto conn = make_ref<TestConnection>(toServer.writeSide);
+    conn->to = FdSink{toServer.writeSide.get()};
+    conn->from = FdSource{toClient.readSide.get()};
+    conn->protoVersion = WorkerProto::latest;
+
+    auto server = std::thread([&]() {
+        FdSink out{toClient.writeSide.get()};
+        FdSource in{toServer.readSide.get()};
+
+        EXPECT_EQ((WorkerProto::Op) readInt(in), WorkerProto::Op::Multiplex);
+        out << STDERR_LAST;
+        out.flush();
+
+        /* Read both requests, then reply to the last one first. */
+        std::map<uint64_t, std::string> requests;
+        for (int i = 0; i < 2; ++i) {
+            auto id = readNum<uint64_t>(in);
+            requests.insert_or_assign(id, readString(in));
+        }
+
+        for (auto & [id, request] : std::views::reverse(requests)) {
+            StringSource source{request};
+            EXPECT_EQ((WorkerProto::Op) readInt(source), WorkerProto::Op::QueryPathFromHashPart);
+            auto hashPart = readString(source);
+            StringSink reply;
+            if (hashPart == "bad")
+                reply << STDERR_ERROR << Error("no such path");
+            else
+                reply << STDERR_LAST << ("reply to " + hashPart);
+            /* Split the reply over several frames. */
+            out << id << reply.s.substr(0, 5) << id << reply.s.substr(5) << id << std::string_view();
+            out.flush();
+        }
+
+        toClient.writeSide.close();
+    });
+
+    {
+        WorkerProto::MultiplexedClientConnection mconn(conn);
+
+        auto query = [&](std::string_view hashPart) {
+            std::string reply;
+            mconn.call(
+                [&](WorkerProto::WriteConn wconn) { wconn.to << WorkerProto::Op::QueryPathFromHashPart << hashPart; },
+                [&](WorkerProto::ReadConn rconn) { reply = readString(rconn.from); });
+            return reply;
+        };
+
+        std::string reply;
+        auto client = std::thread([&]() { reply = query("foo"); });
+
+        EXPECT_THROW(query("bad"), Error);
+
+        client.join();
+        EXPECT_EQ(reply, "reply to foo");
+
+        server.join();
+    }
+}
+
 TEST_F(WorkerProtoTest, handshake_client_replay)
 {
     CharacterizationTest::readTest("handshake-to-client.bin", [&](std::string toClientLog) {
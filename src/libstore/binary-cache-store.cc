@@ -14,10 +14,12 @@
 #include "nix/util/archive.hh"
 #include "nix/util/util.hh"
 
+#include <algorithm>
 #include <chrono>
 #include <future>
 #include <regex>
 #include <sstream>
+#include <thread>
 #include <variant>
 
 #include <nlohmann/json.hpp>
@@ -162,7 +164,16 @@ void BinaryCacheStore::writeNarInfo(ref<NarInfo> narInfo)
             std::shared_ptr<NarInfo>(narInfo));
 }
 
-ref<NarInfo> BinaryCacheStore::uploadData(Source & narSource, RepairFlag repair, fun<ValidPathInfo(HashResult)> mkInfo)
+struct BinaryCacheStore::CompressedNar
+{
+    AutoCloseFD fdTemp;
+    ref<NarInfo> narInfo;
+    std::shared_ptr<NarAccessor> narAccessor;
+    uint64_t compressionTimeMs;
+};
+
+BinaryCacheStore::CompressedNar
+BinaryCacheStore::compressNar(Source & narSource, fun<ValidPathInfo(HashResult)> mkInfo)
 {
     auto fdTemp = createAnonymousTempFile();
 
@@ -214,6 +225,19 @@ ref<NarInfo> BinaryCacheStore::uploadData(Source & narSource, RepairFlag repair,
         ((1.0 - (double) fileSize / info.narSize) * 100.0),
         duration);
 
+    return CompressedNar{
+        .fdTemp = std::move(fdTemp),
+        .narInfo = narInfo,
+        .narAccessor = narAccessor,
+        .compressionTimeMs = (uint64_t) duration,
+    };
+}
+
+void BinaryCacheStore::uploadCompressedNar(CompressedNar & nar, RepairFlag repair)
+{
+    auto & narInfo = nar.narInfo;
+    auto & narAccessor = nar.narAccessor;
+
     /* Optionally write a JSON file containing a listing of the
        contents of the NAR. */
     if (config.writeNARListing) {
@@ -222,7 +246,7 @@ ref<NarInfo> BinaryCacheStore::uploadData(Source & narSource, RepairFlag repair,
             {"root", narAccessor->getListing()},
         };
 
-        upsertFile(std::string(info.path.hashPart()) + ".ls", j.dump(), "application/json");
+        upsertFile(std::string(narInfo->path.hashPart()) + ".ls", j.dump(), "application/json");
     }
 
     /* Optionally maintain an index of DWARF debug info files
@@ -283,18 +307,27 @@ ref<NarInfo> BinaryCacheStore::uploadData(Source & narSource, RepairFlag repair,
 
     /* Atomically write the NAR file. */
     if (repair || !fileExists(narInfo->url)) {
-        FdSource source{fdTemp.get()};
+        FdSource source{nar.fdTemp.get()};
         source.restart(); /* Seek back to the start of the file. */
         stats.narWrite++;
         upsertFile(narInfo->url, source, "application/x-nix-nar", narInfo->fileSize);
     } else
         stats.narWriteAverted++;
 
-    stats.narWriteBytes += info.narSize;
-    stats.narWriteCompressedBytes += fileSize;
-    stats.narWriteCompressionTimeMs += duration;
+    /* The compressed NAR is not needed anymore, so release its disk
+       space now rather than whenever `nar` is destroyed. */
+    nar.fdTemp.close();
 
-    return narInfo;
+    stats.narWriteBytes += narInfo->narSize;
+    stats.narWriteCompressedBytes += narInfo->fileSize;
+    stats.narWriteCompressionTimeMs += nar.compressionTimeMs;
+}
+
+ref<NarInfo> BinaryCacheStore::uploadData(Source & narSource, RepairFlag repair, fun<ValidPathInfo(HashResult)> mkInfo)
+{
+    auto nar = compressNar(narSource, std::move(mkInfo));
+    uploadCompressedNar(nar, repair);
+    return nar.narInfo;
 }
 
 void BinaryCacheStore::uploadNarInfo(ref<NarInfo> narInfo)
@@ -360,118 +393,199 @@ void BinaryCacheStore::addMultipleToStore(
     std::atomic<uint64_t> nrRunning{0};
     auto showProgress = [&, nrTotal = pathsToCopy.size()]() { act.progress(nrDone, nrTotal, nrRunning); };
 
-    /* The NarInfos produced by uploading the NARs, to be consumed when
-       writing the .narinfo files. Populated by the `UploadNar` nodes
-       and read by the corresponding `UploadNarInfo` nodes. */
-    Sync<std::map<StorePath, ref<NarInfo>>> narInfos_;
-
-    /* The work graph has two kinds of nodes: uploading the NAR for a
-       path (which has no dependencies, since NARs are independent of
-       each other), and uploading the .narinfo for a path (which depends
-       on the corresponding NAR upload and on the .narinfo uploads of all
-       the path's references). Processing the latter in topological order
-       maintains the closure invariant: whenever a .narinfo exists, the
-       .narinfo files of all its references exist as well. */
-    struct UploadNar
+    /* The upload is a three-stage pipeline: compressing the NAR for a
+       path into a temporary file (which is CPU-bound), uploading that
+       file (which is I/O-bound), and uploading the .narinfo for the
+       path, which waits for its NAR and for the .narinfo files of all
+       the path's references. The latter maintains the closure
+       invariant: whenever a .narinfo exists, the .narinfo files of all
+       its references exist as well.
+
+       Work is only enqueued once it can run, so no thread of the pool
+       waits for another stage. At most one NAR per core is being
+       compressed, and a NAR is queued for upload as soon as it has
+       been compressed, so the remaining threads are free for
+       uploads. Uploads mostly wait on the network (and are multiplexed
+       by the file transfer thread for HTTP and S3 caches). To bound
+       the temporary files on disk, no more NARs are compressed while
+       `maxPending` of them are being compressed or waiting for or
+       being uploaded. */
+    const size_t maxCompressing = std::max(std::thread::hardware_concurrency(), 1U);
+    const size_t maxUploading = std::max(config.uploadConcurrency.get(), 1U);
+    const size_t maxPending = maxCompressing + 2 * maxUploading;
+
+    /* Compress the largest (and typically slowest) NARs first. */
+    std::vector<StorePath> compressionOrder;
+    for (auto & [path, item] : infosMap)
+        compressionOrder.push_back(path);
+    std::ranges::sort(compressionOrder, [&](const StorePath & a, const StorePath & b) {
+        auto sizeA = infosMap.at(a)->first.narSize;
+        auto sizeB = infosMap.at(b)->first.narSize;
+        return sizeA != sizeB ? sizeA > sizeB : a < b;
+    });
+
+    struct PathState
     {
-        StorePath path;
-        uint64_t narSize;
+        /**
+         * The number of references in this copy whose .narinfo hasn't
+         * been written yet.
+         */
+        size_t refsLeft = 0;
+
+        /**
+         * The paths in this copy that refer to this one.
+         */
+        std::vector<StorePath> referrers;
+
+        /**
+         * Set once the NAR has been uploaded.
+         */
+        std::shared_ptr<NarInfo> narInfo;
+    };
 
-        /* Order NAR uploads by descending size so that the largest
-           (and typically slowest) NARs are started first. */
-        bool operator<(const UploadNar & other) const
-        {
-            return narSize != other.narSize ? narSize > other.narSize : path < other.path;
-        }
+    struct State
+    {
+        std::map<StorePath, PathState> paths;
+
+        /**
+         * The NARs that have been compressed but not uploaded yet.
+         */
+        std::map<StorePath, CompressedNar> compressedNars;
+
+        size_t nextCompression = 0;
+
+        /**
+         * The number of NARs being compressed, or compressed and not
+         * uploaded yet.
+         */
+        size_t nrPending = 0;
+
+        size_t nrCompressing = 0;
+
+        size_t narInfosLeft = 0;
     };
 
-    struct UploadNarInfo
+    Sync<State> state_;
+
     {
-        StorePath path;
+        auto state(state_.lock());
+        state->narInfosLeft = infosMap.size();
+        for (auto & [path, item] : infosMap) {
+            state->paths[path];
+            for (auto & ref : item->first.references)
+                if (ref != path && infosMap.count(ref)) {
+                    state->paths[path].refsLeft++;
+                    state->paths[ref].referrers.push_back(path);
+                }
+        }
+    }
+
+    std::function<void(State &)> startCompressions;
+    std::function<void(State &, const StorePath &)> narUploaded, narInfoWritten;
+
+    /* Create pool last to ensure threads are stopped before other
+       destructors run. */
+    ThreadPool pool(maxCompressing + maxUploading);
+
+    auto writeNarInfo = [&](const StorePath & path) {
+        checkInterrupt();
+        ref<NarInfo> narInfo{state_.lock()->paths.at(path).narInfo};
+        uploadNarInfo(narInfo);
+        narInfoWritten(*state_.lock(), path);
+    };
+
+    auto uploadNar = [&](const StorePath & path) {
+        checkInterrupt();
+        auto nar = [&]() {
+            auto state(state_.lock());
+            auto i = state->compressedNars.find(path);
+            assert(i != state->compressedNars.end());
+            auto nar = std::move(i->second);
+            state->compressedNars.erase(i);
+            return nar;
+        }();
 
-        bool operator<(const UploadNarInfo & other) const
         {
-            return path < other.path;
+            MaintainCount<decltype(nrRunning)> mc(nrRunning);
+            showProgress();
+            uploadCompressedNar(nar, repair);
         }
-    };
 
-    /* `std::variant`'s `operator<` orders by alternative index first, so
-       all `UploadNar` nodes sort (and thus get enqueued) before any
-       `UploadNarInfo` node.
-       TODO: uploading the debug info and NAR listings could be turned into separate graph nodes as well.
-       */
-    using Node = std::variant<UploadNar, UploadNarInfo>;
-
-    std::set<Node> nodes;
-    for (auto & [path, item] : infosMap) {
-        nodes.insert(UploadNar{path, item->first.narSize});
-        nodes.insert(UploadNarInfo{path});
-    }
+        nrDone++;
+        showProgress();
 
-    processGraph<Node>(
-        nodes,
-
-        [&](const Node & node) -> std::set<Node> {
-            return std::visit(
-                overloaded{
-                    [&](const UploadNar &) -> std::set<Node> {
-                        /* NAR uploads have no dependencies. */
-                        return {};
-                    },
-                    [&](const UploadNarInfo & n) -> std::set<Node> {
-                        std::set<Node> edges;
-                        auto & info = infosMap.at(n.path)->first;
-                        /* Wait for our own NAR to be uploaded ... */
-                        edges.insert(UploadNar{n.path, info.narSize});
-                        /* ... and for the .narinfo files of all
-                           references that are part of this copy (other
-                           references are already valid in the store). */
-                        for (auto & ref : info.references) {
-                            if (ref != n.path && infosMap.count(ref))
-                                edges.insert(UploadNarInfo{ref});
-                        }
-                        return edges;
-                    },
-                },
-                node);
-        },
+        auto state(state_.lock());
+        state->nrPending--;
+        state->paths.at(path).narInfo = nar.narInfo.get_ptr();
+        narUploaded(*state, path);
+        startCompressions(*state);
+    };
 
-        [&](const Node & node) {
-            checkInterrupt();
-            std::visit(
-                overloaded{
-                    [&](const UploadNar & n) {
-                        auto & [info, source_] = *infosMap.at(n.path);
-
-                        /* Make sure the Source object is destroyed when
-                           we're done, e.g. to release the connection
-                           lock held by LegacySSHStore::narFromPath(). */
-                        auto source = std::move(source_);
-
-                        if (repair || !isValidPath(info.path)) {
-                            MaintainCount<decltype(nrRunning)> mc(nrRunning);
-                            showProgress();
-                            auto narInfo = uploadData(*source, repair, [&](HashResult nar) {
-                                auto info2 = info;
-                                info2.ultimate = false;
-                                return info2;
-                            });
-                            narInfos_.lock()->insert_or_assign(info.path, narInfo);
-                        }
+    auto compressNar_ = [&](const StorePath & path) {
+        checkInterrupt();
+        auto & [info, source_] = *infosMap.at(path);
+
+        /* Make sure the Source object is destroyed when we're done,
+           e.g. to release the connection lock held by
+           LegacySSHStore::narFromPath(). */
+        auto source = std::move(source_);
+
+        if (!repair && isValidPath(info.path)) {
+            nrDone++;
+            showProgress();
+            auto state(state_.lock());
+            state->nrCompressing--;
+            state->nrPending--;
+            narInfoWritten(*state, path);
+            startCompressions(*state);
+            return;
+        }
 
-                        nrDone++;
-                        showProgress();
-                    },
-                    [&](const UploadNarInfo & n) {
-                        auto & info = infosMap.at(n.path)->first;
-                        if (!repair && isValidPath(info.path))
-                            return;
-                        auto narInfo = narInfos_.lock()->at(n.path);
-                        uploadNarInfo(narInfo);
-                    },
-                },
-                node);
+        MaintainCount<decltype(nrRunning)> mc(nrRunning);
+        showProgress();
+        auto compressed = compressNar(*source, [&](HashResult nar) {
+            auto info2 = info;
+            info2.ultimate = false;
+            return info2;
         });
+
+        auto state(state_.lock());
+        state->nrCompressing--;
+        state->compressedNars.insert_or_assign(path, std::move(compressed));
+        pool.enqueue(std::bind(uploadNar, path));
+        startCompressions(*state);
+    };
+
+    startCompressions = [&](State & state) {
+        while (state.nextCompression < compressionOrder.size() && state.nrCompressing < maxCompressing
+               && state.nrPending < maxPending) {
+            pool.enqueue(std::bind(compressNar_, compressionOrder[state.nextCompression++]));
+            state.nrCompressing++;
+            state.nrPending++;
+        }
+    };
+
+    narUploaded = [&](State & state, const StorePath & path) {
+        if (!state.paths.at(path).refsLeft)
+            pool.enqueue(std::bind(writeNarInfo, path));
+    };
+
+    narInfoWritten = [&](State & state, const StorePath & path) {
+        state.narInfosLeft--;
+        for (auto & referrer : state.paths.at(path).referrers) {
+            auto & referrerState = state.paths.at(referrer);
+            assert(referrerState.refsLeft);
+            if (!--referrerState.refsLeft && referrerState.narInfo)
+                pool.enqueue(std::bind(writeNarInfo, referrer));
+        }
+    };
+
+    startCompressions(*state_.lock());
+
+    pool.process();
+
+    if (state_.lock()->narInfosLeft)
+        throw Error("uploading paths to the binary cache did not complete (cyclic reference?)");
 }
 
 StorePath BinaryCacheStore::addToStoreFromDump(
@@ -575,6 +689,8 @@ void BinaryCacheStore::narFromPath(const StorePath & storePath, Sink & sink)
     auto info = queryPathInfo(storePath).cast<const NarInfo>();
 
     uint64_t narSize = 0;
+    uint64_t compressedSize = 0;
+    auto startTime = std::chrono::steady_clock::now();
 
     LambdaSink uncompressedSink{
         [&](std::string_view data) {
@@ -582,9 +698,25 @@ void BinaryCacheStore::narFromPath(const StorePath & storePath, Sink & sink)
             sink(data);
         },
         [&]() {
+            auto durationMs =
+                std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime)
+                    .count();
             stats.narRead++;
-            // stats.narReadCompressedBytes += nar->size(); // FIXME
+            stats.narReadCompressedBytes += compressedSize;
             stats.narReadBytes += narSize;
+            stats.narReadTimeMs += durationMs;
+            /* Record the throughput of complete downloads that are big
+               enough not to be dominated by latency, for use by
+               `race-substituters`. */
+            if (diskCache && info->fileSize && compressedSize == info->fileSize
+                && compressedSize >= 256 * 1024 && durationMs > 0) {
+                try {
+                    diskCache->recordDownloadThroughput(
+                        config.getReference().render(/*FIXME withParams=*/false), compressedSize * 1000 / durationMs);
+                } catch (...) {
+                    ignoreExceptionExceptInterrupt();
+                }
+            }
         }};
 
     /* makeDecompressionSink used to treat empty strings as "none". It seems
@@ -595,8 +727,13 @@ void BinaryCacheStore::narFromPath(const StorePath & storePath, Sink & sink)
        compression a non-optional field. */
     auto decompressor = makeDecompressionSink(info->compression.value_or(CompressionAlgo::none), uncompressedSink);
 
+    LambdaSink compressedSink{[&](std::string_view data) {
+        compressedSize += data.size();
+        (*decompressor)(data);
+    }};
+
     try {
-        getFile(info->url, *decompressor);
+        getFile(info->url, compressedSink);
     } catch (NoSuchBinaryCacheFile & e) {
         throw SubstituteGone(std::move(e.info()));
     }
@@ -606,6 +743,103 @@ void BinaryCacheStore::narFromPath(const StorePath & storePath, Sink & sink)
     // Note: don't do anything here because it's never reached if we're called as a coroutine.
 }
 
+void BinaryCacheStore::narFromPathForCopy(const StorePath & storePath, Sink & sink, Store & dstStore)
+{
+    auto info = queryPathInfo(storePath).cast<const NarInfo>();
+
+    if (!config.useDeltas || !info->delta)
+        return narFromPath(storePath, sink);
+
+    auto & delta = *info->delta;
+
+    std::shared_ptr<const ValidPathInfo> baseInfo;
+    try {
+        baseInfo = dstStore.queryPathInfo(delta.base);
+    } catch (InvalidPath &) {
+        return narFromPath(storePath, sink);
+    }
+    if (baseInfo->narHash != delta.baseNarHash)
+        return narFromPath(storePath, sink);
+
+    uint64_t narSize = 0;
+    uint64_t compressedSize = 0;
+
+    LambdaSink uncompressedSink{[&](std::string_view data) {
+        narSize += data.size();
+        sink(data);
+    }};
+
+    try {
+        /* zstd references the base as a raw prefix, so it has to be
+           in memory as a whole. The delta, on the other hand, is
+           applied while it's being downloaded. */
+        StringSink baseNar;
+        baseNar.s.reserve(baseInfo->narSize);
+        dstStore.narFromPath(delta.base, baseNar);
+
+        debug("fetching '%s' as a delta against '%s'", printStorePath(storePath), printStorePath(delta.base));
+
+        auto decompressor = makeDeltaDecompressionSink(std::move(baseNar.s), uncompressedSink);
+
+        LambdaSink deltaSink{[&](std::string_view data) {
+            compressedSize += data.size();
+            (*decompressor)(data);
+        }};
+
+        getFile(delta.url, deltaSink);
+
+        decompressor->finish();
+
+        stats.narRead++;
+        stats.narReadCompressedBytes += compressedSize;
+        stats.narReadBytes += narSize;
+    } catch (Error & e) {
+        /* Once part of the NAR has been written to `sink`, it's too
+           late to fall back to the full NAR. */
+        if (narSize)
+            throw;
+        warn(
+            "cannot use delta for '%s' from '%s', fetching the full NAR instead: %s",
+            printStorePath(storePath),
+            config.getHumanReadableURI(),
+            e.msg());
+        return narFromPath(storePath, sink);
+    }
+}
+
+void BinaryCacheStore::addNarDelta(const StorePath & storePath, const StorePath & basePath)
+{
+    auto info = queryPathInfo(storePath).cast<const NarInfo>();
+    auto baseInfo = queryPathInfo(basePath);
+
+    StringSink baseNar, nar;
+    narFromPath(basePath, baseNar);
+    narFromPath(storePath, nar);
+
+    auto delta = compressDelta(baseNar.s, nar.s, config.compressionLevel);
+    auto deltaHash = hashString(HashAlgorithm::SHA256, delta);
+
+    auto narInfo = make_ref<NarInfo>(*info);
+    narInfo->delta = NarDelta{
+        .url = "delta/" + deltaHash.to_string(HashFormat::Nix32, false) + ".nar.zst",
+        .base = basePath,
+        .baseNarHash = baseInfo->narHash,
+        .fileSize = delta.size(),
+    };
+
+    printMsg(
+        lvlTalkative,
+        "created %d-byte delta for '%s' against '%s' (full NAR is %d bytes compressed)",
+        delta.size(),
+        printStorePath(storePath),
+        printStorePath(basePath),
+        info->fileSize);
+
+    upsertFile(narInfo->delta->url, std::move(delta), "application/x-nix-nar-delta");
+
+    writeNarInfo(narInfo);
+}
+
 void BinaryCacheStore::queryPathInfoUncached(
     const StorePath & storePath, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept
 {
@@ -624,7 +858,24 @@ void BinaryCacheStore::queryPathInfoUncached(
 
         auto narInfoFile = narInfoFileFor(storePath);
 
+        auto startTime = std::chrono::steady_clock::now();
+
         getFile(narInfoFile, {[=, this](std::future<std::optional<std::string>> fut) {
+                    /* Record the latency of the lookup, including failed
+                       ones (e.g. timeouts), for use by
+                       `race-substituters`. */
+                    auto latencyMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                         std::chrono::steady_clock::now() - startTime)
+                                         .count();
+                    stats.narInfoReadTimeMs += latencyMs;
+                    if (diskCache) {
+                        try {
+                            diskCache->recordNarInfoLatency(uri, latencyMs);
+                        } catch (...) {
+                            ignoreExceptionExceptInterrupt();
+                        }
+                    }
+
                     try {
                         auto data = fut.get();
 
@@ -737,7 +988,7 @@ void BinaryCacheStore::registerDrvOutput(const Realisation & info)
 
 ref<RemoteFSAccessor> BinaryCacheStore::getRemoteFSAccessor(bool requireValidPath)
 {
-    return make_ref<RemoteFSAccessor>(ref<Store>(shared_from_this()), requireValidPath, config.localNarCache);
+    return make_ref<RemoteFSAccessor>(ref<Store>(shared_from_this()), requireValidPath, config.localNarCache, config.localNarCacheSize);
 }
 
 ref<SourceAccessor> BinaryCacheStore::getFSAccessor(bool requireValidPath)
@@ -1273,7 +1273,7 @@ LogFile::LogFile(Store & store, const StorePath & drvPath, const LogFileSettings
     auto dir = store.config.getLogDir() / LocalFSStore::drvsLogDir / baseName.substr(0, 2);
     createDirs(dir);
 
-    auto logFileName = dir / (baseName.substr(2) + (logSettings.compressLog ? ".bz2" : ""));
+    auto logFileName = dir / (baseName.substr(2) + (logSettings.compressLog ? ".zst" : ""));
 
     fd = openNewFileForWrite(
         logFileName,
@@ -1287,8 +1287,11 @@ LogFile::LogFile(Store & store, const StorePath & drvPath, const LogFileSettings
 
     fileSink = std::make_shared<FdSink>(fd.get());
 
+    /* Write the log in the seekable zstd format, so that `nix log` can
+       read its tail or any other part without decompressing the
+       whole log. Frames are written as the build progresses. */
     if (logSettings.compressLog)
-        sink = std::shared_ptr<CompressionSink>(makeCompressionSink(CompressionAlgo::bzip2, *fileSink));
+        sink = std::shared_ptr<CompressionSink>(makeZstdSeekableCompressionSink(*fileSink));
     else
         sink = fileSink;
 }
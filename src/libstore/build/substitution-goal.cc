@@ -9,6 +9,8 @@
 
 #include <nlohmann/json.hpp>
 
+#include <limits>
+
 namespace nix {
 
 PathSubstitutionGoal::PathSubstitutionGoal(
@@ -45,6 +47,175 @@ Goal::Done PathSubstitutionGoal::doneFailure(ExitCode result, BuildResult::Failu
     return res;
 }
 
+namespace {
+
+/**
+ * The outcome of racing the lookups of a path in all substituters.
+ */
+struct SubstituterRaceOutcome
+{
+    /**
+     * The substituters in the order in which they should be tried.
+     */
+    std::list<ref<Store>> subs;
+
+    /**
+     * The lookups that had finished when the race was decided, so that
+     * they don't need to be repeated.
+     */
+    std::map<const Store *, std::shared_future<ref<const ValidPathInfo>>> lookups;
+};
+
+} // namespace
+
+/**
+ * The expected time in milliseconds to fetch a typically sized NAR
+ * from `sub`, based on its performance in previous invocations, or
+ * infinity if unknown.
+ */
+static double expectedFetchTimeMs(Store & sub)
+{
+    static constexpr double typicalNarSize = 1024 * 1024;
+
+    auto stats = sub.getSubstituterStats();
+    if (!stats || !stats->downloadThroughput)
+        return std::numeric_limits<double>::infinity();
+    return stats->narInfoLatencyMs.value_or(0) + typicalNarSize * 1000 / *stats->downloadThroughput;
+}
+
+/**
+ * Look up `storePath` in all of `subs` concurrently, and call
+ * `callback` as soon as a usable result has arrived and no substituter
+ * that is expected to be faster is still pending (or once all lookups
+ * have finished). The winner comes first in the outcome; the others
+ * keep their priority order.
+ */
+static void raceSubstituters(
+    const std::list<ref<Store>> & subs,
+    const StorePath & storePath,
+    const std::optional<ContentAddress> & ca,
+    Store & workerStore,
+    Callback<SubstituterRaceOutcome> callback)
+{
+    /* The lookups may outlive the worker. */
+    std::weak_ptr<Store> maybeWorkerStore = workerStore.weak_from_this();
+
+    struct Candidate
+    {
+        ref<Store> sub;
+        std::optional<StorePath> lookupPath;
+        double expectedTimeMs;
+        std::optional<std::shared_future<ref<const ValidPathInfo>>> lookup;
+        bool usable = false;
+        size_t finishOrder = 0;
+    };
+
+    struct State
+    {
+        std::vector<Candidate> candidates;
+        size_t nrStarted = 0, nrFinished = 0;
+        std::optional<Callback<SubstituterRaceOutcome>> callback;
+    };
+
+    auto state_ = std::make_shared<Sync<State>>();
+
+    auto maybeDecide = [](State & state) {
+        if (!state.callback)
+            return;
+
+        const Candidate * best = nullptr;
+        for (auto & c : state.candidates)
+            if (c.lookup && c.usable
+                && (!best
+                    || std::pair(c.expectedTimeMs, c.finishOrder)
+                           < std::pair(best->expectedTimeMs, best->finishOrder)))
+                best = &c;
+
+        if (state.nrFinished < state.nrStarted) {
+            if (!best)
+                return;
+            for (auto & c : state.candidates)
+                if (c.lookupPath && !c.lookup && c.expectedTimeMs < best->expectedTimeMs)
+                    return;
+        }
+
+        SubstituterRaceOutcome outcome;
+        if (best) {
+            debug("substituter '%s' won the race", best->sub->config.getHumanReadableURI());
+            outcome.subs.push_back(best->sub);
+        }
+        for (auto & c : state.candidates) {
+            if (&c != best)
+                outcome.subs.push_back(c.sub);
+            if (c.lookup)
+                outcome.lookups.emplace(&*c.sub, *c.lookup);
+        }
+
+        auto callback = std::move(*state.callback);
+        state.callback.reset();
+        callback(std::move(outcome));
+    };
+
+    std::vector<Candidate> candidates;
+
+    {
+        auto state(state_->lock());
+        state->callback.emplace(std::move(callback));
+
+        for (auto & sub : subs) {
+            auto & c = state->candidates.emplace_back(Candidate{.sub = sub, .expectedTimeMs = 0});
+            /* See the corresponding logic in `PathSubstitutionGoal::init()`. */
+            if (ca)
+                c.lookupPath = sub->makeFixedOutputPathFromCA(
+                    std::string{storePath.name()}, ContentAddressWithReferences::withoutRefs(*ca));
+            else if (sub->storeDir == workerStore.storeDir)
+                c.lookupPath = storePath;
+            if (c.lookupPath) {
+                c.expectedTimeMs = expectedFetchTimeMs(*sub);
+                state->nrStarted++;
+            }
+        }
+
+        /* Start the lookups after releasing the lock, since their
+           callbacks may be called synchronously. */
+        candidates = state->candidates;
+
+        maybeDecide(*state);
+    }
+
+    for (auto [i, c] : enumerate(candidates)) {
+        if (!c.lookupPath)
+            continue;
+        c.sub->queryPathInfo(
+            *c.lookupPath,
+            {[state_, i, maybeDecide, storePath, maybeWorkerStore, sub = c.sub](
+                 std::future<ref<const ValidPathInfo>> fut) {
+                auto lookup = fut.share();
+
+                /* Mirror the checks done by `PathSubstitutionGoal::init()`
+                   so that we don't pick a substituter whose result it
+                   will reject. */
+                bool usable = false;
+                try {
+                    auto info = lookup.get();
+                    usable = info->path == storePath || (info->isContentAddressed(*sub) && info->references.empty());
+                    if (usable && !sub->config.isTrusted) {
+                        auto workerStore = maybeWorkerStore.lock();
+                        usable = workerStore && !workerStore->pathInfoIsUntrusted(*info);
+                    }
+                } catch (...) {
+                }
+
+                auto state(state_->lock());
+                auto & c = state->candidates[i];
+                c.lookup = std::move(lookup);
+                c.usable = usable;
+                c.finishOrder = state->nrFinished++;
+                maybeDecide(*state);
+            }});
+    }
+}
+
 Goal::Co PathSubstitutionGoal::init()
 {
     trace("init");
@@ -62,6 +233,18 @@ Goal::Co PathSubstitutionGoal::init()
 
     auto subs = worker.getSubstituters();
 
+    /* Lookups that have already been done by racing the substituters. */
+    std::map<const Store *, std::shared_future<ref<const ValidPathInfo>>> lookups;
+
+    if (worker.settings.raceSubstituters && subs.size() > 1) {
+        auto outcome = co_await AsyncCallback<SubstituterRaceOutcome>(
+            [&](Callback<SubstituterRaceOutcome> cb) {
+                raceSubstituters(subs, storePath, ca, worker.store, std::move(cb));
+            });
+        subs = std::move(outcome.subs);
+        lookups = std::move(outcome.lookups);
+    }
+
     bool substituterFailed = false;
     std::optional<Error> lastStoresException = std::nullopt;
 
@@ -91,8 +274,11 @@ Goal::Co PathSubstitutionGoal::init()
         }
 
         try {
-            info = co_await AsyncCallback<ref<const ValidPathInfo>>(
-                [sub, path = subPath.value_or(storePath)](auto cb) { sub->queryPathInfo(path, std::move(cb)); });
+            if (auto lookup = get(lookups, &*sub))
+                info = lookup->get();
+            else
+                info = co_await AsyncCallback<ref<const ValidPathInfo>>(
+                    [sub, path = subPath.value_or(storePath)](auto cb) { sub->queryPathInfo(path, std::move(cb)); });
         } catch (InvalidPath &) {
             continue;
         } catch (SubstituterDisabled & e) {
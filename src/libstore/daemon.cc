@@ -27,7 +27,9 @@
 #  include "nix/util/monitor-fd.hh"
 #endif
 
+#include <queue>
 #include <sstream>
+#include <thread>
 
 namespace nix::daemon {
 
@@ -48,12 +50,23 @@ Sink & operator<<(Sink & sink, const Logger::Fields & fields)
 
 namespace {
 
+struct TunnelLogger;
+
+/* In multiplexed mode, the logger of the request that the current
+   thread is serving. */
+static thread_local TunnelLogger * requestLogger = nullptr;
+
 /* Logger that forwards log messages to the client, *if* we're in a
    state where the protocol allows it (i.e., when canSendStderr is
    true). */
 struct TunnelLogger : public Logger
 {
-    FdSink & to;
+    BufferedSink & to;
+
+    /* Whether the connection is in multiplexed mode. Messages are then
+       sent to the client by the logger of the request that produced
+       them. */
+    std::atomic<bool> multiplexed{false};
 
     struct State
     {
@@ -65,7 +78,7 @@ struct TunnelLogger : public Logger
 
     WorkerProto::Version clientVersion;
 
-    TunnelLogger(FdSink & to, WorkerProto::Version clientVersion)
+    TunnelLogger(BufferedSink & to, WorkerProto::Version clientVersion)
         : to(to)
         , clientVersion(clientVersion)
     {
@@ -73,6 +86,14 @@ struct TunnelLogger : public Logger
 
     void enqueueMsg(const std::string & s) noexcept
     {
+        if (multiplexed) {
+            /* Messages from threads that aren't serving a request
+               can't be attributed to one, so they're dropped. */
+            if (requestLogger && requestLogger != this)
+                requestLogger->enqueueMsg(s);
+            return;
+        }
+
         auto state(state_.lock());
 
         if (state->canSendStderr) {
@@ -306,12 +327,37 @@ struct ClientSettings
     }
 };
 
+/* What an operation reads its arguments from and writes its reply to:
+   the whole connection, or a single request in multiplexed mode. */
+struct OpConnection
+{
+    Source & from;
+    BufferedSink & to;
+    const WorkerProto::Version & protoVersion;
+
+    operator WorkerProto::ReadConn()
+    {
+        return WorkerProto::ReadConn{
+            .from = from,
+            .version = protoVersion,
+        };
+    }
+
+    operator WorkerProto::WriteConn()
+    {
+        return WorkerProto::WriteConn{
+            .to = to,
+            .version = protoVersion,
+        };
+    }
+};
+
 static void performOp(
     TunnelLogger * logger,
     ref<Store> store,
     TrustedFlag trusted,
     RecursiveFlag recursive,
-    WorkerProto::BasicServerConnection & conn,
+    OpConnection conn,
     WorkerProto::Op op)
 {
     WorkerProto::ReadConn rconn(conn);
@@ -1083,6 +1129,169 @@ static void performOp(
     }
 }
 
+/* Sends everything written to it to the client in frames tagged with
+   the ID of a request. Used in multiplexed mode. */
+struct RequestSink : BufferedSink
+{
+    Sync<BufferedSink *> & to_;
+    uint64_t id;
+
+    RequestSink(Sync<BufferedSink *> & to_, uint64_t id)
+        : to_(to_)
+        , id(id)
+    {
+    }
+
+    /* Send the empty frame that tells the client that the reply is
+       complete. */
+    void finish()
+    {
+        flush();
+        auto to(to_.lock());
+        **to << id << std::string_view();
+        (*to)->flush();
+    }
+
+protected:
+
+    void writeUnbuffered(std::string_view data) override
+    {
+        if (data.empty())
+            return;
+        auto to(to_.lock());
+        **to << id << data;
+        (*to)->flush();
+    }
+};
+
+/* The maximum number of requests that are served concurrently in
+   multiplexed mode. */
+static constexpr size_t maxMultiplexedWorkers = 16;
+
+/* The maximum number of requests that can be in flight on a
+   connection in multiplexed mode. When it's reached, we stop reading
+   from the connection until a request has been answered, so a client
+   that sends requests faster than we serve them is slowed down by the
+   socket rather than making us queue them. */
+static constexpr size_t maxMultiplexedRequests = 64;
+
+/* Serve requests in multiplexed mode (see
+   `WorkerProto::featureMultiplexing`) until the client closes the
+   connection. The connection thread reads the requests and hands them
+   to a set of worker threads, which reply as soon as they're done. */
+static void serveMultiplexed(
+    TunnelLogger * tunnelLogger,
+    ref<Store> store,
+    TrustedFlag trusted,
+    RecursiveFlag recursive,
+    WorkerProto::BasicServerConnection & conn,
+    unsigned int & opCount)
+{
+    tunnelLogger->multiplexed = true;
+
+    Sync<BufferedSink *> to_(&conn.to);
+
+    auto serveRequest = [&](uint64_t id, const std::string & request) {
+        RequestSink to(to_, id);
+        TunnelLogger logger(to, conn.protoVersion);
+        requestLogger = &logger;
+        Finally resetLogger([&]() { requestLogger = nullptr; });
+
+        try {
+            StringSource from(request);
+            auto op = (WorkerProto::Op) readInt(from);
+            debug("performing multiplexed daemon worker op %d for request %d", op, id);
+            if (!WorkerProto::isMultiplexable(op))
+                throw Error("operation %1% cannot be multiplexed", op);
+            performOp(&logger, store, trusted, recursive, {from, to, conn.protoVersion}, op);
+        } catch (Error & e) {
+            /* Unlike on a normal connection, the client can always
+               receive the error, since the request was read
+               completely. */
+            logger.stopWork(&e);
+        } catch (std::bad_alloc & e) {
+            auto ex = Error("Nix daemon out of memory");
+            logger.stopWork(&ex);
+        }
+
+        to.finish();
+    };
+
+    struct State
+    {
+        std::queue<std::pair<uint64_t, std::string>> pending;
+        /* Requests that have been read but not answered yet. */
+        size_t inFlight = 0;
+        size_t idle = 0;
+        bool quit = false;
+    };
+
+    Sync<State> state_;
+    std::condition_variable wakeup, requestDone;
+    std::vector<std::thread> workers;
+
+    auto worker = [&]() {
+        while (true) {
+            std::pair<uint64_t, std::string> request;
+            {
+                auto state(state_.lock());
+                state->idle++;
+                while (state->pending.empty() && !state->quit)
+                    state.wait(wakeup);
+                state->idle--;
+                if (state->pending.empty())
+                    return;
+                request = std::move(state->pending.front());
+                state->pending.pop();
+            }
+            try {
+                serveRequest(request.first, request.second);
+            } catch (...) {
+                /* Sending the reply failed, so the client is gone. The
+                   connection thread will notice. */
+            }
+            state_.lock()->inFlight--;
+            requestDone.notify_one();
+        }
+    };
+
+    Finally joinWorkers([&]() {
+        state_.lock()->quit = true;
+        wakeup.notify_all();
+        for (auto & thread : workers)
+            thread.join();
+    });
+
+    while (true) {
+        uint64_t id;
+        std::string request;
+        try {
+            {
+                auto state(state_.lock());
+                while (state->inFlight >= maxMultiplexedRequests) {
+                    state.wait_for(requestDone, std::chrono::milliseconds(100));
+                    checkInterrupt();
+                }
+            }
+            id = readNum<uint64_t>(conn.from);
+            request = readString(conn.from);
+        } catch (Interrupted & e) {
+            break;
+        } catch (EndOfFile & e) {
+            break;
+        }
+
+        opCount++;
+
+        auto state(state_.lock());
+        state->pending.emplace(id, std::move(request));
+        state->inFlight++;
+        if (state->pending.size() > state->idle && workers.size() < maxMultiplexedWorkers)
+            workers.emplace_back(worker);
+        wakeup.notify_one();
+    }
+}
+
 void processConnection(ref<Store> store, FdSource && from, FdSink && to, TrustedFlag trusted, RecursiveFlag recursive)
 {
 #ifndef _WIN32 // TODO need graceful async exit support on Windows?
@@ -1107,6 +1316,10 @@ void processConnection(ref<Store> store, FdSource && from, FdSink && to, Trusted
         localVersion.features.insert(std::string{WorkerProto::featureDisableSetOptions});
     if (!experimentalFeatureSettings.isEnabled(Xp::Provenance))
         localVersion.features.erase(std::string(WorkerProto::featureProvenance));
+    /* Multiplexed mode relies on the tunnel logger being the global
+       logger to route log messages to requests. */
+    if (recursive)
+        localVersion.features.erase(std::string(WorkerProto::featureMultiplexing));
 
     WorkerProto::BasicServerConnection conn;
     conn.protoVersion = WorkerProto::BasicServerConnection::handshake(to, from, localVersion);
@@ -1116,6 +1329,7 @@ void processConnection(ref<Store> store, FdSource && from, FdSink && to, Trusted
 
     conn.to = std::move(to);
     conn.from = std::move(from);
+    conn.maybeEnableStreamCompression();
 
     auto tunnelLogger = new TunnelLogger(conn.to, conn.protoVersion);
     auto prevLogger = logger;
@@ -1166,8 +1380,17 @@ void processConnection(ref<Store> store, FdSource && from, FdSink && to, Trusted
 
             debug("performing daemon worker op: %d", op);
 
+            if (op == WorkerProto::Op::Multiplex
+                && conn.protoVersion.features.contains(WorkerProto::featureMultiplexing)) {
+                tunnelLogger->startWork();
+                tunnelLogger->stopWork();
+                conn.to.flush();
+                serveMultiplexed(tunnelLogger, store, trusted, recursive, conn, opCount);
+                break;
+            }
+
             try {
-                performOp(tunnelLogger, store, trusted, recursive, conn, op);
+                performOp(tunnelLogger, store, trusted, recursive, {conn.from, conn.to, conn.protoVersion}, op);
             } catch (Error & e) {
                 /* If we're not in a state where we can send replies, then
                    something went wrong processing the input of the
@@ -1,5 +1,6 @@
 #include "nix/store/derivations.hh"
 #include "nix/store/downstream-placeholder.hh"
+#include "nix/store/drv-hash-cache.hh"
 #include "nix/store/store-api.hh"
 #include "nix/util/types.hh"
 #include "nix/util/util.hh"
@@ -219,6 +220,27 @@ constexpr struct Escapes
         return map[(unsigned char) c];
     }
 } escapes;
+
+/**
+ * The characters that `printString()` has to escape.
+ */
+constexpr struct NeedsEscape
+{
+    bool map[256];
+
+    constexpr NeedsEscape()
+    {
+        for (int i = 0; i < 256; i++)
+            map[i] = false;
+        for (char c : {'"', '\\', '\n', '\r', '\t'})
+            map[(int) (unsigned char) c] = true;
+    }
+
+    bool operator[](char c) const
+    {
+        return map[(unsigned char) c];
+    }
+} needsEscape;
 } // namespace
 
 /* Read string `s' from stream `str'. */
@@ -316,12 +338,23 @@ static bool endOfList(StringViewStream & str)
     return false;
 }
 
-static StringSet parseStrings(StringViewStream & str, bool arePaths)
+/* Lists in derivations are sorted, so elements are inserted with
+   `end()` as hint, which makes each insertion constant time. */
+static StringSet parseStrings(StringViewStream & str)
 {
     StringSet res;
     expect(str, '[');
     while (!endOfList(str))
-        res.insert((arePaths ? parsePath(str) : parseString(str)).toOwned());
+        res.insert(res.end(), parseString(str).toOwned());
+    return res;
+}
+
+static StorePathSet parseStorePaths(const StoreDirConfig & store, StringViewStream & str)
+{
+    StorePathSet res;
+    expect(str, '[');
+    while (!endOfList(str))
+        res.insert(res.end(), store.parseStorePath(*parsePath(str)));
     return res;
 }
 
@@ -413,7 +446,7 @@ parseDerivedPathMapNode(const StoreDirConfig & store, StringViewStream & str, De
 {
     DerivedPathMap<StringSet>::ChildNode node;
 
-    auto parseNonDynamic = [&]() { node.value = parseStrings(str, false); };
+    auto parseNonDynamic = [&]() { node.value = parseStrings(str); };
 
     // Older derivation should never use new form, but newer
     // derivaiton can use old form.
@@ -428,13 +461,14 @@ parseDerivedPathMapNode(const StoreDirConfig & store, StringViewStream & str, De
             break;
         case '(':
             expect(str, '(');
-            node.value = parseStrings(str, false);
+            node.value = parseStrings(str);
             expect(str, ",["sv);
             while (!endOfList(str)) {
                 expect(str, '(');
                 auto outputName = parseString(str).toOwned();
                 expect(str, ',');
-                node.childMap.insert_or_assign(outputName, parseDerivedPathMapNode(store, str, version));
+                node.childMap.insert_or_assign(
+                    node.childMap.end(), std::move(outputName), parseDerivedPathMapNode(store, str, version));
                 expect(str, ')');
             }
             expect(str, ')');
@@ -492,7 +526,7 @@ Derivation parseDerivation(
         expect(str, '(');
         std::string id = parseString(str).toOwned();
         auto output = parseDerivationOutput(store, str, xpSettings);
-        drv.outputs.emplace(std::move(id), std::move(output));
+        drv.outputs.emplace_hint(drv.outputs.end(), std::move(id), std::move(output));
     }
 
     /* Parse the list of input derivations. */
@@ -502,12 +536,12 @@ Derivation parseDerivation(
         auto drvPath = parsePath(str);
         expect(str, ',');
         drv.inputDrvs.map.insert_or_assign(
-            store.parseStorePath(*drvPath), parseDerivedPathMapNode(store, str, version));
+            drv.inputDrvs.map.end(), store.parseStorePath(*drvPath), parseDerivedPathMapNode(store, str, version));
         expect(str, ')');
     }
 
     expect(str, ',');
-    drv.inputSrcs = store.parseStorePathSet(parseStrings(str, true));
+    drv.inputSrcs = parseStorePaths(store, str);
     expect(str, ',');
     drv.platform = parseString(str).toOwned();
     expect(str, ',');
@@ -522,13 +556,13 @@ Derivation parseDerivation(
     expect(str, ",["sv);
     while (!endOfList(str)) {
         expect(str, '(');
-        auto name = parseString(str).toOwned();
+        auto name = parseString(str);
         expect(str, ',');
         auto value = parseString(str);
-        if (name == StructuredAttrs::envVarName) {
+        if (*name == StructuredAttrs::envVarName) {
             drv.structuredAttrs = StructuredAttrs::parse(*std::move(value));
         } else {
-            drv.env.insert_or_assign(std::move(name), std::move(value).toOwned());
+            drv.env.insert_or_assign(drv.env.end(), std::move(name).toOwned(), std::move(value).toOwned());
         }
         expect(str, ')');
     }
@@ -549,29 +583,15 @@ Derivation parseDerivation(
 static void printString(std::string & res, std::string_view s)
 {
     res += '"';
-    static constexpr auto chunkSize = 1024;
-    std::array<char, 2 * chunkSize + 2> buffer;
-    while (!s.empty()) {
-        auto chunk = s.substr(0, /*n=*/chunkSize);
-        s.remove_prefix(chunk.size());
-        char * buf = buffer.data();
-        char * p = buf;
-        for (auto c : chunk)
-            if (c == '\"' || c == '\\') {
-                *p++ = '\\';
-                *p++ = c;
-            } else if (c == '\n') {
-                *p++ = '\\';
-                *p++ = 'n';
-            } else if (c == '\r') {
-                *p++ = '\\';
-                *p++ = 'r';
-            } else if (c == '\t') {
-                *p++ = '\\';
-                *p++ = 't';
-            } else
-                *p++ = c;
-        res.append(buf, p - buf);
+    /* Append runs of characters that don't need escaping in one go. */
+    while (true) {
+        auto i = std::find_if(s.begin(), s.end(), [](char c) { return needsEscape[c]; });
+        res.append(s.begin(), i);
+        if (i == s.end())
+            break;
+        res += '\\';
+        res += *i == '\n' ? 'n' : *i == '\r' ? 'r' : *i == '\t' ? 't' : *i;
+        s.remove_prefix(i - s.begin() + 1);
     }
     res += '"';
 }
@@ -583,6 +603,19 @@ static void printUnquotedString(std::string & res, std::string_view s)
     res += '"';
 }
 
+/**
+ * Print a store path without first rendering it into a temporary
+ * string, as `StoreDirConfig::printStorePath()` does.
+ */
+static void printUnquotedStorePath(std::string & res, const StoreDirConfig & store, const StorePath & path)
+{
+    res += '"';
+    res += store.storeDir;
+    res += '/';
+    res += path.to_string();
+    res += '"';
+}
+
 template<class ForwardIterator>
 static void printStrings(std::string & res, ForwardIterator i, ForwardIterator j)
 {
@@ -656,11 +689,68 @@ static bool hasDynamicDrvDep(const Derivation & drv)
            != drv.inputDrvs.map.end();
 }
 
+static size_t estimateDerivedPathMapNodeSize(const DerivedPathMap<StringSet>::ChildNode & node)
+{
+    size_t size = 8;
+    for (auto & outputName : node.value)
+        size += outputName.size() + 3;
+    for (auto & [outputName, childNode] : node.childMap)
+        size += outputName.size() + 6 + estimateDerivedPathMapNodeSize(childNode);
+    return size;
+}
+
+/**
+ * The size of the ATerm of `drv`, assuming that no characters need
+ * escaping and allowing for the longest possible output hashes. Used
+ * to size the result of `unparse()` up front rather than growing it
+ * repeatedly.
+ */
+static size_t estimateATermSize(
+    const StoreDirConfig & store,
+    const Derivation & drv,
+    const DerivedPathMap<StringSet>::ChildNode::Map * actualInputs,
+    const std::optional<std::pair<std::string_view, std::string>> & structuredAttrs)
+{
+    /* Quotes and separators of a store path in a list. */
+    const size_t storePathSize = store.storeDir.size() + 1 + StorePath::HashLen + 1 + 4;
+
+    size_t size = 64;
+
+    for (auto & [outputName, _] : drv.outputs)
+        size += outputName.size() + storePathSize + drv.name.size() + 1 + outputName.size() + 192;
+
+    if (actualInputs)
+        for (auto & [drvHashModulo, node] : *actualInputs)
+            size += drvHashModulo.size() + 4 + estimateDerivedPathMapNodeSize(node);
+    else
+        for (auto & [drvPath, node] : drv.inputDrvs.map)
+            size += storePathSize + drvPath.name().size() + estimateDerivedPathMapNodeSize(node);
+
+    for (auto & path : drv.inputSrcs)
+        size += storePathSize + path.name().size();
+
+    size += drv.platform.size() + drv.builder.size() + 6;
+    for (auto & arg : drv.args)
+        size += arg.size() + 3;
+
+    for (auto & [name, value] : drv.env)
+        size += name.size() + value.size() + 6;
+    if (structuredAttrs)
+        size += structuredAttrs->first.size() + structuredAttrs->second.size() + 6;
+
+    return size;
+}
+
 std::string Derivation::unparse(
     const StoreDirConfig & store, bool maskOutputs, DerivedPathMap<StringSet>::ChildNode::Map * actualInputs) const
 {
+    StructuredAttrs::checkKeyNotInUse(env);
+    std::optional<std::pair<std::string_view, std::string>> structuredAttrsEnv;
+    if (structuredAttrs)
+        structuredAttrsEnv = structuredAttrs->unparse();
+
     std::string s;
-    s.reserve(65536);
+    s.reserve(estimateATermSize(store, *this, actualInputs, structuredAttrsEnv));
 
     /* Use older unversioned form if possible, for wider compat. Use
        newer form only if we need it, which we do for
@@ -687,7 +777,10 @@ std::string Derivation::unparse(
             overloaded{
                 [&](const DerivationOutput::InputAddressed & doi) {
                     s += ',';
-                    printUnquotedString(s, maskOutputs ? ""sv : store.printStorePath(doi.path));
+                    if (maskOutputs)
+                        printUnquotedString(s, {});
+                    else
+                        printUnquotedStorePath(s, store, doi.path);
                     s += ',';
                     printUnquotedString(s, {});
                     s += ',';
@@ -695,7 +788,10 @@ std::string Derivation::unparse(
                 },
                 [&](const DerivationOutput::CAFixed & dof) {
                     s += ',';
-                    printUnquotedString(s, maskOutputs ? ""sv : store.printStorePath(dof.path(store, name, i.first)));
+                    if (maskOutputs)
+                        printUnquotedString(s, {});
+                    else
+                        printUnquotedStorePath(s, store, dof.path(store, name, i.first));
                     s += ',';
                     printUnquotedString(s, dof.ca.printMethodAlgo());
                     s += ',';
@@ -750,15 +846,24 @@ std::string Derivation::unparse(
             else
                 s += ',';
             s += '(';
-            printUnquotedString(s, store.printStorePath(drvPath));
+            printUnquotedStorePath(s, store, drvPath);
             unparseDerivedPathMapNode(store, s, childMap);
             s += ')';
         }
     }
 
-    s += "],"sv;
-    auto paths = store.printStorePathSet(inputSrcs); // FIXME: slow
-    printUnquotedStrings(s, paths.begin(), paths.end());
+    /* `StorePathSet` is ordered by base name, which is also the order
+       of the printed paths, since they share the store directory. */
+    s += "],["sv;
+    first = true;
+    for (auto & path : inputSrcs) {
+        if (first)
+            first = false;
+        else
+            s += ',';
+        printUnquotedStorePath(s, store, path);
+    }
+    s += ']';
 
     s += ',';
     printUnquotedString(s, platform);
@@ -770,28 +875,27 @@ std::string Derivation::unparse(
     s += ",["sv;
     first = true;
 
-    auto unparseEnv = [&](const StringPairs & atermEnv) {
-        for (auto & i : atermEnv) {
-            if (first)
-                first = false;
-            else
-                s += ',';
-            s += '(';
-            printString(s, i.first);
+    auto unparseEnvVar = [&](const std::string & name, std::string_view value) {
+        if (first)
+            first = false;
+        else
             s += ',';
-            printString(s, maskOutputs && outputs.count(i.first) ? ""sv : i.second);
-            s += ')';
-        }
+        s += '(';
+        printString(s, name);
+        s += ',';
+        printString(s, maskOutputs && outputs.count(name) ? ""sv : value);
+        s += ')';
     };
 
-    StructuredAttrs::checkKeyNotInUse(env);
-    if (structuredAttrs) {
-        StringPairs scratch = env;
-        scratch.insert(structuredAttrs->unparse());
-        unparseEnv(scratch);
-    } else {
-        unparseEnv(env);
-    }
+    /* Merge the structured attributes into the sorted environment
+       without copying it. */
+    auto structuredAttrsPos = structuredAttrsEnv ? env.lower_bound(structuredAttrsEnv->first) : env.end();
+    for (auto i = env.begin(); i != structuredAttrsPos; ++i)
+        unparseEnvVar(i->first, i->second);
+    if (structuredAttrsEnv)
+        unparseEnvVar(std::string(structuredAttrsEnv->first), structuredAttrsEnv->second);
+    for (auto i = structuredAttrsPos; i != env.end(); ++i)
+        unparseEnvVar(i->first, i->second);
 
     s += "])"sv;
 
@@ -889,10 +993,22 @@ static DrvHashModulo pathDerivationModulo(Store & store, const StorePath & drvPa
     if (drvHashes.cvisit(drvPath, [&hash](const auto & kv) { hash.emplace(kv.second); })) {
         return *hash;
     }
+
+    /* Another process may have hashed this derivation before. */
+    auto diskCache = DrvHashCache::get();
+    if (diskCache) {
+        if (auto h = diskCache->lookup(store, drvPath)) {
+            drvHashes.insert_or_assign(drvPath, *h);
+            return *h;
+        }
+    }
+
     auto h = hashDerivationModulo(store, store.readInvalidDerivation(drvPath), false);
 
     // Cache it
     drvHashes.insert_or_assign(drvPath, h);
+    if (diskCache)
+        diskCache->upsert(store, drvPath, h);
     return h;
 }
 
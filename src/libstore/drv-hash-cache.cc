@@ -0,0 +1,230 @@
+#include "nix/store/drv-hash-cache.hh"
+#include "nix/store/globals.hh"
+#include "nix/store/sqlite.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/users.hh"
+#include "nix/util/sync.hh"
+#include "nix/util/util.hh"
+
+#include <map>
+
+#include <nlohmann/json.hpp>
+
+namespace nix {
+
+static const char * schema = R"sql(
+
+create table if not exists DrvHashes (
+    drvPath   text primary key not null,
+    type      text not null, -- 'drv', 'ca' or 'deferred'
+    value     text
+);
+
+)sql";
+
+struct DrvHashCacheImpl : DrvHashCache
+{
+private:
+    void anchor() override;
+public:
+    /**
+     * Number of new entries to collect before writing them to the
+     * database in a single transaction. Evaluation adds an entry for
+     * every derivation it instantiates, so committing each of them
+     * separately would be comparatively slow.
+     */
+    const size_t maxPending = 256;
+
+    struct State
+    {
+        SQLite db;
+        SQLiteStmt insertHash, queryHash;
+    };
+
+    /**
+     * Only taken for database access. Lock order: `_state`, then
+     * `pending`.
+     */
+    Sync<State> _state;
+
+    /**
+     * Entries that haven't been written to the database yet.
+     */
+    SharedSync<std::map<std::string, DrvHashModulo>> pending;
+
+    DrvHashCacheImpl(
+        SQLiteSettings sqliteSettings, std::filesystem::path dbPath = getCacheDir() / "drv-hashes-v1.sqlite")
+    {
+        auto state(_state.lock());
+
+        createDirs(dbPath.parent_path());
+
+        state->db = SQLite(dbPath, SQLite::Settings{sqliteSettings});
+
+        state->db.isCache();
+
+        state->db.exec(schema);
+
+        state->insertHash.create(state->db, "insert or replace into DrvHashes(drvPath, type, value) values (?, ?, ?)");
+
+        state->queryHash.create(state->db, "select type, value from DrvHashes where drvPath = ?");
+    }
+
+    ~DrvHashCacheImpl()
+    {
+        try {
+            write();
+        } catch (...) {
+            ignoreExceptionInDestructor();
+        }
+    }
+
+    void write()
+    {
+        /* Hold the database lock while the entries are neither in
+           `pending` nor committed, so that `lookup()` doesn't miss
+           them. */
+        auto state(_state.lock());
+
+        /* Don't keep entries around that we failed to write. */
+        std::map<std::string, DrvHashModulo> entries;
+        std::swap(entries, *pending.lock());
+        if (entries.empty())
+            return;
+
+        retrySQLite<void>([&]() {
+            SQLiteTxn txn(state->db);
+            for (auto & [drvPath, hash] : entries)
+                std::visit(
+                    overloaded{
+                        [&](const DrvHashModulo::DrvHash & drvHash) {
+                            state->insertHash.use()
+                                .apply(drvPath)
+                                .apply("drv")
+                                .apply(drvHash.to_string(HashFormat::SRI, true))
+                                .exec();
+                        },
+                        [&](const DrvHashModulo::CaOutputHashes & outputHashes) {
+                            auto json = nlohmann::json::object();
+                            for (auto & [outputName, h] : outputHashes)
+                                json[outputName] = h.to_string(HashFormat::SRI, true);
+                            state->insertHash.use().apply(drvPath).apply("ca").apply(json.dump()).exec();
+                        },
+                        [&](const DrvHashModulo::DeferredDrv &) {
+                            state->insertHash.use().apply(drvPath).apply("deferred").bind().exec();
+                        },
+                    },
+                    hash.raw);
+            txn.commit();
+        });
+
+        debug("wrote %d derivation hashes to the disk cache", entries.size());
+    }
+
+    void flush() override
+    {
+        try {
+            write();
+        } catch (...) {
+            ignoreExceptionExceptInterrupt(lvlDebug);
+        }
+    }
+
+    std::optional<DrvHashModulo> lookup(const StoreDirConfig & store, const StorePath & drvPath) override
+    {
+        try {
+            auto drvPathS = store.printStorePath(drvPath);
+
+            {
+                auto pending_(pending.readLock());
+                if (auto hash = get(*pending_, drvPathS))
+                    return *hash;
+            }
+
+            auto state(_state.lock());
+
+            return retrySQLite<std::optional<DrvHashModulo>>([&]() -> std::optional<DrvHashModulo> {
+                auto queryHash(state->queryHash.use().apply(drvPathS));
+                if (!queryHash.next())
+                    return std::nullopt;
+
+                auto type = queryHash.getStr(0);
+                if (type == "drv")
+                    return DrvHashModulo{Hash::parseSRI(queryHash.getStr(1))};
+                if (type == "ca") {
+                    DrvHashModulo::CaOutputHashes outputHashes;
+                    for (auto & [outputName, h] : nlohmann::json::parse(queryHash.getStr(1)).items())
+                        outputHashes.insert_or_assign(outputName, Hash::parseSRI(h.get<std::string>()));
+                    return DrvHashModulo{std::move(outputHashes)};
+                }
+                if (type == "deferred")
+                    return DrvHashModulo{DrvHashModulo::DeferredDrv{}};
+                throw Error("derivation hash cache entry for '%s' has unknown type '%s'", drvPathS, type);
+            });
+        } catch (...) {
+            ignoreExceptionExceptInterrupt(lvlDebug);
+            return std::nullopt;
+        }
+    }
+
+    void upsert(const StoreDirConfig & store, const StorePath & drvPath, const DrvHashModulo & hash) override
+    {
+        try {
+            bool full;
+            {
+                auto pending_(pending.lock());
+                pending_->insert_or_assign(store.printStorePath(drvPath), hash);
+                full = pending_->size() >= maxPending;
+            }
+            if (full)
+                write();
+        } catch (...) {
+            ignoreExceptionExceptInterrupt(lvlDebug);
+        }
+    }
+};
+
+void DrvHashCache::anchor() {}
+
+void DrvHashCacheImpl::anchor() {}
+
+/**
+ * Read on every derivation instantiation, but written only once
+ * (and by `set()`).
+ */
+static SharedSync<std::optional<std::shared_ptr<DrvHashCache>>> drvHashCache;
+
+std::shared_ptr<DrvHashCache> DrvHashCache::get()
+{
+    if (auto cache(drvHashCache.readLock()); *cache)
+        return **cache;
+
+    auto cache(drvHashCache.lock());
+    if (!*cache) {
+        try {
+            *cache = std::make_shared<DrvHashCacheImpl>(SQLiteSettings{.useWAL = settings.useSQLiteWAL});
+        } catch (...) {
+            ignoreExceptionExceptInterrupt(lvlDebug);
+            *cache = nullptr;
+        }
+    }
+    return **cache;
+}
+
+void DrvHashCache::set(std::shared_ptr<DrvHashCache> cache)
+{
+    *drvHashCache.lock() = std::move(cache);
+}
+
+void DrvHashCache::flushGlobal()
+{
+    if (auto cache(drvHashCache.readLock()); *cache && **cache)
+        (**cache)->flush();
+}
+
+ref<DrvHashCache> DrvHashCache::getTest(SQLiteSettings sqliteSettings, std::filesystem::path dbPath)
+{
+    return make_ref<DrvHashCacheImpl>(sqliteSettings, dbPath);
+}
+
+} // namespace nix
@@ -58,6 +58,17 @@ public:
         "local-nar-cache",
         "Path to a local cache of NARs fetched from this binary cache, used by commands such as `nix store cat`."};
 
+    Setting<uint64_t> localNarCacheSize{
+        this,
+        0,
+        "local-nar-cache-size",
+        R"(
+          The maximum size in bytes of the `local-nar-cache` directory.
+          When exceeded, the least recently used NARs are removed from it.
+          `0` means no limit. The directory may be shared by multiple
+          stores and processes.
+        )"};
+
     Setting<bool> parallelCompression{
         this,
         false,
@@ -77,6 +88,30 @@ public:
           The meaning and accepted values depend on the compression method selected.
           `-1` specifies that the default compression level should be used.
         )"};
+
+    Setting<unsigned int> uploadConcurrency{
+        this,
+        16,
+        "upload-concurrency",
+        R"(
+          The maximum number of NARs to upload to this cache in parallel
+          when copying multiple paths (e.g. with `nix copy`). Up to one
+          NAR per CPU core is compressed at the same time, and each NAR is
+          uploaded as soon as it has been compressed. Compression pauses
+          while more than twice this many compressed NARs (plus the ones
+          being compressed) are kept on disk waiting to be uploaded.
+        )"};
+
+    Setting<bool> useDeltas{
+        this,
+        true,
+        "use-deltas",
+        R"(
+          When copying a path from this cache, download its NAR as a
+          delta against an older version of the path if the cache
+          advertises one and the destination store already has that
+          version. Deltas are created with `nix store add-delta`.
+        )"};
 };
 
 /**
@@ -198,6 +233,26 @@ private:
 
     void writeNarInfo(ref<NarInfo> narInfo);
 
+    /**
+     * A NAR that has been serialised, hashed and compressed into a
+     * temporary file, but not uploaded yet.
+     */
+    struct CompressedNar;
+
+    /**
+     * The CPU-bound half of `uploadData()`: read the NAR from
+     * `narSource`, compress it into a temporary file, and construct the
+     * corresponding `NarInfo`.
+     */
+    CompressedNar compressNar(Source & narSource, fun<ValidPathInfo(HashResult)> mkInfo);
+
+    /**
+     * The I/O-bound half of `uploadData()`: upload a NAR produced by
+     * `compressNar()`, together with its optional NAR listing and
+     * debuginfo links.
+     */
+    void uploadCompressedNar(CompressedNar & nar, RepairFlag repair);
+
     /**
      * Upload the NAR for a path and everything else *except* the
      * `.narinfo` file (i.e. the compressed NAR, an optional NAR
@@ -264,6 +319,15 @@ public:
 
     void narFromPath(const StorePath & path, Sink & sink) override;
 
+    void narFromPathForCopy(const StorePath & path, Sink & sink, Store & dstStore) override;
+
+    /**
+     * Upload a delta that reconstructs the NAR of `path` from the NAR
+     * of `basePath`, and advertise it in the `.narinfo` of `path`.
+     * Both paths must already be in this cache.
+     */
+    void addNarDelta(const StorePath & path, const StorePath & basePath);
+
     ref<SourceAccessor> getFSAccessor(bool requireValidPath = true) override;
 
     std::shared_ptr<SourceAccessor> getFSAccessor(const StorePath &, bool requireValidPath = true) override;
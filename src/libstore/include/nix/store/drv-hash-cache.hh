@@ -0,0 +1,77 @@
+#pragma once
+///@file
+
+#include "nix/util/ref.hh"
+#include "nix/store/derivations.hh"
+
+#include <filesystem>
+#include <optional>
+
+namespace nix {
+
+struct SQLiteSettings;
+
+/**
+ * A persistent cache of `hashDerivationModulo()` results in the
+ * user's cache directory, so that a new process doesn't have to read
+ * and parse every `.drv` in the closure of a derivation again to hash
+ * it.
+ *
+ * Entries are keyed by the printed store path of the derivation.
+ * Since that path is determined by the contents of the derivation,
+ * entries never need to be invalidated.
+ *
+ * The cache is only an optimisation: if the database can't be read
+ * or written, `hashDerivationModulo()` just reads the derivations
+ * again, so failures are only logged at debug level.
+ */
+struct DrvHashCache
+{
+private:
+    /* VTable anchor to avoid weak linkage of the vtable - it breaks
+       dynamic_cast across shared libraries on Darwin. */
+    virtual void anchor();
+public:
+
+    virtual ~DrvHashCache() {}
+
+    virtual std::optional<DrvHashModulo> lookup(const StoreDirConfig & store, const StorePath & drvPath) = 0;
+
+    /**
+     * Record the `hashDerivationModulo(store, drv, false)` of the
+     * derivation `drvPath`. Entries may be written to disk in batches,
+     * but are visible to `lookup()` immediately.
+     */
+    virtual void upsert(const StoreDirConfig & store, const StorePath & drvPath, const DrvHashModulo & hash) = 0;
+
+    /**
+     * Write the entries recorded by `upsert()` to disk. This happens
+     * automatically once enough have accumulated and when the cache is
+     * destroyed.
+     */
+    virtual void flush() = 0;
+
+    /**
+     * Return a singleton cache object that can be used concurrently by
+     * multiple threads, opening it on first use. Returns null if the
+     * cache cannot be opened or has been disabled with `set()`.
+     */
+    static std::shared_ptr<DrvHashCache> get();
+
+    /**
+     * Replace the object returned by `get()`, e.g. with one returned
+     * by `getTest()`. Null disables the cache.
+     */
+    static void set(std::shared_ptr<DrvHashCache> cache);
+
+    /**
+     * Flush the object returned by `get()`, if it has been opened.
+     * This must be called before replacing the process with `exec()`,
+     * which doesn't run the destructor.
+     */
+    static void flushGlobal();
+
+    static ref<DrvHashCache> getTest(SQLiteSettings, std::filesystem::path dbPath);
+};
+
+} // namespace nix
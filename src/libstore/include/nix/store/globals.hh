@@ -51,8 +51,14 @@ public:
         "compress-build-log",
         R"(
           If set to `true` (the default), build logs written to
-          `/nix/var/log/nix/drvs` are compressed on the fly using bzip2.
+          `/nix/var/log/nix/drvs` are compressed on the fly using zstd.
           Otherwise, they are not compressed.
+
+          Compressed logs are split into independently compressed
+          frames and end in an index of those frames, so that
+          [`nix log --tail`](@docroot@/command-ref/new-cli/nix3-log.md)
+          doesn't need to decompress the whole log. Logs compressed
+          with bzip2 by older versions of Nix can still be read.
         )",
         {"build-compress-log"}};
 };
@@ -38,6 +38,16 @@ public:
 
     Setting<int> maxConnections{this, 1, "max-connections", "Maximum number of concurrent SSH connections."};
 
+    Setting<bool> streamCompression{
+        this,
+        false,
+        "stream-compression",
+        R"(
+          Whether to compress the `nix-store --serve` session with zstd,
+          if the remote side supports it. The compression level adapts to
+          whether the connection or the CPU is the bottleneck.
+        )"};
+
     /**
      * Hack for hydra
      */
@@ -133,6 +133,17 @@ public:
     }
 
     std::optional<std::string> getBuildLogExact(const StorePath & path) override;
+
+    std::optional<std::string>
+    getBuildLogRangeExact(const StorePath & drvPath, int64_t offset, uint64_t length) override;
+
+    bool canReadBuildLogRange(const StorePath & drvPath) override;
+
+    /**
+     * Call `callback` for every line containing `needle` in the build
+     * logs in this store.
+     */
+    void grepBuildLogs(std::string_view needle, fun<void(const StorePath & drvPath, std::string_view line)> callback);
 };
 
 } // namespace nix
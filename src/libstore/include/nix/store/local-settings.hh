@@ -273,6 +273,47 @@ public:
           duplicate files.
         )"};
 
+    Setting<bool> optimiseWithReflinks{
+        this,
+        false,
+        "optimise-with-reflinks",
+        R"(
+          If set to `true`, store optimisation (`nix store optimise` and
+          [`auto-optimise-store`](#conf-auto-optimise-store)) makes files
+          with identical contents share their data on disk (reflinks),
+          instead of replacing them with hard links. The files remain
+          independent, so that one can be repaired without affecting the
+          others. (The first file with given contents is still
+          hard-linked into the index in `/nix/store/.links`, which lets
+          the garbage collector tell when the index entry is unused.)
+          This requires a file system that supports it, such as btrfs or
+          XFS; on other file systems, files are not deduplicated.
+        )"};
+
+    Setting<uint64_t> scrubBandwidth{
+        this,
+        0,
+        "scrub-bandwidth",
+        R"(
+          The maximum number of bytes per second read from the store when
+          verifying its contents, as done by `nix-store --verify
+          --check-contents` and by [`scrub-interval`](#conf-scrub-interval).
+          A value of `0` (the default) means unlimited.
+        )"};
+
+    Setting<unsigned int> scrubInterval{
+        this,
+        0,
+        "scrub-interval",
+        R"(
+          If set to a non-zero value, the Nix daemon continuously verifies
+          the contents of the store in the background, starting a new pass
+          this many seconds after the previous one finished. An
+          interrupted pass resumes where it left off. Corrupted paths are
+          reported in the daemon's log. A value of `0` (the default)
+          disables background verification.
+        )"};
+
     Setting<size_t> narBufferSize{
         this, 32 * 1024 * 1024, "nar-buffer-size", "Maximum size of NARs before spilling them to disk."};
 
@@ -8,6 +8,7 @@
 #include "nix/store/indirect-root-store.hh"
 #include "nix/store/active-builds.hh"
 #include "nix/util/sync.hh"
+#include "nix/util/canon-path.hh"
 
 #include <atomic>
 #include <chrono>
@@ -313,6 +314,15 @@ public:
         RepairFlag repair,
         std::shared_ptr<const Provenance> provenance) override;
 
+    StorePath addToStore(
+        std::string_view name,
+        const SourcePath & path,
+        ContentAddressMethod method,
+        HashAlgorithm hashAlgo,
+        const StorePathSet & references,
+        PathFilter & filter,
+        RepairFlag repair) override;
+
     void addTempRoots(const StorePathSet & paths) override;
 
 private:
@@ -414,11 +424,48 @@ public:
     /**
      * Optimise a single store path. Optionally, test the encountered
      * symlinks for corruption.
+     *
+     * @param fileHashes If given, the NAR hashes of the files in
+     * `path` (see `PathScanResult::fileHashes`), which are then used
+     * instead of hashing the files again.
      */
-    void optimisePath(const std::filesystem::path & path, RepairFlag repair);
+    void optimisePath(
+        const std::filesystem::path & path,
+        RepairFlag repair,
+        const std::map<CanonPath, Hash> * fileHashes = nullptr);
 
     bool verifyStore(bool checkContents, RepairFlag repair) override;
 
+    struct ScrubOptions
+    {
+        /**
+         * Resume from and record progress in
+         * `<state-dir>/scrub-cursor`, so that an interrupted scrub
+         * continues where it left off. Once all paths have been
+         * checked, the cursor is removed, so the next resumed scrub
+         * starts from the beginning. This is meant for background
+         * scrubbing; an explicit verification should check
+         * everything.
+         */
+        bool resume = false;
+
+        /**
+         * If set, stop after checking this many paths. Only useful
+         * with `resume`, which lets the next scrub continue there.
+         */
+        std::optional<size_t> maxPaths;
+    };
+
+    /**
+     * Check the contents of the `.links` directory and of `paths`
+     * against their recorded hashes, using all cores and reading at
+     * most `scrub-bandwidth` bytes per second. Corrupted paths are
+     * reported as `resCorruptedPath` results.
+     *
+     * @return Whether any errors were found.
+     */
+    bool scrubStore(const StorePathSet & paths, RepairFlag repair, const ScrubOptions & options);
+
 protected:
 
     /**
@@ -534,6 +581,14 @@ private:
 
     std::pair<std::filesystem::path, AutoCloseFD> createTempDirInStore();
 
+    /**
+     * Whether files can be cloned on the store's file system (see
+     * `cloneFile()`). This is probed on first use.
+     */
+    bool canCloneFiles();
+
+    Sync<std::optional<bool>> _canCloneFiles;
+
     typedef boost::concurrent_flat_set<ino_t> InodeHash;
 
     InodeHash loadInodeHash();
@@ -543,7 +598,14 @@ private:
         OptimiseStats & stats,
         const std::filesystem::path & path,
         InodeHash & inodeHash,
-        RepairFlag repair);
+        RepairFlag repair,
+        const std::map<CanonPath, Hash> * fileHashes = nullptr,
+        const CanonPath & relPath = CanonPath::root);
+    void reflinkPath(
+        Activity * act,
+        OptimiseStats & stats,
+        const std::filesystem::path & path,
+        const std::filesystem::path & linkPath);
 
     // Internal versions that are not wrapped in retry_sqlite.
     bool isValidPath_(State & state, const StorePath & path);
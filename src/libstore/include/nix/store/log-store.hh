@@ -21,6 +21,36 @@ public:
 
     virtual std::optional<std::string> getBuildLogExact(const StorePath & path) = 0;
 
+    /**
+     * Return at most `length` bytes of the build log of the specified
+     * store path, starting at byte `offset`. A negative `offset`
+     * counts from the end of the log.
+     */
+    std::optional<std::string> getBuildLogRange(const StorePath & path, int64_t offset, uint64_t length);
+
+    /**
+     * Return the last `nrLines` lines of the build log of the
+     * specified store path.
+     */
+    std::optional<std::string> getBuildLogTail(const StorePath & path, size_t nrLines);
+
+    /**
+     * Like `getBuildLogRange()`, but for a derivation. The default
+     * implementation gets the entire log; stores that can read part
+     * of a log cheaply override this.
+     */
+    virtual std::optional<std::string>
+    getBuildLogRangeExact(const StorePath & drvPath, int64_t offset, uint64_t length);
+
+    /**
+     * Whether `getBuildLogRangeExact()` can read part of the build log
+     * of `drvPath` without fetching or decompressing all of it.
+     */
+    virtual bool canReadBuildLogRange(const StorePath & drvPath)
+    {
+        return false;
+    }
+
     virtual void addBuildLog(const StorePath & path, std::string_view log) = 0;
 
     static LogStore & require(Store & store);
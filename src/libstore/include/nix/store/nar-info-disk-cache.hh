@@ -12,6 +12,7 @@ namespace nix {
 
 struct SQLiteSettings;
 struct NarInfoDiskCacheSettings;
+struct SubstituterStats;
 
 struct NarInfoDiskCache
 {
@@ -64,6 +65,21 @@ public:
     virtual std::pair<Outcome, std::shared_ptr<Realisation>>
     lookupRealisation(const std::string & uri, const DrvOutput & id) = 0;
 
+    /**
+     * Update the moving average of the `.narinfo` lookup latency of the
+     * binary cache at `uri`. Samples are written to disk in batches, so
+     * `lookupSubstituterStats()` may not see the latest ones.
+     */
+    virtual void recordNarInfoLatency(const std::string & uri, uint64_t latencyMs) = 0;
+
+    /**
+     * Update the moving average of the NAR download throughput (in
+     * bytes per second) of the binary cache at `uri`.
+     */
+    virtual void recordDownloadThroughput(const std::string & uri, uint64_t throughput) = 0;
+
+    virtual std::optional<SubstituterStats> lookupSubstituterStats(const std::string & uri) = 0;
+
     /**
      * Return a singleton cache object that can be used concurrently by
      * multiple threads.
@@ -10,6 +10,31 @@ namespace nix {
 
 struct StoreDirConfig;
 
+/**
+ * A delta that reconstructs a NAR from the NAR of another store path
+ * (see `compressDelta()`).
+ */
+struct NarDelta
+{
+    std::string url;
+
+    /**
+     * The store path whose NAR the delta is relative to.
+     */
+    StorePath base;
+
+    /**
+     * The NAR hash of `base` the delta was made against. A client must
+     * only use the delta if its copy of `base` has the same NAR hash,
+     * since input-addressed paths need not be reproducible.
+     */
+    Hash baseNarHash;
+
+    uint64_t fileSize = 0;
+
+    bool operator==(const NarDelta &) const = default;
+};
+
 struct UnkeyedNarInfo : virtual UnkeyedValidPathInfo
 {
     std::string url;
@@ -17,6 +42,12 @@ struct UnkeyedNarInfo : virtual UnkeyedValidPathInfo
     std::optional<Hash> fileHash;
     uint64_t fileSize = 0;
 
+    /**
+     * Optional alternative to downloading `url` for clients that
+     * already have `delta->base`.
+     */
+    std::optional<NarDelta> delta;
+
     UnkeyedNarInfo(UnkeyedValidPathInfo info)
         : UnkeyedValidPathInfo(std::move(info))
     {
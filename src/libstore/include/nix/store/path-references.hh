@@ -4,6 +4,7 @@
 #include "nix/store/references.hh"
 #include "nix/store/path.hh"
 #include "nix/util/source-accessor.hh"
+#include "nix/util/hash.hh"
 
 #include <functional>
 #include <vector>
@@ -12,6 +13,39 @@ namespace nix {
 
 StorePathSet scanForReferences(Sink & toTee, const std::filesystem::path & path, const StorePathSet & refs);
 
+/**
+ * Result of `scanAndHashPath()`.
+ */
+struct PathScanResult
+{
+    /**
+     * The subset of the scanned-for store paths that occur in the NAR
+     * serialisation of the path.
+     */
+    StorePathSet references;
+
+    /**
+     * SHA-256 hash and size of the NAR serialisation of the path.
+     */
+    HashResult narHash;
+
+    /**
+     * SHA-256 hash of the NAR serialisation of every regular file and
+     * symlink in the path, keyed by its position relative to the root
+     * of the path. These are the hashes `LocalStore::optimisePath()`
+     * would compute. Only filled in if requested.
+     */
+    std::map<CanonPath, Hash> fileHashes;
+};
+
+/**
+ * Serialise `path` once, and from that single traversal both scan it
+ * for references to `refs` and compute its NAR hash. If `hashFiles` is
+ * set, also compute the NAR hash of each individual file, so that the
+ * store optimiser doesn't have to read the files again.
+ */
+PathScanResult scanAndHashPath(const std::filesystem::path & path, const StorePathSet & refs, bool hashFiles);
+
 class PathRefScanSink : public RefScanSink
 {
     std::map<std::string, StorePath> backMap;
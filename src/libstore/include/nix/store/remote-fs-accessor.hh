@@ -38,7 +38,11 @@ public:
      */
     std::shared_ptr<SourceAccessor> accessObject(const StorePath & path);
 
-    RemoteFSAccessor(ref<Store> store, bool requireValidPath = true, std::optional<AbsolutePath> cacheDir = {});
+    RemoteFSAccessor(
+        ref<Store> store,
+        bool requireValidPath = true,
+        std::optional<AbsolutePath> cacheDir = {},
+        uint64_t cacheMaxSize = 0);
 
     std::optional<Stat> maybeLstat(const CanonPath & path) override;
 
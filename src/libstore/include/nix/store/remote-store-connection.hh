@@ -29,6 +29,15 @@ public:
     std::chrono::time_point<std::chrono::steady_clock> startTime;
 };
 
+/**
+ * Connection used by the Remote Store implementation for requests that
+ * may be multiplexed (see `WorkerProto::isMultiplexable()`).
+ */
+struct RemoteStore::MultiplexedConnection : WorkerProto::MultiplexedClientConnection
+{
+    using WorkerProto::MultiplexedClientConnection::MultiplexedClientConnection;
+};
+
 /**
  * A wrapper around Pool<RemoteStore::Connection>::Handle that marks
  * the connection as bad (causing it to be closed) if a non-daemon
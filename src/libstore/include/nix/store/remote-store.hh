@@ -11,6 +11,7 @@
 #include "nix/store/gc-store.hh"
 #include "nix/store/log-store.hh"
 #include "nix/store/active-builds.hh"
+#include "nix/store/worker-protocol.hh"
 
 namespace nix {
 
@@ -41,6 +42,30 @@ public:
         std::numeric_limits<unsigned int>::max(),
         "max-connection-age",
         "Maximum age of a connection before it is closed."};
+
+    Setting<bool> streamCompression{
+        this,
+        false,
+        "stream-compression",
+        R"(
+          Whether to compress the connection to the Nix daemon with zstd,
+          if the daemon supports it. The compression level adapts to
+          whether the connection or the CPU is the bottleneck. This is
+          mostly useful for `ssh-ng://` stores on slow links.
+        )"};
+
+    Setting<bool> multiplexing{
+        this,
+        true,
+        "multiplexing",
+        R"(
+          Whether to send queries such as path info lookups to the Nix
+          daemon over a single multiplexed connection, if the daemon
+          supports it. Many threads can then have queries in flight at
+          the same time, without each of them needing a connection of
+          its own, and the daemon answers each query as soon as it's
+          done.
+        )"};
 };
 
 /**
@@ -204,6 +229,34 @@ protected:
 
     ConnectionHandle getConnection();
 
+    struct MultiplexedConnection;
+
+    /**
+     * The connection for multiplexed requests. Opened on first use.
+     */
+    Sync<std::shared_ptr<MultiplexedConnection>> multiplexedConnection;
+
+    /**
+     * Set if the daemon doesn't support multiplexed requests.
+     */
+    std::atomic_bool multiplexingUnsupported{false};
+
+    /**
+     * Get the connection for multiplexed requests, or nullptr if
+     * `multiplexing` is disabled or the daemon doesn't support it.
+     */
+    std::shared_ptr<MultiplexedConnection> getMultiplexedConnection();
+
+    /**
+     * Perform an operation that may be multiplexed (see
+     * `WorkerProto::isMultiplexable()`), on the multiplexed connection
+     * if possible and on a connection from the pool otherwise.
+     * `writeRequest` must write the operation and its arguments;
+     * `readReply` reads the result.
+     */
+    void performMultiplexable(
+        fun<void(WorkerProto::WriteConn)> writeRequest, fun<void(WorkerProto::ReadConn)> readReply);
+
     friend struct ConnectionHandle;
 
     virtual ref<SourceAccessor> getFSAccessor(bool requireValidPath = true) override;
@@ -109,6 +109,17 @@ struct S3BinaryCacheStoreConfig : HttpBinaryCacheStoreConfig
           Default is 100 MiB. Only takes effect when multipart-upload is enabled.
         )"};
 
+    Setting<unsigned int> multipartConcurrency{
+        this,
+        4,
+        "multipart-concurrency",
+        R"(
+          The maximum number of parts of a multipart upload to upload in
+          parallel. Each part in flight is held in memory, so this
+          multiplied by `multipart-chunk-size` bounds the memory used
+          per upload. Only takes effect when multipart-upload is enabled.
+        )"};
+
     Setting<std::optional<std::string>> storageClass{
         this,
         std::nullopt,
@@ -31,6 +31,13 @@ struct ServeProto::BasicClientConnection
     static ServeProto::Version
     handshake(BufferedSink & to, Source & from, ServeProto::Version localVersion, std::string_view host);
 
+    /**
+     * Ask the remote side to compress the rest of the session with
+     * zstd, and do the same on our side. Does nothing if the remote
+     * side is too old to support it.
+     */
+    void enableCompression();
+
     /**
      * Coercion to `ServeProto::ReadConn`. This makes it easy to use the
      * factored out serve protocol serializers with a
@@ -8,7 +8,7 @@ namespace nix {
 #define SERVE_MAGIC_1 0x390c9deb
 #define SERVE_MAGIC_2 0x5452eecb
 
-#define SERVE_PROTOCOL_VERSION (2 << 8 | 8)
+#define SERVE_PROTOCOL_VERSION (2 << 8 | 9)
 #define GET_PROTOCOL_MAJOR(x) ((x) & 0xff00)
 #define GET_PROTOCOL_MINOR(x) ((x) & 0x00ff)
 struct StoreDirConfig;
@@ -69,7 +69,7 @@ struct ServeProto
 
     static constexpr Version latest = {
         .major = 2,
-        .minor = 8,
+        .minor = 9,
     };
 
     /**
@@ -152,6 +152,12 @@ enum struct ServeProto::Command : uint64_t {
     QueryClosure = 7,
     BuildDerivation = 8,
     AddToStoreNar = 9,
+    /**
+     * Switch the rest of the session to zstd stream compression.
+     *
+     * @since 2.9
+     */
+    EnableCompression = 10,
 };
 
 struct ServeProto::BuildOptions
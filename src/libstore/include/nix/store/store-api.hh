@@ -76,6 +76,25 @@ struct MissingPaths
     uint64_t narSize{0};
 };
 
+/**
+ * The performance of a store when used as a substituter, as recorded
+ * across invocations by the NAR info disk cache.
+ */
+struct SubstituterStats
+{
+    /**
+     * Moving average of the time to look up a `.narinfo`, in
+     * milliseconds.
+     */
+    std::optional<uint64_t> narInfoLatencyMs;
+
+    /**
+     * Moving average of the throughput of NAR downloads, in bytes per
+     * second.
+     */
+    std::optional<uint64_t> downloadThroughput;
+};
+
 /**
  * Need to make this a separate class so I can get the right
  * initialization order in the constructor for `StoreConfig`.
@@ -448,6 +467,13 @@ protected:
 
     std::shared_ptr<NarInfoDiskCache> diskCache;
 
+    /**
+     * The result of `getSubstituterStats()`. It's queried for every
+     * path that may be substituted, so it's read from the disk cache
+     * only once per process.
+     */
+    Sync<std::optional<std::optional<SubstituterStats>>> substituterStats;
+
     Store(const Store::Config & config);
 
 public:
@@ -770,6 +796,17 @@ public:
      */
     virtual void narFromPath(const StorePath & path, Sink & sink);
 
+    /**
+     * Write a NAR dump of a store path that is being copied to
+     * `dstStore`. Stores that can send deltas override this to
+     * reconstruct the NAR from a similar path that `dstStore` already
+     * has, instead of transferring all of it.
+     */
+    virtual void narFromPathForCopy(const StorePath & path, Sink & sink, Store & dstStore)
+    {
+        narFromPath(path, sink);
+    }
+
     /**
      * For each path, if it's a derivation, build it.  Building a
      * derivation means ensuring that the output paths are valid.  If
@@ -1056,10 +1093,12 @@ public:
         std::atomic<uint64_t> narInfoReadAverted{0};
         std::atomic<uint64_t> narInfoMissing{0};
         std::atomic<uint64_t> narInfoWrite{0};
+        std::atomic<uint64_t> narInfoReadTimeMs{0};
         std::atomic<uint64_t> pathInfoCacheSize{0};
         std::atomic<uint64_t> narRead{0};
         std::atomic<uint64_t> narReadBytes{0};
         std::atomic<uint64_t> narReadCompressedBytes{0};
+        std::atomic<uint64_t> narReadTimeMs{0};
         std::atomic<uint64_t> narWrite{0};
         std::atomic<uint64_t> narWriteAverted{0};
         std::atomic<uint64_t> narWriteBytes{0};
@@ -1069,6 +1108,13 @@ public:
 
     const Stats & getStats();
 
+    /**
+     * Return the performance of this store as a substituter in previous
+     * invocations, if it has a NAR info disk cache. This is read once
+     * and doesn't reflect samples recorded by this process.
+     */
+    std::optional<SubstituterStats> getSubstituterStats();
+
     /**
      * Computes the full closure of of a set of store-paths for e.g.
      * derivations that need this information for `exportReferencesGraph`.
@@ -1139,6 +1185,12 @@ protected:
 
     Stats stats;
 
+    /**
+     * Warn (or fail, in tests) if `path`, which has been added to the
+     * store as `narSize` bytes, exceeds `warn-large-path-threshold`.
+     */
+    void warnIfLargePath(const SourcePath & path, uint64_t narSize);
+
     /**
      * Helper for methods that are not unsupported: this is used for
      * default definitions for virtual methods that are meant to be overridden.
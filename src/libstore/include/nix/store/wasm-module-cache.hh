@@ -0,0 +1,39 @@
+#pragma once
+///@file
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace nix {
+
+/**
+ * A persistent cache of compiled Wasm modules in the user's cache
+ * directory, shared by `builtins.wasm` and the WASI derivation
+ * builder. Compiling a large module can take seconds, so callers
+ * store the serialized result of compilation here and deserialize it
+ * in later processes.
+ *
+ * Entries are keyed by the hash of the module's bytes, in a separate
+ * directory for each `engineKey`, which must identify the Wasm
+ * runtime version and the engine configuration used to compile the
+ * module. Each entry starts with a checksum of the compiled module,
+ * which is verified on lookup, since the runtime trusts what it
+ * deserializes. The runtime still rejects artifacts that are
+ * incompatible with the engine, in which case callers should just
+ * compile the module again.
+ *
+ * Errors are never fatal: they're logged and treated as a cache miss.
+ */
+std::optional<std::string> lookupCompiledWasmModule(std::string_view engineKey, std::span<const uint8_t> wasm);
+
+/**
+ * Add the serialized compiled form of `wasm` to the cache, replacing
+ * any previous entry.
+ */
+void storeCompiledWasmModule(
+    std::string_view engineKey, std::span<const uint8_t> wasm, std::span<const uint8_t> compiled);
+
+} // namespace nix
@@ -3,6 +3,10 @@
 
 #include "nix/store/worker-protocol.hh"
 #include "nix/store/store-api.hh"
+#include "nix/util/sync.hh"
+
+#include <map>
+#include <thread>
 
 namespace nix {
 
@@ -23,6 +27,13 @@ struct WorkerProto::BasicConnection
      */
     WorkerProto::Version protoVersion;
 
+    /**
+     * Wrap `to` and `from` in zstd stream compression if
+     * `featureZstdStreamCompression` was negotiated. Both sides must
+     * call this right after the handshake.
+     */
+    void maybeEnableStreamCompression();
+
     /**
      * Coercion to `WorkerProto::ReadConn`. This makes it easy to use the
      * factored out serve protocol serializers with a
@@ -122,6 +133,76 @@ struct WorkerProto::BasicClientConnection : WorkerProto::BasicConnection
         const StoreDirConfig & store, bool * daemonException, const StorePath & path, fun<void(Source &)> receiveNar);
 };
 
+/**
+ * A client connection in multiplexed mode (see
+ * `WorkerProto::featureMultiplexing`). Any number of threads can have
+ * requests in flight on it at the same time. A reader thread
+ * dispatches the frames sent by the daemon, which can arrive in any
+ * order, to the threads waiting for them.
+ */
+struct WorkerProto::MultiplexedClientConnection
+{
+    /**
+     * Switch `conn` to multiplexed mode. `featureMultiplexing` must
+     * have been negotiated. `conn` must not be used directly anymore
+     * afterwards.
+     */
+    MultiplexedClientConnection(ref<BasicClientConnection> conn);
+
+    /**
+     * Close the connection. There must be no requests in flight.
+     */
+    ~MultiplexedClientConnection();
+
+    /**
+     * Whether the connection is still usable, i.e. hasn't been
+     * closed or broken.
+     */
+    bool good();
+
+    /**
+     * Send a request and wait for the reply. `writeRequest` must write
+     * the operation and its arguments; `readReply` is called to read
+     * the result after the daemon's log messages for this request
+     * have been processed. If the daemon reports an error, it is
+     * thrown instead.
+     */
+    void call(fun<void(WorkerProto::WriteConn)> writeRequest, fun<void(WorkerProto::ReadConn)> readReply);
+
+private:
+
+    struct Request;
+    struct ReplySource;
+
+    ref<BasicClientConnection> conn;
+
+    struct State
+    {
+        uint64_t nextId = 1;
+
+        /**
+         * The requests that are waiting for (the rest of) a reply.
+         */
+        std::map<uint64_t, std::shared_ptr<Request>> requests;
+
+        /**
+         * The error that broke the connection, if any.
+         */
+        std::exception_ptr failure;
+    };
+
+    Sync<State> state_;
+
+    /**
+     * Serialises writes to `conn->to`.
+     */
+    std::mutex writeLock;
+
+    std::thread readerThread;
+
+    void reader();
+};
+
 struct WorkerProto::BasicServerConnection : WorkerProto::BasicConnection
 {
     /**
@@ -142,6 +142,34 @@ struct WorkerProto
      */
     static constexpr std::string_view featureDisableSetOptions = "disable-set-options";
 
+    /**
+     * Feature for compressing everything after the handshake with a
+     * zstd stream. Only offered by clients that have
+     * `stream-compression` enabled for the store.
+     */
+    static constexpr std::string_view featureZstdStreamCompression = "zstd-stream-compression";
+
+    /**
+     * Feature for switching a connection to multiplexed mode with
+     * `Op::Multiplex`. In this mode the client tags each request with
+     * an ID and can have many requests in flight at the same time. The
+     * daemon serves them concurrently and replies in any order.
+     *
+     * After the daemon has acknowledged `Op::Multiplex` with
+     * `STDERR_LAST`, every message in either direction is a frame
+     * consisting of a request ID and a string. The client sends each
+     * request as one frame holding the operation and its arguments, as
+     * they would be sent on a normal connection. The daemon sends the
+     * log messages and the reply for that request, again as on a
+     * normal connection, split over any number of frames tagged with
+     * the request ID, followed by an empty frame. Only the operations
+     * accepted by `isMultiplexable()` can be sent in multiplexed mode.
+     * The daemon stops reading requests while too many of them are in
+     * flight, so clients must keep reading replies while sending
+     * requests.
+     */
+    static constexpr std::string_view featureMultiplexing = "multiplexing";
+
     /**
      * A unidirectional read connection, to be used by the read half of the
      * canonical serializers below.
@@ -172,6 +200,7 @@ struct WorkerProto
     struct BasicConnection;
     struct BasicClientConnection;
     struct BasicServerConnection;
+    struct MultiplexedClientConnection;
 
     /**
      * Extra information provided as part of protocol negotiation.
@@ -218,6 +247,15 @@ struct WorkerProto
     {
         WorkerProto::Serialise<T>::write(store, conn, t);
     }
+
+    /**
+     * Whether `op` may be sent on a connection in multiplexed mode (see
+     * `featureMultiplexing`). These are the operations that don't
+     * stream data, don't depend on per-connection state and don't
+     * query substituters. (`QueryValidPaths` may do the latter, which
+     * could tie up the daemon's worker threads for a long time.)
+     */
+    static bool isMultiplexable(Op op);
 };
 
 enum struct WorkerProto::Op : uint64_t {
@@ -268,6 +306,7 @@ enum struct WorkerProto::Op : uint64_t {
     QueryActiveBuilds = 48,
     AddTempRoots = 49,
     QueryPathInfos = 50,
+    Multiplex = 51,
 };
 
 struct WorkerProto::ClientHandshakeInfo
@@ -310,6 +310,24 @@ public:
         )",
         {"binary-caches"}};
 
+    Setting<bool> raceSubstituters{
+        this,
+        false,
+        "race-substituters",
+        R"(
+          If set to `true`, Nix looks up each path in all
+          [substituters](#conf-substituters) concurrently, rather than
+          trying them one after the other in priority order. The path is
+          then downloaded from the substituter that has a valid signature
+          for it and that is expected to be fastest, based on the latency
+          and throughput it had in previous downloads. Substituters that
+          have not been used before are not waited for if another one
+          has already responded.
+
+          This prevents a slow or unresponsive substituter from delaying
+          every substitution by its full timeout.
+        )"};
+
     Setting<unsigned long> maxLogSize{
         this,
         0,
@@ -91,6 +91,9 @@ ref<LegacySSHStore::Connection> LegacySSHStore::openConnection()
         throw Error("cannot connect to '%1%'", config->authority.host);
     }
 
+    if (config->streamCompression)
+        conn->enableCompression();
+
     return conn;
 };
 
@@ -2,6 +2,9 @@
 #include "nix/store/local-fs-store.hh"
 #include "nix/util/compression.hh"
 #include "nix/store/derivations.hh"
+#include "nix/util/file-system.hh"
+
+#include <limits>
 
 namespace nix {
 
@@ -178,29 +181,184 @@ std::shared_ptr<SourceAccessor> LocalFSStore::getFSAccessor(const StorePath & pa
 
 const std::filesystem::path LocalFSStore::drvsLogDir = "drvs";
 
+namespace {
+
+enum struct LogFormat { Plain, Zstd, Bzip2 };
+
+} // namespace
+
+static std::optional<std::pair<std::filesystem::path, LogFormat>>
+findBuildLog(const std::filesystem::path & logDir, const StorePath & drvPath)
+{
+    auto baseName = std::string(drvPath.to_string());
+
+    for (auto & logPath :
+         {logDir / LocalFSStore::drvsLogDir / baseName.substr(0, 2) / baseName.substr(2),
+          logDir / LocalFSStore::drvsLogDir / baseName})
+        for (auto & [ext, format] :
+             {std::pair{"", LogFormat::Plain}, {".zst", LogFormat::Zstd}, {".bz2", LogFormat::Bzip2}}) {
+            auto path = logPath;
+            path += ext;
+            if (pathExists(path))
+                return {{path, format}};
+        }
+
+    return std::nullopt;
+}
+
+/**
+ * Write the part of a build log starting at `offset` (counting from
+ * the end if negative) of at most `length` bytes to `sink`.
+ */
+static void readBuildLog(
+    const std::filesystem::path & logPath, LogFormat format, int64_t offset, uint64_t length, Sink & sink)
+{
+    auto start = [&](uint64_t size) -> uint64_t {
+        return offset < 0 ? size - std::min<uint64_t>(-offset, size) : std::min<uint64_t>(offset, size);
+    };
+
+    auto fd = openFileReadonly(logPath);
+    if (!fd)
+        throw NativeSysError("opening build log %s", PathFmt(logPath));
+
+    switch (format) {
+    case LogFormat::Plain: {
+        auto size = getFileSize(fd.get());
+        auto from = start(size);
+        copyFdRange(fd.get(), from, std::min(length, size - from), sink);
+        break;
+    }
+    case LogFormat::Zstd: {
+        /* Only decompress the frames we need. */
+        auto table = ZstdSeekTable::read(fd.get());
+        table.readRange(fd.get(), start(table.size()), length, sink);
+        break;
+    }
+    case LogFormat::Bzip2: {
+        auto log = decompress(CompressionAlgo::bzip2, readFile(fd.get()));
+        auto from = start(log.size());
+        sink(std::string_view(log).substr(from, length));
+        break;
+    }
+    }
+}
+
 std::optional<std::string> LocalFSStore::getBuildLogExact(const StorePath & path)
 {
-    auto baseName = path.to_string();
+    return getBuildLogRangeExact(path, 0, std::numeric_limits<uint64_t>::max());
+}
+
+std::optional<std::string>
+LocalFSStore::getBuildLogRangeExact(const StorePath & drvPath, int64_t offset, uint64_t length)
+{
+    auto log = findBuildLog(config.logDir.get(), drvPath);
+    if (!log)
+        return std::nullopt;
+
+    auto & [logPath, format] = *log;
+
+    StringSink sink;
+    try {
+        readBuildLog(logPath, format, offset, length, sink);
+    } catch (Error &) {
+        /* Treat corrupt compressed logs as missing. */
+        if (format == LogFormat::Plain)
+            throw;
+        return std::nullopt;
+    }
+    return std::move(sink.s);
+}
 
-    for (int j = 0; j < 2; j++) {
+bool LocalFSStore::canReadBuildLogRange(const StorePath & drvPath)
+{
+    /* bzip2 logs have to be decompressed in full. */
+    auto log = findBuildLog(config.logDir.get(), drvPath);
+    return log && log->second != LogFormat::Bzip2;
+}
 
-        auto logPath = config.logDir.get()
-                       / (j == 0 ? drvsLogDir / baseName.substr(0, 2) / baseName.substr(2) : drvsLogDir / baseName);
-        auto logBz2Path = logPath;
-        logBz2Path += ".bz2";
+void LocalFSStore::grepBuildLogs(
+    std::string_view needle, fun<void(const StorePath & drvPath, std::string_view line)> callback)
+{
+    auto grep = [&](const std::filesystem::path & logPath, std::string_view baseName) {
+        LogFormat format = LogFormat::Plain;
+        if (baseName.ends_with(".zst")) {
+            format = LogFormat::Zstd;
+            baseName.remove_suffix(4);
+        } else if (baseName.ends_with(".bz2")) {
+            format = LogFormat::Bzip2;
+            baseName.remove_suffix(4);
+        }
 
-        if (pathExists(logPath))
-            return readFile(logPath);
+        std::optional<StorePath> drvPath;
+        try {
+            drvPath = StorePath(baseName);
+        } catch (BadStorePath &) {
+            return;
+        }
 
-        else if (pathExists(logBz2Path)) {
-            try {
-                return decompress(CompressionAlgo::bzip2, readFile(logBz2Path));
-            } catch (Error &) {
+        /* Search for `needle` in a sequence of complete lines. */
+        auto search = [&](std::string_view text) {
+            for (size_t pos = 0; (pos = text.find(needle, pos)) != text.npos;) {
+                auto lineStart = text.rfind('\n', pos);
+                lineStart = lineStart == text.npos ? 0 : lineStart + 1;
+                auto lineEnd = std::min(text.find('\n', pos), text.size());
+                callback(*drvPath, text.substr(lineStart, lineEnd - lineStart));
+                pos = lineEnd + 1;
+            }
+        };
+
+        /* The incomplete line at the end of the data seen so far. */
+        std::string pending;
+
+        LambdaSink sink([&](std::string_view data) {
+            if (!pending.empty()) {
+                auto nl = data.find('\n');
+                if (nl == data.npos) {
+                    pending += data;
+                    return;
+                }
+                pending += data.substr(0, nl);
+                search(pending);
+                pending.clear();
+                data.remove_prefix(nl + 1);
             }
+            auto nl = data.rfind('\n');
+            if (nl == data.npos) {
+                pending = data;
+                return;
+            }
+            search(data.substr(0, nl));
+            pending = data.substr(nl + 1);
+        });
+
+        try {
+            readBuildLog(logPath, format, 0, std::numeric_limits<uint64_t>::max(), sink);
+        } catch (Error & e) {
+            if (format == LogFormat::Plain)
+                throw;
+            warn("cannot read build log %s: %s", PathFmt(logPath), e.msg());
         }
-    }
 
-    return std::nullopt;
+        if (!pending.empty())
+            search(pending);
+    };
+
+    auto logDir = config.logDir.get() / drvsLogDir;
+    if (!pathExists(logDir))
+        return;
+
+    for (auto & entry : DirectoryIterator{logDir}) {
+        checkInterrupt();
+        auto name = entry.path().filename().string();
+        if (entry.is_directory()) {
+            for (auto & entry2 : DirectoryIterator{entry.path()}) {
+                checkInterrupt();
+                grep(entry2.path(), name + entry2.path().filename().string());
+            }
+        } else
+            /* Logs of old versions of Nix aren't in subdirectories. */
+            grep(entry.path(), name);
+    }
 }
 
 } // namespace nix
@@ -2,6 +2,8 @@
 #include "nix/store/globals.hh"
 #include "nix/util/git.hh"
 #include "nix/util/archive.hh"
+#include "nix/util/fs-sink.hh"
+#include "nix/util/reflink.hh"
 #include "nix/store/pathlocks.hh"
 #include "nix/store/worker-protocol.hh"
 #include "nix/store/derivations.hh"
@@ -27,6 +29,7 @@
 
 #include <memory>
 #include <new>
+#include <thread>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -1539,6 +1542,147 @@ StorePath LocalStore::addToStoreFromDump(
     return dstPath;
 }
 
+StorePath LocalStore::addToStore(
+    std::string_view name,
+    const SourcePath & path,
+    ContentAddressMethod method,
+    HashAlgorithm hashAlgo,
+    const StorePathSet & references,
+    PathFilter & filter,
+    RepairFlag repair)
+{
+    /* If `path` is a local directory or file on the same file system
+       as the store, and that file system can clone files, copy it with
+       `copyRecursive()`, which clones the files' extents instead of
+       streaming a NAR through this process. The data is then read only
+       once, to hash the copy. Otherwise the copy would have to read
+       the data as well, so the generic route is cheaper. Filtered and
+       flat imports can't be expressed as a plain copy, so they take
+       the generic route too. */
+    auto physicalPath = path.accessor->getPhysicalPath(path.path);
+    auto sameFileSystem = [&]() {
+        auto st = maybeLstat(*physicalPath);
+        return st && st->st_dev == lstat(config->realStoreDir.get()).st_dev;
+    };
+    if (&filter != &defaultPathFilter || method.getFileIngestionMethod() != FileIngestionMethod::NixArchive
+        || !physicalPath || !sameFileSystem() || !canCloneFiles())
+        return Store::addToStore(name, path, method, hashAlgo, references, filter, repair);
+
+    const LocalSettings & localSettings = config->getLocalSettings();
+
+    /* Clone first and hash the copy, rather than hashing the source
+       and then cloning it. That way the data is read only once, and
+       the hash is that of what ends up in the store even if the source
+       is modified concurrently. Cloning is cheap, so it doesn't matter
+       much that it's wasted if the path turns out to be valid. */
+    auto [tempDir, tempDirFd] = createTempDirInStore();
+    AutoDelete delTempDir(tempDir);
+    auto tempPath = tempDir / "x";
+
+    {
+        RestoreSink sink{localSettings.fsyncStorePaths};
+        sink.dstPath = tempPath;
+        copyRecursive(*path.accessor, path.path, sink, CanonPath::root);
+    }
+
+    /* Compute the NAR hash and the content-address hash in a single
+       pass. */
+    HashSink narHashSink{HashAlgorithm::SHA256};
+    std::optional<HashSink> caHashSink;
+    if (hashAlgo != HashAlgorithm::SHA256)
+        caHashSink.emplace(hashAlgo);
+    {
+        auto accessor = makeFSSourceAccessor(tempPath);
+        if (caHashSink) {
+            TeeSink both{narHashSink, *caHashSink};
+            accessor->dumpPath(CanonPath::root, both);
+        } else
+            accessor->dumpPath(CanonPath::root, narHashSink);
+    }
+    auto narHash = narHashSink.finish();
+    auto hash = caHashSink ? caHashSink->finish().hash : narHash.hash;
+    auto narSize = narHash.numBytesDigested;
+
+    auto desc = ContentAddressWithReferences::fromParts(
+        method,
+        hash,
+        {
+            .others = references,
+            .self = false,
+        });
+
+    auto dstPath = makeFixedOutputPathFromCA(name, desc);
+
+    addTempRoot(dstPath);
+
+    if (repair || !isValidPath(dstPath)) {
+
+        auto realPath = toRealPath(dstPath);
+
+        PathLocks outputLock({realPath});
+
+        if (repair || !isValidPathUncached(dstPath)) {
+
+            deletePath(realPath);
+
+            autoGC();
+
+            moveFile(tempPath, realPath);
+
+            canonicalisePathMetaData(realPath, {NIX_WHEN_SUPPORT_ACLS(localSettings.ignoredAcls)});
+
+            optimisePath(realPath, repair);
+
+            if (localSettings.fsyncStorePaths) {
+                recursiveSync(realPath);
+                syncParent(realPath);
+            }
+
+            auto info = ValidPathInfo::makeFromCA(*this, name, std::move(desc), narHash.hash);
+            info.narSize = narSize;
+            info.provenance = path.getProvenance();
+            registerValidPath(info);
+        } else
+            invalidatePathInfoCacheFor(dstPath);
+
+        outputLock.setDeletion(true);
+    }
+
+    warnIfLargePath(path, narSize);
+
+    return dstPath;
+}
+
+bool LocalStore::canCloneFiles()
+{
+    auto canClone(_canCloneFiles.lock());
+
+    if (!*canClone) {
+        auto [tempDir, tempDirFd] = createTempDirInStore();
+        AutoDelete delTempDir(tempDir);
+
+        auto fromPath = tempDir / "from";
+        writeFile(fromPath, "x");
+        auto from = openFileReadonly(fromPath);
+        if (!from)
+            throw SysError("opening %s", PathFmt(fromPath));
+
+        auto toPath = tempDir / "to";
+        auto to = openNewFileForWrite(toPath, 0600, {});
+        if (!to)
+            throw SysError("creating %s", PathFmt(toPath));
+
+        *canClone = cloneFile(from.get(), to.get());
+
+        debug(
+            "the file system of %s %s cloning files",
+            PathFmt(config->realStoreDir.get()),
+            *canClone ? "supports" : "doesn't support");
+    }
+
+    return **canClone;
+}
+
 /* Create a temporary directory in the store that won't be
    garbage-collected until the returned FD is closed. */
 std::pair<std::filesystem::path, AutoCloseFD> LocalStore::createTempDirInStore()
@@ -1598,90 +1742,229 @@ bool LocalStore::verifyStore(bool checkContents, RepairFlag repair)
     auto [errors, validPaths] = verifyAllValidPaths(repair);
 
     /* Optionally, check the content hashes (slow). */
-    if (checkContents) {
+    if (checkContents && scrubStore(validPaths, repair, {}))
+        errors = true;
+
+    return errors;
+}
 
+namespace {
+
+/**
+ * Limits the rate at which store contents are read by
+ * `scrubStore()`, shared between all its threads.
+ */
+struct ScrubThrottle
+{
+    /**
+     * Bytes per second, or 0 for unlimited.
+     */
+    uint64_t bandwidth;
+
+    /**
+     * The time at which the next read may start.
+     */
+    Sync<std::chrono::steady_clock::time_point> next_{std::chrono::steady_clock::now()};
+
+    /**
+     * Account for `n` bytes having been read, sleeping to stay under
+     * `bandwidth`.
+     */
+    void operator()(size_t n)
+    {
+        if (!bandwidth)
+            return;
+        std::chrono::steady_clock::time_point t;
+        {
+            auto next(next_.lock());
+            t = std::max(*next, std::chrono::steady_clock::now());
+            *next = t
+                    + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        std::chrono::duration<double>((double) n / bandwidth));
+        }
+        std::this_thread::sleep_until(t);
+        checkInterrupt();
+    }
+};
+
+} // namespace
+
+bool LocalStore::scrubStore(const StorePathSet & paths, RepairFlag repair, const ScrubOptions & options)
+{
+    /* Only one resumable scrub can run at a time, since they share
+       the cursor. */
+    AutoCloseFD fdScrubLock;
+    std::optional<FdLock> scrubLock;
+    if (options.resume) {
+        fdScrubLock = openLockFile(config->stateDir.get() / "scrub.lock", true);
+        scrubLock.emplace(fdScrubLock.get(), ltWrite, true, "waiting for another store scrub to finish...");
+    }
+
+    /* The cursor records the last path such that it and all paths
+       before it have been checked. Its absence means that the links
+       haven't been checked yet. */
+    auto cursorPath = config->stateDir.get() / "scrub-cursor";
+    std::optional<std::string> cursor;
+    if (options.resume && pathExists(cursorPath))
+        cursor = readFile(cursorPath);
+
+    auto writeCursor = [&](std::string_view lastChecked) {
+        if (options.resume)
+            writeFile(cursorPath, lastChecked);
+    };
+
+    ScrubThrottle throttle{config->getLocalSettings().scrubBandwidth};
+
+    auto hashContents = [&](const std::filesystem::path & path, HashAlgorithm ha) {
+        HashSink hashSink(ha);
+        LambdaSink sink([&](std::string_view data) {
+            throttle(data.size());
+            hashSink(data);
+        });
+        dumpPath(path, sink);
+        return hashSink.finish();
+    };
+
+    std::atomic<bool> errors{false};
+
+    if (!cursor) {
         printInfo("checking link hashes...");
 
+        ThreadPool pool;
+
         for (auto & link : DirectoryIterator{linksDir}) {
+            pool.enqueue([&, link{link.path()}]() {
+                checkInterrupt();
+                auto name = link.filename();
+                printMsg(lvlTalkative, "checking contents of %s", PathFmt(name));
+                std::string hash = hashContents(link, HashAlgorithm::SHA256).hash.to_string(HashFormat::Nix32, false);
+                if (hash != name.string()) {
+                    printError("link %s was modified! expected hash %s, got '%s'", PathFmt(link), name.string(), hash);
+                    if (repair) {
+                        unlinkIfExists(link);
+                        printInfo("removed link %s", PathFmt(link));
+                    } else {
+                        errors = true;
+                    }
+                }
+            });
+        }
+
+        pool.process();
+
+        cursor = "";
+        writeCursor(*cursor);
+    } else
+        printInfo("resuming store scrub after '%s'...", *cursor);
+
+    printInfo("checking store hashes...");
+
+    std::vector<StorePath> todo;
+    for (auto & path : paths)
+        if (path.to_string() > *cursor)
+            todo.push_back(path);
+
+    bool finished = true;
+    if (options.maxPaths && todo.size() > *options.maxPaths) {
+        todo.resize(*options.maxPaths);
+        finished = false;
+    }
+
+    Activity act(*logger, actVerifyPaths);
+
+    std::atomic<size_t> done{0};
+    std::atomic<size_t> failed{0};
+
+    Hash nullHash(HashAlgorithm::SHA256);
+
+    auto checkPath = [&](const StorePath & path, Sync<std::vector<StorePath>> & corrupted) {
+        try {
             checkInterrupt();
-            auto name = link.path().filename();
-            printMsg(lvlTalkative, "checking contents of %s", PathFmt(name));
-            std::string hash =
-                hashPath(makeFSSourceAccessor(link.path()), FileIngestionMethod::NixArchive, HashAlgorithm::SHA256)
-                    .first.to_string(HashFormat::Nix32, false);
-            if (hash != name.string()) {
+
+            auto info =
+                std::const_pointer_cast<ValidPathInfo>(std::shared_ptr<const ValidPathInfo>(queryPathInfo(path)));
+
+            printMsg(lvlTalkative, "checking contents of '%s'", printStorePath(path));
+
+            auto current = hashContents(toRealPath(path), info->narHash.algo);
+
+            if (info->narHash != nullHash && info->narHash != current.hash) {
+                act.result(resCorruptedPath, printStorePath(path));
                 printError(
-                    "link %s was modified! expected hash %s, got '%s'", PathFmt(link.path()), name.string(), hash);
-                if (repair) {
-                    unlinkIfExists(link.path());
-                    printInfo("removed link %s", PathFmt(link.path()));
-                } else {
+                    "path '%s' was modified! expected hash '%s', got '%s'",
+                    printStorePath(path),
+                    info->narHash.to_string(HashFormat::Nix32, true),
+                    current.hash.to_string(HashFormat::Nix32, true));
+                if (repair)
+                    corrupted.lock()->push_back(path);
+                else
                     errors = true;
+            } else {
+
+                bool update = false;
+
+                /* Fill in missing hashes. */
+                if (info->narHash == nullHash) {
+                    printInfo("fixing missing hash on '%s'", printStorePath(path));
+                    info->narHash = current.hash;
+                    update = true;
                 }
-            }
-        }
 
-        printInfo("checking store hashes...");
+                /* Fill in missing narSize fields (from old stores). */
+                if (info->narSize == 0) {
+                    printInfo("updating size field on '%s' to %s", printStorePath(path), current.numBytesDigested);
+                    info->narSize = current.numBytesDigested;
+                    update = true;
+                }
 
-        Hash nullHash(HashAlgorithm::SHA256);
+                if (update)
+                    updatePathInfo(*_state->lock(), *info);
+            }
 
-        for (auto & i : validPaths) {
-            try {
-                auto info =
-                    std::const_pointer_cast<ValidPathInfo>(std::shared_ptr<const ValidPathInfo>(queryPathInfo(i)));
-
-                /* Check the content hash (optionally - slow). */
-                printMsg(lvlTalkative, "checking contents of '%s'", printStorePath(i));
-
-                auto hashSink = HashSink(info->narHash.algo);
-
-                dumpPath(toRealPath(i), hashSink);
-                auto current = hashSink.finish();
-
-                if (info->narHash != nullHash && info->narHash != current.hash) {
-                    printError(
-                        "path '%s' was modified! expected hash '%s', got '%s'",
-                        printStorePath(i),
-                        info->narHash.to_string(HashFormat::Nix32, true),
-                        current.hash.to_string(HashFormat::Nix32, true));
-                    if (repair)
-                        repairPath(i);
-                    else
-                        errors = true;
-                } else {
+        } catch (Error & e) {
+            /* It's possible that the path got GC'ed, so ignore
+               errors on invalid paths. */
+            if (isValidPath(path))
+                logError(e.info());
+            else
+                logWarning(e.info());
+            errors = true;
+            failed++;
+        }
 
-                    bool update = false;
+        done++;
+        act.progress(done, todo.size(), 0, failed);
+    };
 
-                    /* Fill in missing hashes. */
-                    if (info->narHash == nullHash) {
-                        printInfo("fixing missing hash on '%s'", printStorePath(i));
-                        info->narHash = current.hash;
-                        update = true;
-                    }
+    /* Check the paths in batches, recording progress after each
+       batch so that an interrupted scrub can be resumed. */
+    static constexpr size_t batchSize = 1024;
 
-                    /* Fill in missing narSize fields (from old stores). */
-                    if (info->narSize == 0) {
-                        printInfo("updating size field on '%s' to %s", printStorePath(i), current.numBytesDigested);
-                        info->narSize = current.numBytesDigested;
-                        update = true;
-                    }
+    for (size_t start = 0; start < todo.size(); start += batchSize) {
+        auto end = std::min(start + batchSize, todo.size());
 
-                    if (update)
-                        updatePathInfo(*_state->lock(), *info);
-                }
+        Sync<std::vector<StorePath>> corrupted;
+
+        ThreadPool pool;
+        for (size_t i = start; i < end; ++i)
+            pool.enqueue([&, i]() { checkPath(todo[i], corrupted); });
+        pool.process();
 
+        for (auto & path : *corrupted.lock())
+            try {
+                repairPath(path);
             } catch (Error & e) {
-                /* It's possible that the path got GC'ed, so ignore
-                   errors on invalid paths. */
-                if (isValidPath(i))
-                    logError(e.info());
-                else
-                    logWarning(e.info());
+                logError(e.info());
                 errors = true;
             }
-        }
+
+        writeCursor(todo[end - 1].to_string());
     }
 
+    /* The next scrub starts from scratch. */
+    if (options.resume && finished)
+        std::filesystem::remove(cursorPath);
+
     return errors;
 }
 
@@ -1857,10 +2140,11 @@ void LocalStore::addBuildLog(const StorePath & drvPath, std::string_view log)
 
     auto baseName = drvPath.to_string();
 
-    auto logPath =
-        config->logDir.get() / drvsLogDir / baseName.substr(0, 2) / (std::string(baseName.substr(2)) + ".bz2");
+    auto logDir = config->logDir.get() / drvsLogDir / baseName.substr(0, 2);
+    auto logPath = logDir / (std::string(baseName.substr(2)) + ".zst");
 
-    if (pathExists(logPath))
+    /* Logs written by older versions are bzip2-compressed. */
+    if (pathExists(logPath) || pathExists(logDir / (std::string(baseName.substr(2)) + ".bz2")))
         return;
 
     createDirs(logPath.parent_path());
@@ -1868,7 +2152,11 @@ void LocalStore::addBuildLog(const StorePath & drvPath, std::string_view log)
     auto tmpFile = logPath;
     tmpFile += ".tmp." + std::to_string(getpid());
 
-    writeFile(tmpFile, compress(CompressionAlgo::bzip2, log));
+    StringSink compressed;
+    auto sink = makeZstdSeekableCompressionSink(compressed);
+    (*sink)(log);
+    sink->finish();
+    writeFile(tmpFile, compressed.s);
 
     std::filesystem::rename(tmpFile, logPath);
 }
@@ -1,5 +1,7 @@
 #include "nix/store/log-store.hh"
 
+#include <algorithm>
+
 namespace nix {
 
 void LogStore::anchor() {}
@@ -12,4 +14,75 @@ std::optional<std::string> LogStore::getBuildLog(const StorePath & path)
     return getBuildLogExact(maybePath.value());
 }
 
+std::optional<std::string> LogStore::getBuildLogRange(const StorePath & path, int64_t offset, uint64_t length)
+{
+    auto maybePath = getBuildDerivationPath(path);
+    if (!maybePath)
+        return std::nullopt;
+    return getBuildLogRangeExact(maybePath.value(), offset, length);
+}
+
+/**
+ * Return the position in `log` where its last `nrLines` lines start,
+ * or `std::nullopt` if it has fewer lines.
+ */
+static std::optional<size_t> findTail(std::string_view log, size_t nrLines)
+{
+    /* Don't count the newline terminating the last line. */
+    auto pos = log.size() - (log.ends_with('\n') ? 1 : 0);
+    size_t n = 0;
+    while (n < nrLines && pos > 0) {
+        auto nl = log.rfind('\n', pos - 1);
+        if (nl == log.npos)
+            break;
+        if (++n == nrLines)
+            return nl + 1;
+        pos = nl;
+    }
+    return std::nullopt;
+}
+
+std::optional<std::string> LogStore::getBuildLogTail(const StorePath & path, size_t nrLines)
+{
+    auto maybePath = getBuildDerivationPath(path);
+    if (!maybePath)
+        return std::nullopt;
+
+    if (nrLines == 0)
+        return getBuildLogRangeExact(maybePath.value(), 0, 0);
+
+    /* Without cheap ranges, every attempt below would fetch the
+       entire log. */
+    if (!canReadBuildLogRange(maybePath.value())) {
+        auto log = getBuildLogExact(maybePath.value());
+        if (!log)
+            return std::nullopt;
+        return log->substr(findTail(*log, nrLines).value_or(0));
+    }
+
+    /* Fetch increasingly large parts of the end of the log until we
+       have enough lines. */
+    for (uint64_t length = 64 * 1024;; length *= 4) {
+        auto log = getBuildLogRangeExact(maybePath.value(), -(int64_t) length, length);
+        if (!log)
+            return std::nullopt;
+
+        if (auto start = findTail(*log, nrLines))
+            return log->substr(*start);
+
+        if (log->size() < length)
+            return log;
+    }
+}
+
+std::optional<std::string> LogStore::getBuildLogRangeExact(const StorePath & drvPath, int64_t offset, uint64_t length)
+{
+    auto log = getBuildLogExact(drvPath);
+    if (!log)
+        return std::nullopt;
+    auto start = offset < 0 ? log->size() - std::min<uint64_t>(-offset, log->size())
+                            : std::min<uint64_t>(offset, log->size());
+    return log->substr(start, length);
+}
+
 } // namespace nix
@@ -4,6 +4,7 @@
 #include "nix/store/sqlite.hh"
 #include "nix/store/globals.hh"
 #include "nix/store/provenance.hh"
+#include "nix/store/store-api.hh"
 
 #include <sqlite3.h>
 #include <nlohmann/json.hpp>
@@ -37,6 +38,10 @@ create table if not exists NARs (
     sigs             text,
     ca               text,
     provenance       text,
+    deltaUrl         text,
+    deltaBase        text,
+    deltaBaseNarHash text,
+    deltaSize        integer,
     timestamp        integer not null,
     present          integer not null,
     primary key (cache, hashPart),
@@ -58,6 +63,14 @@ create table if not exists BuildTrace (
     foreign key (cache) references BinaryCaches(id) on delete cascade
 );
 
+create table if not exists SubstituterStats (
+    cache            integer primary key not null,
+    narInfoLatency   integer, -- moving average in milliseconds
+    throughput       integer, -- moving average in bytes per second
+    timestamp        integer not null,
+    foreign key (cache) references BinaryCaches(id) on delete cascade
+);
+
 create table if not exists LastPurge (
     dummy            text primary key,
     value            integer
@@ -83,16 +96,31 @@ public:
     {
         SQLite db;
         SQLiteStmt insertCache, queryCache, insertNAR, insertMissingNAR, queryNAR, insertRealisation,
-            insertMissingRealisation, queryRealisation, purgeCache;
+            insertMissingRealisation, queryRealisation, purgeCache, updateNarInfoLatency, updateThroughput,
+            querySubstituterStats;
         std::map<std::string, Cache> caches;
+
+        /**
+         * `.narinfo` lookup latencies that haven't been written to the
+         * database yet, as pairs of cache ID and latency.
+         */
+        std::vector<std::pair<int, uint64_t>> pendingLatencies;
     };
 
+    /**
+     * Number of latency samples to collect before writing them to the
+     * database in a single transaction. A sample is recorded for every
+     * `.narinfo` lookup, so writing each of them separately would add
+     * a database write to every lookup.
+     */
+    const size_t maxPendingLatencies = 64;
+
     Sync<State> _state;
 
     NarInfoDiskCacheImpl(
         const Settings & settings,
         SQLiteSettings sqliteSettings,
-        std::filesystem::path dbPath = getCacheDir() / "binary-cache-detsys-v3.sqlite")
+        std::filesystem::path dbPath = getCacheDir() / "binary-cache-detsys-v4.sqlite")
         : NarInfoDiskCache{settings}
     {
         auto state(_state.lock());
@@ -115,14 +143,15 @@ public:
         state->insertNAR.create(
             state->db,
             "insert or replace into NARs(cache, hashPart, namePart, url, compression, fileHash, fileSize, narHash, "
-            "narSize, refs, deriver, sigs, ca, provenance, timestamp, present) values (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, 1)");
+            "narSize, refs, deriver, sigs, ca, provenance, deltaUrl, deltaBase, deltaBaseNarHash, deltaSize, "
+            "timestamp, present) values (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, 1)");
 
         state->insertMissingNAR.create(
             state->db, "insert or replace into NARs(cache, hashPart, timestamp, present) values (?, ?, ?, 0)");
 
         state->queryNAR.create(
             state->db,
-            "select present, namePart, url, compression, fileHash, fileSize, narHash, narSize, refs, deriver, sigs, ca, provenance from NARs where cache = ? and hashPart = ? and ((present = 0 and timestamp > ?) or (present = 1 and timestamp > ?))");
+            "select present, namePart, url, compression, fileHash, fileSize, narHash, narSize, refs, deriver, sigs, ca, provenance, deltaUrl, deltaBase, deltaBaseNarHash, deltaSize from NARs where cache = ? and hashPart = ? and ((present = 0 and timestamp > ?) or (present = 1 and timestamp > ?))");
 
         state->insertRealisation.create(
             state->db,
@@ -147,6 +176,26 @@ public:
                          (outputPath is not null and timestamp > ?))
             )");
 
+        /* The moving averages weigh the latest sample by 1/5. */
+        state->updateNarInfoLatency.create(
+            state->db,
+            R"(
+                insert into SubstituterStats(cache, narInfoLatency, timestamp) values (?1, ?2, ?3)
+                    on conflict (cache) do update set
+                        narInfoLatency = coalesce((4 * narInfoLatency + ?2) / 5, ?2), timestamp = ?3
+            )");
+
+        state->updateThroughput.create(
+            state->db,
+            R"(
+                insert into SubstituterStats(cache, throughput, timestamp) values (?1, ?2, ?3)
+                    on conflict (cache) do update set
+                        throughput = coalesce((4 * throughput + ?2) / 5, ?2), timestamp = ?3
+            )");
+
+        state->querySubstituterStats.create(
+            state->db, "select narInfoLatency, throughput from SubstituterStats where cache = ?");
+
         /* Periodically purge expired entries from the database. */
         retrySQLite<void>([&]() {
             auto now = time(nullptr);
@@ -294,6 +343,13 @@ public:
                 narInfo->ca = ContentAddress::parseOpt(queryNAR.getStr(11));
                 if (experimentalFeatureSettings.isEnabled(Xp::Provenance) && !queryNAR.isNull(12))
                     narInfo->provenance = Provenance::from_json_str_optional(queryNAR.getStr(12));
+                if (!queryNAR.isNull(13))
+                    narInfo->delta = NarDelta{
+                        .url = queryNAR.getStr(13),
+                        .base = StorePath(queryNAR.getStr(14)),
+                        .baseNarHash = Hash::parseAnyPrefixed(queryNAR.getStr(15)),
+                        .fileSize = (uint64_t) queryNAR.getInt(16),
+                    };
 
                 return {oValid, narInfo};
             });
@@ -377,6 +433,14 @@ public:
                     .apply(
                         info->provenance ? info->provenance->to_json_str() : "",
                         experimentalFeatureSettings.isEnabled(Xp::Provenance) && info->provenance)
+                    .apply(narInfo && narInfo->delta ? narInfo->delta->url : "", narInfo && narInfo->delta)
+                    .apply(
+                        narInfo && narInfo->delta ? std::string(narInfo->delta->base.to_string()) : "",
+                        narInfo && narInfo->delta)
+                    .apply(
+                        narInfo && narInfo->delta ? narInfo->delta->baseNarHash.to_string(HashFormat::Nix32, true) : "",
+                        narInfo && narInfo->delta)
+                    .apply(narInfo && narInfo->delta ? narInfo->delta->fileSize : 0, narInfo && narInfo->delta)
                     .apply(time(nullptr))
                     .exec();
 
@@ -404,6 +468,92 @@ public:
         });
     }
 
+    ~NarInfoDiskCacheImpl()
+    {
+        try {
+            flushLatencies(*_state.lock());
+        } catch (...) {
+            ignoreExceptionInDestructor();
+        }
+    }
+
+    void flushLatencies(State & state)
+    {
+        if (state.pendingLatencies.empty())
+            return;
+
+        try {
+            retrySQLite<void>([&]() {
+                SQLiteTxn txn(state.db);
+                auto now = time(nullptr);
+                for (auto & [cacheId, latencyMs] : state.pendingLatencies)
+                    state.updateNarInfoLatency.use()
+                        .apply(cacheId)
+                        .apply(static_cast<int64_t>(latencyMs))
+                        .apply(now)
+                        .exec();
+                txn.commit();
+            });
+        } catch (...) {
+            /* Keep the samples for the next attempt, but don't let
+               them pile up if the database stays unwritable. */
+            if (state.pendingLatencies.size() >= 4 * maxPendingLatencies)
+                state.pendingLatencies.erase(
+                    state.pendingLatencies.begin(), state.pendingLatencies.end() - maxPendingLatencies);
+            throw;
+        }
+
+        state.pendingLatencies.clear();
+    }
+
+    void recordNarInfoLatency(const std::string & uri, uint64_t latencyMs) override
+    {
+        auto state(_state.lock());
+
+        auto & cache(getCache(*state, uri));
+
+        state->pendingLatencies.emplace_back(cache.info.id, latencyMs);
+        if (state->pendingLatencies.size() >= maxPendingLatencies)
+            flushLatencies(*state);
+    }
+
+    void recordDownloadThroughput(const std::string & uri, uint64_t throughput) override
+    {
+        retrySQLite<void>([&]() {
+            auto state(_state.lock());
+
+            auto & cache(getCache(*state, uri));
+
+            state->updateThroughput.use()
+                .apply(cache.info.id)
+                .apply(static_cast<int64_t>(throughput))
+                .apply(time(nullptr))
+                .exec();
+        });
+    }
+
+    std::optional<SubstituterStats> lookupSubstituterStats(const std::string & uri) override
+    {
+        return retrySQLite<std::optional<SubstituterStats>>([&]() -> std::optional<SubstituterStats> {
+            auto state(_state.lock());
+
+            auto cache(queryCacheRaw(*state, uri));
+            if (!cache)
+                return std::nullopt;
+
+            auto query(state->querySubstituterStats.use().apply(cache->info.id));
+            if (!query.next())
+                return std::nullopt;
+
+            SubstituterStats stats;
+            if (!query.isNull(0))
+                stats.narInfoLatencyMs = query.getInt(0);
+            if (!query.isNull(1))
+                stats.downloadThroughput = query.getInt(1);
+            return stats;
+        });
+    }
+
     virtual void upsertAbsentRealisation(const std::string & uri, const DrvOutput & id) override
     {
         retrySQLite<void>([&]() {
@@ -33,6 +33,11 @@ NarInfo::NarInfo(const StoreDirConfig & store, const std::string & s, const std:
     bool havePath = false;
     bool haveNarHash = false;
 
+    std::string deltaUrl;
+    std::optional<StorePath> deltaBase;
+    std::optional<Hash> deltaBaseNarHash;
+    uint64_t deltaSize = 0;
+
     size_t pos = 0;
     while (pos < s.size()) {
 
@@ -93,6 +98,18 @@ NarInfo::NarInfo(const StoreDirConfig & store, const std::string & s, const std:
             ca = ContentAddress::parseOpt(value);
         } else if (name == "Provenance" && experimentalFeatureSettings.isEnabled(Xp::Provenance))
             provenance = Provenance::from_json_str(value);
+        else if (name == "DeltaURL")
+            deltaUrl = value;
+        else if (name == "DeltaBase")
+            deltaBase = StorePath(value);
+        else if (name == "DeltaBaseNarHash")
+            deltaBaseNarHash = parseHashField(value);
+        else if (name == "DeltaSize") {
+            auto n = string2Int<decltype(deltaSize)>(value);
+            if (!n)
+                throw corrupt("invalid DeltaSize");
+            deltaSize = *n;
+        }
 
         pos = eol + 1;
         line += 1;
@@ -101,6 +118,15 @@ NarInfo::NarInfo(const StoreDirConfig & store, const std::string & s, const std:
     if (!compression)
         compression = CompressionAlgo::bzip2;
 
+    /* An incomplete delta is not an error; we just can't use it. */
+    if (!deltaUrl.empty() && deltaBase && deltaBaseNarHash)
+        delta = NarDelta{
+            .url = std::move(deltaUrl),
+            .base = std::move(*deltaBase),
+            .baseNarHash = std::move(*deltaBaseNarHash),
+            .fileSize = deltaSize,
+        };
+
     if (!havePath || !haveNarHash || url.empty() || narSize == 0) {
         line = 0; // don't include line information in the error
         throw corrupt(
@@ -143,6 +169,14 @@ std::string NarInfo::to_string(const StoreDirConfig & store) const
     if (provenance && experimentalFeatureSettings.isEnabled(Xp::Provenance))
         res += "Provenance: " + provenance->to_json_str() + "\n";
 
+    if (delta) {
+        res += "DeltaURL: " + delta->url + "\n";
+        res += "DeltaBase: " + std::string(delta->base.to_string()) + "\n";
+        res += "DeltaBaseNarHash: " + delta->baseNarHash.to_string(HashFormat::Nix32, true) + "\n";
+        if (delta->fileSize)
+            res += "DeltaSize: " + std::to_string(delta->fileSize) + "\n";
+    }
+
     return res;
 }
 
@@ -5,6 +5,9 @@
 #include "nix/store/posix-fs-canonicalise.hh"
 #include "nix/util/source-accessor.hh"
 #include "nix/util/file-system.hh"
+#include "nix/util/file-system-at.hh"
+#include "nix/util/reflink.hh"
+#include "nix/util/util.hh"
 
 #include <boost/unordered/concurrent_flat_set.hpp>
 
@@ -102,7 +105,13 @@ Strings LocalStore::readDirectoryIgnoringInodes(const std::filesystem::path & pa
 }
 
 void LocalStore::optimisePath_(
-    Activity * act, OptimiseStats & stats, const std::filesystem::path & path, InodeHash & inodeHash, RepairFlag repair)
+    Activity * act,
+    OptimiseStats & stats,
+    const std::filesystem::path & path,
+    InodeHash & inodeHash,
+    RepairFlag repair,
+    const std::map<CanonPath, Hash> * fileHashes,
+    const CanonPath & relPath)
 {
     checkInterrupt();
 
@@ -131,7 +140,7 @@ void LocalStore::optimisePath_(
     if (S_ISDIR(st.st_mode)) {
         Strings names = readDirectoryIgnoringInodes(path, inodeHash);
         for (auto & i : names)
-            optimisePath_(act, stats, path / i, inodeHash, repair);
+            optimisePath_(act, stats, path / i, inodeHash, repair, fileHashes, relPath / i);
         return;
     }
 
@@ -166,8 +175,16 @@ void LocalStore::optimisePath_(
 
        Also note that if `path' is a symlink, then we're hashing the
        contents of the symlink (i.e. the result of readlink()), not
-       the contents of the target (which may not even exist). */
-    Hash hash = hashPath(makeFSSourceAccessor(path), FileSerialisationMethod::NixArchive, HashAlgorithm::SHA256).hash;
+       the contents of the target (which may not even exist).
+
+       The caller may already have computed this hash while
+       serialising the path, in which case we don't read the file
+       again. */
+    auto knownHash = fileHashes ? get(*fileHashes, relPath) : nullptr;
+    Hash hash = knownHash
+                    ? *knownHash
+                    : hashPath(makeFSSourceAccessor(path), FileSerialisationMethod::NixArchive, HashAlgorithm::SHA256)
+                          .hash;
     debug("%s has hash '%s'", PathFmt(path), hash.to_string(HashFormat::Nix32, true));
 
     /* Check if this is a known hash. */
@@ -192,6 +209,15 @@ void LocalStore::optimisePath_(
         }
     }
 
+    /* Only regular files can share extents. */
+    bool useReflinks = config->getLocalSettings().optimiseWithReflinks;
+    if (useReflinks && !S_ISREG(st.st_mode))
+        return;
+
+    /* Even with reflinks, the first file with these contents is
+       hard-linked into the links directory, so that the garbage
+       collector can tell from its link count when it's no longer
+       used. */
     if (!pathExists(linkPath)) {
         /* Nope, create a hard link in the links directory. */
         try {
@@ -233,6 +259,11 @@ void LocalStore::optimisePath_(
         return;
     }
 
+    if (useReflinks) {
+        reflinkPath(act, stats, path, linkPath);
+        return;
+    }
+
     printMsg(lvlTalkative, "linking %1% to %2%", PathFmt(path), PathFmt(linkPath));
 
     /* Make the containing directory writable, but only if it's not
@@ -305,6 +336,57 @@ void LocalStore::optimisePath_(
         );
 }
 
+void LocalStore::reflinkPath(
+    Activity * act, OptimiseStats & stats, const std::filesystem::path & path, const std::filesystem::path & linkPath)
+{
+    static std::atomic<bool> haveWarned = false;
+
+    auto fd = openFileReadonly(path, FinalSymlink::DontFollow);
+    if (!fd)
+        throw SysError("opening %s", PathFmt(path));
+
+    /* A concurrent garbage collection may have removed the link. */
+    auto linkFd = openFileReadonly(linkPath, FinalSymlink::DontFollow);
+    if (!linkFd) {
+        if (errno == ENOENT)
+            return;
+        throw SysError("opening %s", PathFmt(linkPath));
+    }
+
+    if (sharesExtents(linkFd.get(), fd.get())) {
+        debug("%1% already shares its contents with %2%", PathFmt(path), PathFmt(linkPath));
+        return;
+    }
+
+    printMsg(lvlTalkative, "reflinking %1% to %2%", PathFmt(path), PathFmt(linkPath));
+
+    /* The kernel compares the contents before sharing them, so this is
+       safe even if the file or the link has been modified. */
+    auto deduped = dedupeFile(linkFd.get(), fd.get());
+    if (!deduped) {
+        warnOnce(
+            haveWarned,
+            "the file system of %s doesn't support reflinks; not deduplicating files",
+            PathFmt(config->realStoreDir.get()));
+        return;
+    }
+    if (!*deduped)
+        return;
+
+    stats.filesLinked++;
+    stats.bytesFreed += *deduped;
+
+    if (act)
+        act->result(
+            resFileLinked,
+            *deduped
+#ifndef _WIN32
+            ,
+            nix::fstat(fd.get()).st_blocks
+#endif
+        );
+}
+
 void LocalStore::optimiseStore(OptimiseStats & stats)
 {
     Activity act(*logger, actOptimiseStore);
@@ -347,16 +429,21 @@ void LocalStore::optimiseStore()
 
     optimiseStore(stats);
 
-    printInfo("%s freed by hard-linking %d files", renderSize(stats.bytesFreed.load()), stats.filesLinked.load());
+    printInfo(
+        "%s freed by %s %d files",
+        renderSize(stats.bytesFreed.load()),
+        config->getLocalSettings().optimiseWithReflinks ? "reflinking" : "hard-linking",
+        stats.filesLinked.load());
 }
 
-void LocalStore::optimisePath(const std::filesystem::path & path, RepairFlag repair)
+void LocalStore::optimisePath(
+    const std::filesystem::path & path, RepairFlag repair, const std::map<CanonPath, Hash> * fileHashes)
 {
     OptimiseStats stats;
     InodeHash inodeHash;
 
     if (config->getLocalSettings().autoOptimiseStore)
-        optimisePath_(nullptr, stats, path, inodeHash, repair);
+        optimisePath_(nullptr, stats, path, inodeHash, repair, fileHashes);
 }
 
 } // namespace nix
@@ -1,7 +1,9 @@
 #include "nix/store/path-references.hh"
 #include "nix/util/archive.hh"
 #include "nix/util/source-accessor.hh"
+#include "nix/util/forwarding-source-accessor.hh"
 #include "nix/util/canon-path.hh"
+#include "nix/util/file-system.hh"
 #include "nix/util/logging.hh"
 
 #include <map>
@@ -56,6 +58,76 @@ StorePathSet scanForReferences(Sink & toTee, const std::filesystem::path & path,
     return refsSink.getResultPaths();
 }
 
+namespace {
+
+/**
+ * An accessor that computes the NAR hash of every regular file and
+ * symlink as it is being serialised, tapping the data that is read
+ * anyway rather than reading it a second time.
+ */
+struct FileHashingSourceAccessor : ForwardingSourceAccessor
+{
+    std::map<CanonPath, Hash> & fileHashes;
+
+    FileHashingSourceAccessor(ref<SourceAccessor> next, std::map<CanonPath, Hash> & fileHashes)
+        : ForwardingSourceAccessor(next)
+        , fileHashes(fileHashes)
+    {
+    }
+
+    void readFile(const CanonPath & path, Sink & sink, fun<void(uint64_t)> sizeCallback) override
+    {
+        HashSink fileSink{HashAlgorithm::SHA256};
+        fileSink << narVersionMagic1 << "(" << "type" << "regular";
+        if (next->lstat(path).isExecutable)
+            fileSink << "executable" << "";
+        fileSink << "contents";
+
+        uint64_t size = 0;
+        TeeSink tee{sink, fileSink};
+        next->readFile(path, tee, [&](uint64_t _size) {
+            size = _size;
+            fileSink << _size;
+            sizeCallback(_size);
+        });
+        writePadding(size, fileSink);
+        fileSink << ")";
+
+        fileHashes.insert_or_assign(path, fileSink.finish().hash);
+    }
+
+    std::string readLink(const CanonPath & path) override
+    {
+        auto target = next->readLink(path);
+
+        HashSink fileSink{HashAlgorithm::SHA256};
+        fileSink << narVersionMagic1 << "(" << "type" << "symlink" << "target" << target << ")";
+        fileHashes.insert_or_assign(path, fileSink.finish().hash);
+
+        return target;
+    }
+};
+
+} // namespace
+
+PathScanResult scanAndHashPath(const std::filesystem::path & path, const StorePathSet & refs, bool hashFiles)
+{
+    PathScanResult res;
+
+    PathRefScanSink refsSink = PathRefScanSink::fromPaths(refs);
+    HashSink narSink{HashAlgorithm::SHA256};
+    TeeSink sink{refsSink, narSink};
+
+    ref<SourceAccessor> accessor = makeFSSourceAccessor(absPath(path));
+    if (hashFiles)
+        accessor = make_ref<FileHashingSourceAccessor>(accessor, res.fileHashes);
+    accessor->dumpPath(CanonPath::root, sink);
+
+    res.references = refsSink.getResultPaths();
+    res.narHash = narSink.finish();
+    return res;
+}
+
 void scanForReferencesDeep(
     SourceAccessor & accessor,
     const CanonPath & rootPath,
@@ -4,9 +4,10 @@ namespace nix {
 
 void RemoteFSAccessor::anchor() {}
 
-RemoteFSAccessor::RemoteFSAccessor(ref<Store> store, bool requireValidPath, std::optional<AbsolutePath> cacheDir)
+RemoteFSAccessor::RemoteFSAccessor(
+    ref<Store> store, bool requireValidPath, std::optional<AbsolutePath> cacheDir, uint64_t cacheMaxSize)
     : store(store)
-    , narCache(cacheDir)
+    , narCache(cacheDir, cacheMaxSize)
     , requireValidPath(requireValidPath)
 {
 }
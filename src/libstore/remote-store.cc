@@ -97,6 +97,8 @@ void RemoteStore::initConnection(Connection & conn)
             localVersion.features.insert(std::string{WorkerProto::featureDisableSetOptions});
             if (!experimentalFeatureSettings.isEnabled(Xp::Provenance))
                 localVersion.features.erase(std::string(WorkerProto::featureProvenance));
+            if (!config.streamCompression)
+                localVersion.features.erase(std::string(WorkerProto::featureZstdStreamCompression));
 
             conn.protoVersion = WorkerProto::BasicClientConnection::handshake(conn.to, tee, localVersion);
             if (conn.protoVersion.number < WorkerProto::minimum.number)
@@ -112,6 +114,8 @@ void RemoteStore::initConnection(Connection & conn)
             throw Error("protocol mismatch, got '%s'", chomp(saved.s));
         }
 
+        conn.maybeEnableStreamCompression();
+
         static_cast<WorkerProto::ClientHandshakeInfo &>(conn) = conn.postHandshake(*this);
 
         for (auto & feature : conn.protoVersion.features)
@@ -178,6 +182,42 @@ RemoteStore::ConnectionHandle RemoteStore::getConnection()
     return ConnectionHandle(connections->get());
 }
 
+std::shared_ptr<RemoteStore::MultiplexedConnection> RemoteStore::getMultiplexedConnection()
+{
+    if (!config.multiplexing || multiplexingUnsupported)
+        return nullptr;
+
+    auto mconn(multiplexedConnection.lock());
+
+    if (*mconn && (*mconn)->good())
+        return *mconn;
+
+    /* Check whether the daemon supports multiplexing on a connection
+       from the pool, which we probably have already. */
+    if (!getConnection()->protoVersion.features.contains(WorkerProto::featureMultiplexing)) {
+        multiplexingUnsupported = true;
+        return nullptr;
+    }
+
+    auto conn = openConnectionWrapper();
+    initConnection(*conn);
+    connectionFds.lock()->insert(conn->from.fd);
+    *mconn = std::make_shared<MultiplexedConnection>(conn);
+    return *mconn;
+}
+
+void RemoteStore::performMultiplexable(
+    fun<void(WorkerProto::WriteConn)> writeRequest, fun<void(WorkerProto::ReadConn)> readReply)
+{
+    if (auto mconn = getMultiplexedConnection())
+        return mconn->call(writeRequest, readReply);
+
+    auto conn(getConnection());
+    writeRequest(*conn);
+    conn.processStderr();
+    readReply(*conn);
+}
+
 void RemoteStore::setOptions()
 {
     setOptions(*(getConnection().handle));
@@ -185,11 +225,14 @@ void RemoteStore::setOptions()
 
 bool RemoteStore::isValidPathUncached(const StorePath & path)
 {
-    auto conn(getConnection());
-    conn->to << WorkerProto::Op::IsValidPath;
-    WorkerProto::write(*this, *conn, path);
-    conn.processStderr();
-    return readInt(conn->from);
+    bool valid;
+    performMultiplexable(
+        [&](WorkerProto::WriteConn conn) {
+            conn.to << WorkerProto::Op::IsValidPath;
+            WorkerProto::write(*this, conn, path);
+        },
+        [&](WorkerProto::ReadConn conn) { valid = readInt(conn.from); });
+    return valid;
 }
 
 StorePathSet RemoteStore::queryValidPaths(const StorePathSet & paths, SubstituteFlag maybeSubstitute)
@@ -245,10 +288,18 @@ void RemoteStore::queryPathInfoUncached(
     const StorePath & path, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept
 {
     try {
-        auto info = ({
+        std::optional<UnkeyedValidPathInfo> info;
+        if (auto mconn = getMultiplexedConnection())
+            mconn->call(
+                [&](WorkerProto::WriteConn conn) { conn.to << WorkerProto::Op::QueryPathInfo << printStorePath(path); },
+                [&](WorkerProto::ReadConn conn) {
+                    if (readInt(conn.from))
+                        info = WorkerProto::Serialise<UnkeyedValidPathInfo>::read(*this, conn);
+                });
+        else {
             auto conn(getConnection());
-            conn->queryPathInfo(*this, &conn.daemonException, path);
-        });
+            info = conn->queryPathInfo(*this, &conn.daemonException, path);
+        }
         if (!info)
             callback(nullptr);
         else
@@ -325,21 +376,27 @@ asio::awaitable<void> RemoteStore::queryPathInfos(
 
 void RemoteStore::queryReferrers(const StorePath & path, StorePathSet & referrers)
 {
-    auto conn(getConnection());
-    conn->to << WorkerProto::Op::QueryReferrers;
-    WorkerProto::write(*this, *conn, path);
-    conn.processStderr();
-    for (auto & i : WorkerProto::Serialise<StorePathSet>::read(*this, *conn))
-        referrers.insert(i);
+    performMultiplexable(
+        [&](WorkerProto::WriteConn conn) {
+            conn.to << WorkerProto::Op::QueryReferrers;
+            WorkerProto::write(*this, conn, path);
+        },
+        [&](WorkerProto::ReadConn conn) {
+            for (auto & i : WorkerProto::Serialise<StorePathSet>::read(*this, conn))
+                referrers.insert(i);
+        });
 }
 
 StorePathSet RemoteStore::queryValidDerivers(const StorePath & path)
 {
-    auto conn(getConnection());
-    conn->to << WorkerProto::Op::QueryValidDerivers;
-    WorkerProto::write(*this, *conn, path);
-    conn.processStderr();
-    return WorkerProto::Serialise<StorePathSet>::read(*this, *conn);
+    StorePathSet derivers;
+    performMultiplexable(
+        [&](WorkerProto::WriteConn conn) {
+            conn.to << WorkerProto::Op::QueryValidDerivers;
+            WorkerProto::write(*this, conn, path);
+        },
+        [&](WorkerProto::ReadConn conn) { derivers = WorkerProto::Serialise<StorePathSet>::read(*this, conn); });
+    return derivers;
 }
 
 StorePathSet RemoteStore::queryDerivationOutputs(const StorePath & path)
@@ -359,11 +416,17 @@ RemoteStore::queryPartialDerivationOutputMap(const StorePath & path, Store * eva
 {
     if (WorkerProto::Version::Number::fromWire(getProtocol()) >= WorkerProto::Version::Number{1, 22}) {
         if (!evalStore_) {
-            auto conn(getConnection());
-            conn->to << WorkerProto::Op::QueryDerivationOutputMap;
-            WorkerProto::write(*this, *conn, path);
-            conn.processStderr();
-            return WorkerProto::Serialise<std::map<std::string, std::optional<StorePath>>>::read(*this, *conn);
+            using OutputMap = std::map<std::string, std::optional<StorePath>>;
+            OutputMap outputs;
+            performMultiplexable(
+                [&](WorkerProto::WriteConn conn) {
+                    conn.to << WorkerProto::Op::QueryDerivationOutputMap;
+                    WorkerProto::write(*this, conn, path);
+                },
+                [&](WorkerProto::ReadConn conn) {
+                    outputs = WorkerProto::Serialise<OutputMap>::read(*this, conn);
+                });
+            return outputs;
         } else {
             auto & evalStore = *evalStore_;
             auto outputs = evalStore.queryStaticPartialDerivationOutputMap(path);
@@ -391,10 +454,13 @@ RemoteStore::queryPartialDerivationOutputMap(const StorePath & path, Store * eva
 
 std::optional<StorePath> RemoteStore::queryPathFromHashPart(const std::string & hashPart)
 {
-    auto conn(getConnection());
-    conn->to << WorkerProto::Op::QueryPathFromHashPart << hashPart;
-    conn.processStderr();
-    return WorkerProto::Serialise<std::optional<StorePath>>::read(*this, *conn);
+    std::optional<StorePath> path;
+    performMultiplexable(
+        [&](WorkerProto::WriteConn conn) { conn.to << WorkerProto::Op::QueryPathFromHashPart << hashPart; },
+        [&](WorkerProto::ReadConn conn) {
+            path = WorkerProto::Serialise<std::optional<StorePath>>::read(*this, conn);
+        });
+    return path;
 }
 
 ref<const ValidPathInfo> RemoteStore::addCAToStore(
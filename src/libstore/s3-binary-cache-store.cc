@@ -9,6 +9,7 @@
 
 #include <cassert>
 #include <cstring>
+#include <list>
 #include <ranges>
 #include <regex>
 #include <span>
@@ -87,6 +88,25 @@ private:
         std::vector<std::string> partEtags;
         std::string buffer;
 
+        /**
+         * A part whose upload has been started but not waited for
+         * yet. The transfer reads from `payload`, so the part must stay
+         * alive until `result` is ready.
+         */
+        struct PendingPart
+        {
+            uint64_t partNumber;
+            std::string data;
+            std::optional<StringSource> payload;
+            std::future<FileTransferResult> result;
+        };
+
+        /**
+         * Up to `multipart-concurrency` parts being uploaded
+         * concurrently, in ascending part number order.
+         */
+        std::list<PendingPart> pendingParts;
+
         MultipartSink(
             S3BinaryCacheStore & store,
             std::string_view path,
@@ -94,9 +114,21 @@ private:
             std::string_view mimeType,
             std::optional<Headers> headers);
 
+        ~MultipartSink();
+
         void operator()(std::string_view data) override;
         void finish();
         void uploadChunk(std::string chunk);
+
+        /**
+         * Wait for the oldest pending part and record its ETag.
+         */
+        void waitForPart();
+
+        /**
+         * Wait for all pending parts and abort the multipart upload.
+         */
+        void abort() noexcept;
     };
 
     /**
@@ -108,13 +140,16 @@ private:
     std::string createMultipartUpload(std::string_view key, std::string_view mimeType, std::optional<Headers> headers);
 
     /**
-     * Uploads a single part of a multipart upload
+     * Starts uploading a single part of a multipart upload. `payload`
+     * must stay alive until the returned future is ready.
      *
      * @see https://docs.aws.amazon.com/AmazonS3/latest/API/API_UploadPart.html#API_UploadPart_RequestSyntax
      *
-     * @returns the [ETag](https://en.wikipedia.org/wiki/HTTP_ETag)
+     * @returns the result of the transfer, whose `etag` is the part's
+     * [ETag](https://en.wikipedia.org/wiki/HTTP_ETag)
      */
-    std::string uploadPart(std::string_view key, std::string_view uploadId, uint64_t partNumber, std::string data);
+    std::future<FileTransferResult>
+    uploadPart(std::string_view key, std::string_view uploadId, uint64_t partNumber, RestartableSource & payload);
 
     /**
      * Completes a multipart upload by combining all uploaded parts.
@@ -253,6 +288,14 @@ S3BinaryCacheStore::MultipartSink::MultipartSink(
     uploadId = store.createMultipartUpload(path, mimeType, std::move(headers));
 }
 
+S3BinaryCacheStore::MultipartSink::~MultipartSink()
+{
+    /* If we're destroyed while parts are still in flight (e.g. because
+       reading the source failed), the upload can't be completed. */
+    if (!pendingParts.empty())
+        abort();
+}
+
 void S3BinaryCacheStore::MultipartSink::operator()(std::string_view data)
 {
     buffer.append(data);
@@ -276,6 +319,9 @@ void S3BinaryCacheStore::MultipartSink::finish()
         uploadChunk(std::move(buffer));
     }
 
+    while (!pendingParts.empty())
+        waitForPart();
+
     try {
         if (partEtags.empty()) {
             throw Error("no data read from stream");
@@ -290,15 +336,55 @@ void S3BinaryCacheStore::MultipartSink::finish()
 
 void S3BinaryCacheStore::MultipartSink::uploadChunk(std::string chunk)
 {
-    auto partNumber = partEtags.size() + 1;
+    /* Bound the number of concurrent transfers, and thus the number of
+       chunks held in memory. */
+    while (pendingParts.size() >= std::max(store.s3Config->multipartConcurrency.get(), 1U))
+        waitForPart();
+
+    auto partNumber = partEtags.size() + pendingParts.size() + 1;
+    auto & part = pendingParts.emplace_back();
+    part.partNumber = partNumber;
+    part.data = std::move(chunk);
+    part.payload.emplace(part.data);
     try {
-        std::string etag = store.uploadPart(path, uploadId, partNumber, std::move(chunk));
-        partEtags.push_back(std::move(etag));
+        part.result = store.uploadPart(path, uploadId, partNumber, *part.payload);
     } catch (Error & e) {
-        store.abortMultipartUpload(path, uploadId);
+        pendingParts.pop_back();
+        abort();
+        e.addTrace({}, "while uploading part %d of an S3 multipart upload", partNumber);
+        throw;
+    }
+}
+
+void S3BinaryCacheStore::MultipartSink::waitForPart()
+{
+    auto & part = pendingParts.front();
+    auto partNumber = part.partNumber;
+    try {
+        auto result = part.result.get();
+        if (result.etag.empty()) {
+            throw Error("S3 UploadPart response missing ETag for part %d", partNumber);
+        }
+        debug("Part %d uploaded, ETag: %s", partNumber, result.etag);
+        partEtags.push_back(std::move(result.etag));
+    } catch (Error & e) {
+        pendingParts.pop_front();
+        abort();
         e.addTrace({}, "while uploading part %d of an S3 multipart upload", partNumber);
         throw;
     }
+    pendingParts.pop_front();
+}
+
+void S3BinaryCacheStore::MultipartSink::abort() noexcept
+{
+    /* The transfers of the pending parts read from their buffers, so
+       they must finish before the buffers can be freed. */
+    for (auto & part : pendingParts)
+        if (part.result.valid())
+            part.result.wait();
+    pendingParts.clear();
+    store.abortMultipartUpload(path, uploadId);
 }
 
 std::string S3BinaryCacheStore::createMultipartUpload(
@@ -336,8 +422,8 @@ std::string S3BinaryCacheStore::createMultipartUpload(
     throw Error("S3 CreateMultipartUpload response missing <UploadId>");
 }
 
-std::string
-S3BinaryCacheStore::uploadPart(std::string_view key, std::string_view uploadId, uint64_t partNumber, std::string data)
+std::future<FileTransferResult> S3BinaryCacheStore::uploadPart(
+    std::string_view key, std::string_view uploadId, uint64_t partNumber, RestartableSource & payload)
 {
     if (partNumber > AWS_MAX_PART_COUNT) {
         throw Error("S3 multipart upload exceeded %d part limit", AWS_MAX_PART_COUNT);
@@ -351,18 +437,10 @@ S3BinaryCacheStore::uploadPart(std::string_view key, std::string_view uploadId,
     url.query["partNumber"] = std::to_string(partNumber);
     url.query["uploadId"] = uploadId;
     req.uri = VerbatimURL(url);
-    StringSource payload{data};
     req.data = {payload};
     req.mimeType = "application/octet-stream";
 
-    auto result = fileTransfer->enqueueFileTransfer(req).get();
-
-    if (result.etag.empty()) {
-        throw Error("S3 UploadPart response missing ETag for part %d", partNumber);
-    }
-
-    debug("Part %d uploaded, ETag: %s", partNumber, result.etag);
-    return std::move(result.etag);
+    return fileTransfer->enqueueFileTransfer(req);
 }
 
 void S3BinaryCacheStore::abortMultipartUpload(std::string_view key, std::string_view uploadId) noexcept
@@ -2,6 +2,7 @@
 #include "nix/store/serve-protocol-impl.hh"
 #include "nix/store/build-result.hh"
 #include "nix/store/derivations.hh"
+#include "nix/util/compression.hh"
 
 namespace nix {
 
@@ -32,6 +33,18 @@ ServeProto::BasicServerConnection::handshake(BufferedSink & to, Source & from, S
     return std::min(remoteVersion, localVersion);
 }
 
+void ServeProto::BasicClientConnection::enableCompression()
+{
+    if (remoteVersion < ServeProto::Version{2, 9})
+        return;
+    to << ServeProto::Command::EnableCompression;
+    to.flush();
+    if (readInt(from) != 1)
+        throw Error("remote side failed to enable compression");
+    to.setEncoder(makeZstdStreamEncoder());
+    from.setDecoder(makeZstdStreamDecoder());
+}
+
 StorePathSet ServeProto::BasicClientConnection::queryValidPaths(
     const StoreDirConfig & store, bool lock, const StorePathSet & paths, SubstituteFlag maybeSubstitute)
 {
@@ -200,18 +200,23 @@ StorePath Store::addToStore(
         LengthSource lengthSource(source);
         storePath =
             addToStoreFromDump(lengthSource, name, fsm, method, hashAlgo, references, repair, path.getProvenance());
-        if (settings.warnLargePathThreshold && lengthSource.total >= settings.warnLargePathThreshold) {
-            static bool failOnLargePath = getEnv("_NIX_TEST_FAIL_ON_LARGE_PATH").value_or("") == "1";
-            if (failOnLargePath)
-                throw Error("doesn't copy large path '%s' to the store (%d)", path, renderSize(lengthSource.total));
-            warn("copied large path '%s' to the store (%d)", path, renderSize(lengthSource.total));
-        }
+        warnIfLargePath(path, lengthSource.total);
     });
     dumpPath(path, *sink, fsm, filter);
     sink->finish();
     return storePath.value();
 }
 
+void Store::warnIfLargePath(const SourcePath & path, uint64_t narSize)
+{
+    if (settings.warnLargePathThreshold && narSize >= settings.warnLargePathThreshold) {
+        static bool failOnLargePath = getEnv("_NIX_TEST_FAIL_ON_LARGE_PATH").value_or("") == "1";
+        if (failOnLargePath)
+            throw Error("doesn't copy large path '%s' to the store (%d)", path, renderSize(narSize));
+        warn("copied large path '%s' to the store (%d)", path, renderSize(narSize));
+    }
+}
+
 void Store::addMultipleToStore(PathsSource && pathsToCopy, Activity & act, RepairFlag repair, CheckSigsFlag checkSigs)
 {
     std::atomic<size_t> nrDone{0};
@@ -914,6 +919,16 @@ const Store::Stats & Store::getStats()
     return stats;
 }
 
+std::optional<SubstituterStats> Store::getSubstituterStats()
+{
+    if (!diskCache)
+        return std::nullopt;
+    auto stats(substituterStats.lock());
+    if (!*stats)
+        *stats = diskCache->lookupSubstituterStats(config.getReference().render(/*FIXME withParams=*/false));
+    return **stats;
+}
+
 static std::string
 makeCopyPathMessage(const StoreConfig & srcCfg, const StoreConfig & dstCfg, std::string_view storePath)
 {
@@ -1002,7 +1017,7 @@ std::shared_ptr<const ValidPathInfo> copyStorePath(
                 act.progress(total, info->narSize);
             });
             TeeSink tee{sink, progressSink};
-            srcStore.narFromPath(storePath, tee);
+            srcStore.narFromPathForCopy(storePath, tee, dstStore);
         },
         [&]() {
             throw EndOfFile(
@@ -1140,7 +1155,7 @@ std::map<StorePath, StorePath> copyPaths(
             });
             TeeSink tee{sink, progressSink};
 
-            srcStore.narFromPath(missingPath, tee);
+            srcStore.narFromPathForCopy(missingPath, tee, dstStore);
         });
         pathsToCopy.emplace_back(std::move(infoForDst), std::move(source));
     }
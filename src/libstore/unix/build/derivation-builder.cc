@@ -11,6 +11,7 @@
 #include "nix/util/git.hh"
 #include "nix/store/daemon.hh"
 #include "nix/util/topo-sort.hh"
+#include "nix/util/thread-pool.hh"
 #include "nix/store/build/child.hh"
 #include "nix/util/unix-domain-socket.hh"
 #include "nix/store/posix-fs-canonicalise.hh"
@@ -48,6 +49,9 @@
 #include <iostream>
 #include <list>
 #include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <thread>
 
 #include "nix/util/strings.hh"
 #include "nix/util/signals.hh"
@@ -472,6 +476,8 @@ std::optional<Descriptor> DerivationBuilderImpl::startBuild()
     /* Construct the environment passed to the builder. */
     initEnv();
 
+    auto setupStart = std::chrono::steady_clock::now();
+
     prepareSandbox();
 
     if (needsHashRewrite() && pathExists(homeDir))
@@ -528,6 +534,12 @@ std::optional<Descriptor> DerivationBuilderImpl::startBuild()
 
     processSandboxSetupMessages();
 
+    printMsg(
+        lvlTalkative,
+        "setting up the build environment for '%s' took %d ms",
+        store.printStorePath(drvPath),
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - setupStart).count());
+
     return builderOut.get();
 }
 
@@ -1164,6 +1176,12 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
          * `scratchOutputsInverse`.
          */
         StringSet otherOutputs;
+        /**
+         * The result of serialising the output in its scratch location.
+         * Its hashes stay valid for as long as the output is not
+         * rewritten.
+         */
+        PathScanResult scan;
     };
 
     /* inverse map of scratchOutputs for efficient lookup */
@@ -1173,6 +1191,7 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
 
     std::map<std::string, std::variant<AlreadyRegistered, PerhapsNeedToRegister>> outputReferencesIfUnregistered;
     std::map<std::string, PosixStat> outputStats;
+    std::map<std::string, std::filesystem::path> outputsToScan;
     for (auto & [outputName, _] : drv.outputs) {
         auto scratchOutput = get(scratchOutputs, outputName);
         assert(scratchOutput);
@@ -1229,21 +1248,45 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
                 NIX_WHEN_SUPPORT_ACLS(localSettings.ignoredAcls)},
             inodesSeen);
 
+        outputsToScan.insert_or_assign(outputName, actualPath);
+        outputStats.insert_or_assign(outputName, std::move(st));
+    }
+
+    /* Serialise each output once, scanning it for references while
+       computing its NAR hash and, if the store is going to be
+       optimised, the hashes of its files. Unless the output has to be
+       rewritten later on, this is the only time we read it. The
+       outputs are independent of each other here, so scan them in
+       parallel. */
+    bool hashFiles = localSettings.autoOptimiseStore;
+    Sync<std::map<std::string, PathScanResult>> scans_;
+    auto scanOutput = [&](const std::string & outputName, const std::filesystem::path & actualPath) {
+        debug("scanning for references for output '%s' in temp location %s", outputName, PathFmt(actualPath));
+        auto scan = scanAndHashPath(actualPath, referenceablePaths, hashFiles);
+        scans_.lock()->insert_or_assign(outputName, std::move(scan));
+    };
+    if (outputsToScan.size() == 1)
+        scanOutput(outputsToScan.begin()->first, outputsToScan.begin()->second);
+    else if (!outputsToScan.empty()) {
+        ThreadPool pool{std::min<size_t>(outputsToScan.size(), std::max(1U, std::thread::hardware_concurrency()))};
+        for (auto & [outputName, actualPath] : outputsToScan)
+            pool.enqueue([&] { scanOutput(outputName, actualPath); });
+        pool.process();
+    }
+
+    for (auto & [outputName, scan] : *scans_.lock()) {
         bool discardReferences = false;
         if (auto udr = get(drvOptions.unsafeDiscardReferences, outputName)) {
             discardReferences = *udr;
         }
 
+        /* We still scanned the output in this case, as we need to know
+           whether it must be rewritten. */
         StorePathSet references;
         if (discardReferences)
             debug("discarding references of output '%s'", outputName);
-        else {
-            debug("scanning for references for output '%s' in temp location %s", outputName, PathFmt(actualPath));
-
-            /* Pass blank Sink as we are not ready to hash data at this stage. */
-            NullSink blank;
-            references = scanForReferences(blank, actualPath, referenceablePaths);
-        }
+        else
+            references = scan.references;
 
         StringSet referencedOutputs;
         for (auto & r : references)
@@ -1255,8 +1298,8 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
             PerhapsNeedToRegister{
                 .refs = references,
                 .otherOutputs = referencedOutputs,
+                .scan = std::move(scan),
             });
-        outputStats.insert_or_assign(outputName, std::move(st));
     }
 
     StringSet emptySet;
@@ -1336,9 +1379,27 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
             continue;
         auto references = *referencesOpt;
 
+        /* The hashes in `scan` are those of the current contents of
+           `actualPath` only as long as `scanIsCurrent` is set. */
+        auto & scan = std::get<PerhapsNeedToRegister>(*orifu).scan;
+        bool scanIsCurrent = true;
+
+        /* Whether `actualPath` has been replaced by a copy that hasn't
+           been canonicalised yet. */
+        bool needsCanonicalise = false;
+
         auto rewriteOutput = [&](const StringMap & rewrites) {
+            /* Since all the hashes we rewrite are those of scratch
+               outputs, we know from the scan whether the output contains
+               any of them. If not, rewriting would not change anything. */
+            if (scanIsCurrent && std::ranges::none_of(scan.references, [&](const StorePath & r) {
+                    return rewrites.contains(std::string{r.hashPart()});
+                }))
+                return;
+
             /* Apply hash rewriting if necessary. */
             if (!rewrites.empty()) {
+                scanIsCurrent = false;
                 debug("rewriting hashes in %1%; cross fingers", PathFmt(actualPath));
 
                 /* FIXME: Is this actually streaming? */
@@ -1417,6 +1478,11 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
             std::string oldHashPart{scratchPath->hashPart()};
             auto got = [&] {
                 auto fim = outputHash.method.getFileIngestionMethod();
+                /* Without self-references, the hash modulo self-references
+                   is just the NAR hash. */
+                if (fim == FileIngestionMethod::NixArchive && outputHash.hashAlgo == HashAlgorithm::SHA256
+                    && scanIsCurrent && !scan.references.contains(*scratchPath))
+                    return scan.narHash.hash;
                 switch (fim) {
                 case FileIngestionMethod::Flat:
                 case FileIngestionMethod::NixArchive: {
@@ -1448,10 +1514,11 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
             }
 
             {
-                HashResult narHashAndSize = hashPath(
-                    {makeFSSourceAccessor(actualPath), CanonPath::root},
-                    FileSerialisationMethod::NixArchive,
-                    HashAlgorithm::SHA256);
+                HashResult narHashAndSize = scanIsCurrent ? scan.narHash
+                                                          : hashPath(
+                                                                {makeFSSourceAccessor(actualPath), CanonPath::root},
+                                                                FileSerialisationMethod::NixArchive,
+                                                                HashAlgorithm::SHA256);
                 newInfo0.narHash = narHashAndSize.hash;
                 newInfo0.narSize = narHashAndSize.numBytesDigested;
             }
@@ -1479,6 +1546,13 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
                of thumb is that actualPath points to the current location of the stuff
                that we'll end up registering. */
             actualPath = std::move(tmpOutput);
+            needsCanonicalise = true;
+
+            /* Something outside the build may still have modified the
+               original while we copied it, so the earlier scan can't be
+               trusted for the copy. Scan the copy instead, which
+               is still cheaper than hashing it several times below. */
+            scan = scanAndHashPath(actualPath, referenceablePaths, hashFiles);
         };
 
         ValidPathInfo newInfo = std::visit(
@@ -1493,10 +1567,11 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
                         outputRewrites.insert_or_assign(
                             std::string{scratchPath->hashPart()}, std::string{requiredFinalPath.hashPart()});
                     rewriteOutput(outputRewrites);
-                    HashResult narHashAndSize = hashPath(
-                        {makeFSSourceAccessor(actualPath), CanonPath::root},
-                        FileSerialisationMethod::NixArchive,
-                        HashAlgorithm::SHA256);
+                    HashResult narHashAndSize = scanIsCurrent ? scan.narHash
+                                                              : hashPath(
+                                                                    {makeFSSourceAccessor(actualPath), CanonPath::root},
+                                                                    FileSerialisationMethod::NixArchive,
+                                                                    HashAlgorithm::SHA256);
                     ValidPathInfo newInfo0{requiredFinalPath, {store, narHashAndSize.hash}};
                     newInfo0.narSize = narHashAndSize.numBytesDigested;
                     auto refs = rewriteRefs();
@@ -1537,16 +1612,19 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
             output->raw);
 
         /* FIXME: set proper permissions in restorePath() so
-            we don't have to do another traversal. */
-        canonicalisePathMetaData(
-            actualPath,
-            {
+            we don't have to do another traversal. Outputs that were
+            left in place have been canonicalised above already, and
+            rewritten ones by `rewriteOutput()`. */
+        if (needsCanonicalise)
+            canonicalisePathMetaData(
+                actualPath,
+                {
 #ifndef _WIN32
-                // builder UIDs are already dealt with
-                .uidRange = std::nullopt,
+                    // builder UIDs are already dealt with
+                    .uidRange = std::nullopt,
 #endif
-                NIX_WHEN_SUPPORT_ACLS(localSettings.ignoredAcls)},
-            inodesSeen);
+                    NIX_WHEN_SUPPORT_ACLS(localSettings.ignoredAcls)},
+                inodesSeen);
 
         /* Calculate where we'll move the output files. In the checking case we
            will leave leave them where they are, for now, rather than move to
@@ -1656,7 +1734,8 @@ SingleDrvOutputs DerivationBuilderImpl::registerOutputs()
             }
 
             if (!store.isValidPath(newInfo.path))
-                store.optimisePath(store.toRealPath(newInfo.path), NoRepair); // FIXME: combine with scanForReferences()
+                store.optimisePath(
+                    store.toRealPath(newInfo.path), NoRepair, scanIsCurrent && hashFiles ? &scan.fileHashes : nullptr);
 
             newInfo.deriver = drvPath;
             newInfo.ultimate = true;
@@ -3,9 +3,15 @@
 #if NIX_USE_WASMTIME
 
 #  include "derivation-builder-impl.hh"
+#  include "nix/store/wasm-module-cache.hh"
+#  include "nix/util/hash.hh"
+#  include "nix/util/processes.hh"
+#  include "nix/util/sync.hh"
 
 #  include <wasmtime.hh>
 
+#  include <map>
+
 namespace nix {
 
 // FIXME: cut&paste
@@ -23,8 +29,89 @@ static std::span<uint8_t> string2span(std::string_view s)
     return std::span<uint8_t>((uint8_t *) s.data(), s.size());
 }
 
+/**
+ * Identifies the configuration of `makeEngine()` in the compiled
+ * module cache.
+ */
+static constexpr std::string_view engineKey = "wasi-builder;serial;wasmtime-" WASMTIME_VERSION;
+
+/**
+ * Make an engine for compiling and running WASI builders. This only
+ * happens in processes forked from a multi-threaded one, so don't let
+ * Wasmtime start a compilation thread pool.
+ */
+static wasmtime::Engine makeEngine()
+{
+    wasmtime::Config config;
+#  ifdef WASMTIME_FEATURE_PARALLEL_COMPILATION
+    config.parallel_compilation(false);
+#  endif
+    return wasmtime::Engine(std::move(config));
+}
+
+/**
+ * Helper processes that compile WASI builders that weren't in the
+ * compiled module cache and add them to it, keyed by the hash of the
+ * module so that each module is compiled only once at a time. They're
+ * waited for when this process exits rather than killed, since they
+ * exist to benefit later builds.
+ */
+struct BackgroundCompiles
+{
+    Sync<std::map<Hash, Pid>> pids;
+
+    ~BackgroundCompiles()
+    {
+        for (auto & [hash, pid] : *pids.lock())
+            try {
+                pid.wait(false);
+            } catch (...) {
+                ignoreExceptionInDestructor();
+            }
+    }
+
+    void start(std::string wasm)
+    {
+        auto hash = hashString(HashAlgorithm::SHA256, wasm);
+
+        auto pids_(pids.lock());
+
+        std::erase_if(*pids_, [](auto & i) { return !i.second.isAlive(); });
+
+        if (pids_->contains(hash))
+            return;
+
+        ProcessOptions options;
+        options.dieWithParent = false;
+
+        pids_->emplace(
+            hash,
+            startProcess(
+                [&]() {
+                    /* If this fails, so will the build. */
+                    try {
+                        auto engine = makeEngine();
+                        auto module = unwrap(wasmtime::Module::compile(engine, string2span(wasm)));
+                        storeCompiledWasmModule(engineKey, string2span(wasm), unwrap(module.serialize()));
+                    } catch (...) {
+                        ignoreExceptionExceptInterrupt(lvlDebug);
+                    }
+                    _exit(0);
+                },
+                options));
+    }
+};
+
+static BackgroundCompiles backgroundCompiles;
+
 struct WasiDerivationBuilder : DerivationBuilderImpl
 {
+    /**
+     * The serialized compiled builder, if it was in the compiled
+     * module cache.
+     */
+    std::optional<std::string> compiledBuilder;
+
     WasiDerivationBuilder(
         LocalStore & store, std::shared_ptr<DerivationBuilderCallbacks> miscMethods, DerivationBuilderParams params)
         : DerivationBuilderImpl(store, std::move(miscMethods), std::move(params))
@@ -32,11 +119,31 @@ struct WasiDerivationBuilder : DerivationBuilderImpl
         experimentalFeatureSettings.require(Xp::WasmDerivations);
     }
 
+    void startChild() override
+    {
+        /* Get the compiled builder from the compiled module cache.
+           This has to happen here because the child runs as the build
+           user, which cannot access our cache directory. */
+        auto wasm = readFile(realPathInHost(drv.builder));
+        compiledBuilder = lookupCompiledWasmModule(engineKey, string2span(wasm));
+
+        /* On a miss, the child compiles the module itself. Compiling a
+           large module can take seconds, which would hold up all other
+           goals if we did it here, so a helper process adds it to the
+           cache for later builds. We don't compile in this process,
+           since Wasmtime's threads wouldn't survive forking the
+           child. */
+        if (!compiledBuilder)
+            backgroundCompiles.start(std::move(wasm));
+
+        DerivationBuilderImpl::startChild();
+    }
+
     void execBuilder(const Strings & args, const Strings & envStrs) override
     {
         using namespace wasmtime;
 
-        Engine engine;
+        auto engine = makeEngine();
         Linker linker(engine);
         unwrap(linker.define_wasi());
 
@@ -64,7 +171,14 @@ struct WasiDerivationBuilder : DerivationBuilderImpl
                 WASMTIME_WASI_FILE_PERMS_READ | WASMTIME_WASI_FILE_PERMS_WRITE))
             throw Error("cannot add temporary directory to WASI config");
 
-        auto module = unwrap(Module::compile(engine, string2span(readFile(realPathInHost(drv.builder)))));
+        auto module = [&]() {
+            if (compiledBuilder) {
+                auto module = Module::deserialize(engine, string2span(*compiledBuilder));
+                if (module)
+                    return module.ok();
+            }
+            return unwrap(Module::compile(engine, string2span(readFile(realPathInHost(drv.builder)))));
+        }();
         wasmtime::Store wasmStore(engine);
         unwrap(wasmStore.context().set_wasi(std::move(wasiConfig)));
         auto instance = unwrap(linker.instantiate(wasmStore, module));
@@ -0,0 +1,82 @@
+#include "nix/store/wasm-module-cache.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/hash.hh"
+#include "nix/util/logging.hh"
+#include "nix/util/users.hh"
+#include "nix/util/util.hh"
+
+namespace nix {
+
+static std::string_view span2string(std::span<const uint8_t> s)
+{
+    return std::string_view((const char *) s.data(), s.size());
+}
+
+/**
+ * Size of the SHA-256 checksum of the compiled module at the start of
+ * each cache entry.
+ */
+static constexpr size_t checksumSize = 32;
+
+static std::filesystem::path getCachePath(std::string_view engineKey, std::span<const uint8_t> wasm)
+{
+    /* Modules compiled by different engines or Wasmtime versions are
+       kept in separate directories. */
+    auto engineHash = hashString(HashAlgorithm::SHA256, engineKey).to_string(HashFormat::Nix32, false);
+    auto moduleHash = hashString(HashAlgorithm::SHA256, span2string(wasm)).to_string(HashFormat::Nix32, false);
+    return getCacheDir() / "wasm-modules-v2" / engineHash / (moduleHash + ".cwasm");
+}
+
+static std::string checksum(std::string_view compiled)
+{
+    auto hash = hashString(HashAlgorithm::SHA256, compiled);
+    return std::string((const char *) hash.hash, hash.hashSize);
+}
+
+std::optional<std::string> lookupCompiledWasmModule(std::string_view engineKey, std::span<const uint8_t> wasm)
+{
+    try {
+        auto path = getCachePath(engineKey, wasm);
+        if (!pathExists(path)) {
+            debug("compiled Wasm module %s is not cached", PathFmt(path));
+            return std::nullopt;
+        }
+
+        auto contents = readFile(path);
+
+        /* Wasmtime doesn't validate what it deserializes, so make sure
+           we don't give it a damaged file. */
+        if (contents.size() < checksumSize
+            || checksum(std::string_view(contents).substr(checksumSize)) != contents.substr(0, checksumSize)) {
+            warn("removing corrupted compiled Wasm module %s", PathFmt(path));
+            std::filesystem::remove(path);
+            return std::nullopt;
+        }
+
+        debug("using compiled Wasm module %s", PathFmt(path));
+        contents.erase(0, checksumSize);
+        return contents;
+    } catch (...) {
+        ignoreExceptionExceptInterrupt(lvlDebug);
+        return std::nullopt;
+    }
+}
+
+void storeCompiledWasmModule(
+    std::string_view engineKey, std::span<const uint8_t> wasm, std::span<const uint8_t> compiled)
+{
+    try {
+        auto path = getCachePath(engineKey, wasm);
+        createDirs(path.parent_path());
+        /* Write to a temporary file first so that concurrent processes
+           never see a partially written module. */
+        auto tmpPath = makeTempPath(path);
+        writeFile(tmpPath, checksum(span2string(compiled)) + std::string(span2string(compiled)));
+        std::filesystem::rename(tmpPath, path);
+        debug("cached compiled Wasm module in %s", PathFmt(path));
+    } catch (...) {
+        ignoreExceptionExceptInterrupt(lvlDebug);
+    }
+}
+
+} // namespace nix
@@ -2,9 +2,22 @@
 #include "nix/store/worker-protocol-impl.hh"
 #include "nix/store/build-result.hh"
 #include "nix/store/derivations.hh"
+#include "nix/util/compression.hh"
+#include "nix/util/finally.hh"
+#include "nix/util/signals.hh"
+
+#include <cstring>
 
 namespace nix {
 
+void WorkerProto::BasicConnection::maybeEnableStreamCompression()
+{
+    if (!protoVersion.features.contains(WorkerProto::featureZstdStreamCompression))
+        return;
+    to.setEncoder(makeZstdStreamEncoder());
+    from.setDecoder(makeZstdStreamDecoder());
+}
+
 WorkerProto::BasicClientConnection::~BasicClientConnection()
 {
     try {
@@ -30,6 +43,43 @@ static Logger::Fields readFields(Source & from)
     return fields;
 }
 
+/**
+ * Forward a log message from the daemon to our logger. Returns false if
+ * `msg` is not a log message.
+ */
+static bool processLogMessage(uint64_t msg, Source & from)
+{
+    if (msg == STDERR_NEXT)
+        printError(chomp(readString(from)));
+
+    else if (msg == STDERR_START_ACTIVITY) {
+        auto act = readNum<ActivityId>(from);
+        auto lvl = (Verbosity) readInt(from);
+        auto type = (ActivityType) readInt(from);
+        auto s = readString(from);
+        auto fields = readFields(from);
+        auto parent = readNum<ActivityId>(from);
+        logger->startActivity(act, lvl, type, s, fields, parent);
+    }
+
+    else if (msg == STDERR_STOP_ACTIVITY) {
+        auto act = readNum<ActivityId>(from);
+        logger->stopActivity(act);
+    }
+
+    else if (msg == STDERR_RESULT) {
+        auto act = readNum<ActivityId>(from);
+        auto type = (ResultType) readInt(from);
+        auto fields = readFields(from);
+        logger->result(act, type, fields);
+    }
+
+    else
+        return false;
+
+    return true;
+}
+
 std::exception_ptr
 WorkerProto::BasicClientConnection::processStderrReturn(Sink * sink, Source * source, bool flush, bool block)
 {
@@ -72,30 +122,8 @@ WorkerProto::BasicClientConnection::processStderrReturn(Sink * sink, Source * so
             break;
         }
 
-        else if (msg == STDERR_NEXT)
-            printError(chomp(readString(from)));
-
-        else if (msg == STDERR_START_ACTIVITY) {
-            auto act = readNum<ActivityId>(from);
-            auto lvl = (Verbosity) readInt(from);
-            auto type = (ActivityType) readInt(from);
-            auto s = readString(from);
-            auto fields = readFields(from);
-            auto parent = readNum<ActivityId>(from);
-            logger->startActivity(act, lvl, type, s, fields, parent);
-        }
-
-        else if (msg == STDERR_STOP_ACTIVITY) {
-            auto act = readNum<ActivityId>(from);
-            logger->stopActivity(act);
-        }
-
-        else if (msg == STDERR_RESULT) {
-            auto act = readNum<ActivityId>(from);
-            auto type = (ResultType) readInt(from);
-            auto fields = readFields(from);
-            logger->result(act, type, fields);
-        }
+        else if (processLogMessage(msg, from))
+            ;
 
         else if (msg == STDERR_LAST) {
             assert(block);
@@ -315,4 +343,174 @@ void WorkerProto::BasicClientConnection::narFromPath(
     receiveNar(from);
 }
 
+struct WorkerProto::MultiplexedClientConnection::Request
+{
+    struct State
+    {
+        /**
+         * The part of the reply received so far, and how much of it
+         * has been read.
+         */
+        std::string data;
+        size_t pos = 0;
+
+        /**
+         * Whether the daemon has sent the final, empty frame.
+         */
+        bool done = false;
+
+        std::exception_ptr failure;
+    };
+
+    Sync<State> state_;
+
+    std::condition_variable wakeup;
+};
+
+/**
+ * A source that reads the frames that the daemon sends for a request,
+ * waiting for the reader thread to receive them.
+ */
+struct WorkerProto::MultiplexedClientConnection::ReplySource : Source
+{
+    Request & request;
+
+    ReplySource(Request & request)
+        : request(request)
+    {
+    }
+
+    size_t read(char * data, size_t len) override
+    {
+        auto state(request.state_.lock());
+        while (state->pos == state->data.size()) {
+            if (state->failure)
+                std::rethrow_exception(state->failure);
+            if (state->done)
+                throw EndOfFile("Nix daemon sent an incomplete reply");
+            state.wait_for(request.wakeup, std::chrono::milliseconds(100));
+            checkInterrupt();
+        }
+        auto n = std::min(len, state->data.size() - state->pos);
+        memcpy(data, state->data.data() + state->pos, n);
+        state->pos += n;
+        return n;
+    }
+};
+
+WorkerProto::MultiplexedClientConnection::MultiplexedClientConnection(ref<BasicClientConnection> conn)
+    : conn(conn)
+{
+    assert(conn->protoVersion.features.contains(WorkerProto::featureMultiplexing));
+    conn->to << WorkerProto::Op::Multiplex;
+    auto ex = conn->processStderrReturn();
+    if (ex)
+        std::rethrow_exception(ex);
+    readerThread = std::thread([this]() { reader(); });
+}
+
+WorkerProto::MultiplexedClientConnection::~MultiplexedClientConnection()
+{
+    /* The daemon closes the connection once it sees EOF, which stops
+       the reader thread. */
+    try {
+        conn->to.flush();
+        conn->closeWrite();
+    } catch (...) {
+        ignoreExceptionInDestructor();
+    }
+    readerThread.join();
+}
+
+bool WorkerProto::MultiplexedClientConnection::good()
+{
+    return !state_.lock()->failure;
+}
+
+void WorkerProto::MultiplexedClientConnection::reader()
+{
+    try {
+        while (true) {
+            auto id = readNum<uint64_t>(conn->from);
+            auto payload = readString(conn->from);
+
+            std::shared_ptr<Request> request;
+            {
+                auto state(state_.lock());
+                auto i = state->requests.find(id);
+                /* Ignore the end of replies that have already been
+                   read completely. */
+                if (i == state->requests.end())
+                    continue;
+                request = i->second;
+            }
+
+            {
+                auto state(request->state_.lock());
+                if (payload.empty())
+                    state->done = true;
+                else
+                    state->data += payload;
+            }
+            request->wakeup.notify_one();
+        }
+    } catch (...) {
+        auto ex = std::current_exception();
+        auto state(state_.lock());
+        state->failure = ex;
+        for (auto & [id, request] : state->requests) {
+            request->state_.lock()->failure = ex;
+            request->wakeup.notify_one();
+        }
+    }
+}
+
+void WorkerProto::MultiplexedClientConnection::call(
+    fun<void(WorkerProto::WriteConn)> writeRequest, fun<void(WorkerProto::ReadConn)> readReply)
+{
+    StringSink requestData;
+    writeRequest({.to = requestData, .version = conn->protoVersion});
+
+    auto request = std::make_shared<Request>();
+    uint64_t id;
+    {
+        auto state(state_.lock());
+        if (state->failure)
+            std::rethrow_exception(state->failure);
+        id = state->nextId++;
+        state->requests.emplace(id, request);
+    }
+
+    Finally removeRequest([&]() { state_.lock()->requests.erase(id); });
+
+    {
+        std::lock_guard<std::mutex> lock(writeLock);
+        if (auto failure = state_.lock()->failure)
+            std::rethrow_exception(failure);
+        try {
+            conn->to << id << requestData.s;
+            conn->to.flush();
+        } catch (...) {
+            /* The daemon may have received part of the frame, so the
+               connection can't be used anymore. */
+            state_.lock()->failure = std::current_exception();
+            throw;
+        }
+    }
+
+    ReplySource from(*request);
+
+    while (true) {
+        auto msg = readNum<uint64_t>(from);
+        if (msg == STDERR_LAST)
+            break;
+        else if (msg == STDERR_ERROR)
+            throw readError(from);
+        else if (!processLogMessage(msg, from))
+            throw Error("got unexpected message type %x from Nix daemon", msg);
+    }
+
+    readReply({.from = from, .version = conn->protoVersion});
+}
+
 } // namespace nix
@@ -35,6 +35,8 @@ const WorkerProto::Version WorkerProto::latest = {
             std::string{WorkerProto::featureVersionedAddToStoreMultiple},
             std::string{WorkerProto::featureAddTempRoots},
             std::string{WorkerProto::featureQueryPathInfos},
+            std::string{WorkerProto::featureZstdStreamCompression},
+            std::string{WorkerProto::featureMultiplexing},
         },
 };
 
@@ -61,6 +63,22 @@ std::partial_ordering WorkerProto::Version::operator<=>(const WorkerProto::Versi
     return std::partial_ordering::unordered;
 }
 
+bool WorkerProto::isMultiplexable(Op op)
+{
+    switch (op) {
+    case Op::IsValidPath:
+    case Op::QueryReferrers:
+    case Op::QueryPathInfo:
+    case Op::QueryPathFromHashPart:
+    case Op::QueryValidDerivers:
+    case Op::QueryPathInfos:
+    case Op::QueryDerivationOutputMap:
+        return true;
+    default:
+        return false;
+    }
+}
+
 /* protocol-specific definitions */
 
 BuildMode WorkerProto::Serialise<BuildMode>::read(const StoreDirConfig & store, WorkerProto::ReadConn conn)
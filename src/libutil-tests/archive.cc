@@ -1,9 +1,19 @@
 #include "nix/util/archive.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/finally.hh"
+#include "nix/util/fs-sink.hh"
+#include "nix/util/memory-source-accessor.hh"
 #include "nix/util/tests/characterization.hh"
 #include "nix/util/tests/gmock-matchers.hh"
 
 #include <gtest/gtest.h>
 
+#ifdef __linux__
+#  include <sys/stat.h>
+
+#  include "nix/util/io-uring-restore-sink.hh"
+#endif
+
 namespace nix {
 
 namespace {
@@ -58,4 +68,107 @@ INSTANTIATE_TEST_SUITE_P(
         // Test that the 'name' field cannot come before the 'node' field in a directory entry.
         std::pair{"name-after-node", "bad archive: expected tag 'name'"}));
 
+#ifdef __linux__
+
+/**
+ * A NAR with more files than can be in flight at once, executables,
+ * and a file that is large enough to be written synchronously.
+ */
+static std::string makeRestoreSinkTestNar()
+{
+    using File = MemorySourceAccessor::File;
+
+    File::Directory sub;
+    for (int i = 0; i < 200; ++i)
+        sub.entries.emplace(fmt("file-%d", i), File::Regular{.executable = i % 3 == 0, .contents = fmt("%d", i)});
+    sub.entries.emplace("empty", File::Regular{});
+    sub.entries.emplace("empty-executable", File::Regular{.executable = true});
+    sub.entries.emplace("link", File::Symlink{.target = "file-1"});
+
+    File::Directory root;
+    root.entries.emplace("sub", std::move(sub));
+    root.entries.emplace("large", File::Regular{.contents = std::string(3 * 1024 * 1024, 'x')});
+
+    auto accessor = make_ref<MemorySourceAccessor>();
+    accessor->root = std::move(root);
+
+    StringSink nar;
+    accessor->dumpPath(CanonPath::root, nar);
+    return std::move(nar.s);
+}
+
+/**
+ * Describe the file system objects under `root`, including their
+ * modes, which aren't fully captured by a NAR.
+ */
+static std::map<std::string, std::string> describeTree(const std::filesystem::path & root)
+{
+    std::map<std::string, std::string> res;
+    res["."] = fmt("%o", lstat(root).st_mode);
+    for (auto & entry : std::filesystem::recursive_directory_iterator(root)) {
+        auto st = lstat(entry.path());
+        auto & desc = res[std::filesystem::relative(entry.path(), root).string()];
+        desc = fmt("%o", st.st_mode);
+        if (S_ISREG(st.st_mode))
+            desc += " " + readFile(entry.path());
+        else if (S_ISLNK(st.st_mode))
+            desc += " -> " + readLink(entry.path()).string();
+    }
+    return res;
+}
+
+TEST(IoUringRestoreSink, roundTrip)
+{
+    auto nar = makeRestoreSinkTestNar();
+
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    auto dst = tmpDir / "out";
+
+    auto sink = linux::makeIoUringRestoreSink(dst, true);
+    if (!sink)
+        GTEST_SKIP() << "io_uring is not available";
+
+    StringSource source(nar);
+    parseDump(*sink, source);
+    sink->finish();
+
+    StringSink nar2;
+    dumpPath(dst, nar2);
+    ASSERT_EQ(nar, nar2.s);
+}
+
+TEST(IoUringRestoreSink, sameTreeAsRestoreSink)
+{
+    auto nar = makeRestoreSinkTestNar();
+
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+
+    /* A umask that clears execute bits, which `RestoreSink` sets on
+       executables regardless. */
+    auto oldUmask = umask(077);
+    Finally restoreUmask([&]() { umask(oldUmask); });
+
+    {
+        RestoreSink sink{false};
+        sink.dstPath = tmpDir / "restore-sink";
+        StringSource source(nar);
+        parseDump(sink, source);
+    }
+
+    auto sink = linux::makeIoUringRestoreSink(tmpDir / "io-uring", false);
+    if (!sink)
+        GTEST_SKIP() << "io_uring is not available";
+    StringSource source(nar);
+    parseDump(*sink, source);
+    sink->finish();
+
+    auto expected = describeTree(tmpDir / "restore-sink");
+    ASSERT_EQ(expected.at("sub/file-0").substr(0, 6), "100711");
+    ASSERT_EQ(describeTree(tmpDir / "io-uring"), expected);
+}
+
+#endif
+
 } // namespace nix
@@ -0,0 +1,12 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/util/util.hh"
+
+int main(int argc, char ** argv)
+{
+    nix::initLibUtil();
+
+    ::benchmark::Initialize(&argc, argv);
+    ::benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
@@ -1,4 +1,7 @@
 #include "nix/util/compression.hh"
+#include "nix/util/file-descriptor.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/fmt.hh"
 #include <gtest/gtest.h>
 #include <zstd.h>
 
@@ -129,4 +132,198 @@ TEST(makeCompressionSink, noneSinkDoesNothingToInput)
     ASSERT_STREQ(strSink.s.c_str(), inputString);
 }
 
+TEST(makeCompressionSink, zstdChunksSpanFrames)
+{
+    std::string input;
+    StringSink out;
+    auto sink = makeZstdSeekableCompressionSink(out, 100'000);
+
+    auto write = [&](std::string s, bool asChunk) {
+        input += s;
+        if (asChunk) {
+            auto owner = std::make_shared<std::string>(std::move(s));
+            SharedChunk chunk{owner, *owner};
+            sink->writeChunks({&chunk, 1});
+        } else
+            (*sink)(s);
+    };
+
+    for (int i = 0; i < 20; ++i) {
+        write(fmt("small write %d\n", i), false);
+        write(std::string(64 * 1024 + i, 'a' + i), true);
+        write(std::string(100, 'z'), true);
+    }
+    sink->finish();
+
+    ASSERT_EQ(decompress(CompressionAlgo::zstd, out.s), input);
+
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+    writeFile(tmpDir / "out.zst", out.s);
+    auto table = ZstdSeekTable::read(openFileReadonly(tmpDir / "out.zst").get());
+    ASSERT_EQ(table.size(), input.size());
+    for (auto & frame : std::span(table.frames).first(table.frames.size() - 1))
+        ASSERT_EQ(frame.size, 100'000u);
+}
+
+/* ----------------------------------------------------------------------------
+ * deltas
+ * --------------------------------------------------------------------------*/
+
+TEST(compressDelta, roundtripsAndIsSmall)
+{
+    std::string base, target;
+    for (int i = 0; i < 100000; ++i)
+        base += std::to_string(i * 7919 % 100003) + "\n";
+    target = base;
+    target.replace(target.size() / 2, 5, "hello");
+
+    auto delta = compressDelta(base, target);
+    ASSERT_LT(delta.size(), compress(CompressionAlgo::zstd, target).size() / 10);
+
+    StringSink sink;
+    auto decompressor = makeDeltaDecompressionSink(base, sink);
+    (*decompressor)(delta);
+    decompressor->finish();
+    ASSERT_EQ(sink.s, target);
+}
+
+/* ----------------------------------------------------------------------------
+ * seekable zstd
+ * --------------------------------------------------------------------------*/
+
+class ZstdSeekableTest : public ::testing::Test
+{
+    std::unique_ptr<AutoDelete> delTmpDir;
+
+protected:
+    std::filesystem::path tmpDir;
+    std::string input;
+    std::string compressed;
+
+public:
+    void SetUp() override
+    {
+        tmpDir = createTempDir();
+        delTmpDir = std::make_unique<AutoDelete>(tmpDir, true);
+
+        for (int i = 0; input.size() < 100'000; ++i)
+            input += fmt("line %d\n", i);
+
+        StringSink sink;
+        auto compressionSink = makeZstdSeekableCompressionSink(sink, 4096);
+        (*compressionSink)(input);
+        compressionSink->finish();
+        compressed = std::move(sink.s);
+    }
+
+    void TearDown() override
+    {
+        delTmpDir.reset();
+    }
+
+    ZstdSeekTable readTable(std::string_view contents)
+    {
+        writeFile(tmpDir / "log.zst", contents);
+        auto fd = openFileReadonly(tmpDir / "log.zst");
+        return ZstdSeekTable::read(fd.get());
+    }
+
+    std::string readRange(const ZstdSeekTable & table, uint64_t offset, uint64_t length)
+    {
+        auto fd = openFileReadonly(tmpDir / "log.zst");
+        StringSink sink;
+        table.readRange(fd.get(), offset, length, sink);
+        return std::move(sink.s);
+    }
+};
+
+TEST_F(ZstdSeekableTest, isRegularZstd)
+{
+    ASSERT_EQ(decompress(CompressionAlgo::zstd, compressed), input);
+}
+
+TEST_F(ZstdSeekableTest, readsRanges)
+{
+    auto table = readTable(compressed);
+    ASSERT_EQ(table.frames.size(), (input.size() + 4095) / 4096);
+    ASSERT_EQ(table.size(), input.size());
+
+    ASSERT_EQ(readRange(table, 0, input.size()), input);
+    ASSERT_EQ(readRange(table, 5000, 10'000), input.substr(5000, 10'000));
+    ASSERT_EQ(readRange(table, 4096, 1), input.substr(4096, 1));
+    ASSERT_EQ(readRange(table, input.size() - 100, 1000), input.substr(input.size() - 100));
+    ASSERT_EQ(readRange(table, input.size(), 1000), "");
+}
+
+TEST_F(ZstdSeekableTest, scansFramesWithoutSeekTable)
+{
+    auto table = readTable(compressed);
+    auto & lastFrame = table.frames.back();
+    auto withoutSeekTable =
+        std::string_view(compressed).substr(0, lastFrame.compressedOffset + lastFrame.compressedSize);
+
+    auto scanned = readTable(withoutSeekTable);
+    ASSERT_EQ(scanned.frames.size(), table.frames.size());
+    ASSERT_EQ(scanned.size(), input.size());
+    ASSERT_EQ(readRange(scanned, 1000, 20'000), input.substr(1000, 20'000));
+
+    /* An incomplete frame at the end, as in a file that's still being
+       written, is ignored. */
+    auto truncated = readTable(withoutSeekTable.substr(0, withoutSeekTable.size() - 1));
+    ASSERT_EQ(truncated.frames.size(), table.frames.size() - 1);
+    ASSERT_EQ(readRange(truncated, 0, input.size()), input.substr(0, truncated.size()));
+}
+
+/* ----------------------------------------------------------------------------
+ * stream compression
+ * --------------------------------------------------------------------------*/
+
+TEST(zstdStream, eachEncodeIsDecodableOnItsOwn)
+{
+    auto encoder = makeZstdStreamEncoder();
+    auto decoder = makeZstdStreamDecoder();
+
+    StringSink wire;
+    encoder->encode("hello ", wire);
+    auto firstSize = wire.s.size();
+    encoder->encode("world", wire);
+
+    /* Only hand the decoder the bytes of the first flush, so it
+       cannot peek ahead. */
+    StringSource first(std::string_view(wire.s).substr(0, firstSize));
+    char buf[64];
+    auto n = decoder->decode(first, buf, sizeof(buf));
+    ASSERT_EQ(std::string_view(buf, n), "hello ");
+    ASSERT_FALSE(decoder->hasPendingInput());
+
+    StringSource second(std::string_view(wire.s).substr(firstSize));
+    n = decoder->decode(second, buf, sizeof(buf));
+    ASSERT_EQ(std::string_view(buf, n), "world");
+}
+
+TEST(zstdStream, roundtripsThroughFdSinkAndFdSource)
+{
+    Pipe pipe;
+    pipe.create();
+
+    std::string input(1024 * 1024, 'x');
+    for (size_t i = 0; i < input.size(); i += 997)
+        input[i] = 'y';
+
+    FdSink sink(pipe.writeSide.get());
+    /* Some plain data before switching, as in a protocol handshake. */
+    sink << 42;
+    sink.setEncoder(makeZstdStreamEncoder(1));
+    sink << input;
+    sink.flush();
+    pipe.writeSide.close();
+
+    FdSource source(pipe.readSide.get());
+    ASSERT_EQ(readInt(source), 42);
+    /* The source has likely buffered encoded bytes already. */
+    source.setDecoder(makeZstdStreamDecoder());
+    ASSERT_EQ(readString(source), input);
+}
+
 } // namespace nix
@@ -2,6 +2,7 @@
 #include <gmock/gmock.h>
 
 #include "nix/util/file-descriptor.hh"
+#include "nix/util/file-system.hh"
 #include "nix/util/serialise.hh"
 #include "nix/util/signals.hh"
 
@@ -322,4 +323,30 @@ TEST(WriteFull, RespectsAllowInterrupts)
     EXPECT_EQ(source.readLine(/*eofOk=*/true), "hello");
 }
 
+TEST(CopyFdRange, FdSinkPreservesOrder)
+{
+    auto [fd, path] = createTempFile();
+    AutoDelete delPath(path, false);
+
+    std::string contents;
+    for (int i = 0; contents.size() < 20000; ++i)
+        contents += std::to_string(i);
+    writeFull(fd.get(), contents);
+
+    Pipe pipe;
+    pipe.create();
+
+    /* Buffered data must be flushed before `FdSink` sends the file
+       contents directly. */
+    FdSink sink(pipe.writeSide.get());
+    sink("head");
+    copyFdRange(fd.get(), 3, 10000, sink);
+    sink("tail");
+    sink.flush();
+    pipe.writeSide.close();
+
+    ASSERT_EQ(sink.written, 10008);
+    ASSERT_EQ(drainFD(pipe.readSide.get()), "head" + contents.substr(3, 10000) + "tail");
+}
+
 } // namespace nix
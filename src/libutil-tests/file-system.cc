@@ -1,5 +1,6 @@
 #include "nix/util/serialise.hh"
 #include "nix/util/file-system.hh"
+#include "nix/util/reflink.hh"
 
 #include <limits.h>
 #include <gtest/gtest.h>
@@ -347,4 +348,41 @@ TEST(createTempDir, works)
     ASSERT_TRUE(std::filesystem::is_directory(tmpDir));
 }
 
+/* ----------------------------------------------------------------------------
+ * copyFileContents
+ * --------------------------------------------------------------------------*/
+
+TEST(copyFileContents, works)
+{
+    auto tmpDir = createTempDir();
+    nix::AutoDelete delTmpDir(tmpDir, /*recursive=*/true);
+
+    std::string contents;
+    while (contents.size() < 3 * 1024 * 1024)
+        contents += fmt("line %d\n", contents.size());
+    writeFile(tmpDir / "from", contents);
+
+    {
+        auto from = openFileReadonly(tmpDir / "from");
+        auto to = openNewFileForWrite(tmpDir / "to", 0644, {});
+        ASSERT_TRUE(from);
+        ASSERT_TRUE(to);
+        if (!copyFileContents(from.get(), to.get()))
+            GTEST_SKIP() << "copying file contents in the kernel is not supported here";
+    }
+
+    EXPECT_EQ(readFile(tmpDir / "to"), contents);
+}
+
+TEST(copyFile, copiesRegularFile)
+{
+    auto tmpDir = createTempDir();
+    nix::AutoDelete delTmpDir(tmpDir, /*recursive=*/true);
+
+    writeFile(tmpDir / "from", "some contents");
+    copyFile(tmpDir / "from", tmpDir / "to", /*andDelete=*/false);
+
+    EXPECT_EQ(readFile(tmpDir / "to"), "some contents");
+}
+
 } // namespace nix
@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+
+#include "nix/util/archive.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/nar-cache.hh"
+
+namespace nix {
+
+static std::string makeNar(std::string_view contents)
+{
+    StringSink sink;
+    dumpString(contents, sink);
+    return std::move(sink.s);
+}
+
+static Hash narHashOf(std::string_view nar)
+{
+    return hashString(HashAlgorithm::SHA256, nar);
+}
+
+TEST(NarCache, sharedBetweenInstances)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+
+    auto nar = makeNar("hello world");
+    auto narHash = narHashOf(nar);
+
+    {
+        NarCache cache(tmpDir);
+        auto accessor = cache.getOrInsert(narHash, [&](Sink & sink) { sink(nar); });
+        EXPECT_EQ(accessor->readFile(CanonPath::root), "hello world");
+    }
+
+    /* A second cache using the same directory (e.g. in another process)
+       must not need to fetch the NAR again. */
+    NarCache cache(tmpDir);
+    auto accessor = cache.getOrInsert(narHash, [&](Sink & sink) { FAIL() << "NAR should have been cached"; });
+    EXPECT_EQ(accessor->readFile(CanonPath::root), "hello world");
+}
+
+TEST(NarCache, regeneratesMissingListing)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+
+    auto nar = makeNar("hello world");
+    auto narHash = narHashOf(nar);
+
+    NarCache(tmpDir).getOrInsert(narHash, [&](Sink & sink) { sink(nar); });
+
+    auto listingFile = tmpDir / (narHash.to_string(HashFormat::Nix32, false) + ".ls");
+    ASSERT_TRUE(pathExists(listingFile));
+    std::filesystem::remove(listingFile);
+
+    NarCache cache(tmpDir);
+    auto accessor = cache.getOrInsert(narHash, [&](Sink & sink) { FAIL() << "NAR should have been cached"; });
+    EXPECT_EQ(accessor->readFile(CanonPath::root), "hello world");
+    EXPECT_TRUE(pathExists(listingFile));
+}
+
+TEST(NarCache, evictsLeastRecentlyUsed)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+
+    std::vector<std::string> nars;
+    for (int i = 0; i < 4; ++i)
+        nars.push_back(makeNar(std::string(4096, 'a' + i)));
+
+    /* Room for about two entries. */
+    NarCache cache(tmpDir, 2 * nars[0].size() + 1024);
+
+    auto narFile = [&](const std::string & nar) {
+        return tmpDir / (narHashOf(nar).to_string(HashFormat::Nix32, false) + ".nar");
+    };
+
+    for (size_t i = 0; i < nars.size(); ++i) {
+        auto & nar = nars[i];
+        cache.getOrInsert(narHashOf(nar), [&](Sink & sink) { sink(nar); });
+        /* Backdate the entry to make the usage order unambiguous,
+           while keeping it older than the next one to be inserted. */
+        std::filesystem::last_write_time(
+            narFile(nar), std::filesystem::file_time_type::clock::now() - std::chrono::seconds(10 - i));
+    }
+
+    EXPECT_FALSE(pathExists(narFile(nars[0])));
+    EXPECT_FALSE(pathExists(narFile(nars[1])));
+    EXPECT_TRUE(pathExists(narFile(nars[2])));
+    EXPECT_TRUE(pathExists(narFile(nars[3])));
+}
+
+} // namespace nix
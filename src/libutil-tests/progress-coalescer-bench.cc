@@ -0,0 +1,139 @@
+#include <benchmark/benchmark.h>
+
+#include "nix/util/progress-coalescer.hh"
+
+#include <thread>
+#include <unordered_map>
+
+namespace nix {
+
+/**
+ * A logger that keeps track of the progress of activities the way the
+ * progress bar does, with a render thread that looks at the state
+ * every 50 ms. Progress results either take the state lock, or are
+ * queued in a `ProgressCoalescer` and applied by the render thread.
+ */
+struct ProgressBenchLogger : Logger
+{
+    const bool coalesce;
+
+    struct State
+    {
+        std::unordered_map<ActivityId, std::array<uint64_t, 4>> activities;
+        uint64_t done = 0;
+        bool quit = false;
+    };
+
+    Sync<State> state_;
+
+    std::condition_variable quitCV;
+
+    ProgressCoalescer progressQueue;
+
+    std::atomic<bool> progressQueued{false};
+
+    std::thread renderThread;
+
+    ProgressBenchLogger(bool coalesce)
+        : coalesce(coalesce)
+    {
+        renderThread = std::thread([&]() {
+            auto state(state_.lock());
+            while (!state->quit) {
+                applyQueuedProgress(*state);
+                uint64_t done = state->done;
+                for (auto & [act, progress] : state->activities)
+                    done += progress[0];
+                benchmark::DoNotOptimize(done);
+                state.wait_for(quitCV, std::chrono::milliseconds(50));
+            }
+        });
+    }
+
+    ~ProgressBenchLogger()
+    {
+        state_.lock()->quit = true;
+        quitCV.notify_one();
+        renderThread.join();
+    }
+
+    void log(Verbosity lvl, std::string_view s) noexcept override {}
+
+    void logEI(const ErrorInfo & ei) noexcept override {}
+
+    void applyQueuedProgress(State & state)
+    {
+        if (!progressQueued.exchange(false))
+            return;
+        progressQueue.drain([&](const ProgressCoalescer::Event & event) {
+            auto i = state.activities.find(event.act);
+            if (i != state.activities.end())
+                i->second = event.values;
+        });
+    }
+
+    void startActivity(
+        ActivityId act,
+        Verbosity lvl,
+        ActivityType type,
+        const std::string & s,
+        const Fields & fields,
+        ActivityId parent) noexcept override
+    {
+        state_.lock()->activities.emplace(act, std::array<uint64_t, 4>{});
+    }
+
+    void stopActivity(ActivityId act) noexcept override
+    {
+        auto state(state_.lock());
+        if (coalesce)
+            applyQueuedProgress(*state);
+        auto i = state->activities.find(act);
+        state->done += i->second[0];
+        state->activities.erase(i);
+    }
+
+    void result(ActivityId act, ResultType type, const Fields & fields) noexcept override
+    {
+        if (coalesce && progressQueue.push(act, type, fields)) {
+            /* Avoid writing to a shared cache line on every result. */
+            if (!progressQueued.load())
+                progressQueued = true;
+            return;
+        }
+        auto state(state_.lock());
+        if (coalesce)
+            applyQueuedProgress(*state);
+        state->activities[act] = {fields[0].i, fields[1].i, fields[2].i, fields[3].i};
+    }
+};
+
+/**
+ * Activities per second when 64 threads each run short activities that
+ * report their progress a number of times, like substitutions of small
+ * paths. Arg 0 takes a lock for every progress result; arg 1 queues
+ * them in a `ProgressCoalescer`.
+ */
+static void BM_ActivityProgress(benchmark::State & state)
+{
+    static std::unique_ptr<ProgressBenchLogger> logger;
+    const uint64_t updatesPerActivity = 16;
+
+    if (state.thread_index() == 0)
+        logger = std::make_unique<ProgressBenchLogger>(state.range(0));
+
+    for (auto _ : state) {
+        Activity act(*logger, lvlInfo, actCopyPath);
+        for (uint64_t i = 1; i <= updatesPerActivity; ++i)
+            act.progress(i, updatesPerActivity, 1, 0);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+
+    if (state.thread_index() == 0)
+        logger.reset();
+}
+
+BENCHMARK(BM_ActivityProgress)->Arg(false)->Arg(true)->Threads(64)->UseRealTime();
+
+} // namespace nix
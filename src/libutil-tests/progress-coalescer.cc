@@ -0,0 +1,172 @@
+#include "nix/util/progress-coalescer.hh"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <thread>
+
+namespace nix {
+
+static Logger::Fields progress(uint64_t done, uint64_t expected, uint64_t running = 0, uint64_t failed = 0)
+{
+    return {done, expected, running, failed};
+}
+
+static Logger::Fields setExpected(ActivityType type, uint64_t expected)
+{
+    return {(uint64_t) type, expected};
+}
+
+static std::vector<ProgressCoalescer::Event> drainAll(ProgressCoalescer & queue)
+{
+    std::vector<ProgressCoalescer::Event> events;
+    queue.drain([&](const ProgressCoalescer::Event & event) { events.push_back(event); });
+    return events;
+}
+
+TEST(ProgressCoalescer, rejectsOtherResults)
+{
+    ProgressCoalescer queue;
+    ASSERT_FALSE(queue.push(1, resBuildLogLine, {"hello"}));
+    ASSERT_FALSE(queue.push(1, resProgress, {(uint64_t) 1, (uint64_t) 2}));
+    ASSERT_FALSE(queue.push(1, resSetExpected, {(uint64_t) actBuild, "x"}));
+    ASSERT_TRUE(drainAll(queue).empty());
+}
+
+TEST(ProgressCoalescer, keepsLastResultPerActivity)
+{
+    ProgressCoalescer queue;
+    ASSERT_TRUE(queue.push(1, resProgress, progress(1, 10, 1, 0)));
+    ASSERT_TRUE(queue.push(2, resProgress, progress(5, 10, 0, 0)));
+    ASSERT_TRUE(queue.push(1, resSetExpected, setExpected(actBuild, 3)));
+    ASSERT_TRUE(queue.push(1, resSetExpected, setExpected(actCopyPath, 1000)));
+    ASSERT_TRUE(queue.push(1, resProgress, progress(2, 10, 1, 1)));
+    ASSERT_TRUE(queue.push(1, resSetExpected, setExpected(actBuild, 4)));
+
+    auto events = drainAll(queue);
+    ASSERT_EQ(events.size(), 4u);
+
+    ASSERT_EQ(events[0].act, 2u);
+    ASSERT_EQ(events[0].values, (std::array<uint64_t, 4>{5, 10, 0, 0}));
+
+    ASSERT_EQ(events[1].type, resSetExpected);
+    ASSERT_EQ(events[1].values[0], (uint64_t) actCopyPath);
+
+    ASSERT_EQ(events[2].type, resProgress);
+    ASSERT_EQ(events[2].values, (std::array<uint64_t, 4>{2, 10, 1, 1}));
+
+    ASSERT_EQ(events[3].values[0], (uint64_t) actBuild);
+    ASSERT_EQ(events[3].values[1], 4u);
+
+    ASSERT_TRUE(drainAll(queue).empty());
+}
+
+/**
+ * Results for an activity that moves between threads are applied in
+ * the order in which they were pushed, not in the order of the rings.
+ */
+TEST(ProgressCoalescer, ordersResultsAcrossThreads)
+{
+    ProgressCoalescer queue;
+
+    /* Gives this thread the first ring. */
+    ASSERT_TRUE(queue.push(2, resProgress, progress(1, 10)));
+
+    std::thread other([&]() { ASSERT_TRUE(queue.push(1, resProgress, progress(1, 10))); });
+    other.join();
+
+    ASSERT_TRUE(queue.push(1, resProgress, progress(2, 10)));
+    ASSERT_TRUE(queue.push(2, resProgress, progress(2, 10)));
+
+    auto events = drainAll(queue);
+    ASSERT_EQ(events.size(), 2u);
+    ASSERT_EQ(events[0].act, 1u);
+    ASSERT_EQ(events[0].values[0], 2u);
+    ASSERT_EQ(events[1].act, 2u);
+    ASSERT_EQ(events[1].values[0], 2u);
+    ASSERT_LT(events[0].seq, events[1].seq);
+}
+
+/**
+ * With a producer that pushes to a new thread's ring after each
+ * result, the consumer never sees an activity's progress go back.
+ */
+TEST(ProgressCoalescer, concurrentHandOver)
+{
+    ProgressCoalescer queue;
+    std::atomic<bool> stop{false};
+    uint64_t done = 0;
+
+    std::thread consumer([&]() {
+        while (!stop) {
+            for (auto & event : drainAll(queue)) {
+                ASSERT_GT(event.values[0], done);
+                done = event.values[0];
+            }
+        }
+    });
+
+    for (uint64_t i = 1; i <= 1000; ++i) {
+        std::thread producer([&]() {
+            while (!queue.push(1, resProgress, progress(i, 1000)))
+                ;
+        });
+        producer.join();
+    }
+
+    stop = true;
+    consumer.join();
+
+    for (auto & event : drainAll(queue))
+        done = event.values[0];
+    ASSERT_EQ(done, 1000u);
+}
+
+TEST(ProgressCoalescer, fullRingRejects)
+{
+    ProgressCoalescer queue;
+    size_t pushed = 0;
+    while (queue.push(pushed + 1, resProgress, progress(pushed, 0, 0, 0)))
+        pushed++;
+    ASSERT_GT(pushed, 0u);
+    ASSERT_EQ(drainAll(queue).size(), pushed);
+    ASSERT_TRUE(queue.push(1, resProgress, progress(0, 0, 0, 0)));
+}
+
+TEST(ProgressCoalescer, concurrentProducers)
+{
+    ProgressCoalescer queue;
+    std::map<ActivityId, uint64_t> done;
+    std::atomic<bool> stop{false};
+
+    std::thread consumer([&]() {
+        while (!stop) {
+            for (auto & event : drainAll(queue)) {
+                ASSERT_GE(event.values[0], done[event.act]);
+                done[event.act] = event.values[0];
+            }
+        }
+    });
+
+    std::vector<std::thread> producers;
+    for (ActivityId t = 1; t <= 8; ++t)
+        producers.emplace_back([&, t]() {
+            for (uint64_t i = 1; i <= 10000;)
+                if (queue.push(t, resProgress, progress(i, 10000, 0, 0)))
+                    ++i;
+        });
+
+    for (auto & t : producers)
+        t.join();
+    stop = true;
+    consumer.join();
+
+    for (auto & event : drainAll(queue))
+        done[event.act] = event.values[0];
+
+    ASSERT_EQ(done.size(), 8u);
+    for (auto & [act, n] : done)
+        ASSERT_EQ(n, 10000u);
+}
+
+} // namespace nix
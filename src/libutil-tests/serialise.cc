@@ -1,5 +1,7 @@
 #include "nix/util/serialise.hh"
 #include "nix/util/config.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/hash.hh"
 
 #include <boost/context/detail/exception.hpp>
 #include <gtest/gtest.h>
@@ -78,4 +80,54 @@ TEST(sourceToSink, forcedUnwindUcaughtExceptions)
 
 #endif
 
+static SharedChunk makeChunk(std::string s)
+{
+    auto owner = std::make_shared<std::string>(std::move(s));
+    return {owner, *owner};
+}
+
+TEST(FdSink, writeChunksAfterBufferedData)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+
+    std::vector<SharedChunk> chunks;
+    for (char c = 'a'; c <= 'c'; ++c)
+        chunks.push_back(makeChunk(std::string(64 * 1024, c)));
+
+    {
+        AutoCloseFD fd = openNewFileForWrite(tmpDir / "out", 0644, {.truncateExisting = true});
+        FdSink sink(fd.get());
+        sink("head");
+        sink.writeChunks(chunks);
+        sink.writeChunks(std::span(chunks).first(0));
+        sink("tail");
+        sink.flush();
+        ASSERT_EQ(sink.written, 3 * 64 * 1024 + 8);
+    }
+
+    ASSERT_EQ(
+        readFile(tmpDir / "out"),
+        "head" + std::string(64 * 1024, 'a') + std::string(64 * 1024, 'b') + std::string(64 * 1024, 'c') + "tail");
+}
+
+TEST(TeeSource, drainIntoFeedsBothSinks)
+{
+    std::string input(200 * 1024, 'x');
+    for (size_t i = 0; i < input.size(); i += 997)
+        input[i] = 'y';
+
+    StringSource source(input);
+    HashSink hashSink(HashAlgorithm::SHA256);
+    TeeSource tee(source, hashSink);
+
+    char head[4];
+    tee(head, sizeof(head));
+    StringSink rest;
+    tee.drainInto(rest, input.size() - 4);
+
+    ASSERT_EQ(rest.s, input.substr(4));
+    ASSERT_EQ(hashSink.finish().hash, hashString(HashAlgorithm::SHA256, input));
+}
+
 } // namespace nix
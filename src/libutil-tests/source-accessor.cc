@@ -1,6 +1,9 @@
 #include "nix/util/fs-sink.hh"
 #include "nix/util/file-system.hh"
 #include "nix/util/processes.hh"
+#include "nix/util/config-global.hh"
+#include "nix/util/finally.hh"
+#include "nix/util/forwarding-source-accessor.hh"
 
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
@@ -164,6 +167,48 @@ TEST_F(FSSourceAccessorTest, invalidateCacheDropsStaleDirFds)
     EXPECT_THAT(accessor, HasSymlink(CanonPath("a/b/l"), "g"));
 }
 
+TEST_F(FSSourceAccessorTest, readAheadDumpIsIdentical)
+{
+#ifdef _WIN32
+    GTEST_SKIP() << "read-ahead is Unix-only";
+#endif
+    for (int d = 0; d < 5; ++d) {
+        auto dir = tmpDir / fmt("dir-%d", d) / "sub";
+        createDirs(dir);
+        for (int f = 0; f < 20; ++f)
+            writeFile(dir / fmt("file-%d", f), std::string(f * 37 + d, 'a' + f));
+        createSymlink("file-0", dir / "link");
+    }
+    writeFile(tmpDir / "empty", "");
+    /* Larger than the read-ahead limit. */
+    writeFile(tmpDir / "large", std::string(3 * 1024 * 1024, 'x'));
+
+    auto dump = [&](ref<SourceAccessor> accessor) {
+        StringSink sink;
+        accessor->dumpPath(CanonPath::root, sink);
+        return std::make_pair(std::move(sink.s), accessor->hashPath(CanonPath::root));
+    };
+
+    auto expected = dump(makeFSSourceAccessor(tmpDir));
+
+    /* Use a window smaller than the number of threads. */
+    globalConfig.set("nar-read-ahead-threads", "4");
+    globalConfig.set("nar-read-ahead-files", "3");
+    Finally resetConfig([] {
+        globalConfig.set("nar-read-ahead-threads", "0");
+        globalConfig.set("nar-read-ahead-files", "64");
+    });
+
+    auto actual = dump(makeFSSourceAccessor(tmpDir));
+    EXPECT_EQ(actual.first, expected.first);
+    EXPECT_EQ(actual.second, expected.second);
+
+    /* Wrapping accessors forward read-ahead. */
+    auto wrapped = dump(make_ref<ForwardingSourceAccessor>(makeFSSourceAccessor(tmpDir)));
+    EXPECT_EQ(wrapped.first, expected.first);
+    EXPECT_EQ(wrapped.second, expected.second);
+}
+
 /* ----------------------------------------------------------------------------
  * RestoreSink non-directory at root (no dirFd)
  * --------------------------------------------------------------------------*/
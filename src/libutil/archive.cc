@@ -43,6 +43,10 @@ PathFilter defaultPathFilter = [](const std::string &) { return true; };
 
 void SourceAccessor::dumpPath(const CanonPath & path, Sink & sink, PathFilter & filter)
 {
+    /* A filter might skip files that read-ahead would then read for
+       nothing. */
+    auto readAhead = &filter == &defaultPathFilter ? startReadAhead(path) : nullptr;
+
     auto dumpContents = [&sink](SourceAccessor & accessor, const CanonPath & path) {
         sink << "contents";
         std::optional<uint64_t> size;
@@ -309,9 +313,7 @@ void parseDump(FileSystemObjectSink & sink, Source & source)
 
 void restorePath(const std::filesystem::path & path, Source & source, bool startFsync)
 {
-    RestoreSink sink{startFsync};
-    sink.dstPath = path;
-    parseDump(sink, source);
+    withRestoreSink(path, startFsync, [&](FileSystemObjectSink & sink) { parseDump(sink, source); });
 }
 
 void copyNAR(Source & source, Sink & sink)
@@ -13,6 +13,10 @@
 #include <brotli/encode.h>
 
 #include <zstd.h>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <span>
 #include <thread>
 
 namespace nix {
@@ -335,6 +339,11 @@ struct BrotliCompressionSink : ChunkedCompressionSink
     }
 };
 
+static constexpr uint32_t zstdSkippableMagic = 0x184D2A5E;
+static constexpr uint32_t zstdSeekableMagic = 0x8F92EAB1;
+static constexpr uint32_t zstdSeekTableFooterSize = 9;
+static constexpr size_t zstdFrameHeaderSizeMax = 18;
+
 /**
  * Zstd compression that cuts a new frame every `bytesPerFrame` of
  * uncompressed input.  The result is a concatenation of independent
@@ -344,12 +353,16 @@ struct BrotliCompressionSink : ChunkedCompressionSink
  * independent and carries its decompressed size, a parallel decoder
  * can split work across them.
  *
- * Frame size is fixed at 16 MiB of input.  zstd's window size is
+ * Frame size defaults to 16 MiB of input.  zstd's window size is
  * level-dependent (~2 MiB at the default level 3, up to 8 MiB at
  * higher levels), so the ratio loss from not being able to reference
  * across a frame boundary is small.  16 MiB gives ~700 frames for the
  * biggest NARs, which is ample parallelism and lets a decoder start
  * work before the whole blob is downloaded.
+ *
+ * In seekable mode, the frames are followed by a seek table listing
+ * their sizes, so that a reader can decompress any part of the data
+ * without decompressing what comes before it.
  */
 struct ZstdMultiFrameCompressionSink : CompressionSink
 {
@@ -357,21 +370,39 @@ struct ZstdMultiFrameCompressionSink : CompressionSink
     std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx{nullptr, ZSTD_freeCCtx};
     std::vector<char> outbuf;
     /**
-     * Input buffer for the current frame.  We accumulate a full
-     * frame's worth before compressing so we can set an exact
+     * Input for the current frame.  We accumulate a full frame's
+     * worth before compressing so we can set an exact
      * `ZSTD_CCtx_setPledgedSrcSize` — that writes `Frame_Content_Size`
      * into the frame header, allowing a parallel decoder to compute
      * each frame's output offset up front.
+     *
+     * Large chunks received through `writeChunks()` are kept by
+     * reference; everything else is copied into `copied`.
      */
-    std::vector<char> inbuf;
+    std::vector<SharedChunk> inbuf;
+    uint64_t inbufSize = 0;
+    /**
+     * Reserved at the frame size, so it's never reallocated and views
+     * into it stay valid until the frame has been emitted.
+     */
+    std::shared_ptr<std::string> copied;
     bool emittedAnyFrame = false;
-    static constexpr uint64_t bytesPerFrame = 16 * 1024 * 1024;
+    const uint64_t bytesPerFrame;
+
+    /**
+     * The compressed and uncompressed size of every frame emitted so
+     * far, if we're writing the seekable format.
+     */
+    std::optional<std::vector<std::pair<uint32_t, uint32_t>>> seekTable;
 
-    ZstdMultiFrameCompressionSink(Sink & nextSink, bool parallel, int level)
+    ZstdMultiFrameCompressionSink(
+        Sink & nextSink, bool parallel, int level, uint64_t bytesPerFrame = 16 * 1024 * 1024, bool seekable = false)
         : nextSink(nextSink)
         , outbuf(ZSTD_CStreamOutSize())
+        , bytesPerFrame(bytesPerFrame)
     {
-        inbuf.reserve(bytesPerFrame);
+        if (seekable)
+            seekTable.emplace();
         cctx.reset(ZSTD_createCCtx());
         if (!cctx)
             throw CompressionError("unable to initialise zstd encoder");
@@ -410,34 +441,109 @@ struct ZstdMultiFrameCompressionSink : CompressionSink
     void emitFrame()
     {
         checkZstd(ZSTD_CCtx_reset(cctx.get(), ZSTD_reset_session_only));
-        checkZstd(ZSTD_CCtx_setPledgedSrcSize(cctx.get(), inbuf.size()));
+        checkZstd(ZSTD_CCtx_setPledgedSrcSize(cctx.get(), inbufSize));
+
+        uint64_t compressedSize = 0;
+        auto compress = [&](std::string_view data, ZSTD_EndDirective mode) {
+            ZSTD_inBuffer in = {data.data(), data.size(), 0};
+            for (;;) {
+                checkInterrupt();
+                ZSTD_outBuffer out = {outbuf.data(), outbuf.size(), 0};
+                size_t remaining = ZSTD_compressStream2(cctx.get(), &out, &in, mode);
+                checkZstd(remaining);
+                if (out.pos > 0)
+                    nextSink({outbuf.data(), out.pos});
+                compressedSize += out.pos;
+                if (mode == ZSTD_e_end ? remaining == 0 : in.pos == in.size)
+                    break;
+            }
+        };
+        for (auto & chunk : inbuf)
+            compress(chunk.data, ZSTD_e_continue);
+        compress({}, ZSTD_e_end);
 
-        ZSTD_inBuffer in = {inbuf.data(), inbuf.size(), 0};
-        for (;;) {
-            checkInterrupt();
-            ZSTD_outBuffer out = {outbuf.data(), outbuf.size(), 0};
-            size_t remaining = ZSTD_compressStream2(cctx.get(), &out, &in, ZSTD_e_end);
-            checkZstd(remaining);
-            if (out.pos > 0)
-                nextSink({outbuf.data(), out.pos});
-            if (remaining == 0)
-                break;
-        }
+        if (seekTable)
+            seekTable->emplace_back(compressedSize, inbufSize);
         inbuf.clear();
+        inbufSize = 0;
+        if (copied)
+            copied->clear();
         emittedAnyFrame = true;
     }
 
+    /**
+     * Add the first part of `chunk` that fits in the current frame,
+     * and emit the frame if it's full. Returns the size of that part.
+     */
+    size_t addToFrame(const SharedChunk & chunk)
+    {
+        size_t n = std::min<uint64_t>(bytesPerFrame - inbufSize, chunk.data.size());
+        auto data = chunk.data.substr(0, n);
+        /* Merge consecutive pieces of the same buffer, e.g. of
+           `copied`. */
+        if (!inbuf.empty() && inbuf.back().owner == chunk.owner
+            && inbuf.back().data.data() + inbuf.back().data.size() == data.data())
+            inbuf.back().data = {inbuf.back().data.data(), inbuf.back().data.size() + n};
+        else
+            inbuf.push_back({chunk.owner, data});
+        inbufSize += n;
+        if (inbufSize >= bytesPerFrame)
+            emitFrame();
+        return n;
+    }
+
+    /**
+     * Emit the seek table as a skippable frame, as described in
+     * zstd's `contrib/seekable_format/zstd_seekable_compression_format.md`.
+     */
+    void emitSeekTable()
+    {
+        StringSink table;
+        auto put32 = [&](uint32_t n) {
+            char buf[4];
+            for (int i = 0; i < 4; ++i)
+                buf[i] = (char) (n >> (i * 8));
+            table({buf, sizeof(buf)});
+        };
+        put32(zstdSkippableMagic);
+        put32(seekTable->size() * 8 + zstdSeekTableFooterSize);
+        for (auto & [compressedSize, size] : *seekTable) {
+            put32(compressedSize);
+            put32(size);
+        }
+        put32(seekTable->size());
+        table(std::string_view("\0", 1)); // descriptor: no checksums
+        put32(zstdSeekableMagic);
+        nextSink(table.s);
+    }
+
     void writeUnbuffered(std::string_view data) override
     {
         while (!data.empty()) {
-            uint64_t room = bytesPerFrame - inbuf.size();
-            size_t n = (room < data.size()) ? room : data.size();
-
-            inbuf.insert(inbuf.end(), data.data(), data.data() + n);
+            if (!copied) {
+                copied = std::make_shared<std::string>();
+                copied->reserve(bytesPerFrame);
+            }
+            size_t n = std::min<uint64_t>(bytesPerFrame - inbufSize, data.size());
+            auto start = copied->size();
+            copied->append(data.substr(0, n));
             data.remove_prefix(n);
+            addToFrame({copied, std::string_view(*copied).substr(start)});
+        }
+    }
 
-            if (inbuf.size() >= bytesPerFrame)
-                emitFrame();
+    void writeChunks(std::span<const SharedChunk> chunks) override
+    {
+        for (auto & chunk : chunks) {
+            /* Small chunks are cheaper to copy than to compress
+               separately. */
+            if (chunk.data.size() < bufSize) {
+                (*this)(chunk.data);
+                continue;
+            }
+            flush();
+            for (size_t pos = 0; pos < chunk.data.size();)
+                pos += addToFrame({chunk.owner, chunk.data.substr(pos)});
         }
     }
 
@@ -448,8 +554,232 @@ struct ZstdMultiFrameCompressionSink : CompressionSink
            never wrote anything — the output must contain at least one
            frame header to be valid zstd (otherwise the libarchive
            decoder chokes on round-tripped empty input). */
-        if (!inbuf.empty() || !emittedAnyFrame)
+        if (inbufSize || !emittedAnyFrame)
             emitFrame();
+        if (seekTable)
+            emitSeekTable();
+    }
+};
+
+static void checkZstd(size_t ret)
+{
+    if (ZSTD_isError(ret))
+        throw CompressionError("zstd error: %s", ZSTD_getErrorName(ret));
+}
+
+/**
+ * Window size needed to reference all of `base` while producing
+ * `target`.
+ */
+static int deltaWindowLog(size_t baseSize, size_t targetSize)
+{
+    auto bounds = ZSTD_cParam_getBounds(ZSTD_c_windowLog);
+    checkZstd(bounds.error);
+    int windowLog = bounds.lowerBound;
+    while (windowLog < bounds.upperBound && (size_t(1) << windowLog) < baseSize + targetSize)
+        windowLog++;
+    return windowLog;
+}
+
+struct ZstdDeltaDecompressionSink : FinishSink
+{
+    Sink & nextSink;
+    std::string base;
+    std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx{nullptr, ZSTD_freeDCtx};
+    std::vector<char> outbuf;
+
+    ZstdDeltaDecompressionSink(std::string base, Sink & nextSink)
+        : nextSink(nextSink)
+        , base(std::move(base))
+        , outbuf(ZSTD_DStreamOutSize())
+    {
+        dctx.reset(ZSTD_createDCtx());
+        if (!dctx)
+            throw CompressionError("unable to initialise zstd decoder");
+        /* The encoder sized its window to cover the whole base, which
+           is usually above the decoder's default limit. */
+        auto bounds = ZSTD_dParam_getBounds(ZSTD_d_windowLogMax);
+        checkZstd(bounds.error);
+        checkZstd(ZSTD_DCtx_setParameter(dctx.get(), ZSTD_d_windowLogMax, bounds.upperBound));
+        checkZstd(ZSTD_DCtx_refPrefix(dctx.get(), this->base.data(), this->base.size()));
+    }
+
+    void operator()(std::string_view data) override
+    {
+        ZSTD_inBuffer in = {data.data(), data.size(), 0};
+        while (in.pos < in.size) {
+            checkInterrupt();
+            ZSTD_outBuffer out = {outbuf.data(), outbuf.size(), 0};
+            checkZstd(ZSTD_decompressStream(dctx.get(), &out, &in));
+            if (out.pos > 0)
+                nextSink({outbuf.data(), out.pos});
+        }
+    }
+
+    void finish() override
+    {
+        /* Drain output still held by the decoder. */
+        for (;;) {
+            ZSTD_inBuffer in = {nullptr, 0, 0};
+            ZSTD_outBuffer out = {outbuf.data(), outbuf.size(), 0};
+            auto ret = ZSTD_decompressStream(dctx.get(), &out, &in);
+            checkZstd(ret);
+            if (out.pos > 0)
+                nextSink({outbuf.data(), out.pos});
+            if (out.pos < out.size) {
+                if (ret != 0)
+                    throw CompressionError("zstd delta is truncated");
+                break;
+            }
+        }
+    }
+};
+
+/**
+ * Zstd stream encoder for protocol connections.  Every call to
+ * `encode()` ends with `ZSTD_e_flush`, so the peer can decode
+ * everything we have sent without waiting for the end of the frame;
+ * the whole connection is a single frame.
+ *
+ * In adaptive mode the compression level follows the measured
+ * throughput, like `zstd --adapt`: if we spend most of our time
+ * blocked writing to the connection, the link is the bottleneck and
+ * spending more CPU on a better ratio is free; if we spend most of
+ * our time compressing, the CPU is the bottleneck and we back off.
+ */
+struct ZstdStreamEncoder : StreamEncoder
+{
+    std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx{nullptr, ZSTD_freeCCtx};
+    std::vector<char> outbuf;
+
+    int level;
+    bool adaptive;
+
+    static constexpr int minLevel = 1;
+    static constexpr int maxLevel = 19;
+
+    /**
+     * Amount of input after which we reconsider the compression
+     * level.
+     */
+    static constexpr uint64_t adaptWindow = 4 * 1024 * 1024;
+
+    uint64_t windowBytes = 0;
+    std::chrono::nanoseconds windowCompressTime{0}, windowWriteTime{0};
+
+    ZstdStreamEncoder(int level, bool adaptive)
+        : outbuf(ZSTD_CStreamOutSize())
+        , level(level == COMPRESSION_LEVEL_DEFAULT ? ZSTD_CLEVEL_DEFAULT : level)
+        , adaptive(adaptive)
+    {
+        cctx.reset(ZSTD_createCCtx());
+        if (!cctx)
+            throw CompressionError("unable to initialise zstd encoder");
+        checkZstd(ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_compressionLevel, this->level));
+    }
+
+    void encode(std::string_view data, Sink & out) override
+    {
+        using namespace std::chrono;
+
+        auto start = steady_clock::now();
+        nanoseconds writeTime{0};
+
+        ZSTD_inBuffer in = {data.data(), data.size(), 0};
+        for (;;) {
+            ZSTD_outBuffer outBuf = {outbuf.data(), outbuf.size(), 0};
+            size_t remaining = ZSTD_compressStream2(cctx.get(), &outBuf, &in, ZSTD_e_flush);
+            checkZstd(remaining);
+            if (outBuf.pos > 0) {
+                auto before = steady_clock::now();
+                out({outbuf.data(), outBuf.pos});
+                writeTime += steady_clock::now() - before;
+            }
+            if (remaining == 0)
+                break;
+        }
+
+        if (!adaptive)
+            return;
+
+        windowBytes += data.size();
+        windowWriteTime += writeTime;
+        windowCompressTime += (steady_clock::now() - start) - writeTime;
+
+        if (windowBytes < adaptWindow)
+            return;
+
+        auto newLevel = level;
+        if (windowWriteTime > 2 * windowCompressTime && level < maxLevel)
+            newLevel++;
+        else if (windowCompressTime > windowWriteTime && level > minLevel)
+            newLevel--;
+
+        if (newLevel != level) {
+            debug("adjusting stream compression level from %d to %d", level, newLevel);
+            level = newLevel;
+            /* The compression level may be changed in the middle of a
+               frame; it takes effect for subsequent blocks. */
+            checkZstd(ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_compressionLevel, level));
+        }
+
+        windowBytes = 0;
+        windowCompressTime = windowWriteTime = nanoseconds{0};
+    }
+};
+
+struct ZstdStreamDecoder : StreamDecoder
+{
+    std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx{nullptr, ZSTD_freeDCtx};
+    std::vector<char> inbuf;
+    ZSTD_inBuffer in{nullptr, 0, 0};
+
+    /**
+     * Whether the last call to `decode()` filled its output buffer,
+     * in which case the decoder may hold more output internally.
+     */
+    bool outputFull = false;
+
+    ZstdStreamDecoder()
+        : inbuf(ZSTD_DStreamInSize())
+    {
+        dctx.reset(ZSTD_createDCtx());
+        if (!dctx)
+            throw CompressionError("unable to initialise zstd decoder");
+        in.src = inbuf.data();
+    }
+
+    void feed(std::string_view encoded) override
+    {
+        assert(in.pos == in.size);
+        if (encoded.size() > inbuf.size())
+            inbuf.resize(encoded.size());
+        memcpy(inbuf.data(), encoded.data(), encoded.size());
+        in = {inbuf.data(), encoded.size(), 0};
+    }
+
+    size_t decode(Source & source, char * data, size_t len) override
+    {
+        while (true) {
+            if (in.pos == in.size && !outputFull) {
+                auto n = source.read(inbuf.data(), inbuf.size());
+                in = {inbuf.data(), n, 0};
+            }
+
+            ZSTD_outBuffer out = {data, len, 0};
+            checkZstd(ZSTD_decompressStream(dctx.get(), &out, &in));
+            outputFull = out.pos == out.size;
+
+            /* A flush point may leave us with a consumed input
+               buffer but no output yet; keep reading. */
+            if (out.pos > 0)
+                return out.pos;
+        }
+    }
+
+    bool hasPendingInput() override
+    {
+        return in.pos < in.size || outputFull;
     }
 };
 
@@ -473,6 +803,222 @@ ref<CompressionSink> makeCompressionSink(CompressionAlgo method, Sink & nextSink
     unreachable();
 }
 
+ref<CompressionSink> makeZstdSeekableCompressionSink(Sink & nextSink, uint64_t bytesPerFrame, int level)
+{
+    return make_ref<ZstdMultiFrameCompressionSink>(nextSink, false, level, bytesPerFrame, true);
+}
+
+/**
+ * Read up to `length` bytes at `offset`, returning fewer at the end of
+ * the file.
+ */
+static std::string readAt(Descriptor fd, uint64_t offset, size_t length)
+{
+    std::string res(length, '\0');
+    size_t pos = 0;
+    while (pos < length) {
+        auto n = readOffset(fd, offset + pos, std::as_writable_bytes(std::span(res).subspan(pos)));
+        if (n == 0)
+            break;
+        pos += n;
+    }
+    res.resize(pos);
+    return res;
+}
+
+static uint32_t get32(std::string_view s, size_t pos)
+{
+    uint32_t n = 0;
+    for (int i = 0; i < 4; ++i)
+        n |= (uint32_t) (unsigned char) s[pos + i] << (i * 8);
+    return n;
+}
+
+static std::optional<ZstdSeekTable> readSeekTable(Descriptor fd, uint64_t fileSize)
+{
+    if (fileSize < 8 + zstdSeekTableFooterSize)
+        return std::nullopt;
+
+    auto footer = readAt(fd, fileSize - zstdSeekTableFooterSize, zstdSeekTableFooterSize);
+    if (footer.size() != zstdSeekTableFooterSize || get32(footer, 5) != zstdSeekableMagic)
+        return std::nullopt;
+
+    uint64_t nrFrames = get32(footer, 0);
+    /* Entries have an optional checksum, which we don't use. */
+    uint64_t entrySize = footer[4] & 0x80 ? 12 : 8;
+    uint64_t tableSize = 8 + nrFrames * entrySize + zstdSeekTableFooterSize;
+    if (tableSize > fileSize)
+        return std::nullopt;
+
+    auto data = readAt(fd, fileSize - tableSize, tableSize);
+    if (data.size() != tableSize || get32(data, 0) != zstdSkippableMagic || get32(data, 4) != tableSize - 8)
+        return std::nullopt;
+
+    ZstdSeekTable table;
+    uint64_t compressedOffset = 0, offset = 0;
+    for (uint64_t i = 0; i < nrFrames; ++i) {
+        uint64_t compressedSize = get32(data, 8 + i * entrySize);
+        uint64_t size = get32(data, 8 + i * entrySize + 4);
+        table.frames.push_back({compressedOffset, compressedSize, offset, size});
+        compressedOffset += compressedSize;
+        offset += size;
+    }
+
+    if (compressedOffset != fileSize - tableSize)
+        return std::nullopt;
+
+    return table;
+}
+
+/**
+ * Find the frames of a zstd file by walking the frame and block
+ * headers (RFC 8878 §3.1.1).
+ */
+static ZstdSeekTable scanFrames(Descriptor fd, uint64_t fileSize)
+{
+    ZstdSeekTable table;
+    uint64_t pos = 0, offset = 0;
+
+    while (pos < fileSize) {
+        checkInterrupt();
+
+        auto header = readAt(fd, pos, zstdFrameHeaderSizeMax);
+        if (header.size() < 8)
+            break;
+
+        auto magic = get32(header, 0);
+
+        if ((magic & 0xFFFFFFF0) == 0x184D2A50) {
+            pos += 8 + (uint64_t) get32(header, 4);
+            continue;
+        }
+
+        if (magic != ZSTD_MAGICNUMBER)
+            throw CompressionError("invalid zstd frame at offset %d", pos);
+
+        unsigned char descriptor = header[4];
+        bool singleSegment = descriptor & 0x20;
+        bool hasChecksum = descriptor & 0x04;
+        static constexpr size_t dictIdSizes[] = {0, 1, 2, 4};
+        static constexpr size_t contentSizeSizes[] = {0, 2, 4, 8};
+        size_t contentSizeSize = contentSizeSizes[descriptor >> 6];
+        if (!contentSizeSize && singleSegment)
+            contentSizeSize = 1;
+        uint64_t headerSize = 5 + !singleSegment + dictIdSizes[descriptor & 3] + contentSizeSize;
+
+        auto size = ZSTD_getFrameContentSize(header.data(), header.size());
+        if (size == ZSTD_CONTENTSIZE_ERROR)
+            break;
+        if (size == ZSTD_CONTENTSIZE_UNKNOWN)
+            throw CompressionError("zstd frame at offset %d doesn't record its uncompressed size", pos);
+
+        uint64_t end = pos + headerSize;
+        bool lastBlock = false;
+        while (!lastBlock && end + 3 <= fileSize) {
+            auto blockHeader = readAt(fd, end, 3);
+            uint32_t n = (unsigned char) blockHeader[0] | (unsigned char) blockHeader[1] << 8
+                         | (unsigned char) blockHeader[2] << 16;
+            lastBlock = n & 1;
+            auto blockType = (n >> 1) & 3;
+            if (blockType == 3)
+                throw CompressionError("invalid zstd block at offset %d", end);
+            /* RLE blocks store a single byte. */
+            end += 3 + (blockType == 1 ? 1 : n >> 3);
+        }
+        if (hasChecksum)
+            end += 4;
+
+        if (!lastBlock || end > fileSize)
+            break;
+
+        table.frames.push_back({pos, end - pos, offset, size});
+        pos = end;
+        offset += size;
+    }
+
+    return table;
+}
+
+uint64_t ZstdSeekTable::size() const
+{
+    return frames.empty() ? 0 : frames.back().offset + frames.back().size;
+}
+
+ZstdSeekTable ZstdSeekTable::read(Descriptor fd)
+{
+    auto fileSize = getFileSize(fd);
+    if (auto table = readSeekTable(fd, fileSize))
+        return std::move(*table);
+    return scanFrames(fd, fileSize);
+}
+
+void ZstdSeekTable::readRange(Descriptor fd, uint64_t offset, uint64_t length, Sink & sink) const
+{
+    std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> dctx{ZSTD_createDCtx(), ZSTD_freeDCtx};
+    if (!dctx)
+        throw CompressionError("unable to initialise zstd decoder");
+
+    auto end = std::min(size(), offset + std::min(length, std::numeric_limits<uint64_t>::max() - offset));
+
+    /* Find the first frame that ends after `offset`. */
+    auto i = std::upper_bound(frames.begin(), frames.end(), offset, [](uint64_t o, const Frame & frame) {
+        return o < frame.offset + frame.size;
+    });
+
+    std::string buf;
+    for (; i != frames.end() && i->offset < end; ++i) {
+        checkInterrupt();
+        auto compressed = readAt(fd, i->compressedOffset, i->compressedSize);
+        if (compressed.size() != i->compressedSize)
+            throw CompressionError("zstd file is truncated");
+        buf.resize(i->size);
+        auto n = ZSTD_decompressDCtx(dctx.get(), buf.data(), buf.size(), compressed.data(), compressed.size());
+        checkZstd(n);
+        if (n != i->size)
+            throw CompressionError("zstd frame has an unexpected size");
+        auto from = std::max(offset, i->offset) - i->offset;
+        sink(std::string_view(buf).substr(from, std::min(end, i->offset + i->size) - i->offset - from));
+    }
+}
+
+std::string compressDelta(std::string_view base, std::string_view target, int level)
+{
+    std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> cctx{ZSTD_createCCtx(), ZSTD_freeCCtx};
+    if (!cctx)
+        throw CompressionError("unable to initialise zstd encoder");
+
+    if (level != COMPRESSION_LEVEL_DEFAULT)
+        checkZstd(ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_compressionLevel, level));
+    /* Same tuning as `zstd --patch-from`: a window covering the base,
+       and long distance matching to find the (far away) matches in
+       it. */
+    checkZstd(
+        ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_windowLog, deltaWindowLog(base.size(), target.size())));
+    checkZstd(ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_enableLongDistanceMatching, 1));
+    checkZstd(ZSTD_CCtx_refPrefix(cctx.get(), base.data(), base.size()));
+
+    std::string res(ZSTD_compressBound(target.size()), '\0');
+    auto n = ZSTD_compress2(cctx.get(), res.data(), res.size(), target.data(), target.size());
+    checkZstd(n);
+    res.resize(n);
+    return res;
+}
+
+std::unique_ptr<FinishSink> makeDeltaDecompressionSink(std::string base, Sink & nextSink)
+{
+    return std::make_unique<ZstdDeltaDecompressionSink>(std::move(base), nextSink);
+}
+
+std::unique_ptr<StreamEncoder> makeZstdStreamEncoder(int level, bool adaptive)
+{
+    return std::make_unique<ZstdStreamEncoder>(level, adaptive);
+}
+
+std::unique_ptr<StreamDecoder> makeZstdStreamDecoder()
+{
+    return std::make_unique<ZstdStreamDecoder>();
+}
+
 std::string compress(CompressionAlgo method, std::string_view in, const bool parallel, int level)
 {
     StringSource source(in);
@@ -3,6 +3,7 @@
 #include "nix/util/util.hh"
 #include "nix/util/signals.hh"
 
+#include <climits>
 #include <span>
 #include <fcntl.h>
 #include <unistd.h>
@@ -11,6 +12,7 @@
 #  include <fileapi.h>
 #else
 #  include <poll.h>
+#  include <sys/uio.h>
 #endif
 
 namespace nix {
@@ -117,6 +119,46 @@ void writeFull(Descriptor fd, std::string_view s, bool allowInterrupts)
     }
 }
 
+void writeFull(Descriptor fd, std::span<const std::string_view> data, bool allowInterrupts)
+{
+#ifndef _WIN32
+    std::vector<struct iovec> iov;
+    iov.reserve(data.size());
+    for (auto & s : data)
+        if (!s.empty())
+            iov.push_back({.iov_base = const_cast<char *>(s.data()), .iov_len = s.size()});
+
+    auto i = iov.begin();
+    while (i != iov.end()) {
+        if (allowInterrupts)
+            checkInterrupt();
+        size_t count = std::min<size_t>(iov.end() - i, IOV_MAX);
+        auto res = retryOnBlock(fd, PollDirection::Out, [&]() {
+            ssize_t n;
+            do {
+                n = ::writev(fd, &*i, count);
+            } while (n == -1 && errno == EINTR);
+            if (n == -1)
+                throw SysError("writing %1% buffers", count);
+            return static_cast<size_t>(n);
+        });
+        /* Skip the buffers that were written completely, and the
+           part of the next one that was written. */
+        while (i != iov.end() && res >= i->iov_len) {
+            res -= i->iov_len;
+            ++i;
+        }
+        if (res) {
+            i->iov_base = static_cast<char *>(i->iov_base) + res;
+            i->iov_len -= res;
+        }
+    }
+#else
+    for (auto & s : data)
+        writeFull(fd, s, allowInterrupts);
+#endif
+}
+
 void writeLine(Descriptor fd, std::string s)
 {
     s += '\n';
@@ -205,15 +247,33 @@ std::string drainFD(Descriptor fd, DrainFdOpts opts)
 void copyFdRange(Descriptor fd, off_t offset, size_t nbytes, Sink & sink)
 {
     auto left = nbytes;
-    std::array<std::byte, 64 * 1024> buf;
+
+    /* Let the sink transfer the data without copying if it can. */
+    while (left) {
+        auto n = sink.writeFromFd(fd, offset, left);
+        if (n == 0)
+            break;
+        assert(n <= left);
+        offset += n;
+        left -= n;
+    }
+
+    /* Read into a reference-counted buffer, so that sinks can keep the
+       data instead of copying it. The buffer is reused if they
+       didn't. */
+    const size_t bufSize = std::min<size_t>(left, 64 * 1024);
+    std::shared_ptr<std::byte[]> buf;
 
     while (left) {
-        auto limit = std::min<size_t>(left, buf.size());
-        auto n = readOffset(fd, offset, std::span(buf.data(), limit));
+        if (!buf || buf.use_count() > 1)
+            buf = std::make_shared_for_overwrite<std::byte[]>(bufSize);
+        auto limit = std::min<size_t>(left, bufSize);
+        auto n = readOffset(fd, offset, std::span(buf.get(), limit));
         if (n == 0)
             throw EndOfFile("unexpected end-of-file reading from %1%", PathFmt(descriptorToPath(fd)));
         assert(n <= left);
-        sink(std::string_view(reinterpret_cast<const char *>(buf.data()), n));
+        SharedChunk chunk{buf, {reinterpret_cast<const char *>(buf.get()), n}};
+        sink.writeChunks({&chunk, 1});
         offset += n;
         left -= n;
     }
@@ -1,10 +1,12 @@
 #include "nix/util/file-system.hh"
+#include "nix/util/file-system-at.hh"
 #include "nix/util/file-path.hh"
 #include "nix/util/file-path-impl.hh"
 #include "nix/util/signals.hh"
 #include "nix/util/finally.hh"
 #include "nix/util/serialise.hh"
 #include "nix/util/util.hh"
+#include "nix/util/reflink.hh"
 
 #include <atomic>
 #include <random>
@@ -585,6 +587,31 @@ void setWriteTime(const std::filesystem::path & path, const PosixStat & st)
     setWriteTime(path, st.st_atime, st.st_mtime, S_ISLNK(st.st_mode));
 }
 
+/**
+ * Copy the regular file `from` (following symlinks) to `to` without
+ * passing the contents through this process, cloning it if possible.
+ * Return `false` if the caller should copy it normally.
+ */
+static bool copyRegularFileInKernel(const std::filesystem::path & from, const std::filesystem::path & to)
+{
+#ifndef _WIN32
+    auto fromFd = openFileReadonly(from);
+    if (!fromFd)
+        return false;
+    auto st = nix::fstat(fromFd.get());
+    if (!S_ISREG(st.st_mode))
+        return false;
+    auto toFd = openNewFileForWrite(to, st.st_mode & 07777, {.truncateExisting = true});
+    if (!toFd || !copyFileContents(fromFd.get(), toFd.get()))
+        return false;
+    if (fchmod(toFd.get(), st.st_mode & 07777) == -1)
+        throw SysError("setting permissions of %s", PathFmt(to));
+    return true;
+#else
+    return false;
+#endif
+}
+
 void copyFile(const std::filesystem::path & from, const std::filesystem::path & to, bool andDelete, bool contents)
 {
     auto fromStatus = std::filesystem::symlink_status(from);
@@ -598,7 +625,9 @@ void copyFile(const std::filesystem::path & from, const std::filesystem::path &
     }
 
     if (std::filesystem::is_symlink(fromStatus) || std::filesystem::is_regular_file(fromStatus)) {
-        if (contents) {
+        if ((contents || std::filesystem::is_regular_file(fromStatus)) && copyRegularFileInKernel(from, to)) {
+            /* Done. */
+        } else if (contents) {
             std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing);
         } else {
             std::filesystem::copy(
@@ -4,6 +4,11 @@
 #include "nix/util/config-global.hh"
 #include "nix/util/file-system-at.hh"
 #include "nix/util/fs-sink.hh"
+#include "nix/util/reflink.hh"
+
+#ifdef __linux__
+#  include "nix/util/io-uring-restore-sink.hh"
+#endif
 
 #ifdef _WIN32
 #  include <fileapi.h>
@@ -40,6 +45,8 @@ void copyRecursive(SourceAccessor & accessor, const CanonPath & from, FileSystem
         sink.createRegularFile(to, [&](CreateRegularFileSink & crf) {
             if (stat.isExecutable)
                 crf.isExecutable();
+            if (auto physicalPath = accessor.getPhysicalPath(from); physicalPath && crf.copyContentsFrom(*physicalPath))
+                return;
             accessor.readFile(from, crf, [&](uint64_t size) { crf.preallocateContents(size); });
         });
         break;
@@ -72,6 +79,19 @@ struct RestoreSinkSettings : Config
 {
     Setting<bool> preallocateContents{
         this, false, "preallocate-contents", "Whether to preallocate files when writing objects with known size."};
+
+    Setting<bool> useIoUring{
+        this,
+        false,
+        "use-io-uring",
+        R"(
+          Whether to use io_uring on Linux to batch the system calls made
+          when unpacking NARs, e.g. when substituting store paths. This
+          mostly helps with store paths that contain many small files. If
+          io_uring is not available, or if
+          [`preallocate-contents`](#conf-preallocate-contents) is enabled,
+          Nix falls back to making the system calls one at a time.
+        )"};
 };
 
 static RestoreSinkSettings restoreSinkSettings;
@@ -236,6 +256,7 @@ struct RestoreRegularFile : CreateRegularFileSink, FdSink
 
     void isExecutable() override;
     void preallocateContents(uint64_t size) override;
+    bool copyContentsFrom(const std::filesystem::path & path) override;
 };
 
 void RestoreRegularFile::anchor() {}
@@ -301,6 +322,19 @@ void RestoreRegularFile::preallocateContents(uint64_t len)
 #endif
 }
 
+bool RestoreRegularFile::copyContentsFrom(const std::filesystem::path & path)
+{
+#ifndef _WIN32
+    auto from = openFileReadonly(path, FinalSymlink::DontFollow);
+    if (!from || !S_ISREG(nix::fstat(from.get()).st_mode))
+        return false;
+    FdSink::flush();
+    return copyFileContents(from.get(), fd.get());
+#else
+    return false;
+#endif
+}
+
 void RestoreSink::createSymlink(const CanonPath & path, const std::string & target)
 {
 #ifndef _WIN32
@@ -312,6 +346,24 @@ void RestoreSink::createSymlink(const CanonPath & path, const std::string & targ
 #endif
 }
 
+void withRestoreSink(const std::filesystem::path & dstPath, bool startFsync, fun<void(FileSystemObjectSink &)> fun)
+{
+#ifdef __linux__
+    /* The io_uring sink writes small files with a single write and
+       doesn't preallocate. */
+    if (restoreSinkSettings.useIoUring && !restoreSinkSettings.preallocateContents)
+        if (auto sink = linux::makeIoUringRestoreSink(dstPath, startFsync)) {
+            fun(*sink);
+            sink->finish();
+            return;
+        }
+#endif
+
+    RestoreSink sink{startFsync};
+    sink.dstPath = dstPath;
+    fun(sink);
+}
+
 void RegularFileSink::createRegularFile(const CanonPath & path, fun<void(CreateRegularFileSink &)> func)
 {
     struct CRF : CreateRegularFileSink
@@ -400,6 +400,15 @@ void HashSink::writeUnbuffered(std::string_view data)
     update(ha, *ctx, data);
 }
 
+void HashSink::writeChunks(std::span<const SharedChunk> chunks)
+{
+    /* Hash the chunks in place rather than copying them into the
+       buffer. */
+    flush();
+    for (auto & chunk : chunks)
+        writeUnbuffered(chunk.data);
+}
+
 HashResult HashSink::finish()
 {
     flush();
@@ -5,6 +5,7 @@
 #include "nix/util/types.hh"
 #include "nix/util/serialise.hh"
 #include "nix/util/compression-algo.hh"
+#include "nix/util/file-descriptor.hh"
 
 #include <string>
 
@@ -31,6 +32,86 @@ std::string compress(CompressionAlgo method, Source & in, const bool parallel =
 ref<CompressionSink>
 makeCompressionSink(CompressionAlgo method, Sink & nextSink, const bool parallel = false, int level = -1);
 
+/**
+ * Create a sink that compresses to the zstd seekable format: a
+ * sequence of independent zstd frames of at most `bytesPerFrame` bytes
+ * of input each, followed by a seek table in a skippable frame. The
+ * result is regular zstd, but `ZstdSeekTable` can read any part of it
+ * without decompressing what comes before.
+ */
+ref<CompressionSink>
+makeZstdSeekableCompressionSink(Sink & nextSink, uint64_t bytesPerFrame = 1024 * 1024, int level = -1);
+
+/**
+ * The locations of the frames of a zstd file.
+ */
+struct ZstdSeekTable
+{
+    struct Frame
+    {
+        /**
+         * The offset and size of the frame in the file.
+         */
+        uint64_t compressedOffset, compressedSize;
+
+        /**
+         * The offset and size of the contents of the frame in the
+         * uncompressed data.
+         */
+        uint64_t offset, size;
+    };
+
+    std::vector<Frame> frames;
+
+    /**
+     * The size of the uncompressed data.
+     */
+    uint64_t size() const;
+
+    /**
+     * Get the frames of the zstd file `fd` from its seek table. If it
+     * doesn't end in a seek table (e.g. because it's still being
+     * written), find them by walking the frame and block headers. An
+     * incomplete frame at the end of the file is ignored.
+     */
+    static ZstdSeekTable read(Descriptor fd);
+
+    /**
+     * Write at most `length` bytes of the uncompressed data starting at
+     * `offset` to `sink`, decompressing only the frames that overlap
+     * that range.
+     */
+    void readRange(Descriptor fd, uint64_t offset, uint64_t length, Sink & sink) const;
+};
+
+/**
+ * Compress `target` with zstd, referencing `base` as a raw prefix, like
+ * `zstd --patch-from`. If `target` is a new version of `base`, the
+ * result is a small delta.
+ */
+std::string compressDelta(std::string_view base, std::string_view target, int level = -1);
+
+/**
+ * Create a sink that undoes `compressDelta()` given the same `base`,
+ * and writes the reconstructed data to `nextSink`.
+ */
+std::unique_ptr<FinishSink> makeDeltaDecompressionSink(std::string base, Sink & nextSink);
+
+/**
+ * Create an encoder for transparent zstd compression of a connection
+ * (see `FdSink::setEncoder()`).
+ *
+ * @param adaptive Whether to adjust the compression level at runtime
+ * depending on whether compression or the connection is the
+ * bottleneck. `level` is then only the starting point.
+ */
+std::unique_ptr<StreamEncoder> makeZstdStreamEncoder(int level = -1, bool adaptive = true);
+
+/**
+ * Create the decoder matching `makeZstdStreamEncoder()`.
+ */
+std::unique_ptr<StreamDecoder> makeZstdStreamDecoder();
+
 MakeError(CompressionError, Error);
 
 } // namespace nix
@@ -129,6 +129,12 @@ void readFull(Descriptor fd, char * buf, size_t count);
 
 void writeFull(Descriptor fd, std::string_view s, bool allowInterrupts = true);
 
+/**
+ * Write all of `data`, using a single `writev()` system call if
+ * possible.
+ */
+void writeFull(Descriptor fd, std::span<const std::string_view> data, bool allowInterrupts = true);
+
 /**
  * Read a line from an unbuffered file descriptor.
  * See BufferedSource::readLine for a buffered variant.
@@ -48,6 +48,11 @@ struct ForwardingSourceAccessor : SourceAccessor
         return next->getPhysicalPath(path);
     }
 
+    std::unique_ptr<ReadAheadGuard> startReadAhead(const CanonPath & path) override
+    {
+        return next->startReadAhead(path);
+    }
+
     void anchor() override;
 };
 
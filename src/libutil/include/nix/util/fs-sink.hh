@@ -32,6 +32,19 @@ public:
      * An optimization. By default, do nothing.
      */
     virtual void preallocateContents(uint64_t size) {};
+
+    /**
+     * An optimization: set the contents of the file to those of the
+     * regular file `path` without passing them through this process,
+     * e.g. by cloning its extents. By default, do nothing.
+     *
+     * @return `false` if the contents were not copied, in which case
+     * the caller must write them to the sink instead.
+     */
+    virtual bool copyContentsFrom(const std::filesystem::path & path)
+    {
+        return false;
+    }
 };
 
 struct FileSystemObjectSink
@@ -147,6 +160,14 @@ public:
     void createSymlink(const CanonPath & path, const std::string & target) override;
 };
 
+/**
+ * Call `fun` with a sink that writes file system objects at `dstPath`,
+ * like `RestoreSink`. Where possible, this batches the system calls
+ * using io_uring, which is much faster for many small files. Otherwise
+ * a `RestoreSink` is used.
+ */
+void withRestoreSink(const std::filesystem::path & dstPath, bool startFsync, fun<void(FileSystemObjectSink &)> fun);
+
 /**
  * Restore a single file at the top level, passing along
  * `receiveContents` to the underlying `Sink`. For anything but a single
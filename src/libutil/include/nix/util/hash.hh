@@ -236,6 +236,7 @@ public:
     HashSink(const HashSink & h);
     ~HashSink();
     void writeUnbuffered(std::string_view data) override;
+    void writeChunks(std::span<const SharedChunk> chunks) override;
     HashResult finish() override;
     HashResult currentHash();
 };
@@ -28,6 +28,8 @@ typedef enum {
     actPostBuildHook = 110,
     actBuildWaiting = 111,
     actFetchTree = 112,
+    actParseFile = 113,
+    actDerivationStrict = 114,
 } ActivityType;
 
 typedef enum {
@@ -72,6 +74,27 @@ public:
           may result in interleaved or corrupted log records.
         )"};
 
+    Setting<std::optional<AbsolutePath>> activityTracePath{
+        this,
+        {},
+        "activity-trace-path",
+        R"(
+          A file to which a trace of Nix's activities (such as builds,
+          substitutions, downloads and copies) is written in the Chrome
+          Trace Event format. It can be opened in
+          [Perfetto](https://ui.perfetto.dev) or `chrome://tracing` to
+          see where time is spent. For each activity, the trace records
+          its duration, the thread that started it, the bytes processed
+          (if applicable) and the time it spent waiting for build
+          slots, locks or remote machines. It also includes evaluator
+          spans, namely the parsing of Nix files and the calls to
+          `derivationStrict`.
+
+          Events are appended to the file, so several Nix processes
+          (such as a client and the daemon) can write to the same
+          trace.
+        )"};
+
     Setting<std::string> sessionId{
         this,
         "",
@@ -297,6 +320,16 @@ std::unique_ptr<Logger> makeJSONLogger(Descriptor fd, bool includeNixPrefix = tr
 
 std::unique_ptr<Logger> makeJSONLogger(const std::filesystem::path & path, bool includeNixPrefix = true);
 
+/**
+ * Create a logger that writes a trace of activities to `path` (see
+ * the `activity-trace-path` setting).
+ */
+std::unique_ptr<Logger> makeTraceLogger(const std::filesystem::path & path);
+
+/**
+ * Add the loggers requested by the `json-log-path` and
+ * `activity-trace-path` settings to `logger`.
+ */
 void applyJSONLogger();
 
 /**
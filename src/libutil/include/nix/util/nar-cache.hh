@@ -15,6 +15,12 @@ namespace nix {
 
 /**
  * A cache for NAR accessors with optional disk caching.
+ *
+ * The cache directory may be shared by multiple processes. Entries are
+ * created by atomically renaming complete files into place and evicted
+ * by unlinking them, so no locking is needed: a process that has an
+ * entry open keeps reading it (through a memory mapping) even if another
+ * process evicts it.
  */
 class NarCache
 {
@@ -23,17 +29,30 @@ class NarCache
      */
     std::optional<std::filesystem::path> cacheDir;
 
+    /**
+     * Maximum total size in bytes of the NARs and listings in
+     * `cacheDir`, or 0 for no limit. When exceeded, the least recently
+     * used NARs are evicted.
+     */
+    uint64_t maxSize;
+
     /**
      * Map from NAR hash to NAR accessor.
      */
     std::map<Hash, ref<SourceAccessor>> nars;
 
+    /**
+     * Evict least recently used NARs from `cacheDir` until its size
+     * is at most `maxSize`.
+     */
+    void evict();
+
 public:
 
     /**
      * Create a NAR cache with an optional cache directory for disk storage.
      */
-    NarCache(std::optional<std::filesystem::path> cacheDir = {});
+    NarCache(std::optional<std::filesystem::path> cacheDir = {}, uint64_t maxSize = 0);
 
     /**
      * Lookup or create a NAR accessor, optionally using disk cache.
@@ -0,0 +1,89 @@
+#pragma once
+///@file
+
+#include "nix/util/logging.hh"
+#include "nix/util/sync.hh"
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace nix {
+
+/**
+ * A queue for `resProgress` and `resSetExpected` results that many
+ * threads can push to without taking a lock, for loggers that apply
+ * them periodically on a single thread (e.g. the thread that renders
+ * the progress bar).
+ *
+ * Every producer thread gets its own single-producer, single-consumer
+ * ring, so pushing a result only touches cache lines owned by that
+ * thread, apart from taking a sequence number. Since both kinds of
+ * result set absolute values, `drain()` only applies the most recent
+ * result of each kind per activity.
+ */
+class ProgressCoalescer
+{
+public:
+
+    struct Event
+    {
+        ActivityId act;
+        ResultType type;
+
+        /**
+         * The integer fields of the result, padded with zeroes.
+         */
+        std::array<uint64_t, 4> values;
+
+        /**
+         * The order in which results were pushed, across all threads.
+         */
+        uint64_t seq;
+    };
+
+    ProgressCoalescer();
+
+    ~ProgressCoalescer();
+
+    /**
+     * Queue a result. Returns false if this is not a well-formed
+     * progress result, or if the calling thread's ring is full. In
+     * that case the caller must `drain()` and then apply the result
+     * itself.
+     */
+    bool push(ActivityId act, ResultType type, const Logger::Fields & fields) noexcept;
+
+    /**
+     * Call `apply` on the results queued so far, in the order in which
+     * they were pushed, even if they were pushed by different threads.
+     * Results that are pushed while `drain()` runs may be left for the
+     * next call, but never one that was pushed before a result that is
+     * applied.
+     *
+     * Calls to `drain()` must be serialised by the caller.
+     */
+    void drain(const std::function<void(const Event &)> & apply);
+
+private:
+
+    struct Ring;
+
+    const uint64_t id;
+
+    std::atomic<uint64_t> nextSeq{0};
+
+    Sync<std::vector<std::shared_ptr<Ring>>> rings_;
+
+    /**
+     * Reused by `drain()` to avoid allocating on every call.
+     */
+    std::vector<Event> scratch;
+    std::vector<size_t> firstTails;
+
+    Ring & getRing();
+};
+
+} // namespace nix
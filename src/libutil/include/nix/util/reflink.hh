@@ -0,0 +1,52 @@
+#pragma once
+///@file
+
+#include "nix/util/file-descriptor.hh"
+
+#include <optional>
+
+namespace nix {
+
+/**
+ * Make the regular file `to` a copy-on-write clone of the regular file
+ * `from`, i.e. let it share `from`'s extents instead of copying the
+ * data (`FICLONE` on Linux). This only works on file systems that
+ * support it (e.g. btrfs and XFS), and only if both files are on the
+ * same file system.
+ *
+ * @return `false` if cloning is not possible, in which case `to` is
+ * left unchanged.
+ */
+bool cloneFile(Descriptor from, Descriptor to);
+
+/**
+ * Copy the contents of the regular file `from` to the empty regular
+ * file `to` without passing them through this process. This clones
+ * `from` if possible, and otherwise lets the kernel copy the data
+ * (`copy_file_range` on Linux).
+ *
+ * @return `false` if neither is possible, in which case nothing has
+ * been written to `to` and the caller should copy the data itself.
+ */
+bool copyFileContents(Descriptor from, Descriptor to);
+
+/**
+ * If the regular files `from` and `to` have identical contents, let
+ * `to` share `from`'s extents, freeing its own (`FIDEDUPERANGE` on
+ * Linux). Unlike replacing `to` with a clone, this is atomic and
+ * keeps the inode of `to`. The kernel compares the contents itself,
+ * so this is safe even if the files are modified concurrently.
+ *
+ * @return The number of bytes deduplicated, or `std::nullopt` if the
+ * file system doesn't support deduplication.
+ */
+std::optional<uint64_t> dedupeFile(Descriptor from, Descriptor to);
+
+/**
+ * Whether `a` and `b` already share their first extent, e.g. because
+ * an earlier `cloneFile()` or `dedupeFile()` made them share it. This
+ * is a cheap heuristic to avoid deduplicating files again.
+ */
+bool sharesExtents(Descriptor a, Descriptor b);
+
+} // namespace nix
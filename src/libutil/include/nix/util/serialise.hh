@@ -2,6 +2,7 @@
 ///@file
 
 #include <memory>
+#include <span>
 #include <type_traits>
 
 #include "nix/util/fun.hh"
@@ -15,6 +16,18 @@ struct stack_context;
 
 namespace nix {
 
+/**
+ * A view of immutable data in a reference-counted buffer. A sink that
+ * receives it can keep `owner` to use the data after returning
+ * (e.g. to gather several chunks into one write) instead of copying
+ * it.
+ */
+struct SharedChunk
+{
+    std::shared_ptr<const void> owner;
+    std::string_view data;
+};
+
 /**
  * Abstract destination of binary data.
  */
@@ -35,6 +48,30 @@ public:
     {
         return true;
     }
+
+    /**
+     * Write up to `nbytes` bytes read from the seekable file `fd`
+     * starting at `offset`, without copying them through this process
+     * if the sink supports that (e.g. `sendfile()` for `FdSink`).
+     *
+     * @return The number of bytes written, which is 0 if the sink
+     * can't do this. The caller must write any remaining bytes itself.
+     */
+    virtual size_t writeFromFd(Descriptor fd, off_t offset, size_t nbytes)
+    {
+        return 0;
+    }
+
+    /**
+     * Write `chunks` in order. Sinks that can consume the data in
+     * place (e.g. hash it, or pass it to `writev()`) override this to
+     * avoid copying it into their own buffer.
+     */
+    virtual void writeChunks(std::span<const SharedChunk> chunks)
+    {
+        for (auto & chunk : chunks)
+            (*this)(chunk.data);
+    }
 };
 
 /**
@@ -183,6 +220,49 @@ public:
     virtual void restart() = 0;
 };
 
+/**
+ * A transformation applied by `FdSink` to the bytes it writes to its
+ * file descriptor, e.g. transparent stream compression of a protocol
+ * connection.
+ */
+struct StreamEncoder
+{
+    virtual ~StreamEncoder() {}
+
+    /**
+     * Encode `data` and write the result to `out`. This has flush
+     * semantics: once it returns, the peer must be able to decode all
+     * of `data` without waiting for more input.
+     */
+    virtual void encode(std::string_view data, Sink & out) = 0;
+};
+
+/**
+ * The inverse of `StreamEncoder`, applied by `FdSource` to the bytes
+ * it reads from its file descriptor.
+ */
+struct StreamDecoder
+{
+    virtual ~StreamDecoder() {}
+
+    /**
+     * Hand over encoded bytes that were already read from the file
+     * descriptor before the decoder was installed.
+     */
+    virtual void feed(std::string_view encoded) = 0;
+
+    /**
+     * Decode at least one and at most `len` bytes into `data`,
+     * pulling encoded bytes from `in` as needed.
+     */
+    virtual size_t decode(Source & in, char * data, size_t len) = 0;
+
+    /**
+     * Whether there is encoded input that has not been decoded yet.
+     */
+    virtual bool hasPendingInput() = 0;
+};
+
 /**
  * A sink that writes data to a file descriptor.
  */
@@ -216,17 +296,40 @@ public:
         fd = s.fd;
         s.fd = INVALID_DESCRIPTOR;
         written = s.written;
+        encoder = std::move(s.encoder);
         return *this;
     }
 
     ~FdSink();
 
+    /**
+     * Pass everything written from now on through `encoder`. Any
+     * data buffered so far is flushed unencoded first.
+     */
+    void setEncoder(std::unique_ptr<StreamEncoder> encoder);
+
     void writeUnbuffered(std::string_view data) override;
 
     bool good() override;
 
+    /**
+     * On Linux, transfer the data with `sendfile()` after flushing
+     * the buffer. Not supported if an encoder is set.
+     */
+    size_t writeFromFd(Descriptor fd, off_t offset, size_t nbytes) override;
+
+    /**
+     * Write the buffer and `chunks` with a single `writev()`, unless
+     * they're small enough to be buffered.
+     */
+    void writeChunks(std::span<const SharedChunk> chunks) override;
+
 private:
     bool _good = true;
+
+    std::unique_ptr<StreamEncoder> encoder;
+
+    void writeRaw(std::string_view data);
 };
 
 /**
@@ -270,10 +373,21 @@ public:
 
     void skip(size_t len) override;
 
+    /**
+     * Pass everything read from now on through `decoder`. Bytes that
+     * are already buffered are handed to the decoder, since the peer
+     * may have started encoding before we got here.
+     */
+    void setDecoder(std::unique_ptr<StreamDecoder> decoder);
+
 protected:
     size_t readUnbuffered(char * data, size_t len) override;
 private:
     bool _good = true;
+
+    std::unique_ptr<StreamDecoder> decoder;
+
+    size_t readRaw(char * data, size_t len);
 };
 
 /**
@@ -363,6 +477,12 @@ public:
         sink1(data);
         sink2(data);
     }
+
+    void writeChunks(std::span<const SharedChunk> chunks) override
+    {
+        sink1.writeChunks(chunks);
+        sink2.writeChunks(chunks);
+    }
 };
 
 /**
@@ -388,6 +508,18 @@ public:
         sink({data, n});
         return n;
     }
+
+    using Source::drainInto;
+
+    /**
+     * Pass the chunks read from `orig` to both sinks, so that neither
+     * has to copy them.
+     */
+    void drainInto(Sink & sink, uint64_t len) override
+    {
+        TeeSink both(this->sink, sink);
+        orig.drainInto(both, len);
+    }
 };
 
 /**
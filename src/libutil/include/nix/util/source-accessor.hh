@@ -172,6 +172,27 @@ public:
 
     virtual void dumpPath(const CanonPath & path, Sink & sink, PathFilter & filter = defaultPathFilter);
 
+    /**
+     * Keeps read-ahead started by `startReadAhead()` going until it's
+     * destroyed.
+     */
+    struct ReadAheadGuard
+    {
+        virtual ~ReadAheadGuard() = default;
+    };
+
+    /**
+     * Hint that the calling thread is about to read every file under
+     * `path` in NAR order, as `dumpPath()` does. Accessors for which
+     * this is worthwhile can prefetch files until the guard is
+     * destroyed. Accessors that wrap another accessor should forward
+     * this.
+     */
+    virtual std::unique_ptr<ReadAheadGuard> startReadAhead(const CanonPath & path)
+    {
+        return nullptr;
+    }
+
     Hash
     hashPath(const CanonPath & path, PathFilter & filter = defaultPathFilter, HashAlgorithm ha = HashAlgorithm::SHA256);
 
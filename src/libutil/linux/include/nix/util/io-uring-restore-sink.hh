@@ -0,0 +1,51 @@
+#pragma once
+///@file
+
+#include <filesystem>
+#include <memory>
+
+#include "nix/util/fs-sink.hh"
+
+namespace nix::linux {
+
+/**
+ * A replacement for `RestoreSink` that batches the system calls for
+ * creating regular files (`openat`, `write`, `sync_file_range` and
+ * `close`) by submitting them to an io_uring, instead of making them
+ * one by one. This matters for NARs with many small files, where
+ * unpacking is otherwise bound by system call latency.
+ *
+ * Directories and symlinks are still created synchronously, since the
+ * operations that follow depend on them. Large files are written
+ * synchronously as well, so that the amount of memory used for
+ * in-flight writes stays bounded, and so are executables, which need
+ * an `fchmod()` to get the same mode as with `RestoreSink`.
+ *
+ * Like `RestoreSink`, this never follows symlinks beneath the
+ * destination path.
+ */
+struct IoUringRestoreSink : FileSystemObjectSink
+{
+private:
+    void anchor() override;
+
+public:
+
+    /**
+     * Wait for all submitted operations to complete. Errors of
+     * asynchronous operations may be reported by any later call to the
+     * sink, and at the latest by this one, so it must be called after
+     * the last file system object has been created.
+     */
+    virtual void finish() = 0;
+};
+
+/**
+ * Create an `IoUringRestoreSink` that writes to `dstPath`, or return
+ * `nullptr` if Nix was built without io_uring support or the running
+ * kernel doesn't provide the operations it needs (or doesn't permit
+ * the use of io_uring at all).
+ */
+std::unique_ptr<IoUringRestoreSink> makeIoUringRestoreSink(const std::filesystem::path & dstPath, bool startFsync);
+
+} // namespace nix::linux
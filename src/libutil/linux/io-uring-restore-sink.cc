@@ -0,0 +1,544 @@
+#include "nix/util/io-uring-restore-sink.hh"
+#include "nix/util/file-system-at.hh"
+#include "nix/util/logging.hh"
+#include "nix/util/strings.hh"
+#include "nix/util/util.hh"
+
+#include "util-config-private.hh"
+
+#if HAVE_LIBURING
+#  include <array>
+#  include <cstring>
+#  include <fcntl.h>
+#  include <liburing.h>
+#endif
+
+namespace nix::linux {
+
+void IoUringRestoreSink::anchor() {}
+
+#if HAVE_LIBURING
+
+namespace {
+
+/**
+ * Maximum number of files that can be in the process of being
+ * written. This is also the size of the ring's table of registered
+ * ("direct") file descriptors.
+ */
+constexpr unsigned maxFilesInFlight = 64;
+
+/**
+ * Every file needs at most this many submission queue entries.
+ */
+constexpr unsigned opsPerFile = 4;
+
+/**
+ * Upper bound on the file contents buffered for in-flight writes.
+ */
+constexpr size_t maxBytesInFlight = 32 * 1024 * 1024;
+
+/**
+ * Files larger than this are written synchronously rather than being
+ * buffered in memory. Batching doesn't gain much for them anyway.
+ */
+constexpr size_t maxBufferedFileSize = 1024 * 1024;
+
+/**
+ * Submit queued operations once this many files are waiting, so the
+ * kernel can start on them while we parse the rest of the NAR.
+ */
+constexpr unsigned submitBatchSize = 16;
+
+enum class Op : uint64_t { Open, Write, StartFsync, Close };
+
+/**
+ * The io_uring shared by the sinks for the root and all subdirectories
+ * of a restore.
+ */
+struct Ring
+{
+    io_uring ring;
+
+    struct PendingFile
+    {
+        std::filesystem::path path;
+
+        /**
+         * Keeps the directory the file is created in open until the
+         * `openat` has completed.
+         */
+        std::shared_ptr<AutoCloseFD> dirFd;
+
+        std::string name;
+
+        std::string contents;
+
+        /**
+         * Number of operations in the chain that haven't completed yet.
+         */
+        unsigned pendingOps = 0;
+
+        std::optional<SysError> error;
+    };
+
+    /**
+     * Indexed by the slot in the registered file table that the file
+     * uses while it is open.
+     */
+    std::array<std::optional<PendingFile>, maxFilesInFlight> files;
+
+    std::vector<unsigned> freeSlots;
+
+    size_t bytesInFlight = 0;
+
+    unsigned filesInFlight = 0;
+
+    unsigned filesUnsubmitted = 0;
+
+    std::optional<SysError> firstError;
+
+    bool initialised = false;
+
+    Ring() = default;
+
+    Ring(const Ring &) = delete;
+
+    ~Ring()
+    {
+        if (!initialised)
+            return;
+        try {
+            drain();
+        } catch (...) {
+            ignoreExceptionInDestructor();
+        }
+        /* This also closes any registered file descriptors that are
+           still open. */
+        io_uring_queue_exit(&ring);
+    }
+
+    /**
+     * Set up the ring, or return `false` if io_uring or one of the
+     * operations we need is not available.
+     */
+    bool init()
+    {
+        if (int res = io_uring_queue_init(maxFilesInFlight * opsPerFile, &ring, 0); res < 0) {
+            debug("not using io_uring to restore files: %s", std::strerror(-res));
+            return false;
+        }
+
+        auto probe = io_uring_get_probe_ring(&ring);
+        bool supported = probe && io_uring_opcode_supported(probe, IORING_OP_OPENAT)
+                         && io_uring_opcode_supported(probe, IORING_OP_WRITE)
+                         && io_uring_opcode_supported(probe, IORING_OP_SYNC_FILE_RANGE)
+                         && io_uring_opcode_supported(probe, IORING_OP_CLOSE);
+        if (probe)
+            io_uring_free_probe(probe);
+
+        /* Direct descriptors for `openat` and `close` need a sparse
+           file table, which doubles as a check for a recent enough
+           kernel. */
+        if (supported)
+            supported = io_uring_register_files_sparse(&ring, maxFilesInFlight) == 0;
+
+        if (!supported) {
+            debug("not using io_uring to restore files: kernel lacks required operations");
+            io_uring_queue_exit(&ring);
+            return false;
+        }
+
+        for (unsigned slot = maxFilesInFlight; slot--;)
+            freeSlots.push_back(slot);
+
+        initialised = true;
+        return true;
+    }
+
+    void addFile(
+        const std::filesystem::path & path,
+        std::shared_ptr<AutoCloseFD> dirFd,
+        std::string name,
+        std::string contents,
+        bool startFsync)
+    {
+        while (freeSlots.empty() || (bytesInFlight && bytesInFlight + contents.size() > maxBytesInFlight))
+            reap(true);
+
+        auto slot = freeSlots.back();
+        freeSlots.pop_back();
+
+        auto & file = files[slot].emplace(PendingFile{
+            .path = path,
+            .dirFd = std::move(dirFd),
+            .name = std::move(name),
+            .contents = std::move(contents),
+        });
+        bytesInFlight += file.contents.size();
+        filesInFlight++;
+
+        /* The operations are hard-linked, so that the file is closed
+           even if the write fails. If the `openat` fails, the later
+           operations fail harmlessly on the empty slot. */
+        auto push = [&](Op op, auto prep) {
+            auto sqe = io_uring_get_sqe(&ring);
+            /* The submission queue has room for `opsPerFile`
+               operations of every file in flight. */
+            assert(sqe);
+            prep(sqe);
+            io_uring_sqe_set_data64(sqe, (uint64_t) slot * opsPerFile + (uint64_t) op);
+            if (op != Op::Close)
+                sqe->flags |= IOSQE_IO_HARDLINK;
+            file.pendingOps++;
+        };
+
+        /* O_EXCL together with O_CREAT ensures symbolic links in the
+           last component are not followed, and `name` has only one
+           component. Executables never get here (see
+           `isExecutable()`). */
+        push(Op::Open, [&](io_uring_sqe * sqe) {
+            io_uring_prep_openat_direct(
+                sqe,
+                file.dirFd->get(),
+                file.name.c_str(),
+                O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC,
+                0666,
+                slot);
+        });
+
+        if (!file.contents.empty())
+            push(Op::Write, [&](io_uring_sqe * sqe) {
+                io_uring_prep_write(sqe, slot, file.contents.data(), file.contents.size(), 0);
+                sqe->flags |= IOSQE_FIXED_FILE;
+            });
+
+        /* See `AutoCloseFD::startFsync()`. */
+        if (startFsync)
+            push(Op::StartFsync, [&](io_uring_sqe * sqe) {
+                io_uring_prep_sync_file_range(sqe, slot, 0, 0, SYNC_FILE_RANGE_WRITE);
+                sqe->flags |= IOSQE_FIXED_FILE;
+            });
+
+        push(Op::Close, [&](io_uring_sqe * sqe) { io_uring_prep_close_direct(sqe, slot); });
+
+        if (++filesUnsubmitted >= submitBatchSize)
+            submit(0);
+    }
+
+    void submit(unsigned waitNr)
+    {
+        filesUnsubmitted = 0;
+        int res;
+        do {
+            res = io_uring_submit_and_wait(&ring, waitNr);
+        } while (res == -EINTR);
+        if (res < 0)
+            throw SysError(-res, "submitting to io_uring");
+    }
+
+    /**
+     * Process completed operations, waiting for at least one if `wait`
+     * is set and any are pending. Throws the first error encountered.
+     */
+    void reap(bool wait)
+    {
+        if (wait && filesInFlight)
+            submit(1);
+
+        unsigned head;
+        unsigned seen = 0;
+        io_uring_cqe * cqe;
+        io_uring_for_each_cqe(&ring, head, cqe)
+        {
+            seen++;
+            auto data = io_uring_cqe_get_data64(cqe);
+            auto slot = data / opsPerFile;
+            auto op = (Op) (data % opsPerFile);
+            auto & file = *files[slot];
+
+            if (!file.error) {
+                if (cqe->res < 0 && op != Op::StartFsync)
+                    file.error.emplace(
+                        -cqe->res,
+                        op == Op::Open    ? "creating file %1%"
+                        : op == Op::Write ? "writing to file %1%"
+                                          : "closing file %1%",
+                        PathFmt(file.path));
+                else if (op == Op::Write && (size_t) cqe->res != file.contents.size())
+                    file.error.emplace(ENOSPC, "writing to file %1%", PathFmt(file.path));
+            }
+
+            if (--file.pendingOps == 0) {
+                if (file.error && !firstError)
+                    firstError = std::move(file.error);
+                bytesInFlight -= file.contents.size();
+                filesInFlight--;
+                files[slot].reset();
+                freeSlots.push_back(slot);
+            }
+        }
+        io_uring_cq_advance(&ring, seen);
+
+        if (firstError) {
+            auto e = std::move(*firstError);
+            firstError.reset();
+            throw e;
+        }
+    }
+
+    void drain()
+    {
+        std::optional<SysError> error;
+        while (filesInFlight) {
+            auto before = filesInFlight;
+            try {
+                reap(true);
+            } catch (SysError & e) {
+                if (!error)
+                    error = std::move(e);
+                /* Don't spin if we can't even submit. */
+                if (filesInFlight == before)
+                    break;
+            }
+        }
+        if (error)
+            throw *error;
+    }
+};
+
+static std::filesystem::path append(const std::filesystem::path & src, const CanonPath & path)
+{
+    auto dst = src;
+    if (!path.rel().empty())
+        dst /= path.rel();
+    return dst;
+}
+
+struct IoUringRestoreSinkImpl : IoUringRestoreSink
+{
+    std::shared_ptr<Ring> ring;
+    std::filesystem::path dstPath;
+    bool startFsync;
+
+    /**
+     * The directory at `dstPath`, once created. Shared with the
+     * in-flight operations on files in it.
+     */
+    std::shared_ptr<AutoCloseFD> dirFd;
+
+    /**
+     * The subdirectory that `openParent()` opened last. A NAR lists
+     * the entries of a directory consecutively, so this saves opening
+     * it again for every file in it.
+     */
+    std::optional<CanonPath> lastParent;
+    std::shared_ptr<AutoCloseFD> lastParentFd;
+
+    IoUringRestoreSinkImpl(std::shared_ptr<Ring> ring, std::filesystem::path dstPath, bool startFsync)
+        : ring(std::move(ring))
+        , dstPath(std::move(dstPath))
+        , startFsync(startFsync)
+    {
+    }
+
+    /**
+     * A plain `RestoreSink` for creating the root object, which is
+     * all it is used for if that is not a directory.
+     */
+    RestoreSink rootSink()
+    {
+        RestoreSink sink{startFsync};
+        sink.dstPath = dstPath;
+        return sink;
+    }
+
+    /**
+     * Open the parent directory of `path`, which must not be the root,
+     * and return it along with the last component of `path`.
+     */
+    std::pair<std::shared_ptr<AutoCloseFD>, std::string> openParent(const CanonPath & path)
+    {
+        assert(!path.isRoot());
+        auto parent = path.parent();
+        if (parent->isRoot())
+            return {dirFd, std::string(*path.baseName())};
+        if (lastParent != parent) {
+            auto parentFd =
+                openFileEnsureBeneathNoSymlinks(dirFd->get(), *parent, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (!parentFd)
+                throw SysError("opening parent directory of %s", PathFmt(append(dstPath, path)));
+            lastParent = *parent;
+            lastParentFd = std::make_shared<AutoCloseFD>(std::move(parentFd));
+        }
+        return {lastParentFd, std::string(*path.baseName())};
+    }
+
+    void createDirectory(const CanonPath & path) override
+    {
+        if (!dirFd) {
+            auto sink = rootSink();
+            sink.createDirectory(path);
+            dirFd = std::make_shared<AutoCloseFD>(std::move(sink.dirFd));
+            return;
+        }
+
+        if (path.isRoot())
+            throw Error("path %s already exists", PathFmt(dstPath));
+
+        auto [parentFd, name] = openParent(path);
+        if (::mkdirat(parentFd->get(), name.c_str(), 0777) == -1)
+            throw SysError("creating directory %s", PathFmt(append(dstPath, path)));
+    }
+
+    void createDirectory(const CanonPath & path, DirectoryCreatedCallback callback) override
+    {
+        createDirectory(path);
+
+        if (path.isRoot()) {
+            callback(*this, path);
+            return;
+        }
+
+        IoUringRestoreSinkImpl dirSink{ring, append(dstPath, path), startFsync};
+        auto fd = openFileEnsureBeneathNoSymlinks(dirFd->get(), path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (!fd)
+            throw SysError("opening directory %s", PathFmt(dirSink.dstPath));
+        dirSink.dirFd = std::make_shared<AutoCloseFD>(std::move(fd));
+
+        callback(dirSink, CanonPath::root);
+    }
+
+    void createRegularFile(const CanonPath & path, fun<void(CreateRegularFileSink &)> func) override
+    {
+        /* A single file doesn't benefit from batching. */
+        if (!dirFd) {
+            rootSink().createRegularFile(path, func);
+            return;
+        }
+
+        struct File : CreateRegularFileSink
+        {
+            IoUringRestoreSinkImpl & sink;
+            const CanonPath & path;
+            std::string contents;
+
+            /**
+             * Set once we have decided to write the file synchronously.
+             */
+            AutoCloseFD fd;
+            std::optional<FdSink> fdSink;
+
+            File(IoUringRestoreSinkImpl & sink, const CanonPath & path)
+                : sink(sink)
+                , path(path)
+            {
+            }
+
+            void writeSynchronously()
+            {
+                fd = openFileEnsureBeneathNoSymlinks(
+                    sink.dirFd->get(),
+                    path,
+                    O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC,
+                    0666);
+                if (!fd)
+                    throw SysError("creating file %1%", PathFmt(append(sink.dstPath, path)));
+                fdSink.emplace(fd.get());
+                (*fdSink)(contents);
+                contents = {};
+            }
+
+            void isExecutable() override
+            {
+                /* There is no io_uring operation to fchmod() a file,
+                   and creating it with the execute bits set would
+                   subject them to the umask. To get exactly the mode
+                   that `RestoreSink` sets, write executables
+                   synchronously. */
+                if (!fd)
+                    writeSynchronously();
+                auto st = nix::fstat(fd.get());
+                if (fchmod(fd.get(), st.st_mode | (S_IXUSR | S_IXGRP | S_IXOTH)) == -1)
+                    throw SysError("fchmod");
+            }
+
+            void preallocateContents(uint64_t size) override
+            {
+                if (size > maxBufferedFileSize) {
+                    if (!fd)
+                        writeSynchronously();
+                } else
+                    contents.reserve(size);
+            }
+
+            void operator()(std::string_view data) override
+            {
+                if (fdSink)
+                    (*fdSink)(data);
+                else {
+                    contents.append(data);
+                    if (contents.size() > maxBufferedFileSize)
+                        writeSynchronously();
+                }
+            }
+        };
+
+        File file{*this, path};
+        func(file);
+
+        if (file.fdSink) {
+            file.fdSink->flush();
+            if (startFsync)
+                file.fd.startFsync();
+            file.fd.close();
+            return;
+        }
+
+        auto [parentFd, name] = openParent(path);
+        ring->addFile(
+            append(dstPath, path),
+            std::move(parentFd),
+            std::move(name),
+            std::move(file.contents),
+            startFsync);
+    }
+
+    void createSymlink(const CanonPath & path, const std::string & target) override
+    {
+        if (!dirFd) {
+            rootSink().createSymlink(path, target);
+            return;
+        }
+
+        auto [parentFd, name] = openParent(path);
+        if (::symlinkat(requireCString(target), parentFd->get(), name.c_str()) == -1)
+            throw SysError("creating symlink from %1% -> '%2%'", PathFmt(append(dstPath, path)), target);
+    }
+
+    void finish() override
+    {
+        ring->drain();
+    }
+};
+
+} // namespace
+
+std::unique_ptr<IoUringRestoreSink> makeIoUringRestoreSink(const std::filesystem::path & dstPath, bool startFsync)
+{
+    auto ring = std::make_shared<Ring>();
+    if (!ring->init())
+        return nullptr;
+    return std::make_unique<IoUringRestoreSinkImpl>(std::move(ring), dstPath, startFsync);
+}
+
+#else
+
+std::unique_ptr<IoUringRestoreSink> makeIoUringRestoreSink(const std::filesystem::path & dstPath, bool startFsync)
+{
+    return nullptr;
+}
+
+#endif
+
+} // namespace nix::linux
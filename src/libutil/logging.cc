@@ -418,20 +418,32 @@ std::unique_ptr<Logger> makeJSONLogger(const std::filesystem::path & path, bool
 
 void applyJSONLogger()
 {
+    std::vector<std::unique_ptr<Logger>> loggers;
+
     if (auto & opt = loggerSettings.jsonLogPath.get()) {
         try {
-            std::vector<std::unique_ptr<Logger>> loggers;
             loggers.push_back(makeJSONLogger(*opt, false));
-            try {
-                logger = makeTeeLogger(std::unique_ptr<Logger>(logger), std::move(loggers)).release();
-            } catch (...) {
-                // `logger` is now gone so give up.
-                abort();
-            }
         } catch (...) {
             ignoreExceptionExceptInterrupt();
         }
     }
+
+    if (auto & opt = loggerSettings.activityTracePath.get()) {
+        try {
+            loggers.push_back(makeTraceLogger(*opt));
+        } catch (...) {
+            ignoreExceptionExceptInterrupt();
+        }
+    }
+
+    if (!loggers.empty()) {
+        try {
+            logger = makeTeeLogger(std::unique_ptr<Logger>(logger), std::move(loggers)).release();
+        } catch (...) {
+            // `logger` is now gone so give up.
+            abort();
+        }
+    }
 }
 
 static Logger::Fields getFields(nlohmann::json & json)
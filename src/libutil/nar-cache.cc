@@ -1,20 +1,178 @@
 #include "nix/util/nar-cache.hh"
 #include "nix/util/file-system.hh"
+#include "nix/util/logging.hh"
+#include "nix/util/util.hh"
 
 #include <nlohmann/json.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/filesystem/path.hpp>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#include <algorithm>
+
 namespace nix {
 
-NarCache::NarCache(std::optional<std::filesystem::path> cacheDir_)
+/**
+ * Prefix of the names of temporary files in the cache directory.
+ */
+static constexpr std::string_view tmpPrefix = ".tmp-";
+
+NarCache::NarCache(std::optional<std::filesystem::path> cacheDir_, uint64_t maxSize)
     : cacheDir(std::move(cacheDir_))
+    , maxSize(maxSize)
 {
     if (cacheDir)
         createDirs(*cacheDir);
 }
 
+/**
+ * Atomically create or replace a file in the cache directory, so that
+ * other processes never see a partially written file.
+ */
+static void writeCacheFile(const std::filesystem::path & path, std::string_view contents)
+{
+    auto [fd, tmpPath] = createTempFile(path.parent_path(), std::string(tmpPrefix) + path.filename().string());
+    AutoDelete delTmp(tmpPath, false);
+    writeFull(fd.get(), contents);
+    fd.close();
+    moveFile(tmpPath, path);
+    delTmp.cancel();
+}
+
+/**
+ * Open a NAR cache entry, or return `nullptr` if it doesn't exist or
+ * is unusable. The NAR is memory-mapped, so file contents are read
+ * directly from the page cache.
+ */
+static std::shared_ptr<NarAccessor>
+openCacheEntry(const std::filesystem::path & cacheFile, const std::filesystem::path & listingFile)
+{
+    /* Map the NAR before reading the listing. If the entry is evicted
+       concurrently, the mapping remains valid. */
+    std::shared_ptr<boost::iostreams::mapped_file_source> mmap;
+    try {
+        /* mapped_file_source can't be constructed from a std::filesystem::path. */
+        mmap = std::make_shared<boost::iostreams::mapped_file_source>(boost::filesystem::path(cacheFile.native()));
+    } catch (std::exception &) {
+        return nullptr;
+    }
+    if (!mmap->is_open())
+        return nullptr;
+
+    std::optional<NarListing> listing;
+
+    try {
+        listing = nlohmann::json::parse(readFile(listingFile)).template get<NarListing>();
+    } catch (SystemError &) {
+    } catch (nlohmann::json::exception &) {
+    }
+
+    if (!listing) {
+        /* The listing is missing (e.g. because it was evicted while
+           we were mapping the NAR) or corrupt, so regenerate it. */
+        try {
+            StringSource source({mmap->data(), mmap->size()});
+            listing = parseNarListing(source);
+        } catch (Error & e) {
+            debug("ignoring corrupt NAR cache entry %s: %s", PathFmt(cacheFile), e.message());
+            return nullptr;
+        }
+
+        try {
+            writeCacheFile(listingFile, nlohmann::json(*listing).dump());
+        } catch (...) {
+            ignoreExceptionExceptInterrupt();
+        }
+    }
+
+    /* Record the use of this entry for LRU eviction. We use the mtime
+       rather than the atime, since the latter is commonly disabled. */
+    std::error_code ec;
+    std::filesystem::last_write_time(cacheFile, std::filesystem::file_time_type::clock::now(), ec);
+
+    return makeLazyNarAccessor(
+        std::move(*listing), [mmap](uint64_t offset, uint64_t length, Sink & sink) {
+            if (offset > mmap->size() || length > mmap->size() - offset)
+                throw Error(
+                    "can't read %d NAR bytes from offset %d: cached NAR is only %d bytes",
+                    length,
+                    offset,
+                    mmap->size());
+            sink({mmap->data() + offset, static_cast<size_t>(length)});
+        });
+}
+
+void NarCache::evict()
+{
+    struct Entry
+    {
+        std::filesystem::file_time_type lastUsed;
+        uint64_t size;
+        std::filesystem::path cacheFile;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t totalSize = 0;
+    auto now = std::filesystem::file_time_type::clock::now();
+
+    for (auto & dirent : std::filesystem::directory_iterator(*cacheDir)) {
+        std::error_code ec;
+        auto & path = dirent.path();
+
+        if (hasPrefix(path.filename().string(), tmpPrefix)) {
+            /* Clean up temporary files left behind by processes that
+               were killed while writing to the cache. */
+            auto mtime = dirent.last_write_time(ec);
+            if (!ec && now - mtime > std::chrono::hours(1))
+                std::filesystem::remove(path, ec);
+            continue;
+        }
+
+        if (path.extension() != ".nar")
+            continue;
+
+        auto lastUsed = dirent.last_write_time(ec);
+        if (ec)
+            continue;
+        auto size = dirent.file_size(ec);
+        if (ec)
+            continue;
+        Entry entry{.lastUsed = lastUsed, .size = size, .cacheFile = path};
+
+        auto listingFile = path;
+        listingFile.replace_extension(".ls");
+        if (auto listingSize = std::filesystem::file_size(listingFile, ec); !ec)
+            entry.size += listingSize;
+
+        totalSize += entry.size;
+        entries.push_back(std::move(entry));
+    }
+
+    if (totalSize <= maxSize)
+        return;
+
+    std::sort(entries.begin(), entries.end(), [](const Entry & a, const Entry & b) {
+        return a.lastUsed < b.lastUsed;
+    });
+
+    for (auto & entry : entries) {
+        if (totalSize <= maxSize)
+            break;
+        debug("evicting %s from the NAR cache", PathFmt(entry.cacheFile));
+        std::error_code ec;
+        /* Remove the NAR first, since its presence marks the entry as
+           complete. Other processes may be evicting the same entry, so
+           ignore errors. */
+        std::filesystem::remove(entry.cacheFile, ec);
+        auto listingFile = entry.cacheFile;
+        listingFile.replace_extension(".ls");
+        std::filesystem::remove(listingFile, ec);
+        totalSize -= entry.size;
+    }
+}
+
 ref<SourceAccessor> NarCache::getOrInsert(const Hash & narHash, fun<void(Sink &)> populate)
 {
     // Check in-memory cache first
@@ -43,38 +201,37 @@ ref<SourceAccessor> NarCache::getOrInsert(const Hash & narHash, fun<void(Sink &)
         auto cacheFile = makeCacheFile("nar");
         auto listingFile = makeCacheFile("ls");
 
-        if (nix::pathExists(cacheFile)) {
-            try {
-                return cacheAccessor(makeLazyNarAccessor(
-                    nlohmann::json::parse(nix::readFile(listingFile)).template get<NarListing>(),
-                    seekableGetNarBytes(cacheFile)));
-            } catch (SystemError &) {
-            }
-
-            try {
-                return cacheAccessor(makeNarAccessor(nix::readFile(cacheFile)));
-            } catch (SystemError &) {
-            }
-        }
+        if (auto accessor = openCacheEntry(cacheFile, listingFile))
+            return cacheAccessor(ref<SourceAccessor>(accessor));
 
         auto nar = getNar();
 
         try {
             /* FIXME: do this asynchronously. */
-            writeFile(cacheFile, nar);
+            writeCacheFile(cacheFile, nar);
         } catch (...) {
             ignoreExceptionExceptInterrupt();
         }
 
         auto narAccessor = makeNarAccessor(std::move(nar));
 
+        /* Processes that open the entry before the listing is written
+           will regenerate it from the NAR, so this is not racy. */
         try {
             nlohmann::json j = narAccessor->getListing();
-            writeFile(listingFile, j.dump());
+            writeCacheFile(listingFile, j.dump());
         } catch (...) {
             ignoreExceptionExceptInterrupt();
         }
 
+        if (maxSize) {
+            try {
+                evict();
+            } catch (...) {
+                ignoreExceptionExceptInterrupt();
+            }
+        }
+
         return cacheAccessor(narAccessor);
     }
 
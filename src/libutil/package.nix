@@ -8,6 +8,7 @@
   libarchive,
   libblake3,
   libcpuid,
+  liburing,
   libsodium,
   nlohmann_json,
   openssl,
@@ -55,7 +56,8 @@ mkMesonLibrary (finalAttrs: {
     openssl
     zstd
   ]
-  ++ lib.optional stdenv.hostPlatform.isx86_64 libcpuid;
+  ++ lib.optional stdenv.hostPlatform.isx86_64 libcpuid
+  ++ lib.optional stdenv.hostPlatform.isLinux liburing;
 
   propagatedBuildInputs = [
     boost
@@ -65,6 +67,7 @@ mkMesonLibrary (finalAttrs: {
 
   mesonFlags = [
     (lib.mesonEnable "cpuid" stdenv.hostPlatform.isx86_64)
+    (lib.mesonEnable "io-uring" stdenv.hostPlatform.isLinux)
   ];
 
   meta = {
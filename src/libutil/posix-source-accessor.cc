@@ -4,10 +4,18 @@
 #include "nix/util/sync.hh"
 #include "nix/util/memory-source-accessor.hh"
 #include "nix/util/signals.hh"
+#include "nix/util/config-global.hh"
+#include "nix/util/util.hh"
 
 #include <boost/unordered/concurrent_flat_map.hpp>
 
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <thread>
 
 #ifndef _WIN32
 #  include <sys/resource.h>
@@ -186,6 +194,379 @@ static unsigned getGlobalDirFdCacheLimit()
     return std::min<rlim_t>(4096, lim.rlim_cur / 8);
 }
 
+struct PosixSourceAccessorSettings : Config
+{
+    Setting<unsigned int> narReadAheadThreads{
+        this,
+        0,
+        "nar-read-ahead-threads",
+        R"(
+          The number of threads that read files ahead when serialising a
+          directory to a NAR, e.g. when copying, hashing or scanning store
+          paths. This helps on cold caches and network file systems, where
+          reading one file at a time is bound by latency. The threads are
+          shared by all serialisations in the process. The NAR itself is
+          unaffected. `0` disables read-ahead.
+        )"};
+
+    Setting<unsigned int> narReadAheadFiles{
+        this,
+        64,
+        "nar-read-ahead-files",
+        R"(
+          The maximum number of files that a NAR serialisation reads ahead
+          if [`nar-read-ahead-threads`](#conf-nar-read-ahead-threads) is
+          non-zero. Files larger than 1 MiB are not read ahead, so this
+          also bounds the memory used per serialisation.
+        )"};
+};
+
+static PosixSourceAccessorSettings posixSourceAccessorSettings;
+
+static GlobalConfig::Register rPosixSourceAccessorSettings(&posixSourceAccessorSettings);
+
+/**
+ * Files larger than this are not read ahead. Reading them is bound by
+ * throughput rather than latency, and we don't want to buffer them.
+ */
+constexpr uint64_t maxReadAheadFileSize = 1024 * 1024;
+
+/**
+ * The threads that do the work of all `ReadAhead`s in this process, so
+ * that concurrent dumps don't each start their own. Threads are
+ * started as needed, up to `nar-read-ahead-threads`.
+ */
+class ReadAheadPool
+{
+    struct State
+    {
+        std::deque<std::function<void()>> jobs;
+        std::vector<std::thread> threads;
+        size_t idle = 0;
+        bool quit = false;
+    };
+
+    Sync<State> state_;
+
+    std::condition_variable wakeup;
+
+    void run()
+    {
+        while (true) {
+            std::function<void()> job;
+            {
+                auto state(state_.lock());
+                state->idle++;
+                state.wait(wakeup, [&] { return state->quit || !state->jobs.empty(); });
+                state->idle--;
+                if (state->quit)
+                    return;
+                job = std::move(state->jobs.front());
+                state->jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+public:
+
+    ~ReadAheadPool()
+    {
+        std::vector<std::thread> threads;
+        {
+            auto state(state_.lock());
+            state->quit = true;
+            std::swap(threads, state->threads);
+        }
+        wakeup.notify_all();
+        for (auto & thread : threads)
+            thread.join();
+    }
+
+    /**
+     * Queue a job, which must not throw.
+     */
+    void enqueue(std::function<void()> job)
+    {
+        auto state(state_.lock());
+        state->jobs.push_back(std::move(job));
+        if (state->idle < state->jobs.size()
+            && state->threads.size() < std::max(1u, posixSourceAccessorSettings.narReadAheadThreads.get()))
+            state->threads.emplace_back([this] { run(); });
+        wakeup.notify_one();
+    }
+};
+
+static ReadAheadPool readAheadPool;
+
+/**
+ * Reads the regular files that a `dumpPath()` of a directory is going
+ * to need next on the threads of `readAheadPool`, while it's active on
+ * the thread that started it.
+ *
+ * NAR serialisation visits directory entries in sorted order, so a
+ * walker can predict the order in which files are read. It numbers the
+ * regular files in that order and queues them for reading, staying at
+ * most `nar-read-ahead-files` files ahead of the dump. When the dump
+ * reads a file, it uses the buffered contents if the prediction was
+ * right and the read succeeded, and otherwise just reads the file
+ * itself. The prediction only affects performance, so the output is
+ * identical either way, even if the tree changes concurrently.
+ *
+ * Files are matched by their physical path, so this works for the
+ * accessors of subdirectories that `readDirectory()` hands to the dump
+ * as well as for accessors that wrap this one.
+ */
+class ReadAhead : public SourceAccessor::ReadAheadGuard
+{
+    /**
+     * The state shared with the jobs, which may still be queued when
+     * the dump is done.
+     */
+    struct Shared
+    {
+        SourceAccessor & accessor;
+
+        size_t window;
+
+        struct Entry
+        {
+            std::filesystem::path path;
+            bool done = false;
+            std::optional<std::string> contents;
+        };
+
+        struct Dir
+        {
+            CanonPath path;
+
+            /**
+             * The entries that haven't been visited yet, in reverse
+             * order.
+             */
+            std::vector<std::pair<std::string, SourceAccessor::DirEntry>> entries;
+        };
+
+        struct State
+        {
+            /**
+             * A directory that the walker has to read before it can go
+             * on.
+             */
+            std::optional<CanonPath> unreadDir;
+
+            std::vector<Dir> stack;
+
+            /**
+             * Whether a walker job is queued or running.
+             */
+            bool walking = false;
+
+            /**
+             * The number of regular files found by the walker so far.
+             */
+            size_t found = 0;
+
+            /**
+             * Files being read or read already, by index.
+             */
+            std::map<size_t, Entry> entries;
+
+            /**
+             * Number of files read by the dump so far.
+             */
+            size_t consumed = 0;
+
+            /**
+             * The number of jobs that are using `accessor`.
+             */
+            size_t active = 0;
+
+            bool quit = false;
+        };
+
+        Sync<State> state_;
+
+        std::condition_variable wakeup;
+
+        Shared(SourceAccessor & accessor, size_t window)
+            : accessor(accessor)
+            , window(window)
+        {
+        }
+    };
+
+    std::shared_ptr<Shared> shared;
+
+    ReadAhead * prev;
+
+    static inline thread_local ReadAhead * current = nullptr;
+
+    /**
+     * Let the walker continue if it stopped at the end of the window.
+     */
+    static void maybeWalk(const std::shared_ptr<Shared> & shared, Shared::State & state)
+    {
+        if (state.walking || state.quit || (!state.unreadDir && state.stack.empty())
+            || state.found >= state.consumed + shared->window)
+            return;
+        state.walking = true;
+        state.active++;
+        readAheadPool.enqueue([shared] { walk(shared); });
+    }
+
+    static void walk(const std::shared_ptr<Shared> & shared)
+    {
+        try {
+            while (true) {
+                std::optional<CanonPath> dir;
+                CanonPath path = CanonPath::root;
+                SourceAccessor::DirEntry type;
+                {
+                    auto state(shared->state_.lock());
+                    if (state->quit || state->found >= state->consumed + shared->window)
+                        break;
+                    if (state->unreadDir) {
+                        dir = std::move(state->unreadDir);
+                        state->unreadDir.reset();
+                    } else {
+                        while (!state->stack.empty() && state->stack.back().entries.empty())
+                            state->stack.pop_back();
+                        if (state->stack.empty())
+                            break;
+                        auto & top = state->stack.back();
+                        path = top.path / top.entries.back().first;
+                        type = top.entries.back().second;
+                        top.entries.pop_back();
+                    }
+                }
+
+                if (dir) {
+                    Shared::Dir entries{.path = *dir};
+                    for (auto & entry : shared->accessor.readDirectory(*dir))
+                        entries.entries.push_back(entry);
+                    std::ranges::reverse(entries.entries);
+                    shared->state_.lock()->stack.push_back(std::move(entries));
+                    continue;
+                }
+
+                switch (type ? *type : shared->accessor.lstat(path).type) {
+                case SourceAccessor::tDirectory:
+                    shared->state_.lock()->unreadDir = std::move(path);
+                    break;
+                case SourceAccessor::tRegular: {
+                    auto state(shared->state_.lock());
+                    auto index = state->found++;
+                    /* Otherwise the dump got here first. */
+                    if (index >= state->consumed)
+                        readAheadPool.enqueue([shared, index, path] { read(shared, index, path); });
+                    break;
+                }
+                default:
+                    break;
+                }
+            }
+        } catch (...) {
+            /* The dump will run into the same problem and report it. */
+            auto state(shared->state_.lock());
+            state->unreadDir.reset();
+            state->stack.clear();
+        }
+
+        auto state(shared->state_.lock());
+        state->walking = false;
+        state->active--;
+        shared->wakeup.notify_all();
+    }
+
+    static void read(const std::shared_ptr<Shared> & shared, size_t index, const CanonPath & path)
+    {
+        {
+            auto state(shared->state_.lock());
+            if (state->quit || index < state->consumed)
+                return;
+            auto physicalPath = shared->accessor.getPhysicalPath(path);
+            if (!physicalPath)
+                return;
+            state->entries.emplace(index, Shared::Entry{.path = std::move(*physicalPath)});
+            state->active++;
+        }
+
+        struct TooLarge
+        {};
+
+        std::optional<std::string> contents;
+        try {
+            StringSink buf;
+            shared->accessor.readFile(path, buf, [&](uint64_t size) {
+                if (size > maxReadAheadFileSize)
+                    throw TooLarge();
+                buf.s.reserve(size);
+            });
+            contents = std::move(buf.s);
+        } catch (...) {
+            /* Leave it to the dump to read the file, and to report
+               any error. */
+        }
+
+        auto state(shared->state_.lock());
+        state->active--;
+        if (auto entry = get(state->entries, index)) {
+            entry->contents = std::move(contents);
+            entry->done = true;
+        }
+        shared->wakeup.notify_all();
+    }
+
+public:
+
+    ReadAhead(SourceAccessor & accessor, const CanonPath & root, size_t window)
+        : shared(std::make_shared<Shared>(accessor, window))
+        , prev(current)
+    {
+        current = this;
+        auto state(shared->state_.lock());
+        state->unreadDir = root;
+        maybeWalk(shared, *state);
+    }
+
+    ~ReadAhead()
+    {
+        current = prev;
+        auto state(shared->state_.lock());
+        state->quit = true;
+        /* Jobs that are still queued won't touch the accessor. */
+        state.wait(shared->wakeup, [&] { return !state->active; });
+    }
+
+    /**
+     * Return the contents of `path` if it's the file that the dump on
+     * this thread is expected to read next and it has been read.
+     */
+    static std::optional<std::string> take(const std::filesystem::path & path)
+    {
+        if (!current)
+            return std::nullopt;
+
+        auto & shared = current->shared;
+        auto state(shared->state_.lock());
+        auto index = state->consumed++;
+
+        /* Drop the files that the dump didn't read in the predicted
+           order, and make room for the next ones. */
+        state->entries.erase(state->entries.begin(), state->entries.lower_bound(index));
+        maybeWalk(shared, *state);
+
+        auto i = state->entries.find(index);
+        if (i == state->entries.end() || i->second.path != path)
+            return std::nullopt;
+        state.wait(shared->wakeup, [&] { return i->second.done; });
+        auto contents = std::move(i->second.contents);
+        state->entries.erase(i);
+        return contents;
+    }
+};
+
 class PosixDirectorySourceAccessor : public PosixSourceAccessorBase
 {
 public:
@@ -311,6 +692,8 @@ public:
 
     std::string readLink(const CanonPath & path) override;
 
+    std::unique_ptr<ReadAheadGuard> startReadAhead(const CanonPath & path) override;
+
     std::optional<std::filesystem::path> getPhysicalPath(const CanonPath & path) override
     {
         if (path.isRoot())
@@ -455,6 +838,12 @@ void PosixDirectorySourceAccessor::readFile(const CanonPath & path, Sink & sink,
     if (path.isRoot())
         throw NotARegularFile("'%s' is not a regular file", showPath(path));
 
+    if (auto contents = ReadAhead::take(*getPhysicalPath(path))) {
+        sizeCallback(contents->size());
+        sink(*contents);
+        return;
+    }
+
     /* TODO: We can do better when we have openat2. */
     auto [parentFd, parentFdOwning] = openParentAndUpsert(path, /*ignoreMissing=*/false);
     AutoCloseFD fileFd;
@@ -595,6 +984,14 @@ try {
     throw SymlinkNotAllowed(e.path, "path '%s' is a symlink", showPath(e.path));
 }
 
+std::unique_ptr<SourceAccessor::ReadAheadGuard> PosixDirectorySourceAccessor::startReadAhead(const CanonPath & path)
+{
+    size_t window = posixSourceAccessorSettings.narReadAheadFiles;
+    if (!posixSourceAccessorSettings.narReadAheadThreads || !window || lstat(path).type != tDirectory)
+        return nullptr;
+    return std::make_unique<ReadAhead>(*this, path, window);
+}
+
 #else
 
 /**
@@ -0,0 +1,172 @@
+#include "nix/util/progress-coalescer.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <tuple>
+
+namespace nix {
+
+struct ProgressCoalescer::Ring
+{
+    static constexpr size_t capacity = 256;
+
+    const uint64_t owner;
+
+    /**
+     * Set when the owning `ProgressCoalescer` is destroyed, so that
+     * the thread that pushes to this ring can forget it.
+     */
+    std::atomic<bool> orphaned{false};
+
+    /**
+     * The next event to be consumed, written only by `drain()`.
+     */
+    alignas(64) std::atomic<size_t> head{0};
+
+    /**
+     * The next free slot, written only by the producer thread.
+     */
+    alignas(64) std::atomic<size_t> tail{0};
+
+    std::array<Event, capacity> events;
+
+    Ring(uint64_t owner)
+        : owner(owner)
+    {
+    }
+};
+
+static std::atomic<uint64_t> nextCoalescerId{1};
+
+ProgressCoalescer::ProgressCoalescer()
+    : id(nextCoalescerId++)
+{
+}
+
+ProgressCoalescer::~ProgressCoalescer()
+{
+    for (auto & ring : *rings_.lock())
+        ring->orphaned = true;
+}
+
+ProgressCoalescer::Ring & ProgressCoalescer::getRing()
+{
+    /* A thread usually only pushes to a single coalescer (the one of
+       the progress bar), so a linear search is fine. */
+    static thread_local std::vector<std::shared_ptr<Ring>> threadRings;
+
+    for (auto & ring : threadRings)
+        if (ring->owner == id)
+            return *ring;
+
+    std::erase_if(threadRings, [](auto & ring) { return ring->orphaned.load(); });
+
+    auto ring = std::make_shared<Ring>(id);
+    rings_.lock()->push_back(ring);
+    threadRings.push_back(ring);
+    return *ring;
+}
+
+bool ProgressCoalescer::push(ActivityId act, ResultType type, const Logger::Fields & fields) noexcept
+{
+    size_t expectedFields = type == resProgress ? 4 : type == resSetExpected ? 2 : 0;
+    if (!expectedFields || fields.size() != expectedFields)
+        return false;
+
+    Event event{.act = act, .type = type, .values = {}, .seq = 0};
+    for (size_t n = 0; n < fields.size(); ++n) {
+        if (fields[n].type != Logger::Field::tInt)
+            return false;
+        event.values[n] = fields[n].i;
+    }
+
+    try {
+        auto & ring = getRing();
+
+        auto tail = ring.tail.load(std::memory_order_relaxed);
+        if (tail - ring.head.load(std::memory_order_acquire) == Ring::capacity)
+            return false;
+
+        /* If this push happens after another one, e.g. because the
+           activity was handed over to another thread, it gets a higher
+           sequence number. */
+        event.seq = nextSeq.fetch_add(1, std::memory_order_relaxed);
+        ring.events[tail % Ring::capacity] = event;
+
+        /* Sequentially consistent, so that a caller that sets a flag
+           after pushing and a consumer that clears the flag before
+           draining can't miss this event. */
+        ring.tail.store(tail + 1);
+
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+void ProgressCoalescer::drain(const std::function<void(const Event &)> & apply)
+{
+    scratch.clear();
+    firstTails.clear();
+
+    {
+        auto rings(rings_.lock());
+
+        /* A result that was pushed before one that we see here may be
+           in a ring that we have already looked at, but it's visible
+           when we look again. So take everything up to these tails,
+           plus what has been pushed since with a lower sequence
+           number. Newer results are left for the next call. */
+        uint64_t cutoff = 0;
+        for (auto & ring : *rings) {
+            auto tail = ring->tail.load();
+            firstTails.push_back(tail);
+            if (tail != ring->head.load(std::memory_order_relaxed))
+                cutoff = std::max(cutoff, ring->events[(tail - 1) % Ring::capacity].seq + 1);
+        }
+
+        for (size_t n = 0; n < rings->size(); ++n) {
+            auto & ring = (*rings)[n];
+            auto head = ring->head.load(std::memory_order_relaxed);
+            auto tail = ring->tail.load();
+            for (; head != tail; ++head) {
+                auto & event = ring->events[head % Ring::capacity];
+                if (head >= firstTails[n] && event.seq >= cutoff)
+                    break;
+                scratch.push_back(event);
+            }
+            ring->head.store(head, std::memory_order_release);
+        }
+
+        /* Forget the rings of threads that have exited. */
+        std::erase_if(*rings, [](auto & ring) { return ring.use_count() == 1 && ring->head == ring->tail; });
+    }
+
+    /* Each ring is already in order, so this just interleaves the
+       rings. */
+    std::ranges::stable_sort(scratch, {}, &Event::seq);
+
+    if (scratch.size() <= 1) {
+        for (auto & event : scratch)
+            apply(event);
+        return;
+    }
+
+    /* Only the last result of each kind for an activity matters. For
+       `resSetExpected`, the kind includes the activity type that the
+       expected count refers to. */
+    std::set<std::tuple<ActivityId, ResultType, uint64_t>> seen;
+    std::vector<bool> superseded(scratch.size());
+    for (size_t n = scratch.size(); n-- > 0;) {
+        auto & event = scratch[n];
+        superseded[n] =
+            !seen.insert({event.act, event.type, event.type == resSetExpected ? event.values[0] : 0}).second;
+    }
+
+    for (size_t n = 0; n < scratch.size(); ++n)
+        if (!superseded[n])
+            apply(scratch[n]);
+}
+
+} // namespace nix
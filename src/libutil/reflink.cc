@@ -0,0 +1,171 @@
+#include "nix/util/reflink.hh"
+#include "nix/util/error.hh"
+#include "nix/util/file-system-at.hh"
+#include "nix/util/signals.hh"
+
+#include <algorithm>
+
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <sys/ioctl.h>
+#  include <unistd.h>
+#  include <linux/fiemap.h>
+#  include <linux/fs.h>
+#endif
+
+namespace nix {
+
+#ifdef __linux__
+
+/**
+ * Whether `errNo` means that the file system (or the kernel) can't do
+ * what we asked for, rather than that something went wrong.
+ */
+static bool isUnsupported(int errNo)
+{
+    return errNo == EOPNOTSUPP || errNo == ENOTTY || errNo == ENOSYS || errNo == EXDEV || errNo == EINVAL;
+}
+
+bool cloneFile(Descriptor from, Descriptor to)
+{
+    if (ioctl(to, FICLONE, from) == 0)
+        return true;
+    if (isUnsupported(errno))
+        return false;
+    throw SysError("cloning file");
+}
+
+bool copyFileContents(Descriptor from, Descriptor to)
+{
+    if (cloneFile(from, to))
+        return true;
+
+    auto size = nix::fstat(from).st_size;
+
+    loff_t inOffset = 0, outOffset = 0;
+    while (inOffset < size) {
+        checkInterrupt();
+        auto n = copy_file_range(from, &inOffset, to, &outOffset, size - inOffset, 0);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            /* Before kernel 5.19, this fails with EXDEV across file
+               systems. EBADF means that `to` was opened in append
+               mode. */
+            if (outOffset == 0 && (isUnsupported(errno) || errno == EBADF))
+                return false;
+            throw SysError("copying file contents");
+        }
+        /* The file was truncated while we were copying it. */
+        if (n == 0)
+            break;
+    }
+
+    return true;
+}
+
+std::optional<uint64_t> dedupeFile(Descriptor from, Descriptor to)
+{
+    uint64_t size = nix::fstat(from).st_size;
+    if (size != (uint64_t) nix::fstat(to).st_size)
+        return 0;
+
+    /* File systems may limit how much they deduplicate per call
+       (e.g. btrfs to 16 MiB), so do it in chunks. */
+    constexpr uint64_t chunkSize = 16 * 1024 * 1024;
+
+    struct
+    {
+        file_dedupe_range range;
+        file_dedupe_range_info info;
+    } args;
+
+    uint64_t deduped = 0;
+    for (uint64_t offset = 0; offset < size;) {
+        checkInterrupt();
+        args = {};
+        args.range.src_offset = offset;
+        args.range.src_length = std::min(chunkSize, size - offset);
+        args.range.dest_count = 1;
+        args.info.dest_fd = to;
+        args.info.dest_offset = offset;
+        if (ioctl(from, FIDEDUPERANGE, &args.range) == -1) {
+            if (errno == EINTR)
+                continue;
+            if (isUnsupported(errno))
+                return std::nullopt;
+            throw SysError("deduplicating file contents");
+        }
+        /* A failed range reports no progress either, so check for
+           errors first. */
+        if (args.info.status < 0) {
+            if (isUnsupported(-args.info.status))
+                return std::nullopt;
+            throw SysError(-args.info.status, "deduplicating file contents");
+        }
+        if (args.info.status == FILE_DEDUPE_RANGE_DIFFERS || args.info.bytes_deduped == 0)
+            break;
+        offset += args.info.bytes_deduped;
+        deduped += args.info.bytes_deduped;
+    }
+
+    return deduped;
+}
+
+/**
+ * Return the physical location of the first extent of `fd`, if it is
+ * known and shared with some other file.
+ */
+static std::optional<uint64_t> getFirstSharedExtent(Descriptor fd)
+{
+    struct
+    {
+        fiemap map;
+        fiemap_extent extent;
+    } args = {};
+    args.map.fm_start = 0;
+    args.map.fm_length = FIEMAP_MAX_OFFSET;
+    args.map.fm_extent_count = 1;
+
+    if (ioctl(fd, FS_IOC_FIEMAP, &args.map) == -1 || args.map.fm_mapped_extents != 1)
+        return std::nullopt;
+
+    auto & extent = args.map.fm_extents[0];
+    if (!(extent.fe_flags & FIEMAP_EXTENT_SHARED)
+        || (extent.fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_NOT_ALIGNED)))
+        return std::nullopt;
+
+    return extent.fe_physical;
+}
+
+bool sharesExtents(Descriptor a, Descriptor b)
+{
+    auto extentA = getFirstSharedExtent(a);
+    return extentA && extentA == getFirstSharedExtent(b);
+}
+
+#else
+
+bool cloneFile(Descriptor from, Descriptor to)
+{
+    return false;
+}
+
+bool copyFileContents(Descriptor from, Descriptor to)
+{
+    return false;
+}
+
+std::optional<uint64_t> dedupeFile(Descriptor from, Descriptor to)
+{
+    return std::nullopt;
+}
+
+bool sharesExtents(Descriptor a, Descriptor b)
+{
+    return false;
+}
+
+#endif
+
+} // namespace nix
@@ -18,6 +18,10 @@
 #  include <poll.h>
 #endif
 
+#ifdef __linux__
+#  include <sys/sendfile.h>
+#endif
+
 namespace nix {
 
 void SerialisationError::anchor() {}
@@ -106,7 +110,22 @@ FdSink::~FdSink()
     }
 }
 
+void FdSink::setEncoder(std::unique_ptr<StreamEncoder> encoder)
+{
+    flush();
+    this->encoder = std::move(encoder);
+}
+
 void FdSink::writeUnbuffered(std::string_view data)
+{
+    if (encoder) {
+        LambdaSink raw([&](std::string_view data) { writeRaw(data); });
+        encoder->encode(data, raw);
+    } else
+        writeRaw(data);
+}
+
+void FdSink::writeRaw(std::string_view data)
 {
     written += data.size();
     try {
@@ -122,6 +141,66 @@ bool FdSink::good()
     return _good;
 }
 
+size_t FdSink::writeFromFd(Descriptor from, off_t offset, size_t nbytes)
+{
+#ifdef __linux__
+    if (encoder)
+        return 0;
+
+    flush();
+
+    while (true) {
+        checkInterrupt();
+        auto n = sendfile(fd, from, &offset, nbytes);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            /* The kernel can't send from or to these files (e.g. `fd`
+               is non-blocking or in append mode). */
+            if (errno == EINVAL || errno == ENOSYS || errno == EAGAIN)
+                return 0;
+            _good = false;
+            throw SysError("sending file contents");
+        }
+        written += n;
+        return n;
+    }
+#else
+    return 0;
+#endif
+}
+
+void FdSink::writeChunks(std::span<const SharedChunk> chunks)
+{
+    size_t size = 0;
+    for (auto & chunk : chunks)
+        size += chunk.data.size();
+
+    /* The encoder copies the data anyway, and small writes are
+       cheaper to buffer than to write right away. */
+    if (encoder || size < bufSize - bufPos) {
+        Sink::writeChunks(chunks);
+        return;
+    }
+
+    std::vector<std::string_view> data;
+    data.reserve(chunks.size() + 1);
+    if (bufPos)
+        data.emplace_back(buffer.get(), bufPos);
+    for (auto & chunk : chunks)
+        data.push_back(chunk.data);
+
+    written += bufPos + size;
+    bufPos = 0;
+
+    try {
+        writeFull(fd, data);
+    } catch (SystemError & e) {
+        _good = false;
+        throw;
+    }
+}
+
 void Source::operator()(char * data, size_t len)
 {
     while (len) {
@@ -151,13 +230,20 @@ void Source::drainInto(Sink & sink)
 
 void Source::drainInto(Sink & sink, uint64_t len)
 {
-    std::array<char, 65536> buf;
+    /* Read into a reference-counted buffer, so that sinks can keep the
+       data instead of copying it. The buffer is reused if they
+       didn't. */
+    const size_t bufSize = std::min<uint64_t>(len, 65536);
+    std::shared_ptr<char[]> buf;
     while (len) {
         checkInterrupt();
+        if (!buf || buf.use_count() > 1)
+            buf = std::make_shared_for_overwrite<char[]>(bufSize);
         // Until std::saturate_cast is available (C++26)
         auto lenTrunc = static_cast<size_t>(std::min<uint64_t>(len, std::numeric_limits<size_t>::max()));
-        auto n = read(buf.data(), std::min(lenTrunc, buf.size()));
-        sink({buf.data(), n});
+        auto n = read(buf.get(), std::min(lenTrunc, bufSize));
+        SharedChunk chunk{buf, {buf.get(), n}};
+        sink.writeChunks({&chunk, 1});
         assert(n <= len);
         len -= n;
     }
@@ -247,7 +333,26 @@ bool BufferedSource::hasData()
     return bufPosOut < bufPosIn;
 }
 
+void FdSource::setDecoder(std::unique_ptr<StreamDecoder> decoder)
+{
+    if (BufferedSource::hasData()) {
+        decoder->feed({buffer.get() + bufPosOut, bufPosIn - bufPosOut});
+        bufPosIn = bufPosOut = 0;
+    }
+    this->decoder = std::move(decoder);
+    isSeekable = false;
+}
+
 size_t FdSource::readUnbuffered(char * data, size_t len)
+{
+    if (decoder) {
+        LambdaSource raw([&](char * data, size_t len) { return readRaw(data, len); });
+        return decoder->decode(raw, data, len);
+    }
+    return readRaw(data, len);
+}
+
+size_t FdSource::readRaw(char * data, size_t len)
 {
     auto n = nix::read(fd, {reinterpret_cast<std::byte *>(data), len});
     if (n == 0) {
@@ -268,6 +373,9 @@ bool FdSource::hasData()
     if (BufferedSource::hasData())
         return true;
 
+    if (decoder && decoder->hasPendingInput())
+        return true;
+
     while (true) {
 #ifdef _WIN32
         /* Windows' fd_set is a bounded handle array, so FD_SET can't
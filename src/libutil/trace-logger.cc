@@ -0,0 +1,327 @@
+#include "nix/util/logging.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/sync.hh"
+#include "nix/util/terminal.hh"
+
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <nlohmann/json.hpp>
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <unistd.h>
+#endif
+
+namespace nix {
+
+namespace {
+
+std::string_view activityTypeName(ActivityType type)
+{
+    switch (type) {
+    case actUnknown:
+        return "unknown";
+    case actCopyPath:
+        return "copy-path";
+    case actFileTransfer:
+        return "file-transfer";
+    case actRealise:
+        return "realise";
+    case actCopyPaths:
+        return "copy-paths";
+    case actBuilds:
+        return "builds";
+    case actBuild:
+        return "build";
+    case actOptimiseStore:
+        return "optimise-store";
+    case actVerifyPaths:
+        return "verify-paths";
+    case actSubstitute:
+        return "substitute";
+    case actQueryPathInfo:
+        return "query-path-info";
+    case actPostBuildHook:
+        return "post-build-hook";
+    case actBuildWaiting:
+        return "queue-wait";
+    case actFetchTree:
+        return "fetch-tree";
+    case actParseFile:
+        return "parse-file";
+    case actDerivationStrict:
+        return "derivation-strict";
+    }
+    return "unknown";
+}
+
+/**
+ * Activities that are strictly nested on the thread that started
+ * them, which can therefore be shown as a flame graph per thread.
+ */
+bool isThreadLocalSpan(ActivityType type)
+{
+    return type == actParseFile || type == actDerivationStrict;
+}
+
+uint64_t getThreadId()
+{
+#ifdef __linux__
+    return gettid();
+#else
+    static std::atomic<uint64_t> nextThreadId{1};
+    static thread_local uint64_t threadId = nextThreadId++;
+    return threadId;
+#endif
+}
+
+/**
+ * A logger that writes activities to a file in the Chrome Trace Event
+ * format, which can be loaded into Perfetto or `chrome://tracing`.
+ *
+ * Each event is appended as a single line, without the closing `]`
+ * (which the format allows to be omitted). So several processes
+ * (e.g. a client and the daemon) can write to the same trace, and a
+ * trace cut short by a crash is still readable.
+ */
+struct TraceLogger : Logger
+{
+    AutoCloseFD fd;
+    uint64_t pid;
+
+    struct Span
+    {
+        ActivityType type;
+        ActivityId parent;
+        uint64_t start;
+        uint64_t tid;
+        std::string name;
+        Fields fields;
+        std::optional<Fields> progress;
+
+        /**
+         * Time that descendants of this activity spent waiting for a
+         * build slot, a lock or a remote machine.
+         */
+        uint64_t queueWait = 0;
+    };
+
+    struct State
+    {
+        std::unordered_map<ActivityId, Span> spans;
+        bool enabled = true;
+    };
+
+    Sync<State> state_;
+
+    TraceLogger(AutoCloseFD && fd)
+        : fd(std::move(fd))
+#ifndef _WIN32
+        , pid(getpid())
+#else
+        , pid(GetCurrentProcessId())
+#endif
+    {
+    }
+
+    /**
+     * Microseconds on a monotonic clock that is shared by all
+     * processes on this machine.
+     */
+    static uint64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    static nlohmann::json fieldsToJSON(const Fields & fields)
+    {
+        auto res = nlohmann::json::array();
+        for (auto & f : fields)
+            if (f.type == Field::tInt)
+                res.push_back(f.i);
+            else
+                res.push_back(f.s);
+        return res;
+    }
+
+    void write(State & state, const nlohmann::json & event)
+    {
+        if (!state.enabled)
+            return;
+        try {
+            writeFull(fd.get(), event.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace) + ",\n", false);
+        } catch (...) {
+            state.enabled = false;
+        }
+    }
+
+    nlohmann::json makeEvent(const char * phase, const Span & span, uint64_t ts)
+    {
+        nlohmann::json event;
+        event["ph"] = phase;
+        event["cat"] = activityTypeName(span.type);
+        event["name"] = span.name.empty() ? std::string(activityTypeName(span.type)) : span.name;
+        event["ts"] = ts;
+        event["pid"] = pid;
+        event["tid"] = span.tid;
+        return event;
+    }
+
+    void log(Verbosity lvl, std::string_view s) noexcept override
+    {
+        if (lvl > lvlWarn)
+            return;
+        try {
+            nlohmann::json event;
+            event["ph"] = "i";
+            event["s"] = "p";
+            event["cat"] = "message";
+            event["name"] = filterANSIEscapes(s, true);
+            event["ts"] = now();
+            event["pid"] = pid;
+            event["tid"] = getThreadId();
+            write(*state_.lock(), event);
+        } catch (...) {
+        }
+    }
+
+    void logEI(const ErrorInfo & ei) noexcept override
+    {
+        log(ei.level, ei.msg.str());
+    }
+
+    void startActivity(
+        ActivityId act,
+        Verbosity lvl,
+        ActivityType type,
+        const std::string & s,
+        const Fields & fields,
+        ActivityId parent) noexcept override
+    {
+        try {
+            Span span{
+                .type = type,
+                .parent = parent,
+                .start = now(),
+                .tid = getThreadId(),
+                .name = filterANSIEscapes(s, true),
+                .fields = fields,
+            };
+
+            auto state(state_.lock());
+
+            /* Activities on the same thread may overlap without being
+               nested (e.g. concurrent builds driven by the same
+               thread), so show them as async events with a track per
+               activity. */
+            if (!isThreadLocalSpan(type)) {
+                auto event = makeEvent("b", span, span.start);
+                event["id"] = std::to_string(act);
+                event["args"]["parent"] = std::to_string(parent);
+                if (!fields.empty())
+                    event["args"]["fields"] = fieldsToJSON(fields);
+                write(*state, event);
+            }
+
+            state->spans.insert_or_assign(act, std::move(span));
+        } catch (...) {
+        }
+    }
+
+    void stopActivity(ActivityId act) noexcept override
+    {
+        try {
+            auto end = now();
+
+            auto state(state_.lock());
+
+            auto i = state->spans.find(act);
+            if (i == state->spans.end())
+                return;
+            auto span = std::move(i->second);
+            state->spans.erase(i);
+
+            auto duration = end - span.start;
+
+            if (span.type == actBuildWaiting)
+                for (auto parent = span.parent; parent;) {
+                    auto j = state->spans.find(parent);
+                    if (j == state->spans.end())
+                        break;
+                    j->second.queueWait += duration;
+                    parent = j->second.parent;
+                }
+
+            nlohmann::json event;
+            if (isThreadLocalSpan(span.type)) {
+                event = makeEvent("X", span, span.start);
+                event["dur"] = duration;
+                if (!span.fields.empty())
+                    event["args"]["fields"] = fieldsToJSON(span.fields);
+            } else {
+                event = makeEvent("e", span, end);
+                event["id"] = std::to_string(act);
+                event["args"]["durationUs"] = duration;
+            }
+
+            /* For file transfers and copies, these are byte counts. */
+            if (span.progress && span.progress->size() >= 2) {
+                event["args"]["done"] = (*span.progress)[0].i;
+                event["args"]["expected"] = (*span.progress)[1].i;
+            }
+
+            if (span.queueWait)
+                event["args"]["queueWaitUs"] = span.queueWait;
+
+            write(*state, event);
+        } catch (...) {
+        }
+    }
+
+    void result(ActivityId act, ResultType type, const Fields & fields) noexcept override
+    {
+        if (type != resProgress)
+            return;
+        try {
+            auto state(state_.lock());
+            auto i = state->spans.find(act);
+            if (i != state->spans.end())
+                i->second.progress = fields;
+        } catch (...) {
+        }
+    }
+};
+
+} // namespace
+
+std::unique_ptr<Logger> makeTraceLogger(const std::filesystem::path & path)
+{
+    auto flags = O_APPEND | O_WRONLY
+#ifndef _WIN32
+                 | O_CLOEXEC
+#endif
+        ;
+
+    /* Whoever creates the file starts the JSON array. */
+    bool created = true;
+    AutoCloseFD fd = toDescriptor(open(path.string().c_str(), flags | O_CREAT | O_EXCL, 0644));
+    if (!fd && errno == EEXIST) {
+        created = false;
+        fd = toDescriptor(open(path.string().c_str(), flags));
+    }
+    if (!fd)
+        throw SysError("opening trace file %1%", PathFmt(path));
+
+    if (created)
+        writeFull(fd.get(), "[\n");
+
+    return std::make_unique<TraceLogger>(std::move(fd));
+}
+
+} // namespace nix
@@ -131,9 +131,11 @@ struct CmdEval : MixJSON, InstallableValueCommand, MixReadOnlyOption
         }
 
         else if (json) {
-            // FIXME: use printJSON
-            auto j = printValueAsJSON(*state, true, *v, pos, context, false);
-            logger->cout("%s", state->devirtualize(outputPretty ? j.dump(2) : j.dump(), context));
+            /* Devirtualization needs the complete string context, so
+               the output can't be streamed to stdout directly. */
+            StringSink out;
+            printValueAsJSON(*state, true, *v, pos, out, context, false, outputPretty ? 2 : 0);
+            logger->cout("%s", state->devirtualize(out.s, context));
         }
 
         else {
@@ -3,10 +3,40 @@
 #include "nix/main/shared.hh"
 #include "nix/store/globals.hh"
 
+#include <limits>
+
 namespace nix {
 
 struct CmdLog : InstallableCommand
 {
+    std::optional<size_t> tail;
+    std::optional<int64_t> offset;
+    std::optional<uint64_t> length;
+
+    CmdLog()
+    {
+        addFlag({
+            .longName = "tail",
+            .description = "Only show the last *n* lines of the log.",
+            .labels = {"n"},
+            .handler = {&tail},
+        });
+
+        addFlag({
+            .longName = "offset",
+            .description = "Show the log starting at byte *n*. A negative *n* counts from the end of the log.",
+            .labels = {"n"},
+            .handler = {&offset},
+        });
+
+        addFlag({
+            .longName = "length",
+            .description = "Show at most *n* bytes of the log.",
+            .labels = {"n"},
+            .handler = {&length},
+        });
+    }
+
     std::string description() override
     {
         return "show the build log of the specified packages or paths, if available";
@@ -39,8 +69,19 @@ struct CmdLog : InstallableCommand
             b.path.raw());
         auto path = resolveDerivedPath(*store, *oneUp);
 
+        if (tail && (offset || length))
+            throw UsageError("'--tail' cannot be combined with '--offset' or '--length'");
+
         RunPager pager;
-        auto log = fetchBuildLog(store, path, installable->what());
+        auto log = tail ? fetchBuildLogTail(store, path, installable->what(), *tail)
+                   : offset || length
+                       ? fetchBuildLogRange(
+                             store,
+                             path,
+                             installable->what(),
+                             offset.value_or(0),
+                             length.value_or(std::numeric_limits<uint64_t>::max()))
+                       : fetchBuildLog(store, path, installable->what());
         logger->stop();
         writeFull(getStandardOutput(), log);
     }
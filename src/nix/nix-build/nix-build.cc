@@ -16,6 +16,7 @@
 #include "nix/store/globals.hh"
 #include "nix/store/realisation.hh"
 #include "nix/store/derivations.hh"
+#include "nix/store/drv-hash-cache.hh"
 #include "nix/store/outputs-query.hh"
 #include "nix/main/shared.hh"
 #include "nix/store/path-with-outputs.hh"
@@ -676,6 +677,9 @@ static void main_nix_build(int argc, char ** argv)
 
         auto argPtrs = stringsToCharPtrs(args);
 
+        /* Static destructors don't run across exec(). */
+        DrvHashCache::flushGlobal();
+
         restoreProcessContext();
 
         logger->stop();
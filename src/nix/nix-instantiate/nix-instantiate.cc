@@ -64,8 +64,9 @@ void processExpr(
                 printValueAsXML(state, strict, location, vRes, s, context, noPos);
                 std::cout << state.devirtualize(s.str(), context);
             } else if (output == okJSON) {
-                auto j = printValueAsJSON(state, strict, vRes, v.determinePos(noPos), context);
-                std::cout << state.devirtualize(j.dump(), context) << std::endl;
+                StringSink s;
+                printValueAsJSON(state, strict, vRes, v.determinePos(noPos), s, context);
+                std::cout << state.devirtualize(s.s, context) << std::endl;
             } else {
                 if (strict)
                     state.forceValueDeep(vRes);
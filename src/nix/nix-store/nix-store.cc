@@ -1,4 +1,5 @@
 #include "nix/util/archive.hh"
+#include "nix/util/compression.hh"
 #include "nix/store/derivations.hh"
 #include "nix/store/outputs-query.hh"
 #include "dotgraph.hh"
@@ -1081,6 +1082,15 @@ static void opServe(Strings opFlags, Strings opArgs)
             break;
         }
 
+        case ServeProto::Command::EnableCompression: {
+            /* The acknowledgement is the last thing we send
+               uncompressed. */
+            out << 1;
+            out.setEncoder(makeZstdStreamEncoder());
+            in.setDecoder(makeZstdStreamDecoder());
+            break;
+        }
+
         default:
             throw Error("unknown serve command %1%", cmd);
         }
@@ -5,6 +5,7 @@
 #include "nix/util/signals.hh"
 #include "nix/store/store-api.hh"
 #include "nix/store/derivations.hh"
+#include "nix/store/drv-hash-cache.hh"
 #include "nix/store/local-fs-store.hh"
 #include "nix/util/finally.hh"
 #include "nix/expr/eval.hh"
@@ -56,6 +57,9 @@ void execProgramInStore(
         envp = environ;
     }
 
+    /* Static destructors don't run across exec(). */
+    DrvHashCache::flushGlobal();
+
     restoreProcessContext();
 
     /* If this is a diverted store (i.e. its "logical" location
@@ -0,0 +1,46 @@
+#include "nix/cmd/command.hh"
+#include "nix/store/binary-cache-store.hh"
+#include "nix/store/store-api.hh"
+
+namespace nix {
+
+struct CmdStoreAddDelta : StorePathCommand
+{
+    std::string base;
+
+    CmdStoreAddDelta()
+    {
+        addFlag({
+            .longName = "base",
+            .description = "The store path to make the delta against, typically an older version of the same package.",
+            .labels = {"store-path"},
+            .handler = {&base},
+            .required = true,
+        });
+    }
+
+    std::string description() override
+    {
+        return "upload a delta between two store paths to a binary cache";
+    }
+
+    std::string doc() override
+    {
+        return
+#include "store-add-delta.md"
+            ;
+    }
+
+    void run(ref<Store> store, const StorePath & storePath) override
+    {
+        auto binaryCache = store.dynamic_pointer_cast<BinaryCacheStore>();
+        if (!binaryCache)
+            throw UsageError("'%s' is not a binary cache", store->config.getHumanReadableURI());
+
+        binaryCache->addNarDelta(storePath, store->followLinksToStorePath(base));
+    }
+};
+
+static auto rStoreAddDelta = registerCommand2<CmdStoreAddDelta>({"store", "add-delta"});
+
+} // namespace nix
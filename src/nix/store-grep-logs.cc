@@ -0,0 +1,41 @@
+#include "nix/cmd/command.hh"
+#include "nix/main/shared.hh"
+#include "nix/store/local-fs-store.hh"
+#include "nix/store/store-cast.hh"
+
+namespace nix {
+
+struct CmdStoreGrepLogs : StoreCommand
+{
+    std::string pattern;
+
+    CmdStoreGrepLogs()
+    {
+        expectArg("pattern", &pattern);
+    }
+
+    std::string description() override
+    {
+        return "search the build logs in a Nix store";
+    }
+
+    std::string doc() override
+    {
+        return
+#include "store-grep-logs.md"
+            ;
+    }
+
+    void run(ref<Store> store) override
+    {
+        auto & localStore = require<LocalFSStore>(*store);
+
+        localStore.grepBuildLogs(pattern, [&](const StorePath & drvPath, std::string_view line) {
+            logger->cout("%s: %s", store->printStorePath(drvPath), line);
+        });
+    }
+};
+
+static auto rCmdStoreGrepLogs = registerCommand2<CmdStoreGrepLogs>({"store", "grep-logs"});
+
+} // namespace nix
@@ -21,6 +21,7 @@
 #include <algorithm>
 #include <climits>
 #include <cstring>
+#include <thread>
 #include <variant>
 
 #include <unistd.h>
@@ -235,6 +236,30 @@ static std::pair<TrustedFlag, std::optional<std::string>> authPeer(const unix::P
     return {trusted, std::move(user)};
 }
 
+/**
+ * Verify the contents of the store every `scrub-interval` seconds.
+ * This runs in its own process, since the daemon forks for every
+ * connection and so must not have other threads.
+ */
+static void runScrubber(ref<const StoreConfig> storeConfig)
+{
+    auto store = storeConfig->openStore();
+    auto localStore = dynamic_cast<LocalStore *>(&*store);
+    if (!localStore) {
+        warn("'scrub-interval' is only supported for local stores");
+        return;
+    }
+
+    while (true) {
+        try {
+            localStore->scrubStore(localStore->queryAllValidPaths(), NoRepair, {.resume = true});
+        } catch (Error & e) {
+            logError(e.info());
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(settings.getLocalSettings().scrubInterval));
+    }
+}
+
 /**
  * Run a server. The loop opens a socket and accepts new connections from that
  * socket.
@@ -280,6 +305,11 @@ static void daemonLoop(
     }
 #endif
 
+    /* The scrubber is killed when we return. */
+    Pid scrubber;
+    if (settings.getLocalSettings().scrubInterval)
+        scrubber = startProcess([&]() { runScrubber(storeConfig); }, {.errorPrefix = "store scrubber error: "});
+
     /* Check for anything that might be a crash. Too many crashes aren't
        supposed to happen and we should limit the amount if someone is
        intentionally triggering those as an ASLR bypass attempt (each forked
@@ -303,7 +333,7 @@ static void daemonLoop(
                 .activationName = "nix-daemon.socket",
                 .auxiliaryFd = sigChldPipe.pipe.readSide.get(),
                 .onAuxiliaryFdPollin =
-                    [&crashCount]() {
+                    [&crashCount, &scrubber]() {
                         sigChldPipe.drain();
                         /* Reap all dead children. */
                         pid_t pid = -1;
@@ -311,6 +341,14 @@ static void daemonLoop(
                         while (pid = ::waitpid(/*pid (any child process)=*/-1, &status, WNOHANG), pid > 0) {
                             printInfo("reaped child process %1%, status = %2%", pid, statusToString(status));
 
+                            /* Don't kill the scrubber's PID again later,
+                               since it may have been reused. */
+                            if (pid == scrubber) {
+                                scrubber.release();
+                                printError("store scrubber exited unexpectedly");
+                                continue;
+                            }
+
                             if (!WIFSIGNALED(status))
                                 continue;
 
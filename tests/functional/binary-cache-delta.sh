@@ -0,0 +1,53 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+TODO_NixOS
+
+needLocalStore "'--no-require-sigs' can’t be used with the daemon"
+
+clearStore
+clearBinaryCache
+clearCacheCache
+
+# Two versions of a path that share most of their contents.
+head -c 1000000 /dev/urandom > "$TEST_ROOT/delta-base"
+cp "$TEST_ROOT/delta-base" "$TEST_ROOT/delta-new"
+echo "new version" >> "$TEST_ROOT/delta-new"
+
+basePath=$(nix store add-file "$TEST_ROOT/delta-base")
+newPath=$(nix store add-file "$TEST_ROOT/delta-new")
+
+nix copy --to "file://$cacheDir" "$basePath" "$newPath"
+
+nix store add-delta --store "file://$cacheDir" --base "$basePath" "$newPath"
+
+narInfo="$cacheDir/$(basename "$newPath" | cut -c1-32).narinfo"
+grepQuiet "^DeltaBase: $(basename "$basePath")$" "$narInfo"
+deltaUrl=$(sed -n 's/^DeltaURL: //p' "$narInfo")
+[[ -n "$deltaUrl" ]]
+
+# The delta is much smaller than the NAR.
+(( $(stat --format=%s "$cacheDir/$deltaUrl") < 10000 ))
+
+# Remove the full NAR from the cache, so that substitution can only
+# succeed by applying the delta to the base we still have.
+rm "$cacheDir/$(sed -n 's/^URL: //p' "$narInfo")"
+
+nix-store --delete "$newPath"
+[[ ! -e "$newPath" ]]
+
+nix-store --substituters "file://$cacheDir" --no-require-sigs -r "$newPath"
+cmp "$newPath" "$TEST_ROOT/delta-new"
+
+# Do it again, now with the .narinfo coming from the disk cache, which
+# must have kept the delta.
+nix-store --delete "$newPath"
+nix-store --substituters "file://$cacheDir" --no-require-sigs -r "$newPath"
+cmp "$newPath" "$TEST_ROOT/delta-new"
+
+# Without the base, the delta can't be used, and neither can the NAR we
+# removed.
+nix-store --delete "$newPath" "$basePath"
+expect 1 nix-store --substituters "file://$cacheDir" --no-require-sigs -r "$newPath" 2>&1 | tee "$TEST_ROOT/log"
+grepQuiet "does not exist in binary cache" "$TEST_ROOT/log"
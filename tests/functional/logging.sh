@@ -15,6 +15,10 @@ rm -rf "$NIX_LOG_DIR"
 (! nix-store -l "$path")
 nix-build dependencies.nix --no-out-link --compress-build-log
 [ "$(nix-store -l "$path")" = FOO ]
+[ "$(nix log --tail 1 "$path")" = FOO ]
+[ "$(nix log --offset 1 --length 1 "$path")" = O ]
+nix store grep-logs OO | grepQuiet ': FOO$'
+(( $(nix store grep-logs no-such-line | wc -l) == 0 ))
 
 # test whether empty logs work fine with `nix log`.
 builder=$TEST_ROOT/builder
@@ -52,3 +56,12 @@ sid=$(head -n1 < "$TEST_ROOT/log.json" | jq -r '.sid')
 nix store info --json-log-path "$TEST_ROOT/log2.json" --session-id "foo"
 (( $(jq -s 'length' < "$TEST_ROOT/log2.json") > 0 ))
 (( $(jq -s --arg sid foo '[.[] | select(.sid != $sid)] | length' < "$TEST_ROOT/log2.json") == 0 ))
+
+# Test activity-trace-path.
+clearStore
+nix build --file dependencies.nix --no-link --activity-trace-path "$TEST_ROOT/trace.json"
+[[ $(head -n1 "$TEST_ROOT/trace.json") = "[" ]]
+tail -n +2 "$TEST_ROOT/trace.json" | sed 's/,$//' > "$TEST_ROOT/trace-events.json"
+(( $(jq -s '[.[] | select(.ph == "e" and .cat == "build")] | length' < "$TEST_ROOT/trace-events.json") == 5 ))
+(( $(jq -s '[.[] | select(.ph == "X" and .cat == "parse-file" and .dur >= 0)] | length' < "$TEST_ROOT/trace-events.json") > 0 ))
+(( $(jq -s '[.[] | select(.ph == "X" and .cat == "derivation-strict")] | length' < "$TEST_ROOT/trace-events.json") >= 5 ))
@@ -0,0 +1,60 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+TODO_NixOS
+
+clearStore
+
+# shellcheck disable=SC2016
+nix-build -o "$TEST_ROOT/result1" -E 'with import '"${config_nix}"'; mkDerivation { name = "foo1"; builder = builtins.toFile "builder" "mkdir $out; echo hello > $out/foo"; }'
+# shellcheck disable=SC2016
+nix-build -o "$TEST_ROOT/result2" -E 'with import '"${config_nix}"'; mkDerivation { name = "foo2"; builder = builtins.toFile "builder" "mkdir $out; echo hello > $out/foo"; }'
+
+outPath1=$(readlink "$TEST_ROOT/result1")
+outPath2=$(readlink "$TEST_ROOT/result2")
+
+# XXX: This should work through the daemon too
+NIX_REMOTE="" nix-store --optimise --option optimise-with-reflinks true
+
+# The files are not hard-linked to each other, whether or not the file
+# system supports reflinks...
+inode1="$(stat --format=%i "$outPath1"/foo)"
+inode2="$(stat --format=%i "$outPath2"/foo)"
+if [ "$inode1" = "$inode2" ]; then
+    echo "inodes match unexpectedly"
+    exit 1
+fi
+
+# ...but the first one is hard-linked into the links directory.
+nlinks=$(( $(stat --format=%h "$outPath1"/foo) + $(stat --format=%h "$outPath2"/foo) ))
+if [ "$nlinks" != 3 ]; then
+    echo "link count incorrect"
+    exit 1
+fi
+
+links="$(ls "$NIX_STORE_DIR"/.links)"
+if [ -z "$links" ]; then
+    echo ".links directory empty after optimising"
+    exit 1
+fi
+
+# Garbage collection keeps the links of live paths.
+nix-store --gc
+
+if [ "$(ls "$NIX_STORE_DIR"/.links)" != "$links" ]; then
+    echo ".links directory changed by GC"
+    exit 1
+fi
+
+[[ "$(cat "$outPath1"/foo)" = hello ]]
+[[ "$(cat "$outPath2"/foo)" = hello ]]
+
+rm "$TEST_ROOT/result1" "$TEST_ROOT/result2"
+
+nix-store --gc
+
+if [ -n "$(ls "$NIX_STORE_DIR"/.links)" ]; then
+    echo ".links directory not empty after GC"
+    exit 1
+fi